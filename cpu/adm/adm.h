@@ -9,9 +9,11 @@
 #include <cstring>
 #include <numeric>
 #include <chrono>
+#include <algorithm>
+#include <climits>
 
-#include <immintrin.h>
-#include <omp.h>
+#include "../cpu_isa.h"
+#include "../executor.h"
 
 namespace adm {
 
@@ -22,6 +24,8 @@ inline constexpr int decmp_chunk = 32;
 inline constexpr int max_bytes_signal_per_ele_16b = 2;
 inline constexpr int max_bytes_signal_per_ele_32b = 3;
 inline constexpr int warp_size = 32;
+// groups a worker takes at least, so small inputs are not split across the pool
+inline constexpr int kGroupGrain = 16;
 
 // ------------- header -------------
 // record metadata
@@ -35,157 +39,221 @@ struct FileHeader {
 
 };
 
-inline void compress_uint16(
-    const std::vector<uint16_t>& input_data,
-    std::vector<int>& output_lengths,
-    std::vector<uint16_t>& centers,
-    std::vector<uint8_t>& codes,
-    std::vector<uint8_t>& bit_signals
-) {
-    int num_elements = input_data.size();
-    int gsize = (num_elements + cmp_tblock_size * cmp_chunk - 1) / (cmp_tblock_size * cmp_chunk);
-    int total_threads = gsize * cmp_tblock_size;
+// ------------- scratch -------------
+// Temporaries of decompress. The caller owns them so that
+// back-to-back calls reuse the same allocations.
+struct DecodeScratch {
+    std::vector<uint8_t> signals;
+};
+
+// Byte counts of compress_emit go to kHistogramTables interleaved tables of
+// 256 entries per worker, so that runs of one byte value do not serialize
+// on a single counter
+inline constexpr int kHistogramTables = 4;
+
+// Temporaries of compress_emit when it counts the bytes it writes
+struct EncodeScratch {
+    std::vector<uint64_t> counts;   // kHistogramTables * 256 per worker
+};
 
-    std::vector<int> signal_length(gsize, 0);
-    std::vector<int> bit_offsets(total_threads, 0);
-    centers.resize(gsize);
-    codes.resize(num_elements);
+inline std::size_t num_groups(std::size_t num_elements) {
+    return (num_elements + cmp_tblock_size * cmp_chunk - 1) / (cmp_tblock_size * cmp_chunk);
+}
 
-    // Center calculation: parallelizing and reducing unnecessary work
-    #pragma omp parallel for
-    for (int warp = 0; warp < gsize; ++warp) {
-        int base_idx = warp * cmp_tblock_size * cmp_chunk;
-        int end_idx = std::min(base_idx + cmp_tblock_size * cmp_chunk, num_elements);
+// Width of the output_lengths entries in the stream. The prefix is computed
+// in 64 bits and stored as int32 while its total fits, which keeps the
+// layout of streams written before 64-bit sizes; the decoder tells the two
+// apart by len1.
+inline std::size_t prefix_entry_size(std::uint64_t total) {
+    return total <= INT_MAX ? sizeof(std::int32_t) : sizeof(std::uint64_t);
+}
 
+// Compression runs in two phases so that codes and bit signals are written
+// straight into their final place in the merged ADM stream:
+//   compress_plan  - group centers and the exclusive prefix of per-lane signal
+//                    bytes (output_lengths, gsize + 1 entries, 64-bit)
+//   compress_emit  - codes and bit signals; bit_signals must hold
+//                    output_lengths[gsize] * cmp_tblock_size bytes
+// The lane bit lengths are recomputed in the second phase instead of being
+// staged in a per-thread scratch area. compress_emit can also count the bytes
+// it writes, which spares the ANS stage its own pass over codes and signals.
+
+// The loop bodies of the phases live in the *_range functions below, written
+// as plain code; each phase runs them through mans::IsaClones, so they are
+// vectorized for the instruction set picked at run time.
+
+// Groups [first, last) of compress_plan: center and longest lane signal
+template <typename T>
+void plan_range(const T* input_data, std::size_t num_elements, uint64_t* output_lengths,
+                T* centers, std::size_t first, std::size_t last) {
+    for (std::size_t warp = first; warp < last; ++warp) {
+        std::size_t base_idx = warp * cmp_tblock_size * cmp_chunk;
+        std::size_t end_idx = std::min<std::size_t>(base_idx + cmp_tblock_size * cmp_chunk, num_elements);
+
+        // Center calculation
         uint64_t sum = 0;
-        for (int i = base_idx; i < end_idx; ++i) {
+        for (std::size_t i = base_idx; i < end_idx; ++i) {
             sum += input_data[i];
         }
+        int count = static_cast<int>(end_idx - base_idx);
+        T center = (count > 0) ? sum / count : 0;
+        centers[warp] = center;
 
-        int count = end_idx - base_idx;
-        centers[warp] = (count > 0) ? sum / count : 0;
+        // Warp-level reduction: longest lane signal in bytes
+        int max_len_bytes = 0;
+        for (std::size_t lane_base = base_idx; lane_base < end_idx; lane_base += cmp_chunk) {
+            int bit_offset = 0;
+            for (int i = 0; i < cmp_chunk && lane_base + i < num_elements; ++i) {
+                T val = input_data[lane_base + i];
+                int diff = val > center ? val - center : center - val;
+                bit_offset += (val == center) ? 1 : (diff + 125) / 126;
+            }
+            max_len_bytes = std::max(max_len_bytes, (bit_offset + 7) / 8);
+        }
+        output_lengths[warp + 1] = max_len_bytes;
     }
+}
 
-    // Allocate temporary buffer for bit_signals
-    std::vector<uint8_t> tmp_bit_signals(total_threads * cmp_chunk * max_bytes_signal_per_ele_16b, 0);
-
-    // Encoding and setting codes, bit_signals (in temporary space)
-    #pragma omp parallel for
-    for (int thread_idx = 0; thread_idx < total_threads; ++thread_idx) {
-        int warp = thread_idx / cmp_tblock_size;
-        int lane = thread_idx % cmp_tblock_size;
-        int base_idx = warp * cmp_tblock_size * cmp_chunk + lane * cmp_chunk;
-
-        if (base_idx >= num_elements) continue;
-        int center = centers[warp];
-
-        uint8_t* bit_out = &tmp_bit_signals[thread_idx * cmp_chunk * max_bytes_signal_per_ele_16b];
-
-        int bit_offset = 0;
-
-        for (int i = 0; i < cmp_chunk && base_idx + i < num_elements; ++i) {
-            uint16_t val = input_data[base_idx + i];
-            int diff = val > center ? val - center : center - val;
-            int output_len = (val == center) ? 1 : (diff + 125) / 126;
-            uint8_t res = (val == center) ? 1 : ((diff + 126 - output_len * 126) * 2 + (val > center ? -1 : 0) + 1);
-
-            codes[base_idx + i] = res;
+template <typename T>
+inline void compress_plan(
+    const T* input_data,
+    std::size_t num_elements,
+    uint64_t* output_lengths,
+    T* centers,
+    const mans::Parallel& par
+) {
+    std::size_t gsize = num_groups(num_elements);
+    const auto plan = mans::IsaClones<&plan_range<T>>::select();
 
-            // Set bitstream (mark the corresponding bit)
-            bit_out[bit_offset / 8] |= (1 << (7 - (bit_offset % 8)));
-            bit_offset += output_len;
-        }
+    par.for_range(gsize, [&](size_t first, size_t last) {
+        plan(input_data, num_elements, output_lengths, centers, first, last);
+    }, kGroupGrain);
 
-        bit_offsets[thread_idx] = bit_offset;
+    // Compute prefix sum (serially)
+    output_lengths[0] = 0;
+    for (std::size_t i = 1; i <= gsize; ++i) {
+        output_lengths[i] = output_lengths[i - 1] + output_lengths[i];
     }
+}
 
-    // Warp-level reduction: compute signal_length[warp] deterministically
-    #pragma omp parallel for
-    for (int warp = 0; warp < gsize; ++warp) {
-        int base_thread = warp * cmp_tblock_size;
-        int end_thread = std::min(base_thread + cmp_tblock_size, total_threads);
-
-        int max_len_bytes = 0;
-        for (int t = base_thread; t < end_thread; ++t) {
-            int bit_offset = bit_offsets[t];
-            int length_bytes = (bit_offset + 7) / 8;
-            max_len_bytes = std::max(max_len_bytes, length_bytes);
-        }
+// Lanes [first, last) of compress_emit: codes and bit signals, and their
+// byte counts into counts (kHistogramTables * 256) unless it is null
+template <typename T>
+void emit_range(const T* input_data, std::size_t num_elements, const uint64_t* output_lengths,
+                const T* centers, uint8_t* codes, uint8_t* bit_signals, uint64_t* counts,
+                std::size_t first, std::size_t last) {
+    for (std::size_t thread_idx = first; thread_idx < last; ++thread_idx) {
+        std::size_t warp = thread_idx / cmp_tblock_size;
+        int lane = thread_idx % cmp_tblock_size;
+        std::size_t base_idx = thread_idx * cmp_chunk;
+        int bit_len = static_cast<int>(output_lengths[warp + 1] - output_lengths[warp]);
 
-        signal_length[warp] = max_len_bytes;
-    }
+        uint8_t* bit_out = bit_signals + output_lengths[warp] * cmp_tblock_size + lane * bit_len;
+        std::memset(bit_out, 0, bit_len);
 
-    // Fill in the tail bits
-    #pragma omp parallel for
-    for (int thread_idx = 0; thread_idx < total_threads; ++thread_idx) {
-        int warp = thread_idx / cmp_tblock_size;
-        int bit_offset = bit_offsets[thread_idx];
-        int max_len_bytes = signal_length[warp];
+        int bit_offset = 0;
+        if (base_idx < num_elements) {
+            T center = centers[warp];
+            for (int i = 0; i < cmp_chunk && base_idx + i < num_elements; ++i) {
+                T val = input_data[base_idx + i];
+                int diff = val > center ? val - center : center - val;
+                int output_len = (val == center) ? 1 : (diff + 125) / 126;
+                uint8_t res = (val == center) ? 1 : ((diff + 126 - output_len * 126) * 2 + (val > center ? -1 : 0) + 1);
+
+                codes[base_idx + i] = res;
+
+                // Set bitstream (mark the corresponding bit)
+                bit_out[bit_offset / 8] |= (1 << (7 - (bit_offset % 8)));
+                bit_offset += output_len;
+            }
+        }
 
-        if (bit_offset < max_len_bytes * 8) {
-            uint8_t* bit_out = &tmp_bit_signals[thread_idx * cmp_chunk * max_bytes_signal_per_ele_16b];
+        // Fill in the tail bits
+        if (bit_offset < bit_len * 8) {
             int byte_idx = bit_offset / 8;
             uint8_t mask = (bit_offset % 8 == 0) ? 0xFF : (0xFF >> (bit_offset % 8));
             bit_out[byte_idx] |= mask;
         }
-    }
 
-    // Compute prefix sum (serially)
-    output_lengths.resize(gsize + 1);
-    output_lengths[0] = 0;
-    for (int i = 1; i <= gsize; ++i) {
-        output_lengths[i] = output_lengths[i - 1] + signal_length[i - 1];
+        if (counts) {
+            const int n = static_cast<int>(std::min<std::size_t>(
+                cmp_chunk, base_idx < num_elements ? num_elements - base_idx : 0));
+            for (int i = 0; i < n; ++i) {
+                ++counts[(i % kHistogramTables) * 256 + codes[base_idx + i]];
+            }
+            for (int i = 0; i < bit_len; ++i) {
+                ++counts[(i % kHistogramTables) * 256 + bit_out[i]];
+            }
+        }
     }
+}
 
-    // Write back bit_signals
-    int total_bit_bytes = output_lengths[gsize] * cmp_tblock_size;
-    bit_signals.resize(total_bit_bytes, 0);
-
-    #pragma omp parallel for
-    for (int thread_idx = 0; thread_idx < total_threads; ++thread_idx) {
-        int warp = thread_idx / cmp_tblock_size;
-        int lane = thread_idx % cmp_tblock_size;
-        int bit_len = signal_length[warp];
-        int dst_base = output_lengths[warp] * cmp_tblock_size + lane * bit_len;
-
-        if (dst_base + bit_len > total_bit_bytes) continue;
+// With a histogram, the counts of every byte of codes and bit_signals are
+// added to it (256 entries)
+template <typename T>
+inline void compress_emit(
+    const T* input_data,
+    std::size_t num_elements,
+    const uint64_t* output_lengths,
+    const T* centers,
+    uint8_t* codes,
+    uint8_t* bit_signals,
+    uint64_t* histogram,
+    EncodeScratch& scratch,
+    const mans::Parallel& par
+) {
+    std::size_t gsize = num_groups(num_elements);
+    std::size_t total_threads = gsize * cmp_tblock_size;
+    const std::size_t grain = kGroupGrain * cmp_tblock_size;
+    const auto emit = mans::IsaClones<&emit_range<T>>::select();
+
+    if (histogram == nullptr) {
+        par.for_range(total_threads, [&](size_t first, size_t last) {
+            emit(input_data, num_elements, output_lengths, centers, codes, bit_signals,
+                 nullptr, first, last);
+        }, grain);
+        return;
+    }
 
-        const uint8_t* src = &tmp_bit_signals[thread_idx * cmp_chunk * max_bytes_signal_per_ele_16b];
-        // 使用向量化指令进行批量拷贝
-        #pragma omp simd
-        for (int i = 0; i < bit_len; ++i) {
-            bit_signals[dst_base + i] = src[i];
+    // the split of for_range, with one set of tables per worker
+    const std::size_t table = kHistogramTables * 256;
+    const int workers = static_cast<int>(std::max<std::size_t>(1, std::min<std::size_t>(
+        par.size(), (total_threads + grain - 1) / grain)));
+    const std::size_t chunk = (total_threads + workers - 1) / workers;
+    scratch.counts.assign(workers * table, 0);
+    par.workers([&](int worker, int) {
+        std::size_t first = std::min(total_threads, worker * chunk);
+        std::size_t last = std::min(total_threads, first + chunk);
+        emit(input_data, num_elements, output_lengths, centers, codes, bit_signals,
+             scratch.counts.data() + worker * table, first, last);
+    }, workers);
+
+    for (std::size_t t = 0; t < workers * table; t += 256) {
+        const uint64_t* counts = scratch.counts.data() + t;
+        for (int b = 0; b < 256; ++b) {
+            histogram[b] += counts[b];
         }
     }
 }
 
-inline void decompress_uint16(
-    const std::vector<int>& output_lengths,             // gsize
-    const std::vector<uint16_t>& centers,               // gsize
-    const std::vector<uint8_t>& codes,                  // num_elements
-    const std::vector<uint8_t>& bit_signals,            // bitstream
-    std::vector<uint16_t>& output_data                  // output: num_elements
-)
-{
-    int num_elements = codes.size();
-    int gsize = output_lengths.size();
-    int total_threads = gsize * cmp_tblock_size;
-
-    // Step 1: Restore signal[]
-    std::vector<uint8_t> signals(num_elements, 0);
-
-    #pragma omp parallel for
-    for (int tid = 0; tid < total_threads; ++tid) {
-        int warp = tid / cmp_tblock_size;
+// Lanes [first, last) of decompress step 1: per-element signals from the
+// bit stream. L is the stored prefix type, int32_t or uint64_t.
+template <typename L>
+void signals_range(const L* output_lengths, const uint8_t* bit_signals,
+                   std::size_t num_elements, uint8_t* signals,
+                   std::size_t first, std::size_t last) {
+    for (std::size_t tid = first; tid < last; ++tid) {
+        std::size_t warp = tid / cmp_tblock_size;
         int lane = tid % cmp_tblock_size;
-        int idx = tid;
+        std::size_t idx = tid;
 
         if (idx * cmp_chunk >= num_elements) continue;
 
-        int length = output_lengths[warp + 1] - output_lengths[warp];
+        int length = static_cast<int>(output_lengths[warp + 1] - output_lengths[warp]);
 
-        int src_start_idx = output_lengths[warp] * cmp_tblock_size + lane * length;
-        int dst_start_idx = idx * cmp_chunk;
+        std::size_t src_start_idx =
+            static_cast<std::size_t>(output_lengths[warp]) * cmp_tblock_size + lane * length;
+        std::size_t dst_start_idx = idx * cmp_chunk;
 
         uint8_t bit_buffer = 0;
         int signal_idx = -1;
@@ -211,20 +279,17 @@ inline void decompress_uint16(
             signals[dst_start_idx + i] = local_signal[i];
         }
     }
+}
 
-    // Step 2: Decode values
-    output_data.resize(num_elements);
-
-    #pragma omp parallel for
-    for (int tid = 0; tid < total_threads; ++tid) {
-        int block_id = tid;
-        int lane = block_id % warp_size;
-        int bid = block_id / cmp_tblock_size;
-        int base_idx = block_id * decmp_chunk;
-
-        if (base_idx >= num_elements) continue;
+// Chunks [first, last) of decompress step 2: values from codes and signals
+template <typename T>
+void values_range(const T* centers, const uint8_t* codes, const uint8_t* signals,
+                  std::size_t num_elements, T* output_data, std::size_t first, std::size_t last) {
+    for (std::size_t tid = first; tid < last; ++tid) {
+        std::size_t base_idx = tid * decmp_chunk;
 
-        uint16_t center = (lane < 16) ? centers[bid * 2] : centers[bid * 2 + 1];
+        // a decmp_chunk never straddles two groups
+        T center = centers[base_idx / (cmp_tblock_size * cmp_chunk)];
 
         // Use local variables to minimize memory access and reduce branch conditions
         for (int i = 0; i < decmp_chunk && base_idx + i < num_elements; ++i) {
@@ -234,222 +299,43 @@ inline void decompress_uint16(
             int diff = (code % 2 == 1) ? ((code - 1) / 2) : (code / 2);
             diff += signal * 126;
 
-            uint16_t val = (code % 2 == 1) ? center - diff : center + diff;
+            T val = (code % 2 == 1) ? center - diff : center + diff;
             output_data[base_idx + i] = val;
         }
     }
 }
 
-inline void compress_uint32(
-    const std::vector<uint32_t>& input_data,
-    std::vector<int>& output_lengths,
-    std::vector<uint32_t>& centers,
-    std::vector<uint8_t>& codes,
-    std::vector<uint8_t>& bit_signals
-) {
-    int num_elements = input_data.size();
-    int gsize = (num_elements + cmp_tblock_size * cmp_chunk - 1) / (cmp_tblock_size * cmp_chunk);
-    int total_threads = gsize * cmp_tblock_size;
-
-    std::vector<int> signal_length(gsize, 0);
-    std::vector<int> bit_offsets(total_threads, 0);
-    centers.resize(gsize);
-    codes.resize(num_elements);
-
-    // static const uint8_t bitmask[8] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
-    // static const uint8_t tail_mask[8] = {0xFF, 0x7F, 0x3F, 0x1F, 0x0F, 0x07, 0x03, 0x01};
-
-
-    // Center calculation: parallelizing and reducing unnecessary work
-    #pragma omp parallel for
-    for (int warp = 0; warp < gsize; ++warp) {
-        int base_idx = warp * cmp_tblock_size * cmp_chunk;
-        int end_idx = std::min(base_idx + cmp_tblock_size * cmp_chunk, num_elements);
-
-        uint64_t sum = 0;
-        for (int i = base_idx; i < end_idx; ++i) {
-            sum += input_data[i];
-        }
-
-        int count = end_idx - base_idx;
-        centers[warp] = (count > 0) ? sum / count : 0;
-    }
-
-    // Allocate temporary buffer for bit_signals
-    std::vector<uint8_t> tmp_bit_signals(total_threads * cmp_chunk * max_bytes_signal_per_ele_32b, 0);
-
-    // Encoding and setting codes, bit_signals (in temporary space)
-    #pragma omp parallel for
-    for (int thread_idx = 0; thread_idx < total_threads; ++thread_idx) {
-        int warp = thread_idx / cmp_tblock_size;
-        int lane = thread_idx % cmp_tblock_size;
-        int base_idx = warp * cmp_tblock_size * cmp_chunk + lane * cmp_chunk;
-
-        if (base_idx >= num_elements) continue;
-        int center = centers[warp];
-
-        uint8_t* bit_out = &tmp_bit_signals[thread_idx * cmp_chunk * max_bytes_signal_per_ele_32b];
-
-        int bit_offset = 0;
-
-        for (int i = 0; i < cmp_chunk && base_idx + i < num_elements; ++i) {
-            uint32_t val = input_data[base_idx + i];
-            int diff = val > center ? val - center : center - val;
-            int output_len = (val == center) ? 1 : (diff + 125) / 126;
-            uint8_t res = (val == center) ? 1 : ((diff + 126 - output_len * 126) * 2 + (val > center ? -1 : 0) + 1);
-
-            codes[base_idx + i] = res;
-
-            // Set bitstream (mark the corresponding bit)
-            // bit_out[bit_offset / 8] |= bitmask[bit_offset % 8];
-            bit_out[bit_offset / 8] |= (1 << (7 - (bit_offset % 8)));
-            bit_offset += output_len;
-        }
-
-        bit_offsets[thread_idx] = bit_offset;
-    }
-
-    // Warp-level reduction: compute signal_length[warp] deterministically
-    #pragma omp parallel for
-    for (int warp = 0; warp < gsize; ++warp) {
-        int base_thread = warp * cmp_tblock_size;
-        int end_thread = std::min(base_thread + cmp_tblock_size, total_threads);
-
-        int max_len_bytes = 0;
-        for (int t = base_thread; t < end_thread; ++t) {
-            int bit_offset = bit_offsets[t];
-            int length_bytes = (bit_offset + 7) / 8;
-            max_len_bytes = std::max(max_len_bytes, length_bytes);
-        }
-
-        signal_length[warp] = max_len_bytes;
-    }
-
-    // Fill in the tail bits
-    #pragma omp parallel for
-    for (int thread_idx = 0; thread_idx < total_threads; ++thread_idx) {
-        int warp = thread_idx / cmp_tblock_size;
-        int bit_offset = bit_offsets[thread_idx];
-        int max_len_bytes = signal_length[warp];
-
-        if (bit_offset < max_len_bytes * 8) {
-            uint8_t* bit_out = &tmp_bit_signals[thread_idx * cmp_chunk * max_bytes_signal_per_ele_32b];
-            int byte_idx = bit_offset / 8;
-            uint8_t mask = (bit_offset % 8 == 0) ? 0xFF : (0xFF >> (bit_offset % 8));
-            bit_out[byte_idx] |= mask;
-            // bit_out[byte_idx] |= tail_mask[bit_offset % 8];
-        }
-    }
-
-    // Compute prefix sum (serially)
-    output_lengths.resize(gsize + 1);
-    output_lengths[0] = 0;
-    for (int i = 1; i <= gsize; ++i) {
-        output_lengths[i] = output_lengths[i - 1] + signal_length[i - 1];
-    }
-
-    // Write back bit_signals
-    int total_bit_bytes = output_lengths[gsize] * cmp_tblock_size;
-    bit_signals.resize(total_bit_bytes, 0);
-
-    #pragma omp parallel for
-    for (int thread_idx = 0; thread_idx < total_threads; ++thread_idx) {
-        int warp = thread_idx / cmp_tblock_size;
-        int lane = thread_idx % cmp_tblock_size;
-        int bit_len = signal_length[warp];
-        int dst_base = output_lengths[warp] * cmp_tblock_size + lane * bit_len;
-
-        if (dst_base + bit_len > total_bit_bytes) continue;
-
-        const uint8_t* src = &tmp_bit_signals[thread_idx * cmp_chunk * max_bytes_signal_per_ele_32b];
-        // Use  simd for bulk copying
-        #pragma omp simd
-        for (int i = 0; i < bit_len; ++i) {
-            bit_signals[dst_base + i] = src[i];
-        }
-    }
-}
-
-
-inline void decompress_uint32(
-    const std::vector<int>& output_lengths,             // gsize
-    const std::vector<uint32_t>& centers,               // gsize
-    const std::vector<uint8_t>& codes,                  // num_elements
-    const std::vector<uint8_t>& bit_signals,            // bitstream
-    std::vector<uint32_t>& output_data                  // output: num_elements
+template <typename T, typename L>
+inline void decompress(
+    const L* output_lengths,                            // gsize + 1
+    const T* centers,                                   // gsize
+    const uint8_t* codes,                               // num_elements
+    std::size_t num_elements,
+    const uint8_t* bit_signals,                         // bitstream
+    T* output_data,                                     // output: num_elements
+    DecodeScratch& scratch,
+    const mans::Parallel& par
 )
 {
-    int num_elements = codes.size();
-    int gsize = output_lengths.size();
-    int total_threads = gsize * cmp_tblock_size;
-
-    // Step 1: Restore signal[]
-    std::vector<uint8_t> signals(num_elements, 0);
+    std::size_t gsize = num_groups(num_elements);
+    std::size_t total_threads = gsize * cmp_tblock_size;
 
-    #pragma omp parallel for
-    for (int tid = 0; tid < total_threads; ++tid) {
-        int warp = tid / cmp_tblock_size;
-        int lane = tid % cmp_tblock_size;
-        int idx = tid;
-
-        if (idx * cmp_chunk >= num_elements) continue;
+    // Step 1: Restore signal[] (every element is overwritten below)
+    std::vector<uint8_t>& signals = scratch.signals;
+    signals.resize(num_elements);
+    const auto restore = mans::IsaClones<&signals_range<L>>::select();
 
-        int length = output_lengths[warp + 1] - output_lengths[warp];
-
-        int src_start_idx = output_lengths[warp] * cmp_tblock_size + lane * length;
-        int dst_start_idx = idx * cmp_chunk;
-
-        uint8_t bit_buffer = 0;
-        int signal_idx = -1;
-        int offset_byte = 0;
-        bool bit = 0;
-
-        uint8_t local_signal[cmp_chunk] = {0};
-
-        for (; offset_byte < length && signal_idx < cmp_chunk; offset_byte++) {
-            bit_buffer = bit_signals[src_start_idx + offset_byte];
-            for (int i = 7; i >= 0 && signal_idx < cmp_chunk; i--) {
-                bit = (bit_buffer >> i) & 1;
-                if (bit) {
-                    signal_idx++;
-                } else {
-                    local_signal[signal_idx]++;
-                }
-            }
-        }
-
-        // Use a local copy to avoid accessing shared memory repeatedly
-        for (int i = 0; i < cmp_chunk && dst_start_idx + i < num_elements; ++i) {
-            signals[dst_start_idx + i] = local_signal[i];
-        }
-    }
+    par.for_range(total_threads, [&](size_t first, size_t last) {
+        restore(output_lengths, bit_signals, num_elements, signals.data(), first, last);
+    }, kGroupGrain * cmp_tblock_size);
 
     // Step 2: Decode values
-    output_data.resize(num_elements);
-
-    #pragma omp parallel for
-    for (int tid = 0; tid < total_threads; ++tid) {
-        int block_id = tid;
-        int lane = block_id % warp_size;
-        int bid = block_id / cmp_tblock_size;
-        int base_idx = block_id * decmp_chunk;
-
-        if (base_idx >= num_elements) continue;
-
-        uint32_t center = (lane < 16) ? centers[bid * 2] : centers[bid * 2 + 1];
-
-        // Use local variables to minimize memory access and reduce branch conditions
-        for (int i = 0; i < decmp_chunk && base_idx + i < num_elements; ++i) {
-            uint8_t code = codes[base_idx + i];
-            uint8_t signal = signals[base_idx + i];
+    std::size_t decode_threads = (num_elements + decmp_chunk - 1) / decmp_chunk;
+    const auto values = mans::IsaClones<&values_range<T>>::select();
 
-            int diff = (code % 2 == 1) ? ((code - 1) / 2) : (code / 2);
-            diff += signal * 126;
-
-            uint32_t val = (code % 2 == 1) ? center - diff : center + diff;
-            output_data[base_idx + i] = val;
-        }
-    }
+    par.for_range(decode_threads, [&](size_t first, size_t last) {
+        values(centers, codes, signals.data(), num_elements, output_data, first, last);
+    }, kGroupGrain * cmp_tblock_size * cmp_chunk / decmp_chunk);
 }
 
 } // namespace adm
@@ -6,6 +6,7 @@
 #include <type_traits>
 #include <stdexcept>
 #include <cstdio> 
+#include <cstdint>
 
 bool bytes_equal(
     const std::vector<std::uint8_t>& a,
@@ -23,56 +24,111 @@ void adm_compress(
     const std::vector<T>& input_data,
     std::vector<std::uint8_t>& output)
 {
-    std::size_t num_elements = input_data.size();
-    if (num_elements == 0) {
+    AdmEncodeScratch<T> scratch;
+    adm_compress(input_data, output, scratch);
+}
+
+template<typename T>
+void adm_compress(
+    const std::vector<T>& input_data,
+    std::vector<std::uint8_t>& output,
+    AdmEncodeScratch<T>& scratch)
+{
+    if (input_data.empty()) {
         output.clear();
         return;
     }
+    output.resize(adm_plan(input_data.data(), input_data.size(), scratch));
+    adm_emit(input_data.data(), input_data.size(), output.data(), scratch);
+}
 
-    std::uint64_t gsize = (num_elements
-        + adm::cmp_tblock_size * adm::cmp_chunk - 1)
-        / (adm::cmp_tblock_size * adm::cmp_chunk);
+template<typename T>
+std::size_t adm_plan(
+    const T* input_data,
+    std::size_t num_elements,
+    AdmEncodeScratch<T>& scratch,
+    const mans::Parallel& par)
+{
+    static_assert(std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t>,
+                  "adm_compress only supports uint16_t and uint32_t");
+    if (num_elements == 0) {
+        return 0;
+    }
 
-    std::vector<int>              output_lengths(gsize + 1);
-    std::vector<T>                centers(gsize);
-    std::vector<std::uint8_t>     codes(num_elements);
-    std::vector<std::uint8_t>     bit_signals;
+    std::size_t gsize = adm::num_groups(num_elements);
+    scratch.output_lengths.resize(gsize + 1);
+    scratch.centers.resize(gsize);
+    adm::compress_plan(input_data, num_elements, scratch.output_lengths.data(),
+                       scratch.centers.data(), par);
+
+    std::size_t len1 = scratch.output_lengths.size() *
+                       adm::prefix_entry_size(scratch.output_lengths[gsize]);
+    std::size_t len2 = scratch.centers.size()        * sizeof(T);
+    std::size_t len3 = num_elements                  * sizeof(std::uint8_t);
+    std::size_t len4 = static_cast<std::size_t>(scratch.output_lengths[gsize]) * adm::cmp_tblock_size;
+    return sizeof(adm::FileHeader) + len1 + len2 + len3 + len4;
+}
 
-    // call adm compress function
-    if constexpr (std::is_same_v<T, std::uint16_t>) {
-        adm::compress_uint16(input_data, output_lengths, centers, codes, bit_signals);
-    } else if constexpr (std::is_same_v<T, std::uint32_t>) {
-        adm::compress_uint32(input_data, output_lengths, centers, codes, bit_signals);
-    } else {
-        static_assert(std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t>,
-                      "adm_compress only supports uint16_t and uint32_t");
+template<typename T>
+void adm_emit(
+    const T* input_data,
+    std::size_t num_elements,
+    std::uint8_t* output,
+    AdmEncodeScratch<T>& scratch,
+    const mans::Parallel& par,
+    bool count_bytes)
+{
+    if (num_elements == 0) {
+        return;
     }
 
+    const std::vector<std::uint64_t>& output_lengths = scratch.output_lengths;
+    const std::vector<T>&             centers        = scratch.centers;
+    std::uint64_t gsize = centers.size();
 
     adm::FileHeader header;
     header.num_elements = static_cast<std::uint64_t>(num_elements);
     header.gsize        = gsize;
 
-    std::size_t len1 = output_lengths.size() * sizeof(int);
-    std::size_t len2 = centers.size()       * sizeof(T);
-    std::size_t len3 = codes.size()         * sizeof(std::uint8_t);
-    std::size_t len4 = bit_signals.size();
+    const std::size_t entry = adm::prefix_entry_size(output_lengths[gsize]);
+    std::size_t len1 = output_lengths.size() * entry;
+    std::size_t len2 = centers.size()        * sizeof(T);
+    std::size_t len3 = num_elements          * sizeof(std::uint8_t);
+    std::size_t len4 = static_cast<std::size_t>(output_lengths[gsize]) * adm::cmp_tblock_size;
 
     header.len1 = len1;
     header.len2 = len2;
     header.len3 = len3;
     header.len4 = len4;
 
-    std::size_t len_header = sizeof(header);
-    std::size_t total_size = len_header + len1 + len2 + len3 + len4;
-
-    output.resize(total_size);
     std::size_t offset = 0;
-    std::memcpy(output.data() + offset, &header,           len_header); offset += len_header;
-    std::memcpy(output.data() + offset, output_lengths.data(), len1);  offset += len1;
-    std::memcpy(output.data() + offset, centers.data(),        len2);  offset += len2;
-    std::memcpy(output.data() + offset, codes.data(),          len3);  offset += len3;
-    std::memcpy(output.data() + offset, bit_signals.data(),    len4);
+    std::memcpy(output + offset, &header,               sizeof(header)); offset += sizeof(header);
+    if (entry == sizeof(std::uint64_t)) {
+        std::memcpy(output + offset, output_lengths.data(), len1);
+    } else {
+        for (std::size_t i = 0; i <= gsize; ++i) {
+            std::int32_t len = static_cast<std::int32_t>(output_lengths[i]);
+            std::memcpy(output + offset + i * sizeof(len), &len, sizeof(len));
+        }
+    }
+    offset += len1;
+    std::memcpy(output + offset, centers.data(),        len2);           offset += len2;
+
+    // header, prefix and centers are counted here, the rest by the kernels
+    std::uint64_t* histogram = nullptr;
+    if (count_bytes) {
+        scratch.histogram.assign(256, 0);
+        histogram = scratch.histogram.data();
+        for (std::size_t i = 0; i < offset; ++i) {
+            ++histogram[output[i]];
+        }
+    }
+
+    // codes and bit signals go straight into their final place
+    adm::compress_emit(input_data, num_elements,
+                       output_lengths.data(), centers.data(),
+                       output + offset, output + offset + len3,
+                       histogram, scratch.kernel, par);
 }
 
 // adm compressed data->raw data
@@ -80,47 +136,211 @@ template<typename T>
 void adm_decompress(
     const std::vector<std::uint8_t>& merged,
     std::vector<T>& recovered)
+{
+    AdmDecodeScratch<T> scratch;
+    adm_decompress(merged, recovered, scratch);
+}
+
+template<typename T>
+void adm_decompress(
+    const std::vector<std::uint8_t>& merged,
+    std::vector<T>& recovered,
+    AdmDecodeScratch<T>& scratch)
 {
     if (merged.size() < sizeof(adm::FileHeader)) {
         throw std::runtime_error("File too small or invalid format.");
     }
-
     adm::FileHeader header;
-    std::size_t offset = 0;
     std::memcpy(&header, merged.data(), sizeof(header));
-    offset += sizeof(header);
+    recovered.resize(static_cast<std::size_t>(header.num_elements));
+    adm_decompress(merged.data(), merged.size(), recovered.data(), recovered.size(), scratch);
+}
 
-    std::size_t num_elements = static_cast<std::size_t>(header.num_elements);
+template<typename U>
+static const U* aligned_or_copied(const std::uint8_t* p, std::size_t bytes, std::vector<U>& copy) {
+    if (reinterpret_cast<std::uintptr_t>(p) % alignof(U) == 0) {
+        return reinterpret_cast<const U*>(p);
+    }
+    copy.resize(bytes / sizeof(U));
+    std::memcpy(copy.data(), p, bytes);
+    return copy.data();
+}
+
+// Throws unless the sections header announces fit in the size bytes of the
+// stream and agree with its element and group counts. Returns whether the
+// prefix entries are uint64 (streams whose signals pass 2 GiB) or int32.
+template<typename T>
+static bool check_header(const adm::FileHeader& header, std::size_t size) {
+    const std::size_t offset = sizeof(header);
     std::size_t len1 = static_cast<std::size_t>(header.len1);
     std::size_t len2 = static_cast<std::size_t>(header.len2);
     std::size_t len3 = static_cast<std::size_t>(header.len3);
     std::size_t len4 = static_cast<std::size_t>(header.len4);
 
-    if (merged.size() < offset + len1 + len2 + len3 + len4) {
+    if (size - offset < len1 || size - offset - len1 < len2 ||
+        size - offset - len1 - len2 < len3 || size - offset - len1 - len2 - len3 < len4) {
         throw std::runtime_error("Corrupted file: not enough data.");
     }
+    const bool wide = len1 == (header.gsize + 1) * sizeof(std::uint64_t);
+    if (len3 != header.num_elements ||
+        (len1 != (header.gsize + 1) * sizeof(std::int32_t) && !wide) ||
+        len2 != header.gsize * sizeof(T) ||
+        header.gsize != adm::num_groups(static_cast<std::size_t>(header.num_elements))) {
+        throw std::runtime_error("Corrupted file: inconsistent ADM header.");
+    }
+    return wide;
+}
+
+template<typename T>
+std::size_t adm_decompress(
+    const std::uint8_t* merged,
+    std::size_t size,
+    void* output,
+    std::size_t output_capacity,
+    AdmDecodeScratch<T>& scratch,
+    const mans::Parallel& par)
+{
+    static_assert(std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t>,
+                  "adm_decompress only supports uint16_t and uint32_t");
+    if (size < sizeof(adm::FileHeader)) {
+        throw std::runtime_error("File too small or invalid format.");
+    }
 
-    std::vector<int>            output_lengths(len1 / sizeof(int));
-    std::vector<T>              centers(len2 / sizeof(T));
-    std::vector<std::uint8_t>   codes(len3);
-    std::vector<std::uint8_t>   bit_signals(len4);
+    adm::FileHeader header;
+    std::size_t offset = 0;
+    std::memcpy(&header, merged, sizeof(header));
+    offset += sizeof(header);
 
-    std::size_t off = offset;
-    std::memcpy(output_lengths.data(), merged.data() + off, len1); off += len1;
-    std::memcpy(centers.data(),        merged.data() + off, len2); off += len2;
-    std::memcpy(codes.data(),          merged.data() + off, len3); off += len3;
-    std::memcpy(bit_signals.data(),    merged.data() + off, len4);
+    std::size_t num_elements = static_cast<std::size_t>(header.num_elements);
+    std::size_t len1 = static_cast<std::size_t>(header.len1);
+    std::size_t len2 = static_cast<std::size_t>(header.len2);
+    std::size_t len3 = static_cast<std::size_t>(header.len3);
+    std::size_t len4 = static_cast<std::size_t>(header.len4);
+    const bool wide = check_header<T>(header, size);
+    if (output_capacity < num_elements) {
+        throw std::runtime_error("adm_decompress: output buffer too small.");
+    }
+    if (num_elements == 0) {
+        return 0;
+    }
 
-    recovered.resize(num_elements);
+    const std::uint8_t* lengths_in = merged + offset;
+    offset += len1;
+    const T* centers = aligned_or_copied(merged + offset, len2, scratch.centers);
+    offset += len2;
+    const std::uint8_t* codes = merged + offset;
+    offset += len3;
+    const std::uint8_t* bit_signals = merged + offset;
+
+    T* out = static_cast<T*>(output);
+    if (reinterpret_cast<std::uintptr_t>(output) % alignof(T) != 0) {
+        scratch.recovered.resize(num_elements);
+        out = scratch.recovered.data();
+    }
+    auto run = [&](const auto* output_lengths) {
+        // the prefix must stay inside the bit signal section
+        if (static_cast<std::uint64_t>(output_lengths[header.gsize]) > len4 / adm::cmp_tblock_size) {
+            throw std::runtime_error("Corrupted file: bit signals truncated.");
+        }
+        adm::decompress(output_lengths, centers, codes, num_elements, bit_signals,
+                        out, scratch.kernel, par);
+    };
+    if (wide) {
+        run(aligned_or_copied(lengths_in, len1, scratch.output_lengths64));
+    } else {
+        run(aligned_or_copied(lengths_in, len1, scratch.output_lengths));
+    }
+    if (out != output) {
+        std::memcpy(output, out, num_elements * sizeof(T));
+    }
+    return num_elements;
+}
 
-    if constexpr (std::is_same_v<T, std::uint16_t>) {
-        adm::decompress_uint16(output_lengths, centers, codes, bit_signals, recovered);
-    } else if constexpr (std::is_same_v<T, std::uint32_t>) {
-        adm::decompress_uint32(output_lengths, centers, codes, bit_signals, recovered);
+template<typename T>
+void adm_decompress_range(
+    const AdmStreamReader& read,
+    std::size_t size,
+    std::size_t first,
+    std::size_t count,
+    void* output,
+    AdmDecodeScratch<T>& scratch,
+    const mans::Parallel& par)
+{
+    static_assert(std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t>,
+                  "adm_decompress_range only supports uint16_t and uint32_t");
+    auto fetch = [&](std::uint64_t offset, std::size_t bytes, void* dst) {
+        if (!read(offset, bytes, static_cast<std::uint8_t*>(dst))) {
+            throw std::runtime_error("adm_decompress_range: cannot read the stream.");
+        }
+    };
+    if (size < sizeof(adm::FileHeader)) {
+        throw std::runtime_error("File too small or invalid format.");
+    }
+    adm::FileHeader header;
+    fetch(0, sizeof(header), &header);
+    const bool wide = check_header<T>(header, size);
+    const std::size_t num_elements = static_cast<std::size_t>(header.num_elements);
+    if (first > num_elements || count > num_elements - first) {
+        throw std::runtime_error("adm_decompress_range: range outside the stream.");
+    }
+    if (count == 0) {
+        return;
+    }
+
+    // the whole groups the range touches
+    const std::size_t group = adm::cmp_tblock_size * adm::cmp_chunk;
+    const std::size_t g0 = first / group;
+    const std::size_t groups = (first + count - 1) / group + 1 - g0;
+    const std::size_t base = g0 * group;
+    const std::size_t elements = std::min(base + groups * group, num_elements) - base;
+    const std::uint64_t prefix_at = sizeof(header);
+    const std::uint64_t centers_at = prefix_at + header.len1;
+    const std::uint64_t codes_at = centers_at + header.len2;
+    const std::uint64_t signals_at = codes_at + header.len3;
+
+    // their prefix entries, rebased to the first one
+    std::vector<std::uint64_t>& lengths = scratch.output_lengths64;
+    lengths.resize(groups + 1);
+    if (wide) {
+        fetch(prefix_at + g0 * sizeof(std::uint64_t), lengths.size() * sizeof(std::uint64_t),
+              lengths.data());
     } else {
-        static_assert(std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t>,
-                      "adm_decompress only supports uint16_t and uint32_t");
+        std::vector<int>& narrow = scratch.output_lengths;
+        narrow.resize(groups + 1);
+        fetch(prefix_at + g0 * sizeof(std::int32_t), narrow.size() * sizeof(std::int32_t),
+              narrow.data());
+        for (std::size_t i = 0; i <= groups; ++i) {
+            if (narrow[i] < 0) {
+                throw std::runtime_error("Corrupted file: bit signals truncated.");
+            }
+            lengths[i] = static_cast<std::uint64_t>(narrow[i]);
+        }
     }
+    for (std::size_t i = 1; i <= groups; ++i) {
+        if (lengths[i] < lengths[i - 1]) {
+            throw std::runtime_error("Corrupted file: bit signals truncated.");
+        }
+    }
+    if (lengths[groups] > header.len4 / adm::cmp_tblock_size) {
+        throw std::runtime_error("Corrupted file: bit signals truncated.");
+    }
+    const std::uint64_t signal_start = lengths[0];
+    for (std::uint64_t& length : lengths) {
+        length -= signal_start;
+    }
+
+    scratch.centers.resize(groups);
+    fetch(centers_at + g0 * sizeof(T), groups * sizeof(T), scratch.centers.data());
+    const std::size_t signal_bytes = static_cast<std::size_t>(lengths[groups]) * adm::cmp_tblock_size;
+    scratch.window.resize(elements + signal_bytes);
+    fetch(codes_at + base, elements, scratch.window.data());
+    fetch(signals_at + signal_start * adm::cmp_tblock_size, signal_bytes,
+          scratch.window.data() + elements);
+
+    scratch.recovered.resize(elements);
+    adm::decompress(lengths.data(), scratch.centers.data(), scratch.window.data(), elements,
+                    scratch.window.data() + elements, scratch.recovered.data(), scratch.kernel, par);
+    std::memcpy(output, scratch.recovered.data() + (first - base), count * sizeof(T));
 }
 
 // ===== compress_and_benchmark =====
@@ -249,6 +469,24 @@ template void adm_compress<uint32_t>(const std::vector<uint32_t>&, std::vector<u
 template void adm_decompress<uint16_t>(const std::vector<uint8_t>&, std::vector<uint16_t>&);
 template void adm_decompress<uint32_t>(const std::vector<uint8_t>&, std::vector<uint32_t>&);
 
+template void adm_compress<uint16_t>(const std::vector<uint16_t>&, std::vector<uint8_t>&, AdmEncodeScratch<uint16_t>&);
+template void adm_compress<uint32_t>(const std::vector<uint32_t>&, std::vector<uint8_t>&, AdmEncodeScratch<uint32_t>&);
+
+template void adm_decompress<uint16_t>(const std::vector<uint8_t>&, std::vector<uint16_t>&, AdmDecodeScratch<uint16_t>&);
+template void adm_decompress<uint32_t>(const std::vector<uint8_t>&, std::vector<uint32_t>&, AdmDecodeScratch<uint32_t>&);
+
+template std::size_t adm_plan<uint16_t>(const uint16_t*, std::size_t, AdmEncodeScratch<uint16_t>&, const mans::Parallel&);
+template std::size_t adm_plan<uint32_t>(const uint32_t*, std::size_t, AdmEncodeScratch<uint32_t>&, const mans::Parallel&);
+
+template void adm_emit<uint16_t>(const uint16_t*, std::size_t, std::uint8_t*, AdmEncodeScratch<uint16_t>&, const mans::Parallel&, bool);
+template void adm_emit<uint32_t>(const uint32_t*, std::size_t, std::uint8_t*, AdmEncodeScratch<uint32_t>&, const mans::Parallel&, bool);
+
+template std::size_t adm_decompress<uint16_t>(const std::uint8_t*, std::size_t, void*, std::size_t, AdmDecodeScratch<uint16_t>&, const mans::Parallel&);
+template std::size_t adm_decompress<uint32_t>(const std::uint8_t*, std::size_t, void*, std::size_t, AdmDecodeScratch<uint32_t>&, const mans::Parallel&);
+
+template void adm_decompress_range<uint16_t>(const AdmStreamReader&, std::size_t, std::size_t, std::size_t, void*, AdmDecodeScratch<uint16_t>&, const mans::Parallel&);
+template void adm_decompress_range<uint32_t>(const AdmStreamReader&, std::size_t, std::size_t, std::size_t, void*, AdmDecodeScratch<uint32_t>&, const mans::Parallel&);
+
 template void adm_compress_and_benchmark<uint16_t>(const std::vector<uint16_t>&, std::vector<uint8_t>&);
 template void adm_compress_and_benchmark<uint32_t>(const std::vector<uint32_t>&, std::vector<uint8_t>&);
 
@@ -3,7 +3,98 @@
 #define ADM_UTILS_H
 
 #include <vector>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+
+#include "adm.h"
+
+// Temporaries of adm_compress, kept alive by the caller across calls.
+// Codes and bit signals are written straight into the merged output, so only
+// the per-group tables computed by adm_plan live here, plus the byte counts
+// adm_emit leaves on request.
+template<typename T>
+struct AdmEncodeScratch {
+    std::vector<std::uint64_t> output_lengths;
+    std::vector<T>            centers;
+    std::vector<std::uint64_t> histogram;   // 256 byte counts of the merged stream
+    adm::EncodeScratch        kernel;
+};
+
+// Temporaries of adm_decompress, kept alive by the caller across calls.
+// output_lengths(64) / centers are only filled when the merged stream is not
+// suitably aligned to be read in place; recovered likewise for the output.
+template<typename T>
+struct AdmDecodeScratch {
+    std::vector<int>          output_lengths;
+    std::vector<std::uint64_t> output_lengths64;
+    std::vector<T>            centers;
+    std::vector<T>            recovered;
+    std::vector<std::uint8_t> window;   // range only: codes and bit signals of its groups
+    adm::DecodeScratch        kernel;
+};
+
+// Reads bytes [offset, offset + size) of a merged ADM stream into dst; false
+// if they cannot be read
+using AdmStreamReader = std::function<bool(std::uint64_t offset, std::size_t size, std::uint8_t* dst)>;
+
+// First half of adm_compress: computes the group tables into scratch and
+// returns the size of the merged ADM stream for input[0, num_elements).
+template<typename T>
+std::size_t adm_plan(
+    const T* input_data,
+    std::size_t num_elements,
+    AdmEncodeScratch<T>& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// Second half of adm_compress: writes the merged ADM stream planned by the
+// last adm_plan call on the same input into output (any alignment). With
+// count_bytes it also leaves the byte histogram of the whole stream in
+// scratch.histogram, counted while the bytes are written, for pans_compress
+// to take instead of reading the stream once more.
+template<typename T>
+void adm_emit(
+    const T* input_data,
+    std::size_t num_elements,
+    std::uint8_t* output,
+    AdmEncodeScratch<T>& scratch,
+    const mans::Parallel& par = mans::Parallel(),
+    bool count_bytes = false
+);
+
+// Pointer interface of adm_decompress: decodes merged[0, size) into output
+// (any alignment) and returns the number of elements written. Throws
+// std::runtime_error on a malformed stream or when output_capacity (in
+// elements) is too small.
+// The pointer functions run their kernels on par; the vector overloads below
+// use the default pool.
+template<typename T>
+std::size_t adm_decompress(
+    const std::uint8_t* merged,
+    std::size_t size,
+    void* output,
+    std::size_t output_capacity,
+    AdmDecodeScratch<T>& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// Random access: decodes elements [first, first + count) of the merged ADM
+// stream of size bytes that read gives access to into output (any
+// alignment). Only the header and the prefix entries, centers, codes and bit
+// signals of the groups the range touches are read and reconstructed.
+// Throws std::runtime_error on a malformed stream, a failed read or a range
+// outside the stream.
+template<typename T>
+void adm_decompress_range(
+    const AdmStreamReader& read,
+    std::size_t size,
+    std::size_t first,
+    std::size_t count,
+    void* output,
+    AdmDecodeScratch<T>& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
 
 template<typename T>
 void adm_compress(
@@ -11,6 +102,13 @@ void adm_compress(
     std::vector<std::uint8_t>& output
 );
 
+template<typename T>
+void adm_compress(
+    const std::vector<T>& input_data,
+    std::vector<std::uint8_t>& output,
+    AdmEncodeScratch<T>& scratch
+);
+
 
 template<typename T>
 void adm_decompress(
@@ -18,6 +116,13 @@ void adm_decompress(
     std::vector<T>& recovered
 );
 
+template<typename T>
+void adm_decompress(
+    const std::vector<std::uint8_t>& merged,
+    std::vector<T>& recovered,
+    AdmDecodeScratch<T>& scratch
+);
+
 
 template<typename T>
 void adm_compress_and_benchmark(
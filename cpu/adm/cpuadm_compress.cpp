@@ -1,4 +1,4 @@
-// compiler： g++ -std=c++17 -mavx512f -fopenmp -march=native -O3 compress.cpp -o compress
+// compiler： g++ -std=c++17 -fopenmp -O3 compress.cpp -o compress
 // exec: OMP_NUM_THREADS=4 ./compress u2 input.u2 output.bin
 //       OMP_NUM_THREADS=4 ./compress u4 input.u2 output.bin
 
@@ -1,4 +1,4 @@
-// compiler: g++ -std=c++17 -mavx512f -fopenmp -march=native -O3 decompress.cpp -o decompress
+// compiler: g++ -std=c++17 -fopenmp -O3 decompress.cpp -o decompress
 // exec   : OMP_NUM_THREADS=4 ./decompress u2 input.bin output.u2
 //          OMP_NUM_THREADS=4 ./decompress u4 input.bin output.u4
 
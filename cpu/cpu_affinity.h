@@ -0,0 +1,123 @@
+#ifndef MANS_CPU_AFFINITY_H
+#define MANS_CPU_AFFINITY_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+namespace mans {
+
+// CPUs this process may run on (sched_getaffinity), in ascending order. Falls
+// back to 0 .. hardware_concurrency - 1 when the mask cannot be read.
+inline std::vector<int> allowed_cpus() {
+    std::vector<int> cpus;
+    for (int max_cpus = 1024; max_cpus <= (1 << 20); max_cpus *= 2) {
+        cpu_set_t* set = CPU_ALLOC(max_cpus);
+        if (set == nullptr) break;
+        size_t bytes = CPU_ALLOC_SIZE(max_cpus);
+        CPU_ZERO_S(bytes, set);
+        if (sched_getaffinity(0, bytes, set) == 0) {
+            for (int cpu = 0; cpu < max_cpus; ++cpu) {
+                if (CPU_ISSET_S(cpu, bytes, set)) cpus.push_back(cpu);
+            }
+            CPU_FREE(set);
+            break;
+        }
+        CPU_FREE(set);
+        if (errno != EINVAL) break;   // EINVAL: the kernel mask is wider, retry
+    }
+    if (cpus.empty()) {
+        int n = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        for (int cpu = 0; cpu < n; ++cpu) cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+// Parses one cgroup v2 cpu.max ("<quota> <period>" or "max <period>") into
+// cores; 0 means unlimited or unreadable.
+inline double parse_cpu_max(const std::string& line) {
+    std::istringstream in(line);
+    std::string quota;
+    double period = 0;
+    if (!(in >> quota >> period) || quota == "max" || period <= 0) return 0;
+    double q = std::strtod(quota.c_str(), nullptr);
+    return q > 0 ? q / period : 0;
+}
+
+// CPU quota of the cgroup v2 this process lives in, in cores, taking the
+// tightest cpu.max between its own cgroup and the root. 0 when there is no
+// quota or no cgroup v2 hierarchy (v1 controllers are not consulted).
+inline double cgroup_cpu_quota() {
+    std::ifstream self("/proc/self/cgroup");
+    std::string line, path;
+    while (std::getline(self, line)) {
+        if (line.compare(0, 3, "0::") == 0) {
+            path = line.substr(3);
+            break;
+        }
+    }
+    if (path.empty() || path[0] != '/') return 0;
+
+    double quota = 0;
+    for (;;) {
+        std::ifstream max_file("/sys/fs/cgroup" + (path == "/" ? std::string() : path) + "/cpu.max");
+        std::string max_line;
+        if (max_file && std::getline(max_file, max_line)) {
+            double q = parse_cpu_max(max_line);
+            if (q > 0 && (quota == 0 || q < quota)) quota = q;
+        }
+        if (path == "/") break;
+        size_t slash = path.find_last_of('/');
+        path = slash == 0 ? "/" : path.substr(0, slash);
+    }
+    return quota;
+}
+
+// Threads worth running at once: the allowed CPUs, capped by the cgroup quota
+// (rounded up, so a 2.5 core quota still gets 3 threads)
+inline int usable_cpus() {
+    int cpus = static_cast<int>(allowed_cpus().size());
+    double quota = cgroup_cpu_quota();
+    if (quota > 0) {
+        cpus = std::min(cpus, std::max(1, static_cast<int>(std::ceil(quota))));
+    }
+    return cpus;
+}
+
+// CPUs the default pool pins its workers to; empty means no pinning. Pinning
+// is skipped when MANS_PIN_THREADS=0, and when a cgroup quota leaves fewer
+// threads than allowed CPUs: the allowed set is then usually shared with
+// other jobs, and pinning every one of them to the same first few cores
+// would stack them.
+inline std::vector<int> default_pin_cpus() {
+    const char* env = std::getenv("MANS_PIN_THREADS");
+    if (env != nullptr && std::strcmp(env, "0") == 0) return {};
+    std::vector<int> cpus = allowed_cpus();
+    if (usable_cpus() < static_cast<int>(cpus.size())) return {};
+    return cpus;
+}
+
+inline bool pin_current_thread(int cpu) {
+    cpu_set_t* set = CPU_ALLOC(cpu + 1);
+    if (set == nullptr) return false;
+    size_t bytes = CPU_ALLOC_SIZE(cpu + 1);
+    CPU_ZERO_S(bytes, set);
+    CPU_SET_S(cpu, bytes, set);
+    bool ok = pthread_setaffinity_np(pthread_self(), bytes, set) == 0;
+    CPU_FREE(set);
+    return ok;
+}
+
+} // namespace mans
+
+#endif // MANS_CPU_AFFINITY_H
@@ -0,0 +1,150 @@
+#ifndef MANS_CPU_ISA_H
+#define MANS_CPU_ISA_H
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+namespace mans {
+
+// Instruction sets the CPU kernels are built for. The binary itself only
+// assumes the x86-64 baseline; every faster kernel carries a target attribute
+// and is reached through a dispatch on active_isa(), so one build runs on any
+// x86-64 host and picks the widest path it supports.
+enum class Isa : int {
+    Scalar = 0,   // x86-64 baseline (SSE2)
+    Sse42 = 1,    // SSE4.2 + POPCNT
+    Avx2 = 2,     // AVX2
+    Avx512 = 3,   // AVX-512 F + BW + VL
+};
+
+// Target attribute strings of the non-baseline kernels; keep in step with
+// detected_isa()
+#define MANS_TARGET_SSE42 "sse4.2,popcnt"
+#define MANS_TARGET_AVX2 "avx2,popcnt"
+#define MANS_TARGET_AVX512 "avx512f,avx512bw,avx512vl,popcnt"
+
+inline const char* isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::Scalar: return "scalar";
+        case Isa::Sse42: return "sse4.2";
+        case Isa::Avx2: return "avx2";
+        case Isa::Avx512: return "avx512";
+    }
+    return "?";
+}
+
+// Accepts the names printed by isa_name (and "sse42")
+inline bool parse_isa(const char* name, Isa& isa) {
+    for (Isa candidate : {Isa::Scalar, Isa::Sse42, Isa::Avx2, Isa::Avx512}) {
+        if (std::strcmp(name, isa_name(candidate)) == 0) {
+            isa = candidate;
+            return true;
+        }
+    }
+    if (std::strcmp(name, "sse42") == 0) {
+        isa = Isa::Sse42;
+        return true;
+    }
+    return false;
+}
+
+// Widest instruction set of the running CPU (CPUID, with the OS support for
+// the AVX / AVX-512 register state checked by libgcc)
+inline Isa detected_isa() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("popcnt")) {
+        return Isa::Avx512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return Isa::Avx2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return Isa::Sse42;
+    }
+    return Isa::Scalar;
+}
+
+namespace detail {
+
+// MANS_FORCE_ISA=<scalar|sse4.2|avx2|avx512> lowers the dispatch; a request
+// above what the CPU supports is clamped to detected_isa()
+inline Isa initial_isa() {
+    Isa isa = detected_isa();
+    const char* env = std::getenv("MANS_FORCE_ISA");
+    if (env == nullptr || *env == '\0') return isa;
+    Isa forced;
+    if (!parse_isa(env, forced)) {
+        std::cerr << "MANS_FORCE_ISA=" << env << " is not one of scalar, sse4.2, avx2, avx512;"
+                  << " using " << isa_name(isa) << std::endl;
+        return isa;
+    }
+    if (forced > isa) {
+        std::cerr << "MANS_FORCE_ISA=" << env << " is not supported by this CPU;"
+                  << " using " << isa_name(isa) << std::endl;
+        return isa;
+    }
+    return forced;
+}
+
+inline std::atomic<int>& isa_slot() {
+    static std::atomic<int> slot(static_cast<int>(initial_isa()));
+    return slot;
+}
+
+} // namespace detail
+
+// Instruction set the kernels dispatch on. Resolved at first use; every
+// encode / decode / histogram / ADM call reads it again, so force_isa() takes
+// effect on the next call.
+inline Isa active_isa() {
+    return static_cast<Isa>(detail::isa_slot().load(std::memory_order_relaxed));
+}
+
+// Switches the dispatch to isa (clamped to detected_isa()) and returns the
+// instruction set now in use. Meant for benchmarks and tests; calls already
+// running keep the kernels they picked.
+inline Isa force_isa(Isa isa) {
+    Isa detected = detected_isa();
+    if (isa > detected) isa = detected;
+    detail::isa_slot().store(static_cast<int>(isa), std::memory_order_relaxed);
+    return isa;
+}
+
+// Copies of a baseline kernel compiled for each instruction set. Fn is written
+// as plain code; flatten pulls it (and everything it calls) into the clone so
+// the whole kernel is vectorized for that target. Kernels with hand-written
+// intrinsics for a level use those instead of the clone.
+template <auto Fn>
+struct IsaClones;
+
+template <typename R, typename... Args, R (*Fn)(Args...)>
+struct IsaClones<Fn> {
+    using Ptr = R (*)(Args...);
+
+    __attribute__((target(MANS_TARGET_SSE42), flatten))
+    static R sse42(Args... args) { return Fn(std::forward<Args>(args)...); }
+
+    __attribute__((target(MANS_TARGET_AVX2), flatten))
+    static R avx2(Args... args) { return Fn(std::forward<Args>(args)...); }
+
+    __attribute__((target(MANS_TARGET_AVX512), flatten))
+    static R avx512(Args... args) { return Fn(std::forward<Args>(args)...); }
+
+    static Ptr select(Isa isa = active_isa()) {
+        switch (isa) {
+            case Isa::Avx512: return &avx512;
+            case Isa::Avx2: return &avx2;
+            case Isa::Sse42: return &sse42;
+            case Isa::Scalar: break;
+        }
+        return Fn;
+    }
+};
+
+} // namespace mans
+
+#endif // MANS_CPU_ISA_H
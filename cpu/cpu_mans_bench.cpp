@@ -0,0 +1,1458 @@
+// compiler: see CMakeLists.txt (target cpu_mans_bench)
+// exec    : ./cpu_mans_bench <mode> u2 [iters] file1.u2 file2.u2 ...
+//
+// Micro benchmarks of the public mans:: API on many repeated calls, the way
+// slice-based pipelines drive it.
+//   context : per-call latency with a fresh call each time vs a reused
+//             CompressContext / DecompressContext
+//   span    : vector overloads vs the caller-owned buffer overloads (both
+//             with a context); the round trip is checked at an odd offset
+//   batch   : a frame of kBatchSlices copies of each file, compressed with one
+//             span call per slice vs one compress_batch / decompress_batch
+//   threads : round trip per thread budget on a private ThreadPool, through
+//             the SubmitExecutor adapter, and kConcurrentCalls calls at once
+//             splitting the pool; every output must match the budget 1 one
+//   affinity: the CPUs the default pool found usable and its round-trip
+//             throughput; tools/run_affinity_cpu.sh runs it under taskset
+//   isa     : round-trip throughput with the kernels forced to each
+//             instruction set this CPU has (mans::force_isa); every level
+//             must write the same stream as the scalar one
+//   precision: ratio vs round-trip throughput for every ANS table precision
+//             and for Precision::Auto (with the precision it picked)
+//   blocksize: ratio and round-trip throughput for every ANS block size
+//             at thread budgets 1, 2, 4, ... on a private ThreadPool
+//   dictionary: 4 KiB to 64 KiB slices of the files, a dictionary trained
+//             on the even ones; ratio and round-trip throughput on the odd
+//             ones without and with it, and the share of slices that used it
+//   compact : 512 B to 256 KiB slices of the files; mean stream size, ratio
+//             and round-trip throughput (the PANS streams of inputs up to
+//             64 KiB are written compact where that is smaller)
+//   stored  : each file next to noise and a single repeated value of the
+//             same size; ratio and round-trip throughput beside a plain
+//             memcpy (PANS blocks the coder does not shorten are stored,
+//             constant ones keep one symbol)
+//   coder   : ratio and round-trip throughput of the portable and the wide
+//             ANS coder, on one thread and on the whole pool
+//   checksum: round-trip throughput without and with block checksums, the
+//             verify-only pass, and decompress followed by a separate CRC32C
+//             pass over the output for comparison
+//   lookup  : PANS decode of 4 KiB slices of the files, of each file whole
+//             and of each file in 64 KiB segments (one table per segment),
+//             per instruction set and table precision, on one thread; with
+//             the L1D read misses and instructions the decode takes where
+//             the host exposes hardware counters (perf_event_open)
+//   latency : p50 / p99 per-call latency of 512 B to 256 KiB inputs cut
+//             from the files, on a private ThreadPool, with the stages spread
+//             over the pool (LowLatency::Off) and on the calling thread (On)
+//   large   : one kLargeFrameBytes frame made of the files repeated, through
+//             the span overloads; throughput and the peak RSS each call adds
+//             on top of the caller's buffers (at most 5 iterations)
+//   histogram: the PANS symbol histogram on 4 KiB to 4 GiB of the files
+//             repeated, at thread budgets 1, 2, 4, ... on a private
+//             ThreadPool, next to a plain one-table loop it must agree with
+//   scaling : PANS compress and decompress of 64 KiB to 4 GiB (as much as
+//             fits in half the RAM) of the files repeated, at thread budgets
+//             1, 2, 4, ... on a private ThreadPool, with the speedup over
+//             budget 1; every budget must write the same stream
+//   range   : frames of 1 MiB to 256 MiB made of the files repeated; full
+//             decompress next to mans::decompress_range of 1 KiB to 1 MiB
+//             windows spread over the frame, each checked against the input
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <memory>
+#include <new>
+#include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../mans_api.hpp"
+#include "file_utils.h"
+#include "pans/pans_utils.h"
+#include "pans/CpuANSChecksum.h"
+
+namespace {
+
+using Clock = std::chrono::high_resolution_clock;
+
+// median of per-call latencies in microseconds
+double median_us(int iters, const std::function<void()>& fn) {
+    std::vector<double> samples;
+    samples.reserve(iters);
+    fn(); // warmup
+    for (int i = 0; i < iters; ++i) {
+        auto start = Clock::now();
+        fn();
+        auto end = Clock::now();
+        samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+// p50 and p99 of per-call latencies in microseconds
+void percentiles_us(int iters, const std::function<void()>& fn, double& p50, double& p99) {
+    std::vector<double> samples;
+    samples.reserve(iters);
+    fn(); // warmup
+    for (int i = 0; i < iters; ++i) {
+        auto start = Clock::now();
+        fn();
+        auto end = Clock::now();
+        samples.push_back(std::chrono::duration<double, std::micro>(end - start).count());
+    }
+    std::sort(samples.begin(), samples.end());
+    p50 = samples[samples.size() / 2];
+    p99 = samples[std::min(samples.size() - 1, samples.size() * 99 / 100)];
+}
+
+void print_usage(const char* prog) {
+    std::cerr << "Use: " << prog << " <context|span|batch|threads|affinity|isa|precision|blocksize|segments|dictionary|compact|stored|coder|checksum|lookup|latency|large|histogram|scaling|range> <u2|u4> [iters=200] <file>...\n";
+}
+
+// peak resident set of the process so far, in MiB
+double peak_rss_mib() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+int bench_context(const mans::MansParams& params, int iters,
+                  const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %12s %12s %8s %12s %12s %8s\n",
+                "file", "size(B)", "cmp(us)", "cmp+ctx(us)", "gain",
+                "dec(us)", "dec+ctx(us)", "gain");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+
+        std::vector<uint8_t> compressed, decompressed;
+        mans::cpu::CompressContext cctx;
+        mans::cpu::DecompressContext dctx;
+
+        double cmp = median_us(iters, [&] {
+            mans::compress(raw.data(), length, params, compressed);
+        });
+        double cmp_ctx = median_us(iters, [&] {
+            mans::compress(raw.data(), length, params, compressed, cctx);
+        });
+        double dec = median_us(iters, [&] {
+            mans::decompress(compressed, params, decompressed);
+        });
+        double dec_ctx = median_us(iters, [&] {
+            mans::decompress(compressed, params, decompressed, dctx);
+        });
+
+        if (decompressed.size() != length * elem ||
+            std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+            std::cerr << "Round trip mismatch: " << file << "\n";
+            return 1;
+        }
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        std::printf("%-40s %10zu %12.1f %12.1f %7.2fx %12.1f %12.1f %7.2fx\n",
+                    name.c_str(), raw.size(), cmp, cmp_ctx, cmp / cmp_ctx,
+                    dec, dec_ctx, dec / dec_ctx);
+    }
+    return 0;
+}
+
+int bench_span(const mans::MansParams& params, int iters,
+               const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %12s %12s %8s %12s %12s %8s\n",
+                "file", "size(B)", "cmp(us)", "cmp+span(us)", "gain",
+                "dec(us)", "dec+span(us)", "gain");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+
+        std::vector<uint8_t> compressed, decompressed;
+        mans::cpu::CompressContext cctx;
+        mans::cpu::DecompressContext dctx;
+
+        // one spare byte in front of each span so both sides run unaligned
+        std::vector<uint8_t> span_out(1 + mans::max_compressed_size(length, params.dtype));
+        std::vector<uint8_t> span_back(1 + length * elem);
+        size_t span_size = 0, span_back_size = 0;
+
+        double cmp = median_us(iters, [&] {
+            mans::compress(raw.data(), length, params, compressed, cctx);
+        });
+        double cmp_span = median_us(iters, [&] {
+            span_size = mans::compress(raw.data(), length, params,
+                                       span_out.data() + 1, span_out.size() - 1, cctx);
+        });
+        double dec = median_us(iters, [&] {
+            mans::decompress(compressed, params, decompressed, dctx);
+        });
+        double dec_span = median_us(iters, [&] {
+            span_back_size = mans::decompress(span_out.data() + 1, span_size, params,
+                                              span_back.data() + 1, span_back.size() - 1, dctx);
+        });
+
+        if (span_size != compressed.size() ||
+            std::memcmp(span_out.data() + 1, compressed.data(), span_size) != 0) {
+            std::cerr << "Span output differs from vector output: " << file << "\n";
+            return 1;
+        }
+        if (span_back_size != length * elem ||
+            std::memcmp(span_back.data() + 1, raw.data(), length * elem) != 0) {
+            std::cerr << "Round trip mismatch: " << file << "\n";
+            return 1;
+        }
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        std::printf("%-40s %10zu %12.1f %12.1f %7.2fx %12.1f %12.1f %7.2fx\n",
+                    name.c_str(), raw.size(), cmp, cmp_span, cmp / cmp_span,
+                    dec, dec_span, dec / dec_span);
+    }
+    return 0;
+}
+
+constexpr size_t kBatchSlices = 64;
+
+int bench_batch(const mans::MansParams& params, int iters,
+                const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %12s %12s %8s %12s %12s %8s\n",
+                "file", "frame(B)", "cmp(us)", "batch(us)", "gain",
+                "dec(us)", "batch(us)", "gain");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        size_t bytes = length * elem;
+        size_t capacity = mans::max_compressed_size(length, params.dtype);
+
+        std::vector<uint8_t> comp(kBatchSlices * capacity), back(kBatchSlices * bytes);
+        std::vector<const void*> in(kBatchSlices, raw.data());
+        std::vector<size_t> lengths(kBatchSlices, length), capacities(kBatchSlices, capacity);
+        std::vector<size_t> comp_sizes(kBatchSlices), back_capacities(kBatchSlices, bytes);
+        std::vector<size_t> back_sizes(kBatchSlices);
+        std::vector<void*> comp_out(kBatchSlices), back_out(kBatchSlices);
+        std::vector<const void*> comp_in(kBatchSlices);
+        for (size_t i = 0; i < kBatchSlices; ++i) {
+            comp_out[i] = comp.data() + i * capacity;
+            comp_in[i] = comp_out[i];
+            back_out[i] = back.data() + i * bytes;
+        }
+
+        mans::cpu::CompressContext cctx;
+        mans::cpu::DecompressContext dctx;
+        std::vector<uint8_t> single(capacity);
+        size_t single_size = 0;
+
+        double cmp = median_us(iters, [&] {
+            for (size_t i = 0; i < kBatchSlices; ++i) {
+                single_size = mans::compress(in[i], length, params, single.data(), capacity, cctx);
+            }
+        });
+        double cmp_batch = median_us(iters, [&] {
+            mans::compress_batch(kBatchSlices, in.data(), lengths.data(), params,
+                                 comp_out.data(), capacities.data(), comp_sizes.data(), cctx);
+        });
+        double dec = median_us(iters, [&] {
+            for (size_t i = 0; i < kBatchSlices; ++i) {
+                mans::decompress(comp_in[i], comp_sizes[i], params, back_out[i], bytes, dctx);
+            }
+        });
+        double dec_batch = median_us(iters, [&] {
+            mans::decompress_batch(kBatchSlices, comp_in.data(), comp_sizes.data(), params,
+                                   back_out.data(), back_capacities.data(), back_sizes.data(), dctx);
+        });
+
+        for (size_t i = 0; i < kBatchSlices; ++i) {
+            if (comp_sizes[i] != single_size ||
+                std::memcmp(comp_out[i], single.data(), single_size) != 0) {
+                std::cerr << "Batch output differs from single output: " << file << "\n";
+                return 1;
+            }
+            if (back_sizes[i] != bytes || std::memcmp(back_out[i], raw.data(), bytes) != 0) {
+                std::cerr << "Round trip mismatch: " << file << "\n";
+                return 1;
+            }
+        }
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        std::printf("%-40s %10zu %12.1f %12.1f %7.2fx %12.1f %12.1f %7.2fx\n",
+                    name.c_str(), kBatchSlices * bytes, cmp, cmp_batch, cmp / cmp_batch,
+                    dec, dec_batch, dec / dec_batch);
+    }
+    return 0;
+}
+
+constexpr int kConcurrentCalls = 4;
+
+// Stand-in for an application's own thread pool: a FIFO served by fixed
+// threads, reached only through submit()
+class CallerPool {
+public:
+    explicit CallerPool(int n) {
+        for (int i = 0; i < n; ++i) {
+            threads_.emplace_back([this] {
+                for (;;) {
+                    std::function<void()> fn;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+                        if (queue_.empty()) return;
+                        fn = std::move(queue_.front());
+                        queue_.pop_front();
+                    }
+                    fn();
+                }
+            });
+        }
+    }
+    ~CallerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+    void submit(std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(std::move(fn));
+        }
+        cv_.notify_one();
+    }
+private:
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> queue_;
+    bool stop_ = false;
+};
+
+int bench_threads(const mans::MansParams& base, int iters,
+                  const std::vector<std::string>& files) {
+    // at least a few workers so the parallel paths run even on small hosts
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    int pool_size = std::max(4, hw);
+    mans::ThreadPool pool(pool_size);
+    CallerPool caller(pool_size - 1);
+    mans::SubmitExecutor adapter(pool_size, [&caller](std::function<void()> fn) {
+        caller.submit(std::move(fn));
+    });
+
+    std::printf("%-40s %10s %-14s %12s %12s\n", "file", "size(B)", "executor", "cmp(us)", "dec(us)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        std::vector<uint8_t> reference;
+        auto run = [&](const std::string& label, mans::Executor* executor, uint32_t budget) {
+            mans::MansParams params = base;
+            params.executor = executor;
+            params.num_threads = budget;
+            std::vector<uint8_t> compressed, decompressed;
+            mans::cpu::CompressContext cctx;
+            mans::cpu::DecompressContext dctx;
+            double cmp = median_us(iters, [&] {
+                mans::compress(raw.data(), length, params, compressed, cctx);
+            });
+            double dec = median_us(iters, [&] {
+                mans::decompress(compressed, params, decompressed, dctx);
+            });
+            if (reference.empty()) reference = compressed;
+            if (compressed != reference || decompressed.size() != length * elem ||
+                std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                std::cerr << "Output of " << label << " differs: " << file << "\n";
+                return false;
+            }
+            std::printf("%-40s %10zu %-14s %12.1f %12.1f\n",
+                        name.c_str(), raw.size(), label.c_str(), cmp, dec);
+            return true;
+        };
+
+        for (int budget = 1; budget < pool_size; budget *= 2) {
+            if (!run("pool/" + std::to_string(budget), &pool, budget)) return 1;
+        }
+        if (!run("pool/" + std::to_string(pool_size), &pool, 0)) return 1;
+        if (!run("adapter", &adapter, 0)) return 1;
+
+        // concurrent callers, each with an equal share of the pool
+        mans::MansParams params = base;
+        params.executor = &pool;
+        params.num_threads = std::max(1, pool_size / kConcurrentCalls);
+        bool ok = true;
+        double conc = median_us(iters, [&] {
+            std::vector<std::thread> callers;
+            for (int c = 0; c < kConcurrentCalls; ++c) {
+                callers.emplace_back([&] {
+                    std::vector<uint8_t> compressed;
+                    mans::compress(raw.data(), length, params, compressed);
+                    if (compressed != reference) ok = false;
+                });
+            }
+            for (auto& t : callers) t.join();
+        });
+        if (!ok) {
+            std::cerr << "Concurrent output differs: " << file << "\n";
+            return 1;
+        }
+        std::printf("%-40s %10zu %-14s %12.1f %12s\n", name.c_str(), raw.size(),
+                    (std::to_string(kConcurrentCalls) + "x shared").c_str(), conc, "-");
+    }
+    return 0;
+}
+
+int bench_affinity(const mans::MansParams& params, int iters,
+                   const std::vector<std::string>& files) {
+    std::printf("allowed_cpus=%zu cgroup_quota=%.2f usable_cpus=%d pool_threads=%d pinned=%s\n",
+                mans::allowed_cpus().size(), mans::cgroup_cpu_quota(), mans::usable_cpus(),
+                mans::default_executor().concurrency(),
+                mans::default_pin_cpus().empty() ? "no" : "yes");
+    std::printf("%-40s %10s %12s %12s\n", "file", "size(B)", "cmp(MB/s)", "dec(MB/s)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+
+        std::vector<uint8_t> compressed, decompressed;
+        mans::cpu::CompressContext cctx;
+        mans::cpu::DecompressContext dctx;
+        double cmp = median_us(iters, [&] {
+            mans::compress(raw.data(), length, params, compressed, cctx);
+        });
+        double dec = median_us(iters, [&] {
+            mans::decompress(compressed, params, decompressed, dctx);
+        });
+        if (decompressed.size() != length * elem ||
+            std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+            std::cerr << "Round trip mismatch: " << file << "\n";
+            return 1;
+        }
+
+        std::string name = file.substr(file.find_last_of('/') + 1);
+        std::printf("%-40s %10zu %12.1f %12.1f\n", name.c_str(), raw.size(),
+                    raw.size() / cmp, raw.size() / dec);
+    }
+    return 0;
+}
+
+int bench_isa(const mans::MansParams& params, int iters,
+              const std::vector<std::string>& files) {
+    const mans::Isa initial = mans::active_isa();
+    const mans::Isa detected = mans::detected_isa();
+    std::printf("detected=%s active=%s\n", mans::isa_name(detected), mans::isa_name(initial));
+    std::printf("%-40s %10s %-8s %12s %12s\n", "file", "size(B)", "isa", "cmp(MB/s)", "dec(MB/s)");
+    int status = 0;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            status = 1;
+            break;
+        }
+        size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        std::vector<uint8_t> reference;
+        for (mans::Isa isa : {mans::Isa::Scalar, mans::Isa::Sse42, mans::Isa::Avx2, mans::Isa::Avx512}) {
+            if (isa > detected) break;
+            mans::force_isa(isa);
+            std::vector<uint8_t> compressed, decompressed;
+            mans::cpu::CompressContext cctx;
+            mans::cpu::DecompressContext dctx;
+            double cmp = median_us(iters, [&] {
+                mans::compress(raw.data(), length, params, compressed, cctx);
+            });
+            double dec = median_us(iters, [&] {
+                mans::decompress(compressed, params, decompressed, dctx);
+            });
+            if (reference.empty()) reference = compressed;
+            if (compressed != reference) {
+                std::cerr << "Stream differs from scalar with " << mans::isa_name(isa) << ": " << file << "\n";
+                status = 1;
+            }
+            if (decompressed.size() != length * elem ||
+                std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                std::cerr << "Round trip mismatch with " << mans::isa_name(isa) << ": " << file << "\n";
+                status = 1;
+            }
+            std::printf("%-40s %10zu %-8s %12.1f %12.1f\n", name.c_str(), raw.size(),
+                        mans::isa_name(isa), raw.size() / cmp, raw.size() / dec);
+        }
+        if (status != 0) break;
+    }
+    mans::force_isa(initial);
+    return status;
+}
+
+int bench_precision(const mans::MansParams& base, int iters,
+                    const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %-6s %5s %8s %12s %12s\n", "file", "size(B)", "param", "bits",
+                "ratio", "cmp(MB/s)", "dec(MB/s)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        for (uint32_t precision = mans::Precision::Min; precision <= mans::Precision::Max + 1; ++precision) {
+            mans::MansParams params = base;
+            params.precision = precision <= mans::Precision::Max ? precision : mans::Precision::Auto;
+            std::vector<uint8_t> compressed, decompressed;
+            mans::cpu::CompressContext cctx;
+            mans::cpu::DecompressContext dctx;
+            double cmp = median_us(iters, [&] {
+                mans::compress(raw.data(), length, params, compressed, cctx);
+            });
+            double dec = median_us(iters, [&] {
+                mans::decompress(compressed, params, decompressed, dctx);
+            });
+            if (decompressed.size() != length * elem ||
+                std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                std::cerr << "Round trip mismatch at precision " << precision << ": " << file << "\n";
+                return 1;
+            }
+            std::string label = params.precision == mans::Precision::Auto
+                ? "auto" : std::to_string(params.precision);
+            std::printf("%-40s %10zu %-6s %5u %8.3f %12.1f %12.1f\n", name.c_str(), raw.size(),
+                        label.c_str(), mans::stream_precision(compressed.data(), compressed.size()),
+                        double(raw.size()) / compressed.size(), raw.size() / cmp, raw.size() / dec);
+        }
+    }
+    return 0;
+}
+
+int bench_block_size(const mans::MansParams& base, int iters,
+                     const std::vector<std::string>& files) {
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    int pool_size = std::max(4, hw);
+    mans::ThreadPool pool(pool_size);
+
+    std::printf("%-40s %10s %7s %7s %8s %12s %12s\n", "file", "size(B)", "block", "threads",
+                "ratio", "cmp(MB/s)", "dec(MB/s)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        for (uint32_t block = mans::BlockSize::Min; block <= mans::BlockSize::Max; block *= 2) {
+            for (int budget = 1; budget <= pool_size; budget *= 2) {
+                mans::MansParams params = base;
+                params.executor = &pool;
+                params.num_threads = budget;
+                params.block_size = block;
+                std::vector<uint8_t> compressed, decompressed;
+                mans::cpu::CompressContext cctx;
+                mans::cpu::DecompressContext dctx;
+                double cmp = median_us(iters, [&] {
+                    mans::compress(raw.data(), length, params, compressed, cctx);
+                });
+                double dec = median_us(iters, [&] {
+                    mans::decompress(compressed, params, decompressed, dctx);
+                });
+                if (decompressed.size() != length * elem ||
+                    std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                    std::cerr << "Round trip mismatch at block size " << block << ": " << file << "\n";
+                    return 1;
+                }
+                std::printf("%-40s %10zu %7u %7d %8.3f %12.1f %12.1f\n", name.c_str(), raw.size(),
+                            block, budget, double(raw.size()) / compressed.size(),
+                            raw.size() / cmp, raw.size() / dec);
+            }
+        }
+    }
+    return 0;
+}
+
+int bench_segments(const mans::MansParams& base, int iters,
+                   const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %8s %6s %8s %12s %12s\n", "file", "size(B)", "segment", "tables",
+                "ratio", "cmp(MB/s)", "dec(MB/s)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        for (uint32_t segment = mans::SegmentSize::Min / 2; segment <= (16u << 20); segment *= 2) {
+            mans::MansParams params = base;
+            params.segment_size = segment < mans::SegmentSize::Min ? mans::SegmentSize::Off : segment;
+            std::vector<uint8_t> compressed, decompressed;
+            mans::cpu::CompressContext cctx;
+            mans::cpu::DecompressContext dctx;
+            double cmp = median_us(iters, [&] {
+                mans::compress(raw.data(), length, params, compressed, cctx);
+            });
+            double dec = median_us(iters, [&] {
+                mans::decompress(compressed, params, decompressed, dctx);
+            });
+            if (decompressed.size() != length * elem ||
+                std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                std::cerr << "Round trip mismatch at segment size " << segment << ": " << file << "\n";
+                return 1;
+            }
+            std::string label = params.segment_size == mans::SegmentSize::Off
+                ? "off" : std::to_string(params.segment_size >> 10) + "K";
+            std::printf("%-40s %10zu %8s %6u %8.3f %12.1f %12.1f\n", name.c_str(), raw.size(),
+                        label.c_str(), mans::stream_num_tables(compressed.data(), compressed.size()),
+                        double(raw.size()) / compressed.size(), raw.size() / cmp, raw.size() / dec);
+            if (segment >= raw.size()) break;
+        }
+    }
+    return 0;
+}
+
+constexpr size_t kDictionaryMinSlice = size_t(4) << 10;
+constexpr size_t kDictionaryMaxSlice = size_t(64) << 10;
+
+int bench_dictionary(const mans::MansParams& base, int iters,
+                     const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+
+    std::printf("%10s %7s %10s %8s %8s %12s %12s\n", "slice(B)", "slices", "dictionary",
+                "used", "ratio", "cmp(MB/s)", "dec(MB/s)");
+    for (size_t slice = kDictionaryMinSlice; slice <= kDictionaryMaxSlice; slice *= 4) {
+        // even slices train, odd slices are measured
+        std::vector<const void*> train, eval;
+        std::vector<size_t> train_lengths, eval_lengths;
+        for (size_t off = 0, i = 0; off + slice <= pattern.size(); off += slice, ++i) {
+            (i % 2 == 0 ? train : eval).push_back(pattern.data() + off);
+            (i % 2 == 0 ? train_lengths : eval_lengths).push_back(slice / elem);
+        }
+        if (eval.empty()) break;
+        std::vector<uint8_t> dictionary = mans::train_dictionary(
+            train.size(), train.data(), train_lengths.data(), base);
+        const uint32_t id = mans::load_dictionary(dictionary.data(), dictionary.size());
+
+        const size_t num = eval.size();
+        const size_t capacity = mans::max_compressed_size(slice / elem, base.dtype);
+        std::vector<uint8_t> compressed(num * capacity), decompressed(num * slice);
+        std::vector<size_t> sizes(num);
+        mans::cpu::CompressContext cctx;
+        mans::cpu::DecompressContext dctx;
+        for (uint32_t dict : {0u, id}) {
+            mans::MansParams params = base;
+            params.dictionary = dict;
+            double cmp = median_us(iters, [&] {
+                for (size_t i = 0; i < num; ++i) {
+                    sizes[i] = mans::compress(eval[i], eval_lengths[i], params,
+                                              compressed.data() + i * capacity, capacity, cctx);
+                }
+            });
+            double dec = median_us(iters, [&] {
+                for (size_t i = 0; i < num; ++i) {
+                    mans::decompress(compressed.data() + i * capacity, sizes[i], params,
+                                     decompressed.data() + i * slice, slice, dctx);
+                }
+            });
+            size_t total = 0, used = 0;
+            for (size_t i = 0; i < num; ++i) {
+                if (std::memcmp(decompressed.data() + i * slice, eval[i], slice) != 0) {
+                    std::cerr << "Round trip mismatch at slice size " << slice << "\n";
+                    return 1;
+                }
+                total += sizes[i];
+                used += mans::stream_dictionary(compressed.data() + i * capacity, sizes[i]) != 0;
+            }
+            double bytes = double(num) * slice;
+            std::printf("%10zu %7zu %10s %7.0f%% %8.3f %12.1f %12.1f\n", slice, num,
+                        dict ? "on" : "off", 100.0 * used / num, bytes / total, bytes / cmp,
+                        bytes / dec);
+        }
+    }
+    return 0;
+}
+
+constexpr size_t kCompactMinSlice = 512;
+constexpr size_t kCompactMaxSlice = size_t(256) << 10;
+
+int bench_compact(const mans::MansParams& base, int iters,
+                  const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+
+    std::printf("%10s %7s %12s %8s %12s %12s\n", "slice(B)", "slices", "stream(B)", "ratio",
+                "cmp(MB/s)", "dec(MB/s)");
+    for (size_t slice = kCompactMinSlice; slice <= kCompactMaxSlice; slice *= 2) {
+        const size_t num = pattern.size() / slice;
+        if (num == 0) break;
+        const size_t capacity = mans::max_compressed_size(slice / elem, base.dtype);
+        std::vector<uint8_t> compressed(num * capacity), decompressed(num * slice);
+        std::vector<size_t> sizes(num);
+        mans::cpu::CompressContext cctx;
+        mans::cpu::DecompressContext dctx;
+        double cmp = median_us(iters, [&] {
+            for (size_t i = 0; i < num; ++i) {
+                sizes[i] = mans::compress(pattern.data() + i * slice, slice / elem, base,
+                                          compressed.data() + i * capacity, capacity, cctx);
+            }
+        });
+        double dec = median_us(iters, [&] {
+            for (size_t i = 0; i < num; ++i) {
+                mans::decompress(compressed.data() + i * capacity, sizes[i], base,
+                                 decompressed.data() + i * slice, slice, dctx);
+            }
+        });
+        if (std::memcmp(decompressed.data(), pattern.data(), num * slice) != 0) {
+            std::cerr << "Round trip mismatch at slice size " << slice << "\n";
+            return 1;
+        }
+        size_t total = 0;
+        for (size_t i = 0; i < num; ++i) total += sizes[i];
+        double bytes = double(num) * slice;
+        std::printf("%10zu %7zu %12.1f %8.3f %12.1f %12.1f\n", slice, num, double(total) / num,
+                    bytes / total, bytes / cmp, bytes / dec);
+    }
+    return 0;
+}
+
+int bench_stored(const mans::MansParams& params, int iters,
+                 const std::vector<std::string>& files) {
+    std::printf("%-40s %-6s %10s %12s %8s %12s %12s %12s\n", "file", "input", "size(B)",
+                "stream(B)", "ratio", "cmp(MB/s)", "dec(MB/s)", "copy(MB/s)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        std::vector<uint8_t> noise(raw.size()), constant(raw.size(), 0x5a);
+        uint64_t x = 0x9e3779b97f4a7c15ull;
+        for (auto& b : noise) {
+            x ^= x << 13;
+            x ^= x >> 7;
+            x ^= x << 17;
+            b = static_cast<uint8_t>(x >> 32);
+        }
+        const std::pair<const char*, const std::vector<uint8_t>*> inputs[] = {
+            {"file", &raw}, {"noise", &noise}, {"const", &constant}};
+        for (const auto& input : inputs) {
+            const std::vector<uint8_t>& data = *input.second;
+            std::vector<uint8_t> compressed, decompressed, copy(data.size());
+            mans::cpu::CompressContext cctx;
+            mans::cpu::DecompressContext dctx;
+            double cmp = median_us(iters, [&] {
+                mans::compress(data.data(), length, params, compressed, cctx);
+            });
+            double dec = median_us(iters, [&] {
+                mans::decompress(compressed, params, decompressed, dctx);
+            });
+            double cpy = median_us(iters, [&] {
+                std::memcpy(copy.data(), data.data(), data.size());
+            });
+            if (decompressed.size() != length * elem ||
+                std::memcmp(decompressed.data(), data.data(), length * elem) != 0) {
+                std::cerr << "Round trip mismatch on " << input.first << ": " << file << "\n";
+                return 1;
+            }
+            std::printf("%-40s %-6s %10zu %12zu %8.3f %12.1f %12.1f %12.1f\n", name.c_str(),
+                        input.first, data.size(), compressed.size(),
+                        double(data.size()) / compressed.size(), data.size() / cmp,
+                        data.size() / dec, data.size() / cpy);
+        }
+    }
+    return 0;
+}
+
+int bench_coder(const mans::MansParams& base, int iters,
+                const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %-9s %7s %8s %12s %12s\n", "file", "size(B)", "coder", "threads",
+                "ratio", "cmp(MB/s)", "dec(MB/s)");
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        // one thread shows the kernels, the whole pool the call
+        for (uint32_t threads : {1u, 0u}) {
+            for (uint32_t coder : {mans::Coder::Portable, mans::Coder::Wide}) {
+                mans::MansParams params = base;
+                params.coder = coder;
+                params.num_threads = threads;
+                std::vector<uint8_t> compressed, decompressed;
+                mans::cpu::CompressContext cctx;
+                mans::cpu::DecompressContext dctx;
+                double cmp = median_us(iters, [&] {
+                    mans::compress(raw.data(), length, params, compressed, cctx);
+                });
+                double dec = median_us(iters, [&] {
+                    mans::decompress(compressed, params, decompressed, dctx);
+                });
+                if (decompressed.size() != length * elem ||
+                    std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                    std::cerr << "Round trip mismatch with coder " << coder << ": " << file << "\n";
+                    return 1;
+                }
+                std::string label = threads == 0 ? "all" : std::to_string(threads);
+                std::printf("%-40s %10zu %-9s %7s %8.3f %12.1f %12.1f\n", name.c_str(), raw.size(),
+                            coder == mans::Coder::Wide ? "wide" : "portable", label.c_str(),
+                            double(raw.size()) / compressed.size(), raw.size() / cmp,
+                            raw.size() / dec);
+            }
+        }
+    }
+    return 0;
+}
+
+int bench_checksum(const mans::MansParams& base, int iters,
+                   const std::vector<std::string>& files) {
+    std::printf("%-40s %10s %-9s %7s %8s %12s %12s %12s %12s\n", "file", "size(B)", "checksum",
+                "threads", "ratio", "cmp(MB/s)", "dec(MB/s)", "verify(MB/s)", "dec+crc(MB/s)");
+    const cpu_ans::ANSChecksumFn crc = cpu_ans::selectChecksum();
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+        size_t length = raw.size() / elem;
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        for (uint32_t threads : {1u, 0u}) {
+            for (uint32_t checksum : {mans::Checksum::Off, mans::Checksum::On}) {
+                mans::MansParams params = base;
+                params.checksum = checksum;
+                params.num_threads = threads;
+                std::vector<uint8_t> compressed, decompressed;
+                std::vector<uint32_t> bad_blocks;
+                mans::cpu::CompressContext cctx;
+                mans::cpu::DecompressContext dctx;
+                double cmp = median_us(iters, [&] {
+                    mans::compress(raw.data(), length, params, compressed, cctx);
+                });
+                double dec = median_us(iters, [&] {
+                    mans::decompress(compressed, params, decompressed, dctx);
+                });
+                if (decompressed.size() != length * elem ||
+                    std::memcmp(decompressed.data(), raw.data(), length * elem) != 0) {
+                    std::cerr << "Round trip mismatch with checksum " << checksum << ": " << file << "\n";
+                    return 1;
+                }
+                // the reference a whole-output checksum costs on top of decompress
+                uint32_t sink = 0;
+                double dec_crc = median_us(iters, [&] {
+                    mans::decompress(compressed, params, decompressed, dctx);
+                    sink ^= crc(decompressed.data(), decompressed.size());
+                });
+                double verify = 0.0;
+                if (checksum == mans::Checksum::On) {
+                    verify = median_us(iters, [&] {
+                        mans::verify(compressed.data(), compressed.size(), params, bad_blocks, dctx);
+                    });
+                    if (!mans::verify(compressed.data(), compressed.size(), params, bad_blocks, dctx) ||
+                        !bad_blocks.empty()) {
+                        std::cerr << "Verify failed on an intact frame: " << file << "\n";
+                        return 1;
+                    }
+                }
+                std::string label = threads == 0 ? "all" : std::to_string(threads);
+                std::printf("%-40s %10zu %-9s %7s %8.3f %12.1f %12.1f %12.1f %12.1f%s\n", name.c_str(),
+                            raw.size(), checksum == mans::Checksum::On ? "on" : "off", label.c_str(),
+                            double(raw.size()) / compressed.size(), raw.size() / cmp,
+                            raw.size() / dec, verify > 0 ? raw.size() / verify : 0.0,
+                            raw.size() / dec_crc, sink == 1 ? " " : "");
+            }
+        }
+    }
+    return 0;
+}
+
+// Hardware event counter of the calling thread, user space only; not
+// available in most VMs or with kernel.perf_event_paranoid above 2
+class ThreadCounter {
+public:
+    ThreadCounter(uint32_t type, uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+    ~ThreadCounter() {
+        if (fd_ >= 0) close(fd_);
+    }
+    ThreadCounter(const ThreadCounter&) = delete;
+    ThreadCounter& operator=(const ThreadCounter&) = delete;
+
+    bool available() const { return fd_ >= 0; }
+    void start() {
+        if (fd_ < 0) return;
+        ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    // events since start()
+    uint64_t stop() {
+        uint64_t value = 0;
+        if (fd_ < 0) return value;
+        ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd_, &value, sizeof(value)) != sizeof(value)) value = 0;
+        return value;
+    }
+
+private:
+    int fd_ = -1;
+};
+
+constexpr size_t kLookupSlice = size_t(4) << 10;
+
+int bench_lookup(int iters, const std::vector<std::string>& files) {
+    const mans::Isa initial = mans::active_isa();
+    const mans::Isa detected = mans::detected_isa();
+    const mans::Parallel par = mans::Parallel().serial();
+    ThreadCounter l1d_misses(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                                                     (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    ThreadCounter instructions(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+    if (!l1d_misses.available() || !instructions.available()) {
+        std::printf("hardware counters not available on this host (perf_event_open)\n");
+    }
+    std::printf("%-40s %-7s %-8s %5s %7s %10s %12s %12s %10s\n", "file", "layout", "isa", "bits",
+                "tables", "table(KiB)", "dec(MB/s)", "L1Dmiss/KiB", "insn/B");
+    PansEncodeScratch encode_scratch;
+    PansDecodeScratch decode_scratch;
+    double duration;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        std::string name = file.substr(file.find_last_of('/') + 1);
+
+        for (const char* layout : {"4k", "file", "seg64k"}) {
+            const bool slices = std::strcmp(layout, "4k") == 0;
+            const size_t piece = slices ? std::min(kLookupSlice, raw.size()) : raw.size();
+            const size_t segment = std::strcmp(layout, "seg64k") == 0 ? kPansMinSegmentSize : kPansNoSegments;
+            for (int precision = (int)mans::Precision::Min; precision <= (int)mans::Precision::Max; ++precision) {
+                // the input cut into pieces, each its own stream
+                std::vector<std::vector<uint8_t>> streams;
+                for (size_t off = 0; off + piece <= raw.size(); off += piece) {
+                    std::vector<uint8_t> stream(pans_max_compressed_size(piece));
+                    stream.resize(pans_compress(raw.data() + off, piece, stream.data(), stream.size(),
+                                                duration, encode_scratch, par, precision,
+                                                kPansDefaultBlockSize, segment));
+                    streams.push_back(std::move(stream));
+                }
+                const size_t bytes = streams.size() * piece;
+                const uint32_t tables = pans_num_tables(streams[0].data(), streams[0].size());
+                std::vector<uint8_t> decoded(piece);
+                for (mans::Isa isa : {mans::Isa::Scalar, mans::Isa::Sse42, mans::Isa::Avx2, mans::Isa::Avx512}) {
+                    if (isa > detected) break;
+                    mans::force_isa(isa);
+                    auto decode_all = [&] {
+                        for (size_t k = 0; k < streams.size(); ++k) {
+                            pans_decompress(streams[k].data(), streams[k].size(), decoded.data(),
+                                            decoded.size(), duration, decode_scratch, par);
+                        }
+                    };
+                    // the last piece is checked; the others go through the same kernels
+                    decode_all();
+                    if (std::memcmp(decoded.data(), raw.data() + (streams.size() - 1) * piece, piece) != 0) {
+                        std::cerr << "Round trip mismatch with " << mans::isa_name(isa)
+                                  << " at precision " << precision << ": " << file << "\n";
+                        mans::force_isa(initial);
+                        return 1;
+                    }
+                    double dec = median_us(std::max(1, iters / (int)std::min<size_t>(streams.size(), 64)),
+                                           decode_all);
+                    l1d_misses.start();
+                    instructions.start();
+                    decode_all();
+                    const uint64_t insn = instructions.stop();
+                    const uint64_t misses = l1d_misses.stop();
+                    char miss_col[32] = "n/a", insn_col[32] = "n/a";
+                    if (l1d_misses.available()) std::snprintf(miss_col, sizeof(miss_col), "%.1f", misses * 1024.0 / bytes);
+                    if (instructions.available()) std::snprintf(insn_col, sizeof(insn_col), "%.2f", double(insn) / bytes);
+                    std::printf("%-40s %-7s %-8s %5d %7u %10.1f %12.1f %12s %10s\n", name.c_str(), layout,
+                                mans::isa_name(isa), precision, tables,
+                                tables * (sizeof(uint32_t) << precision) / 1024.0, bytes / dec,
+                                miss_col, insn_col);
+                }
+            }
+        }
+    }
+    mans::force_isa(initial);
+    return 0;
+}
+
+constexpr size_t kLatencyMinBytes = 512;
+constexpr size_t kLatencyMaxBytes = size_t(256) << 10;
+
+int bench_latency(const mans::MansParams& base, int iters,
+                  const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    while (pattern.size() < kLatencyMaxBytes) {
+        pattern.insert(pattern.end(), pattern.begin(), pattern.end());
+    }
+    size_t elem = base.dtype == mans::DataType::U16 ? 2 : 4;
+    int pool_size = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+    mans::ThreadPool pool(pool_size);
+
+    std::printf("%10s %7s %12s %12s %12s %12s\n", "size(B)", "path", "cmp p50(us)",
+                "cmp p99(us)", "dec p50(us)", "dec p99(us)");
+    for (size_t size = kLatencyMinBytes; size <= kLatencyMaxBytes; size *= 2) {
+        size_t length = size / elem;
+        std::vector<uint8_t> compressed(mans::max_compressed_size(length, base.dtype));
+        std::vector<uint8_t> decompressed(size);
+        size_t compressed_size = 0, decompressed_size = 0;
+        for (uint32_t path : {mans::LowLatency::Off, mans::LowLatency::On}) {
+            mans::MansParams params = base;
+            params.executor = &pool;
+            params.low_latency = path;
+            mans::cpu::CompressContext cctx;
+            mans::cpu::DecompressContext dctx;
+            double cmp50, cmp99, dec50, dec99;
+            percentiles_us(iters, [&] {
+                compressed_size = mans::compress(pattern.data(), length, params,
+                                                 compressed.data(), compressed.size(), cctx);
+            }, cmp50, cmp99);
+            percentiles_us(iters, [&] {
+                decompressed_size = mans::decompress(compressed.data(), compressed_size, params,
+                                                     decompressed.data(), decompressed.size(), dctx);
+            }, dec50, dec99);
+            if (decompressed_size != size || std::memcmp(decompressed.data(), pattern.data(), size) != 0) {
+                std::cerr << "Round trip mismatch at " << size << " bytes\n";
+                return 1;
+            }
+            std::printf("%10zu %7s %12.1f %12.1f %12.1f %12.1f\n", size,
+                        path == mans::LowLatency::On ? "serial" : "pool", cmp50, cmp99, dec50, dec99);
+        }
+    }
+    return 0;
+}
+
+constexpr size_t kLargeFrameBytes = size_t(1) << 30;
+
+int bench_large(const mans::MansParams& params, int iters,
+                const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+    size_t length = kLargeFrameBytes / elem;
+    std::vector<uint8_t> raw(length * elem);
+    for (size_t off = 0; off < raw.size(); off += pattern.size()) {
+        std::memcpy(raw.data() + off, pattern.data(), std::min(pattern.size(), raw.size() - off));
+    }
+    // every caller buffer is touched before the first call
+    std::vector<uint8_t> compressed(mans::max_compressed_size(length, params.dtype), 0);
+    std::vector<uint8_t> decompressed(raw.size(), 0);
+    size_t compressed_size = 0, decompressed_size = 0;
+    mans::cpu::CompressContext cctx;
+    mans::cpu::DecompressContext dctx;
+    iters = std::min(iters, 5);
+
+    double base = peak_rss_mib();
+    double cmp = median_us(iters, [&] {
+        compressed_size = mans::compress(raw.data(), length, params,
+                                         compressed.data(), compressed.size(), cctx);
+    });
+    double cmp_rss = peak_rss_mib() - base;
+    base = peak_rss_mib();
+    double dec = median_us(iters, [&] {
+        decompressed_size = mans::decompress(compressed.data(), compressed_size, params,
+                                             decompressed.data(), decompressed.size(), dctx);
+    });
+    double dec_rss = peak_rss_mib() - base;
+    if (decompressed_size != raw.size() || decompressed != raw) {
+        std::cerr << "Round trip mismatch on the large frame\n";
+        return 1;
+    }
+
+    std::printf("%12s %8s %12s %14s %12s %14s\n", "size(B)", "ratio", "cmp(MB/s)",
+                "cmp +RSS(MiB)", "dec(MB/s)", "dec +RSS(MiB)");
+    std::printf("%12zu %8.3f %12.1f %14.1f %12.1f %14.1f\n", raw.size(),
+                double(raw.size()) / compressed_size, raw.size() / cmp, cmp_rss,
+                raw.size() / dec, dec_rss);
+    return 0;
+}
+
+constexpr size_t kRangeMaxFrameBytes = size_t(256) << 20;
+constexpr size_t kRangeMaxWindowBytes = size_t(1) << 20;
+
+int bench_range(const mans::MansParams& params, int iters, const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    size_t elem = params.dtype == mans::DataType::U16 ? 2 : 4;
+    std::vector<uint8_t> raw(kRangeMaxFrameBytes);
+    for (size_t off = 0; off < raw.size(); off += pattern.size()) {
+        std::memcpy(raw.data() + off, pattern.data(), std::min(pattern.size(), raw.size() - off));
+    }
+    std::vector<uint8_t> compressed, decompressed(raw.size()), window(kRangeMaxWindowBytes);
+    mans::cpu::CompressContext cctx;
+    mans::cpu::DecompressContext dctx;
+
+    std::printf("%12s %8s %12s %12s %12s %10s\n", "frame(B)", "ratio", "window(B)", "full(us)",
+                "range(us)", "speedup");
+    for (size_t frame = size_t(1) << 20; frame <= kRangeMaxFrameBytes; frame *= 16) {
+        const size_t length = frame / elem;
+        mans::compress(raw.data(), length, params, compressed, cctx);
+        double full = median_us(std::max(1, std::min(iters, int(kRangeMaxFrameBytes / frame))), [&] {
+            mans::decompress(compressed.data(), compressed.size(), params, decompressed.data(),
+                             decompressed.size(), dctx);
+        });
+        for (size_t bytes = size_t(1) << 10; bytes <= std::min(kRangeMaxWindowBytes, frame); bytes *= 32) {
+            const size_t count = bytes / elem;
+            // windows spread over the frame, each checked against the input
+            uint64_t seed = 1;
+            size_t first = 0;
+            size_t written = 0;
+            auto next_first = [&] {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                first = (seed >> 17) % (length - count + 1);
+            };
+            double range = median_us(iters, [&] {
+                next_first();
+                written = mans::decompress_range(compressed.data(), compressed.size(), first, count,
+                                                 params, window.data(), window.size(), dctx);
+            });
+            if (written != bytes || std::memcmp(window.data(), raw.data() + first * elem, bytes) != 0) {
+                std::cerr << "Range mismatch at element " << first << " of a " << frame << " byte frame\n";
+                return 1;
+            }
+            std::printf("%12zu %8.3f %12zu %12.1f %12.1f %10.1f\n", frame,
+                        double(frame) / compressed.size(), bytes, full, range, full / range);
+        }
+    }
+    return 0;
+}
+
+constexpr size_t kHistogramMinBytes = size_t(4) << 10;
+constexpr size_t kHistogramMaxBytes = size_t(4) << 30;
+
+int bench_histogram(int iters, const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    // the largest size that can be allocated here, halving from 4 GiB
+    size_t max_bytes = kHistogramMaxBytes;
+    std::unique_ptr<uint8_t[]> data;
+    while (!data && max_bytes >= kHistogramMinBytes) {
+        data.reset(new (std::nothrow) uint8_t[max_bytes]);
+        if (!data) max_bytes /= 2;
+    }
+    if (!data) {
+        std::cerr << "Failed to allocate the histogram input\n";
+        return 1;
+    }
+    for (size_t off = 0; off < max_bytes; off += pattern.size()) {
+        std::memcpy(data.get() + off, pattern.data(), std::min(pattern.size(), max_bytes - off));
+    }
+
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    int pool_size = std::max(4, hw);
+    mans::ThreadPool pool(pool_size);
+
+    std::printf("%12s %7s %12s %12s\n", "size(B)", "threads", "hist(MB/s)", "plain(MB/s)");
+    uint64_t counts[256], reference[256];
+    for (size_t size = kHistogramMinBytes; size <= max_bytes; size *= 4) {
+        // about 4 GiB counted per configuration
+        int size_iters = static_cast<int>(std::max<size_t>(
+            1, std::min<size_t>(iters, kHistogramMaxBytes / size)));
+        double plain = median_us(size_iters, [&] {
+            std::fill(reference, reference + 256, 0);
+            for (size_t i = 0; i < size; ++i) ++reference[data[i]];
+        });
+        for (int budget = 1; budget <= pool_size; budget *= 2) {
+            mans::Parallel par(pool, budget);
+            double hist = median_us(size_iters, [&] {
+                pans_histogram(data.get(), size, counts, par);
+            });
+            if (!std::equal(counts, counts + 256, reference)) {
+                std::cerr << "Histogram mismatch at " << size << " bytes, " << budget << " threads\n";
+                return 1;
+            }
+            std::printf("%12zu %7d %12.1f %12.1f\n", size, budget, size / hist, size / plain);
+        }
+    }
+    return 0;
+}
+
+constexpr size_t kScalingMinBytes = size_t(64) << 10;
+constexpr size_t kScalingMaxBytes = size_t(4) << 30;
+
+int bench_scaling(int iters, const std::vector<std::string>& files) {
+    std::vector<uint8_t> pattern;
+    for (const auto& file : files) {
+        std::vector<uint8_t> raw;
+        if (!load_u8_file(file, raw) || raw.empty()) {
+            std::cerr << "Failed to load input file: " << file << "\n";
+            return 1;
+        }
+        pattern.insert(pattern.end(), raw.begin(), raw.end());
+    }
+    // the largest size whose input, stream and output fit in half the RAM,
+    // halving from 4 GiB
+    const size_t ram = static_cast<size_t>(sysconf(_SC_PHYS_PAGES)) * sysconf(_SC_PAGESIZE);
+    size_t max_bytes = kScalingMaxBytes;
+    while (max_bytes > kScalingMinBytes &&
+           2 * max_bytes + pans_max_compressed_size(max_bytes) > ram / 2) {
+        max_bytes /= 2;
+    }
+    std::unique_ptr<uint8_t[]> data(new (std::nothrow) uint8_t[max_bytes]);
+    std::unique_ptr<uint8_t[]> stream(new (std::nothrow) uint8_t[pans_max_compressed_size(max_bytes)]);
+    std::unique_ptr<uint8_t[]> decoded(new (std::nothrow) uint8_t[max_bytes]);
+    if (!data || !stream || !decoded) {
+        std::cerr << "Failed to allocate the scaling buffers\n";
+        return 1;
+    }
+    for (size_t off = 0; off < max_bytes; off += pattern.size()) {
+        std::memcpy(data.get() + off, pattern.data(), std::min(pattern.size(), max_bytes - off));
+    }
+
+    int hw = static_cast<int>(std::thread::hardware_concurrency());
+    int pool_size = std::max(4, hw);
+    mans::ThreadPool pool(pool_size);
+    PansEncodeScratch encode_scratch;
+    PansDecodeScratch decode_scratch;
+    double duration;
+
+    std::printf("%12s %7s %12s %12s %9s %9s\n", "size(B)", "threads", "comp(MB/s)", "dec(MB/s)",
+                "comp(x)", "dec(x)");
+    std::vector<uint8_t> reference;
+    for (size_t size = kScalingMinBytes; size <= max_bytes; size *= 4) {
+        // about 1 GiB coded per configuration
+        int size_iters = static_cast<int>(std::max<size_t>(
+            1, std::min<size_t>(iters, (size_t(1) << 30) / size)));
+        const size_t capacity = pans_max_compressed_size(size);
+        size_t stream_size = 0;
+        double comp_one = 0, dec_one = 0;
+        for (int budget = 1; budget <= pool_size; budget *= 2) {
+            mans::Parallel par(pool, budget);
+            double comp = median_us(size_iters, [&] {
+                stream_size = pans_compress(data.get(), size, stream.get(), capacity, duration,
+                                            encode_scratch, par);
+            });
+            // every budget must write the stream of budget 1
+            if (budget == 1) {
+                reference.assign(stream.get(), stream.get() + stream_size);
+            } else if (stream_size != reference.size() ||
+                       std::memcmp(stream.get(), reference.data(), stream_size) != 0) {
+                std::cerr << "Stream mismatch at " << size << " bytes, " << budget << " threads\n";
+                return 1;
+            }
+            size_t decoded_size = 0;
+            double dec = median_us(size_iters, [&] {
+                decoded_size = pans_decompress(stream.get(), stream_size, decoded.get(), size,
+                                               duration, decode_scratch, par);
+            });
+            if (decoded_size != size || std::memcmp(decoded.get(), data.get(), size) != 0) {
+                std::cerr << "Round trip mismatch at " << size << " bytes, " << budget << " threads\n";
+                return 1;
+            }
+            if (budget == 1) {
+                comp_one = comp;
+                dec_one = dec;
+            }
+            std::printf("%12zu %7d %12.1f %12.1f %9.2f %9.2f\n", size, budget, size / comp, size / dec,
+                        comp_one / comp, dec_one / dec);
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 4) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    std::string mode      = argv[1];
+    std::string dtype_str = argv[2];
+
+    mans::MansParams params{};
+    params.backend = mans::Backend::CPU;
+    if (dtype_str == "u2" || dtype_str == "-u2") {
+        params.dtype = mans::DataType::U16;
+    } else if (dtype_str == "u4" || dtype_str == "-u4") {
+        params.dtype = mans::DataType::U32;
+    } else {
+        std::cerr << "Unknown data type flag: " << dtype_str << "\nUse: u2 or u4\n";
+        return 1;
+    }
+
+    int arg = 3;
+    int iters = 200;
+    if (arg < argc && std::all_of(argv[arg], argv[arg] + std::strlen(argv[arg]), ::isdigit)) {
+        iters = std::max(1, std::stoi(argv[arg++]));
+    }
+    std::vector<std::string> files(argv + arg, argv + argc);
+    if (files.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (mode == "context") {
+        return bench_context(params, iters, files);
+    }
+    if (mode == "span") {
+        return bench_span(params, iters, files);
+    }
+    if (mode == "batch") {
+        return bench_batch(params, iters, files);
+    }
+    if (mode == "threads") {
+        return bench_threads(params, iters, files);
+    }
+    if (mode == "affinity") {
+        return bench_affinity(params, iters, files);
+    }
+    if (mode == "isa") {
+        return bench_isa(params, iters, files);
+    }
+    if (mode == "precision") {
+        return bench_precision(params, iters, files);
+    }
+    if (mode == "blocksize") {
+        return bench_block_size(params, iters, files);
+    }
+    if (mode == "segments") {
+        return bench_segments(params, iters, files);
+    }
+    if (mode == "dictionary") {
+        return bench_dictionary(params, iters, files);
+    }
+    if (mode == "compact") {
+        return bench_compact(params, iters, files);
+    }
+    if (mode == "stored") {
+        return bench_stored(params, iters, files);
+    }
+    if (mode == "coder") {
+        return bench_coder(params, iters, files);
+    }
+    if (mode == "checksum") {
+        return bench_checksum(params, iters, files);
+    }
+    if (mode == "lookup") {
+        return bench_lookup(iters, files);
+    }
+    if (mode == "latency") {
+        return bench_latency(params, iters, files);
+    }
+    if (mode == "large") {
+        return bench_large(params, iters, files);
+    }
+    if (mode == "histogram") {
+        return bench_histogram(iters, files);
+    }
+    if (mode == "range") {
+        return bench_range(params, iters, files);
+    }
+    if (mode == "scaling") {
+        return bench_scaling(iters, files);
+    }
+
+    std::cerr << "Unknown mode: " << mode << "\n";
+    print_usage(argv[0]);
+    return 1;
+}
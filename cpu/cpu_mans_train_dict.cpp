@@ -0,0 +1,95 @@
+// compiler: g++ -std=c++17 -O3 cpu_mans_train_dict.cpp mans_cpu.cpp -o cpu_mans_train_dict -fopenmp
+// exec    : ./cpu_mans_train_dict u2 out.dict 8192 0 sample1.u2 sample2.u2 ...
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+
+#include "../mans_defs.h"
+#include "mans_cpu.h"
+#include "file_utils.h"
+
+// Cuts every sample file into slices of slice_elems elements, the size the
+// dictionary will be used on, so ADM decides per slice as compress does
+template<typename T>
+static bool collect_slices(const std::vector<std::string>& files, size_t slice_elems,
+                           bool (*load)(const std::string&, std::vector<T>&),
+                           std::vector<std::vector<T>>& samples,
+                           std::vector<const void*>& inputs, std::vector<size_t>& lengths) {
+    samples.resize(files.size());
+    for (size_t f = 0; f < files.size(); ++f) {
+        if (!load(files[f], samples[f])) {
+            std::cerr << "Failed to load sample file: " << files[f] << "\n";
+            return false;
+        }
+        for (size_t i = 0; i < samples[f].size(); i += slice_elems) {
+            inputs.push_back(samples[f].data() + i);
+            lengths.push_back(std::min(slice_elems, samples[f].size() - i));
+        }
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+
+    if (argc < 6) {
+        std::cerr << "Use: " << argv[0]
+                  << " <u2|u4> <output_dict_file> <slice_elements> <id(0: from the table)>"
+                     " <sample_file>... \n";
+        return 1;
+    }
+
+    std::string dtype_str   = argv[1];
+    std::string output_file = argv[2];
+    size_t slice_elems      = std::stoul(argv[3]);
+    uint32_t id             = std::stoul(argv[4]);
+    std::vector<std::string> files(argv + 5, argv + argc);
+    if (slice_elems == 0) {
+        std::cerr << "slice_elements must not be 0\n";
+        return 1;
+    }
+
+    mans::MansParams params{};
+    params.backend = mans::Backend::CPU;
+    params.adm_threshold = 4000;
+
+    std::vector<std::vector<uint16_t>> samples16;
+    std::vector<std::vector<uint32_t>> samples32;
+    std::vector<const void*> inputs;
+    std::vector<size_t> lengths;
+    bool loaded = false;
+    if (dtype_str == "u2" || dtype_str == "-u2") {
+        params.dtype = mans::DataType::U16;
+        loaded = collect_slices(files, slice_elems, &load_u16_file, samples16, inputs, lengths);
+    } else if (dtype_str == "u4" || dtype_str == "-u4") {
+        params.dtype = mans::DataType::U32;
+        loaded = collect_slices(files, slice_elems, &load_u32_file, samples32, inputs, lengths);
+    } else {
+        std::cerr << "Unknown data type flag: " << dtype_str << "\nUse: u2 or u4\n";
+        return 1;
+    }
+    if (!loaded) {
+        return 1;
+    }
+
+    std::vector<uint8_t> dictionary;
+    try {
+        dictionary = mans::cpu::train_dictionary(inputs.size(), inputs.data(), lengths.data(),
+                                                 params, id);
+        id = mans::cpu::load_dictionary(dictionary.data(), dictionary.size());
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    if (!save_u8_file(output_file, dictionary)) {
+        std::cerr << "Failed to write dictionary: " << output_file << "\n";
+        return 1;
+    }
+
+    std::cout << "Dictionary " << id << " trained on " << inputs.size() << " slices of "
+              << files.size() << " files, written to " << output_file << "\n";
+    return 0;
+}
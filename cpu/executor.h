@@ -0,0 +1,283 @@
+#ifndef MANS_EXECUTOR_H
+#define MANS_EXECUTOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "cpu_affinity.h"
+
+namespace mans {
+
+// Where the parallel stages of MANS run. run(n, task) calls task(i) once for
+// every i in [0, n) and returns when all calls have finished; it may run some
+// or all of them on the calling thread. An exception thrown by a task is
+// rethrown from run() after the remaining tasks have completed.
+class Executor {
+public:
+    virtual ~Executor() = default;
+
+    // Number of tasks that can make progress at the same time
+    virtual int concurrency() const = 0;
+
+    virtual void run(int n, const std::function<void(int)>& task) = 0;
+};
+
+namespace detail {
+
+// One run() call. Task indices are claimed from an atomic counter by whoever
+// shows up first: the calling thread always works on its own job, so a job
+// completes even if no helper ever gets scheduled, which is what keeps nested
+// run() calls and saturated caller pools free of deadlocks.
+class Job {
+public:
+    Job(int n, const std::function<void(int)>* task) : n_(n), task_(task) {}
+
+    bool claimed() const { return next_.load(std::memory_order_relaxed) >= n_; }
+
+    void work() {
+        int i;
+        while ((i = next_.fetch_add(1, std::memory_order_relaxed)) < n_) {
+            try {
+                (*task_)(i);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) error_ = std::current_exception();
+            }
+            if (done_.fetch_add(1, std::memory_order_acq_rel) + 1 == n_) {
+                { std::lock_guard<std::mutex> lock(mutex_); }
+                cv_.notify_all();
+            }
+        }
+    }
+
+    void wait() {
+        if (done_.load(std::memory_order_acquire) != n_) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return done_.load(std::memory_order_acquire) == n_; });
+        }
+        if (error_) std::rethrow_exception(error_);
+    }
+
+private:
+    const int n_;
+    const std::function<void(int)>* task_;   // only dereferenced while unclaimed tasks remain
+    std::atomic<int> next_{0};
+    std::atomic<int> done_{0};
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::exception_ptr error_;
+};
+
+} // namespace detail
+
+// Persistent pool: num_threads - 1 workers are started once and then shared by
+// every call that uses the pool, the calling thread being the last one.
+// Concurrent calls queue their jobs here instead of starting threads of their
+// own, so they split the cores between them.
+// With pin_cpus given, worker i is pinned to pin_cpus[(i + 1) % size]; the
+// first entry is left to the calling thread, whose affinity is not touched.
+class ThreadPool final : public Executor {
+public:
+    explicit ThreadPool(int num_threads, std::vector<int> pin_cpus = {})
+        : num_threads_(std::max(1, num_threads)) {
+        for (int i = 1; i < num_threads_; ++i) {
+            int cpu = pin_cpus.empty() ? -1 : pin_cpus[i % pin_cpus.size()];
+            threads_.emplace_back([this, cpu] {
+                if (cpu >= 0) pin_current_thread(cpu);
+                worker_loop();
+            });
+        }
+    }
+
+    ~ThreadPool() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int concurrency() const override { return num_threads_; }
+
+    void run(int n, const std::function<void(int)>& task) override {
+        if (n <= 0) return;
+        if (n == 1 || threads_.empty()) {
+            for (int i = 0; i < n; ++i) task(i);
+            return;
+        }
+        auto job = std::make_shared<detail::Job>(n, &task);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(job);
+        }
+        if (n - 1 >= static_cast<int>(threads_.size())) {
+            cv_.notify_all();
+        } else {
+            for (int i = 0; i < n - 1; ++i) cv_.notify_one();
+        }
+        job->work();
+        job->wait();
+    }
+
+private:
+    void worker_loop() {
+        for (;;) {
+            std::shared_ptr<detail::Job> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this] { return stop_ || !jobs_.empty(); });
+                if (stop_) return;
+                job = jobs_.front();
+                // fully claimed jobs leave the queue; others stay for more helpers
+                if (job->claimed()) {
+                    jobs_.pop_front();
+                    continue;
+                }
+            }
+            job->work();
+        }
+    }
+
+    int num_threads_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::shared_ptr<detail::Job>> jobs_;
+    bool stop_ = false;
+};
+
+// Adapter for a thread pool owned by the caller. submit(fn) must arrange for
+// fn to run on one of the pool's threads at some point; concurrency is the
+// number of tasks MANS should split a stage into. The calling thread takes
+// part in every run(), so a busy or fully blocked pool only costs speed.
+class SubmitExecutor final : public Executor {
+public:
+    using Submit = std::function<void(std::function<void()>)>;
+
+    SubmitExecutor(int concurrency, Submit submit)
+        : concurrency_(std::max(1, concurrency)), submit_(std::move(submit)) {}
+
+    int concurrency() const override { return concurrency_; }
+
+    void run(int n, const std::function<void(int)>& task) override {
+        if (n <= 0) return;
+        if (n == 1) {
+            task(0);
+            return;
+        }
+        auto job = std::make_shared<detail::Job>(n, &task);
+        for (int i = 0; i < n - 1; ++i) {
+            submit_([job] { job->work(); });
+        }
+        job->work();
+        job->wait();
+    }
+
+private:
+    int concurrency_;
+    Submit submit_;
+};
+
+// Pool used when MansParams::executor is null: one thread per usable CPU
+// (affinity mask and cgroup quota), pinned as default_pin_cpus() says
+inline Executor& default_executor() {
+    static ThreadPool pool(usable_cpus(), default_pin_cpus());
+    return pool;
+}
+
+// The executor of one call together with its thread budget; every parallel
+// stage of the call goes through it. A budget of 0 means the executor's full
+// concurrency.
+class Parallel {
+public:
+    explicit Parallel(Executor& executor = default_executor(), int max_threads = 0)
+        : executor_(&executor),
+          size_(max_threads > 0 ? std::min(max_threads, executor.concurrency())
+                                : executor.concurrency()) {
+        size_ = std::max(1, size_);
+    }
+
+    int size() const { return size_; }
+
+    // Same executor, one thread: for stages nested inside an outer parallel loop
+    Parallel serial() const { return Parallel(*executor_, 1); }
+
+    // Calls fn(worker, workers) once per worker, workers = min(size(), limit)
+    template <typename Fn>
+    void workers(Fn&& fn, std::size_t limit = SIZE_MAX) const {
+        int n = static_cast<int>(std::max<std::size_t>(1, std::min<std::size_t>(size_, limit)));
+        if (n == 1) {
+            fn(0, 1);
+            return;
+        }
+        std::function<void(int)> task = [&fn, n](int w) { fn(w, n); };
+        executor_->run(n, task);
+    }
+
+    // Splits [0, count) into contiguous ranges of at least grain items, one per
+    // worker, and calls fn(begin, end) for each
+    template <typename Fn>
+    void for_range(std::size_t count, Fn&& fn, std::size_t grain = 1) const {
+        if (count == 0) return;
+        std::size_t max_workers = (count + grain - 1) / grain;
+        int n = static_cast<int>(std::min<std::size_t>(size_, max_workers));
+        if (n <= 1) {
+            fn(std::size_t(0), count);
+            return;
+        }
+        std::size_t chunk = (count + n - 1) / n;
+        workers([&](int w, int) {
+            std::size_t begin = std::min(count, w * chunk);
+            std::size_t end = std::min(count, begin + chunk);
+            if (begin < end) fn(begin, end);
+        }, n);
+    }
+
+    // Chunks of [0, count) handed out by chunk_grain when grain is 0: about
+    // kChunksPerWorker per worker, so a worker that is slow or starts late
+    // leaves its last chunks to the others
+    static constexpr std::size_t kChunksPerWorker = 8;
+
+    std::size_t chunk_grain(std::size_t count) const {
+        return std::max<std::size_t>(1, count / (static_cast<std::size_t>(size_) * kChunksPerWorker));
+    }
+
+    // Calls fn(begin, end) for contiguous chunks of grain items (chunk_grain
+    // when 0) of [0, count), claimed in order by whichever worker is free:
+    // for items of uneven cost, where for_range would wait on the slowest range
+    template <typename Fn>
+    void for_chunks(std::size_t count, Fn&& fn, std::size_t grain = 0) const {
+        if (count == 0) return;
+        if (grain == 0) grain = chunk_grain(count);
+        std::atomic<std::size_t> next{0};
+        workers([&](int, int) {
+            for (std::size_t begin; (begin = next.fetch_add(grain, std::memory_order_relaxed)) < count;) {
+                fn(begin, std::min(count, begin + grain));
+            }
+        }, (count + grain - 1) / grain);
+    }
+
+private:
+    Executor* executor_;
+    int size_;
+};
+
+} // namespace mans
+
+#endif // MANS_EXECUTOR_H
@@ -0,0 +1,62 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+#include "adm/adm_utils.h"
+#include "pans/pans_utils.h"
+
+namespace mans {
+namespace cpu {
+
+// Per-slice state of compress_batch, grown to the largest batch seen
+struct CompressBatchState {
+    std::vector<AdmEncodeScratch<std::uint16_t>> adm16;
+    std::vector<AdmEncodeScratch<std::uint32_t>> adm32;
+    std::vector<std::vector<std::uint8_t>>       adm_out;   // ADM output of codec 1 slices
+    std::vector<const std::uint8_t*>             pans_in;
+    std::vector<std::size_t>                     pans_in_size;
+    std::vector<const std::uint64_t*>            pans_histogram; // ADM byte counts, null for direct slices
+    std::vector<std::uint8_t*>                   pans_out;
+    std::vector<std::size_t>                     pans_capacity;
+    std::vector<std::size_t>                     pans_size;
+};
+
+// Per-slice state of decompress_batch, grown to the largest batch seen
+struct DecompressBatchState {
+    std::vector<AdmDecodeScratch<std::uint16_t>> adm16;
+    std::vector<AdmDecodeScratch<std::uint32_t>> adm32;
+    std::vector<std::vector<std::uint8_t>>       pans_data; // PANS output of codec 1 slices
+    std::vector<std::uint8_t>                    codec;
+    std::vector<const std::uint8_t*>             pans_in;
+    std::vector<std::size_t>                     pans_in_size;
+    std::vector<std::uint8_t*>                   pans_out;
+    std::vector<std::size_t>                     pans_capacity;
+    std::vector<std::size_t>                     pans_size;
+};
+
+// Scratch state for repeated compress calls. Every buffer is grown on demand
+// and kept, so after the first call on the largest slice a caller feeds it,
+// compression no longer allocates or page-faults. A context must not be used
+// by two calls at the same time; use one per thread.
+struct CompressContext {
+    AdmEncodeScratch<std::uint16_t> adm16;
+    AdmEncodeScratch<std::uint32_t> adm32;
+    PansEncodeScratch               pans;
+    std::vector<std::uint8_t>       pans_input;   // ADM output (codec 1 only)
+    std::vector<std::uint8_t>       pans_output;  // open_benchmark only
+    CompressBatchState              batch;
+};
+
+// Scratch state for repeated decompress calls, same rules as CompressContext.
+struct DecompressContext {
+    AdmDecodeScratch<std::uint16_t> adm16;
+    AdmDecodeScratch<std::uint32_t> adm32;
+    PansDecodeScratch               pans;
+    std::vector<std::uint8_t>       payload;      // open_benchmark only
+    std::vector<std::uint8_t>       pans_data;    // PANS output (codec 1 only)
+    DecompressBatchState            batch;
+};
+
+}
+}
@@ -4,6 +4,12 @@
 #include <limits>
 #include <algorithm>
 #include <vector>
+#include <type_traits>
+#include <stdexcept>
+#include <string>
+#include <cstdint>
+#include <climits>
+#include <atomic>
 
 
 #include "adm/adm_utils.h"
@@ -42,150 +48,538 @@ static bool decide_use_adm(const T* data, size_t size, uint32_t threshold) {
     return (max_block_diff <= threshold);
 }
 
-static void prepend_header(
-    const std::vector<std::uint8_t>& payload,
-    std::vector<std::uint8_t>& final_payload,
-    std::uint8_t codec)
-{
-    final_payload.clear();
-    final_payload.reserve(1 + payload.size());
-    final_payload.push_back(codec);
-    final_payload.insert(final_payload.end(), payload.begin(), payload.end());
-}
-
 // ==========================================
 // 2. Decompress Helper Function
 // ==========================================
 
-static bool strip_header(
-    const std::vector<std::uint8_t>& all,
-    std::vector<std::uint8_t>& payload,
+static bool read_header(
+    const std::uint8_t* all,
+    std::size_t size,
     std::uint8_t& codec)
 {
-    if (all.size() < sizeof(MansHeader)) {
+    if (size < sizeof(MansHeader)) {
         std::cerr << "[Error] File too small, invalid mans format.\n";
         return false;
     }
     codec = all[0];
-    payload.assign(all.begin() + 1, all.end());
     return true;
 }
 
+// Executor and thread budget requested by params for a call on bytes of raw
+// data. Small calls run on the calling thread alone: below
+// LowLatency::AutoBytes waking the workers for every stage takes longer
+// than the stage itself.
+static Parallel make_parallel(const MansParams& params, std::size_t bytes) {
+    Executor& executor = params.executor ? *params.executor : default_executor();
+    int budget = static_cast<int>(std::min<uint32_t>(params.num_threads, INT_MAX));
+    if (params.low_latency == LowLatency::On ||
+        (params.low_latency == LowLatency::Auto && bytes <= LowLatency::AutoBytes)) {
+        budget = 1;
+    }
+    return Parallel(executor, budget);
+}
+
+// PANS precision argument for params.precision
+static int pans_precision_of(const MansParams& params, const char* what) {
+    if (params.precision == Precision::Default) return kPansDefaultPrecision;
+    if (params.precision == Precision::Auto) return kPansAutoPrecision;
+    if (params.precision < Precision::Min || params.precision > Precision::Max) {
+        throw std::runtime_error(std::string(what) + ": unsupported precision " +
+                                 std::to_string(params.precision));
+    }
+    return static_cast<int>(params.precision);
+}
+
+// PANS block size argument for params.block_size
+static uint32_t pans_block_size_of(const MansParams& params, const char* what) {
+    if (params.block_size == BlockSize::Default) return kPansDefaultBlockSize;
+    if (params.block_size < BlockSize::Min || params.block_size > BlockSize::Max ||
+        (params.block_size & (params.block_size - 1)) != 0) {
+        throw std::runtime_error(std::string(what) + ": unsupported block size " +
+                                 std::to_string(params.block_size));
+    }
+    return params.block_size;
+}
+
+// PANS segment argument for params.segment_size
+static size_t pans_segment_size_of(const MansParams& params, const char* what) {
+    if (params.segment_size == SegmentSize::Off) return kPansNoSegments;
+    if (params.segment_size < SegmentSize::Min) {
+        throw std::runtime_error(std::string(what) + ": unsupported segment size " +
+                                 std::to_string(params.segment_size));
+    }
+    return params.segment_size;
+}
+
+// PANS coder argument for params.coder
+static uint32_t pans_coder_of(const MansParams& params, const char* what) {
+    switch (params.coder) {
+        case Coder::Portable: return kPansCoderPortable;
+        case Coder::Wide: return kPansCoderWide;
+    }
+    throw std::runtime_error(std::string(what) + ": unknown coder " + std::to_string(params.coder));
+}
+
+// PANS checksum argument for params.checksum
+static bool pans_checksum_of(const MansParams& params, const char* what) {
+    switch (params.checksum) {
+        case Checksum::Off: return false;
+        case Checksum::On: return true;
+    }
+    throw std::runtime_error(std::string(what) + ": unknown checksum mode " +
+                             std::to_string(params.checksum));
+}
+
+static void require_capacity(std::size_t needed, std::size_t capacity, const char* what) {
+    if (capacity < needed) {
+        throw std::runtime_error(std::string(what) + ": output buffer too small (" +
+                                 std::to_string(capacity) + " < " +
+                                 std::to_string(needed) + " bytes)");
+    }
+}
+
 // ==========================================
 // 3. Core Compress/Decompress Loginic
 // ==========================================
 
 template<typename T>
-void do_compress_t(const T* data_ptr, size_t length, const MansParams& params, 
-                   std::vector<uint8_t>& final_out, 
-                   bool save_adm, const std::string& dump_path, bool open_benchmark) {
+static AdmEncodeScratch<T>& adm_scratch(CompressContext& ctx) {
+    if constexpr (std::is_same_v<T, std::uint16_t>) {
+        return ctx.adm16;
+    } else {
+        return ctx.adm32;
+    }
+}
+
+template<typename T>
+static AdmDecodeScratch<T>& adm_scratch(DecompressContext& ctx) {
+    if constexpr (std::is_same_v<T, std::uint16_t>) {
+        return ctx.adm16;
+    } else {
+        return ctx.adm32;
+    }
+}
+
+template<typename T>
+std::size_t do_compress_t(const T* data_ptr, size_t length, const MansParams& params, 
+                          std::uint8_t* out, std::size_t capacity, CompressContext& ctx,
+                          bool save_adm, const std::string& dump_path, bool open_benchmark) {
     
     uint32_t threshold = params.adm_threshold; 
     if (threshold == 0) threshold = 4000; 
 
+    require_capacity(sizeof(MansHeader), capacity, "mans::compress");
+    const Parallel par = make_parallel(params, length * sizeof(T));
+    const int precision = pans_precision_of(params, "mans::compress");
+    const uint32_t block_size = pans_block_size_of(params, "mans::compress");
+    const size_t segment_size = pans_segment_size_of(params, "mans::compress");
+    const uint32_t coder = pans_coder_of(params, "mans::compress");
+    const bool checksum = pans_checksum_of(params, "mans::compress");
+
     bool use_adm = decide_use_adm(data_ptr, length, threshold);
 
-    std::vector<uint8_t> pans_input;
+    std::vector<uint8_t>& pans_input = ctx.pans_input;
+    const std::size_t raw_bytes = length * sizeof(T);
+    const std::uint8_t* pans_in = reinterpret_cast<const std::uint8_t*>(data_ptr);
+    std::size_t pans_in_size = raw_bytes;
+    const std::uint64_t* pans_histogram = nullptr;
     uint8_t codec_code = 0;
 
-    if (use_adm) {
-        codec_code = 1; // ADM
+    if (use_adm && open_benchmark) {
         std::vector<T> temp_vec(data_ptr, data_ptr + length);
-        if (open_benchmark){
-            adm_compress_and_benchmark(temp_vec, pans_input);
+        adm_compress_and_benchmark(temp_vec, pans_input);
+    } else if (use_adm) {
+        // ADM can expand data that barely passes the threshold; fall back
+        // to direct mode then so max_compressed_size() stays a valid bound
+        AdmEncodeScratch<T>& scratch = adm_scratch<T>(ctx);
+        std::size_t adm_size = adm_plan(data_ptr, length, scratch, par);
+        if (adm_size <= raw_bytes) {
+            pans_input.resize(adm_size);
+            // the symbol counts for PANS come out of the same pass
+            adm_emit(data_ptr, length, pans_input.data(), scratch, par, true);
+            pans_histogram = scratch.histogram.data();
         } else {
-            adm_compress(temp_vec, pans_input);
+            use_adm = false;
         }
+    }
+
+    if (use_adm) {
+        codec_code = 1; // ADM
+        pans_in = pans_input.data();
+        pans_in_size = pans_input.size();
         
         if (save_adm && !dump_path.empty()) {
             save_u8_file(dump_path, pans_input);
         }
     } else {
-        codec_code = 2; // Direct
-        pans_input.resize(length * sizeof(T));
-        if (length > 0) {
-            std::memcpy(pans_input.data(), data_ptr, length * sizeof(T));
-        }
+        codec_code = 2; // Direct: PANS reads the caller's buffer as is
+    }
+
+    // The header byte is written in place, the PANS stream right behind it
+    out[0] = codec_code;
+    if (pans_in_size == 0) {
+        return sizeof(MansHeader);
     }
 
-    std::vector<uint8_t> pans_output;
+    std::size_t written = 0;
     if (open_benchmark) {
-        pans_compress_and_benchmark(
-            pans_input,
-            pans_output
-        );
+        std::vector<uint8_t> bench_input(pans_in, pans_in + pans_in_size);
+        std::vector<uint8_t>& pans_output = ctx.pans_output;
+        pans_compress_and_benchmark(bench_input, pans_output);
+        require_capacity(sizeof(MansHeader) + pans_output.size(), capacity, "mans::compress");
+        std::memcpy(out + sizeof(MansHeader), pans_output.data(), pans_output.size());
+        written = pans_output.size();
     } else {
-        uint32_t bs=0, cs=0; // dummy vars if required by signature
         double dur = 0.0;
-        pans_compress(
-            pans_input,
-            pans_output,
-            bs,
-            cs,
-            dur 
+        written = pans_compress(
+            pans_in,
+            pans_in_size,
+            pans_histogram,
+            out + sizeof(MansHeader),
+            capacity - sizeof(MansHeader),
+            dur,
+            ctx.pans,
+            par,
+            precision,
+            block_size,
+            segment_size,
+            params.dictionary,
+            coder,
+            checksum
         );
+        if (written == 0) {
+            throw std::runtime_error("mans::compress: PANS encoding failed");
+        }
     }
-    
 
-    prepend_header(pans_output, final_out, codec_code);
+    return sizeof(MansHeader) + written;
 }
 
-template<typename T>
-void do_decompress_t(const std::vector<uint8_t>& input_data, 
-                     std::vector<uint8_t>& final_out,
-                     bool save_adm, const std::string& dump_path, bool open_benchmark)
+// Decodes into the buffer returned by reserve(bytes), which is called once
+// the decoded size is known and must throw if it cannot provide that much.
+template<typename T, typename Reserve>
+std::size_t do_decompress_t(const std::uint8_t* input_data, std::size_t input_size,
+                            Reserve&& reserve, const MansParams& params, DecompressContext& ctx,
+                            bool save_adm, const std::string& dump_path, bool open_benchmark)
 {
-
-    std::vector<uint8_t> payload;
     uint8_t codec = 0;
-    if (!strip_header(input_data, payload, codec)) {
-        return; 
+    if (!read_header(input_data, input_size, codec)) {
+        return 0; 
     }
+    if (codec != 1 && codec != 2) {
+        std::cerr << "[Error] Unknown codec type: " << int(codec) << "\n";
+        return 0;
+    }
+
+    // The payload is addressed in place, right behind the header byte
+    const std::uint8_t* payload = input_data + sizeof(MansHeader);
+    std::size_t payload_size = input_size - sizeof(MansHeader);
+    if (payload_size == 0) {
+        reserve(0);
+        return 0;
+    }
+    // The raw size of an ADM frame is only known once PANS has run; its PANS
+    // output, a fraction of it, stands in for it
+    const Parallel par = make_parallel(params, pans_decompressed_size(payload, payload_size));
 
     // 2. PANS Decompress
     // The result of PANS may be the final data (Codec 2), or it may be ADM-compressed data (Codec 1)
-    std::vector<uint8_t> pans_data;
-    
+    std::vector<uint8_t>& pans_data = ctx.pans_data;
 
     if (open_benchmark) {
-        pans_decompress_and_benchmark(payload, pans_data);
+        std::vector<uint8_t>& bench_payload = ctx.payload;
+        bench_payload.assign(payload, payload + payload_size);
+        pans_decompress_and_benchmark(bench_payload, pans_data);
     } else {
-        uint32_t bs=0, cs=0; // dummy vars if required by signature
+        std::size_t pans_size = pans_decompressed_size(payload, payload_size);
+        // Direct mode decodes straight into the caller's buffer
+        std::uint8_t* dst = nullptr;
+        if (codec == 2) {
+            dst = reserve(pans_size);
+        } else {
+            pans_data.resize(pans_size);
+            dst = pans_data.data();
+        }
         double dur = 0.0;
-        pans_decompress(payload, pans_data, bs, cs,dur); 
+        if (pans_decompress(payload, payload_size, dst, pans_size, dur, ctx.pans, par) != pans_size) {
+            return 0;
+        }
+        if (codec == 2) {
+            return pans_size;
+        }
     }
 
     if (codec == 2) {
-        // === Direct Mode ===
-        // PANS decompression output is the original data (byte stream)
-        final_out = std::move(pans_data);
-    } 
-    else if (codec == 1) {
-        // === ADM Mode ===
-        
-        // Debug: Save ADM compressed data
-        if (save_adm && !dump_path.empty()) {
-            save_u8_file(dump_path, pans_data);
+        // === Direct Mode (benchmark) ===
+        std::memcpy(reserve(pans_data.size()), pans_data.data(), pans_data.size());
+        return pans_data.size();
+    }
+
+    // === ADM Mode ===
+    
+    // Debug: Save ADM compressed data
+    if (save_adm && !dump_path.empty()) {
+        save_u8_file(dump_path, pans_data);
+    }
+
+    if (open_benchmark) {
+        std::vector<T>& recovered = adm_scratch<T>(ctx).recovered;
+        adm_decompress_and_benchmark(pans_data, recovered);
+        size_t total_bytes = recovered.size() * sizeof(T);
+        std::memcpy(reserve(total_bytes), recovered.data(), total_bytes);
+        return total_bytes;
+    }
+
+    adm::FileHeader header;
+    if (pans_data.size() < sizeof(header)) {
+        throw std::runtime_error("File too small or invalid format.");
+    }
+    std::memcpy(&header, pans_data.data(), sizeof(header));
+    std::size_t num_elements = static_cast<std::size_t>(header.num_elements);
+    std::uint8_t* dst = reserve(num_elements * sizeof(T));
+    return adm_decompress<T>(pans_data.data(), pans_data.size(), dst, num_elements,
+                             adm_scratch<T>(ctx), par) * sizeof(T);
+}
+
+template<typename T>
+std::size_t do_decompress_range_t(const std::uint8_t* input_data, std::size_t input_size,
+                                  std::size_t first, std::size_t count, const MansParams& params,
+                                  std::uint8_t* out, std::size_t capacity, DecompressContext& ctx)
+{
+    require_capacity(count * sizeof(T), capacity, "mans::decompress_range");
+    uint8_t codec = 0;
+    if (!read_header(input_data, input_size, codec)) {
+        return 0;
+    }
+    if (codec != 1 && codec != 2) {
+        std::cerr << "[Error] Unknown codec type: " << int(codec) << "\n";
+        return 0;
+    }
+    const std::uint8_t* payload = input_data + sizeof(MansHeader);
+    const std::size_t payload_size = input_size - sizeof(MansHeader);
+    const std::size_t pans_size = payload_size == 0 ? 0 : pans_decompressed_size(payload, payload_size);
+    auto outside = [&] {
+        return std::runtime_error("mans::decompress_range: elements [" + std::to_string(first) +
+                                  ", " + std::to_string(first + count) + ") outside the frame");
+    };
+    if (payload_size == 0) {
+        if (first != 0 || count != 0) throw outside();
+        return 0;
+    }
+    const Parallel par = make_parallel(params, count * sizeof(T));
+
+    if (codec == 2) {
+        // Direct mode: the elements are the PANS bytes, decoded straight into out
+        if (first > pans_size / sizeof(T) || count > pans_size / sizeof(T) - first) {
+            throw outside();
+        }
+        if (!pans_decompress_range(payload, payload_size, first * sizeof(T), count * sizeof(T),
+                                   out, ctx.pans, par)) {
+            return 0;
         }
+        return count * sizeof(T);
+    }
+
+    // ADM mode: every section of the ADM stream it reads is a byte range of
+    // the PANS output
+    AdmStreamReader read = [&](std::uint64_t offset, std::size_t bytes, std::uint8_t* dst) {
+        return pans_decompress_range(payload, payload_size, offset, bytes, dst, ctx.pans, par);
+    };
+    adm::FileHeader header;
+    if (pans_size < sizeof(header) || !read(0, sizeof(header), reinterpret_cast<std::uint8_t*>(&header))) {
+        return 0;
+    }
+    if (first > header.num_elements || count > header.num_elements - first) {
+        throw outside();
+    }
+    adm_decompress_range<T>(read, pans_size, first, count, out, adm_scratch<T>(ctx), par);
+    return count * sizeof(T);
+}
+
+// ==========================================
+// 4. Batch Compress/Decompress
+// ==========================================
+
+template<typename T>
+static std::vector<AdmEncodeScratch<T>>& batch_adm_scratch(CompressBatchState& batch) {
+    if constexpr (std::is_same_v<T, std::uint16_t>) {
+        return batch.adm16;
+    } else {
+        return batch.adm32;
+    }
+}
+
+template<typename T>
+static std::vector<AdmDecodeScratch<T>>& batch_adm_scratch(DecompressBatchState& batch) {
+    if constexpr (std::is_same_v<T, std::uint16_t>) {
+        return batch.adm16;
+    } else {
+        return batch.adm32;
+    }
+}
 
-        // ADM Decompress (还原为 T 类型)
-        std::vector<T> recovered_items;
-        if (open_benchmark) {
-            adm_decompress_and_benchmark(pans_data, recovered_items);
+// Runs fn(i) for every slice; workers claim slices one at a time, so one
+// large slice does not hold up a worker's share of small ones
+template<typename Fn>
+static void for_each_slice(const Parallel& par, size_t num, Fn&& fn) {
+    par.for_chunks(num, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) fn(i);
+    }, 1);
+}
+
+template<typename T>
+void do_compress_batch_t(size_t num, const void* const* inputs, const size_t* lengths,
+                         const MansParams& params, void* const* outs, const size_t* capacities,
+                         size_t* out_sizes, CompressContext& ctx) {
+    uint32_t threshold = params.adm_threshold; 
+    if (threshold == 0) threshold = 4000; 
+    const int precision = pans_precision_of(params, "mans::compress_batch");
+    const uint32_t block_size = pans_block_size_of(params, "mans::compress_batch");
+    const size_t segment_size = pans_segment_size_of(params, "mans::compress_batch");
+    const uint32_t coder = pans_coder_of(params, "mans::compress_batch");
+    const bool checksum = pans_checksum_of(params, "mans::compress_batch");
+
+    for (size_t i = 0; i < num; ++i) {
+        require_capacity(sizeof(MansHeader), capacities[i], "mans::compress_batch");
+    }
+
+    std::size_t total_bytes = 0;
+    for (size_t i = 0; i < num; ++i) total_bytes += lengths[i] * sizeof(T);
+
+    CompressBatchState& batch = ctx.batch;
+    std::vector<AdmEncodeScratch<T>>& adm = batch_adm_scratch<T>(batch);
+    if (adm.size() < num) adm.resize(num);
+    if (batch.adm_out.size() < num) batch.adm_out.resize(num);
+    batch.pans_in.resize(num);
+    batch.pans_in_size.resize(num);
+    batch.pans_histogram.resize(num);
+    batch.pans_out.resize(num);
+    batch.pans_capacity.resize(num);
+    batch.pans_size.resize(num);
+
+    // ADM stage, one slice per task. The ADM kernels of a slice run serially
+    // on the worker that owns it.
+    const Parallel par = make_parallel(params, total_bytes);
+    const Parallel slice_par = par.serial();
+    for_each_slice(par, num, [&](size_t i) {
+        const T* data = static_cast<const T*>(inputs[i]);
+        const std::size_t length = lengths[i];
+        std::uint8_t codec_code = 2; // Direct
+        batch.pans_in[i] = reinterpret_cast<const std::uint8_t*>(data);
+        batch.pans_in_size[i] = length * sizeof(T);
+        batch.pans_histogram[i] = nullptr;
+
+        if (decide_use_adm(data, length, threshold)) {
+            std::size_t adm_size = adm_plan(data, length, adm[i], slice_par);
+            if (adm_size <= length * sizeof(T)) {
+                batch.adm_out[i].resize(adm_size);
+                adm_emit(data, length, batch.adm_out[i].data(), adm[i], slice_par, true);
+                batch.pans_in[i] = batch.adm_out[i].data();
+                batch.pans_in_size[i] = adm_size;
+                batch.pans_histogram[i] = adm[i].histogram.data();
+                codec_code = 1; // ADM
+            }
+        }
+
+        std::uint8_t* out = static_cast<std::uint8_t*>(outs[i]);
+        out[0] = codec_code;
+        batch.pans_out[i] = out + sizeof(MansHeader);
+        batch.pans_capacity[i] = capacities[i] - sizeof(MansHeader);
+    });
+
+    // PANS stage: blocks of all slices are spread over the same workers
+    pans_compress_batch(static_cast<uint32_t>(num), batch.pans_in.data(), batch.pans_in_size.data(),
+                        batch.pans_histogram.data(), batch.pans_out.data(), batch.pans_capacity.data(), batch.pans_size.data(),
+                        ctx.pans, par, precision, block_size, segment_size, params.dictionary, coder,
+                        checksum);
+
+    for (size_t i = 0; i < num; ++i) {
+        if (batch.pans_size[i] == 0 && batch.pans_in_size[i] != 0) {
+            throw std::runtime_error("mans::compress_batch: output buffer of slice " +
+                                     std::to_string(i) + " too small");
+        }
+        out_sizes[i] = sizeof(MansHeader) + batch.pans_size[i];
+    }
+}
+
+template<typename T>
+void do_decompress_batch_t(size_t num, const void* const* inputs, const size_t* sizes,
+                           const MansParams& params, void* const* outs, const size_t* capacities,
+                           size_t* out_sizes, DecompressContext& ctx) {
+    DecompressBatchState& batch = ctx.batch;
+    std::vector<AdmDecodeScratch<T>>& adm = batch_adm_scratch<T>(batch);
+    if (adm.size() < num) adm.resize(num);
+    if (batch.pans_data.size() < num) batch.pans_data.resize(num);
+    batch.codec.assign(num, 0);
+    batch.pans_in.resize(num);
+    batch.pans_in_size.resize(num);
+    batch.pans_out.resize(num);
+    batch.pans_capacity.resize(num);
+    batch.pans_size.resize(num);
+
+    // Route every payload: direct slices decode straight into the caller's
+    // buffer, ADM slices into a per-slice staging buffer
+    for (size_t i = 0; i < num; ++i) {
+        out_sizes[i] = 0;
+        const std::uint8_t* in = static_cast<const std::uint8_t*>(inputs[i]);
+        batch.pans_in[i] = in;
+        batch.pans_in_size[i] = 0;
+        batch.pans_out[i] = nullptr;
+        batch.pans_capacity[i] = 0;
+
+        std::uint8_t codec = 0;
+        if (!read_header(in, sizes[i], codec)) {
+            continue;
+        }
+        if (codec != 1 && codec != 2) {
+            std::cerr << "[Error] Unknown codec type: " << int(codec) << "\n";
+            continue;
+        }
+        batch.codec[i] = codec;
+        batch.pans_in[i] = in + sizeof(MansHeader);
+        batch.pans_in_size[i] = sizes[i] - sizeof(MansHeader);
+
+        std::size_t pans_size = pans_decompressed_size(batch.pans_in[i], batch.pans_in_size[i]);
+        if (codec == 2) {
+            require_capacity(pans_size, capacities[i], "mans::decompress_batch");
+            batch.pans_out[i] = static_cast<std::uint8_t*>(outs[i]);
+            batch.pans_capacity[i] = capacities[i];
         } else {
-            adm_decompress(pans_data, recovered_items);
+            batch.pans_data[i].resize(pans_size);
+            batch.pans_out[i] = batch.pans_data[i].data();
+            batch.pans_capacity[i] = pans_size;
         }
+    }
+
+    std::size_t total_bytes = 0;
+    for (size_t i = 0; i < num; ++i) {
+        total_bytes += pans_decompressed_size(batch.pans_in[i], batch.pans_in_size[i]);
+    }
+    const Parallel par = make_parallel(params, total_bytes);
 
-        // Convert: vector<T> -> vector<uint8_t> (API requires output as a byte stream)
-        size_t total_bytes = recovered_items.size() * sizeof(T);
-        final_out.resize(total_bytes);
-        if (total_bytes > 0) {
-            std::memcpy(final_out.data(), recovered_items.data(), total_bytes);
+    // PANS stage: blocks of all slices are spread over the same workers
+    pans_decompress_batch(static_cast<uint32_t>(num), batch.pans_in.data(), batch.pans_in_size.data(),
+                          batch.pans_out.data(), batch.pans_capacity.data(), batch.pans_size.data(),
+                          ctx.pans, par);
+
+    for (size_t i = 0; i < num; ++i) {
+        if (batch.codec[i] == 2) {
+            out_sizes[i] = batch.pans_size[i];
+        } else if (batch.codec[i] == 1 && batch.pans_size[i] >= sizeof(adm::FileHeader)) {
+            adm::FileHeader header;
+            std::memcpy(&header, batch.pans_data[i].data(), sizeof(header));
+            require_capacity(static_cast<std::size_t>(header.num_elements) * sizeof(T),
+                             capacities[i], "mans::decompress_batch");
         }
-    } 
-    else {
-        std::cerr << "[Error] Unknown codec type: " << int(codec) << "\n";
     }
+
+    // ADM stage, one slice per task
+    const Parallel slice_par = par.serial();
+    for_each_slice(par, num, [&](size_t i) {
+        if (batch.codec[i] != 1 || batch.pans_size[i] == 0) return;
+        out_sizes[i] = adm_decompress<T>(batch.pans_data[i].data(), batch.pans_size[i], outs[i],
+                                         capacities[i] / sizeof(T), adm[i], slice_par) * sizeof(T);
+    });
 }
 
 // ==========================================
@@ -195,22 +589,215 @@ void do_decompress_t(const std::vector<uint8_t>& input_data,
 void compress_internal(const void* input_data, size_t length, const MansParams& params, 
                        std::vector<uint8_t>& out, 
                        bool save_adm, const std::string& dump_path, bool open_benchmark) {
+    CompressContext ctx;
+    compress_internal(input_data, length, params, out, ctx, save_adm, dump_path, open_benchmark);
+}
+
+void decompress_internal(const std::vector<uint8_t>& input_data, const MansParams& params, 
+                         std::vector<uint8_t>& out, 
+                         bool save_adm, const std::string& dump_path, bool open_benchmark) {
+    DecompressContext ctx;
+    decompress_internal(input_data, params, out, ctx, save_adm, dump_path, open_benchmark);
+}
+
+size_t max_compressed_size(size_t length, uint32_t dtype) {
+    size_t elem = (dtype == DataType::U32) ? sizeof(std::uint32_t) : sizeof(std::uint16_t);
+    return sizeof(MansHeader) + pans_max_compressed_size(length * elem);
+}
+
+uint32_t stream_precision(const void* input_data, size_t size) {
+    const std::uint8_t* in = static_cast<const std::uint8_t*>(input_data);
+    if (size <= sizeof(MansHeader)) return 0;
+    return static_cast<uint32_t>(pans_precision(in + sizeof(MansHeader), size - sizeof(MansHeader)));
+}
+
+uint32_t stream_block_size(const void* input_data, size_t size) {
+    const std::uint8_t* in = static_cast<const std::uint8_t*>(input_data);
+    if (size <= sizeof(MansHeader)) return 0;
+    return pans_block_size(in + sizeof(MansHeader), size - sizeof(MansHeader));
+}
+
+uint32_t stream_num_tables(const void* input_data, size_t size) {
+    const std::uint8_t* in = static_cast<const std::uint8_t*>(input_data);
+    if (size <= sizeof(MansHeader)) return 0;
+    return pans_num_tables(in + sizeof(MansHeader), size - sizeof(MansHeader));
+}
+
+uint32_t stream_dictionary(const void* input_data, size_t size) {
+    const std::uint8_t* in = static_cast<const std::uint8_t*>(input_data);
+    if (size <= sizeof(MansHeader)) return 0;
+    return pans_dictionary_id(in + sizeof(MansHeader), size - sizeof(MansHeader));
+}
+
+uint32_t stream_coder(const void* input_data, size_t size) {
+    const std::uint8_t* in = static_cast<const std::uint8_t*>(input_data);
+    if (size <= sizeof(MansHeader)) return Coder::Portable;
+    return pans_coder(in + sizeof(MansHeader), size - sizeof(MansHeader)) == kPansCoderWide
+        ? Coder::Wide : Coder::Portable;
+}
+
+bool verify_internal(const void* input_data, size_t size, const MansParams& params,
+                     std::vector<uint32_t>& bad_blocks, DecompressContext& ctx) {
+    bad_blocks.clear();
+    const std::uint8_t* in = static_cast<const std::uint8_t*>(input_data);
+    uint8_t codec = 0;
+    if (!read_header(in, size, codec) || size <= sizeof(MansHeader)) return false;
+    const std::uint8_t* payload = in + sizeof(MansHeader);
+    const std::size_t payload_size = size - sizeof(MansHeader);
+    const Parallel par = make_parallel(params, pans_decompressed_size(payload, payload_size));
+    return pans_verify(payload, payload_size, bad_blocks, ctx.pans, par);
+}
+
+// Adds the counts of the symbols PANS gets for data (see do_compress_t) to counts
+template<typename T>
+static void add_sample_counts(const T* data, size_t length, uint32_t threshold,
+                              AdmEncodeScratch<T>& scratch, std::vector<uint8_t>& staging,
+                              uint64_t* counts, const Parallel& par) {
+    std::uint64_t sample[256];
+    std::size_t adm_size = SIZE_MAX;
+    if (decide_use_adm(data, length, threshold)) {
+        adm_size = adm_plan(data, length, scratch, par);
+    }
+    if (adm_size <= length * sizeof(T)) {
+        staging.resize(adm_size);
+        adm_emit(data, length, staging.data(), scratch, par, true);
+        std::memcpy(sample, scratch.histogram.data(), sizeof(sample));
+    } else {
+        pans_histogram(reinterpret_cast<const std::uint8_t*>(data), length * sizeof(T), sample, par);
+    }
+    for (int i = 0; i < 256; ++i) counts[i] += sample[i];
+}
+
+std::vector<uint8_t> train_dictionary(size_t num, const void* const* inputs, const size_t* lengths,
+                                      const MansParams& params, uint32_t id) {
+    uint32_t threshold = params.adm_threshold;
+    if (threshold == 0) threshold = 4000;
+    const int precision = pans_precision_of(params, "mans::train_dictionary");
+    std::size_t total_bytes = 0;
+    for (size_t i = 0; i < num; ++i) {
+        total_bytes += lengths[i] * (params.dtype == DataType::U32 ? sizeof(uint32_t) : sizeof(uint16_t));
+    }
+    const Parallel par = make_parallel(params, total_bytes);
+    CompressContext ctx;
+    std::uint64_t counts[256] = {};
+    for (size_t i = 0; i < num; ++i) {
+        if (params.dtype == DataType::U16) {
+            add_sample_counts(static_cast<const uint16_t*>(inputs[i]), lengths[i], threshold,
+                              ctx.adm16, ctx.pans_input, counts, par);
+        } else if (params.dtype == DataType::U32) {
+            add_sample_counts(static_cast<const uint32_t*>(inputs[i]), lengths[i], threshold,
+                              ctx.adm32, ctx.pans_input, counts, par);
+        }
+    }
+    std::vector<uint8_t> dictionary(kPansDictionarySize);
+    if (pans_train_dictionary(counts, precision, id, dictionary.data()) == 0) {
+        throw std::runtime_error("mans::train_dictionary: no samples or unsupported precision");
+    }
+    return dictionary;
+}
+
+uint32_t load_dictionary(const void* data, size_t size) {
+    uint32_t id = pans_load_dictionary(static_cast<const std::uint8_t*>(data), size);
+    if (id == 0) {
+        throw std::runtime_error("mans::load_dictionary: malformed dictionary or ID in use");
+    }
+    return id;
+}
+
+void compress_internal(const void* input_data, size_t length, const MansParams& params, 
+                       std::vector<uint8_t>& out, CompressContext& ctx,
+                       bool save_adm, const std::string& dump_path, bool open_benchmark) {
+    out.resize(max_compressed_size(length, params.dtype));
+    out.resize(compress_internal(input_data, length, params, out.data(), out.size(), ctx,
+                                 save_adm, dump_path, open_benchmark));
+}
+
+void decompress_internal(const std::vector<uint8_t>& input_data, const MansParams& params, 
+                         std::vector<uint8_t>& out, DecompressContext& ctx,
+                         bool save_adm, const std::string& dump_path, bool open_benchmark) {
+    auto reserve = [&out](std::size_t bytes) {
+        out.resize(bytes);
+        return out.data();
+    };
+    size_t written = 0;
     if (params.dtype == DataType::U16) {
-        do_compress_t(static_cast<const uint16_t*>(input_data), length, params, out, save_adm, dump_path, open_benchmark);
+        written = do_decompress_t<uint16_t>(input_data.data(), input_data.size(), reserve,
+                                            params, ctx,
+                                            save_adm, dump_path, open_benchmark);
     } else if (params.dtype == DataType::U32) {
-        do_compress_t(static_cast<const uint32_t*>(input_data), length, params, out, save_adm, dump_path, open_benchmark);
+        written = do_decompress_t<uint32_t>(input_data.data(), input_data.size(), reserve,
+                                            params, ctx,
+                                            save_adm, dump_path, open_benchmark);
     }
+    out.resize(written);
 }
 
-void decompress_internal(const std::vector<uint8_t>& input_data, const MansParams& params, 
-                         std::vector<uint8_t>& out, 
+size_t compress_internal(const void* input_data, size_t length, const MansParams& params,
+                         void* out, size_t capacity, CompressContext& ctx,
                          bool save_adm, const std::string& dump_path, bool open_benchmark) {
+    std::uint8_t* dst = static_cast<std::uint8_t*>(out);
+    if (params.dtype == DataType::U16) {
+        return do_compress_t(static_cast<const uint16_t*>(input_data), length, params, dst, capacity, ctx, save_adm, dump_path, open_benchmark);
+    } else if (params.dtype == DataType::U32) {
+        return do_compress_t(static_cast<const uint32_t*>(input_data), length, params, dst, capacity, ctx, save_adm, dump_path, open_benchmark);
+    }
+    return 0;
+}
+
+size_t decompress_internal(const void* input_data, size_t size, const MansParams& params,
+                           void* out, size_t capacity, DecompressContext& ctx,
+                           bool save_adm, const std::string& dump_path, bool open_benchmark) {
+    auto reserve = [out, capacity](std::size_t bytes) {
+        require_capacity(bytes, capacity, "mans::decompress");
+        return static_cast<std::uint8_t*>(out);
+    };
+    const std::uint8_t* src = static_cast<const std::uint8_t*>(input_data);
+    if (params.dtype == DataType::U16) {
+        return do_decompress_t<uint16_t>(src, size, reserve, params, ctx, save_adm, dump_path, open_benchmark);
+    } else if (params.dtype == DataType::U32) {
+        return do_decompress_t<uint32_t>(src, size, reserve, params, ctx, save_adm, dump_path, open_benchmark);
+    }
+    return 0;
+}
+
+size_t decompress_range_internal(const void* input_data, size_t size, size_t first, size_t count,
+                                 const MansParams& params, void* out, size_t capacity,
+                                 DecompressContext& ctx) {
+    const std::uint8_t* src = static_cast<const std::uint8_t*>(input_data);
+    std::uint8_t* dst = static_cast<std::uint8_t*>(out);
+    if (params.dtype == DataType::U16) {
+        return do_decompress_range_t<uint16_t>(src, size, first, count, params, dst, capacity, ctx);
+    } else if (params.dtype == DataType::U32) {
+        return do_decompress_range_t<uint32_t>(src, size, first, count, params, dst, capacity, ctx);
+    }
+    return 0;
+}
+
+void compress_batch_internal(size_t num, const void* const* inputs, const size_t* lengths,
+                             const MansParams& params, void* const* outs, const size_t* capacities,
+                             size_t* out_sizes, CompressContext& ctx) {
+    if (num > UINT32_MAX) {
+        throw std::runtime_error("mans::compress_batch: too many slices");
+    }
+    if (params.dtype == DataType::U16) {
+        do_compress_batch_t<uint16_t>(num, inputs, lengths, params, outs, capacities, out_sizes, ctx);
+    } else if (params.dtype == DataType::U32) {
+        do_compress_batch_t<uint32_t>(num, inputs, lengths, params, outs, capacities, out_sizes, ctx);
+    }
+}
+
+void decompress_batch_internal(size_t num, const void* const* inputs, const size_t* sizes,
+                               const MansParams& params, void* const* outs, const size_t* capacities,
+                               size_t* out_sizes, DecompressContext& ctx) {
+    if (num > UINT32_MAX) {
+        throw std::runtime_error("mans::decompress_batch: too many slices");
+    }
     if (params.dtype == DataType::U16) {
-        do_decompress_t<uint16_t>(input_data, out, save_adm, dump_path, open_benchmark);
+        do_decompress_batch_t<uint16_t>(num, inputs, sizes, params, outs, capacities, out_sizes, ctx);
     } else if (params.dtype == DataType::U32) {
-        do_decompress_t<uint32_t>(input_data, out, save_adm, dump_path, open_benchmark);
+        do_decompress_batch_t<uint32_t>(num, inputs, sizes, params, outs, capacities, out_sizes, ctx);
     }
 }
 
 } // namespace cpu
-} // namespace mans
\ No newline at end of file
+} // namespace mans
@@ -1,7 +1,11 @@
 #pragma once
+#include <cstddef>
 #include <vector>
 #include <string>
 #include "../mans_defs.h" 
+#include "mans_context.h"
+#include "cpu_isa.h"
+#include "executor.h"
 namespace mans {
 namespace cpu {
 
@@ -26,5 +30,160 @@ void decompress_internal(
     bool open_benchmark
 );
 
+// same as above, reusing the scratch buffers held by ctx
+void compress_internal(
+    const void* input_data, 
+    size_t length, 
+    const MansParams& params, 
+    std::vector<uint8_t>& out,
+    CompressContext& ctx,
+    bool save_adm, 
+    const std::string& dump_path,
+    bool open_benchmark
+);
+
+void decompress_internal(
+    const std::vector<uint8_t>& input_data, 
+    const MansParams& params, 
+    std::vector<uint8_t>& out,
+    DecompressContext& ctx,
+    bool save_adm, 
+    const std::string& dump_path,
+    bool open_benchmark
+);
+
+// Worst-case compress_internal output size for length elements of dtype, at
+// any precision, block size and segment size
+size_t max_compressed_size(size_t length, uint32_t dtype);
+
+// ANS table precision a compressed frame was written with, 0 if it holds no
+// PANS stream (empty input)
+uint32_t stream_precision(const void* input_data, size_t size);
+
+// ANS block size a compressed frame was written with, 0 if it holds no PANS
+// stream
+uint32_t stream_block_size(const void* input_data, size_t size);
+
+// ANS probability tables of a compressed frame (more than one only with
+// segments), 0 if it holds no PANS stream
+uint32_t stream_num_tables(const void* input_data, size_t size);
+
+// Dictionary a compressed frame refers to, 0 if it stores its own ANS table
+// or holds no PANS stream
+uint32_t stream_dictionary(const void* input_data, size_t size);
+
+// ANS coder (Coder::Portable or Coder::Wide) of a compressed frame,
+// Coder::Portable if it holds no PANS stream
+uint32_t stream_coder(const void* input_data, size_t size);
+
+// Checks every ANS block of a frame compressed with Checksum::On against its
+// checksum without writing the decoded data anywhere; bad_blocks gets the
+// blocks that do not match. false if the frame is malformed, holds no PANS
+// stream or was compressed without checksums.
+bool verify_internal(
+    const void* input_data,
+    size_t size,
+    const MansParams& params,
+    std::vector<uint32_t>& bad_blocks,
+    DecompressContext& ctx
+);
+
+// Trains a dictionary on num sample slices (inputs[i] holds lengths[i]
+// elements of params.dtype): the symbols PANS would see for each, ADM output
+// or raw bytes, summed and normalized at params.precision (Auto: picked from
+// the sums). id 0 derives the ID from the table. Returns the serialized
+// dictionary; throws std::runtime_error if the samples are empty.
+std::vector<uint8_t> train_dictionary(
+    size_t num,
+    const void* const* inputs,
+    const size_t* lengths,
+    const MansParams& params,
+    uint32_t id
+);
+
+// Registers a serialized dictionary for compress and decompress in this
+// process and returns its ID. Throws std::runtime_error if it is malformed
+// or clashes with a loaded dictionary of the same ID.
+uint32_t load_dictionary(const void* data, size_t size);
+
+// Pointer interface: compresses into out[0, capacity) and returns the bytes
+// written. Throws std::runtime_error if capacity is too small;
+// max_compressed_size() is always enough. out needs no particular alignment.
+size_t compress_internal(
+    const void* input_data, 
+    size_t length, 
+    const MansParams& params, 
+    void* out,
+    size_t capacity,
+    CompressContext& ctx,
+    bool save_adm, 
+    const std::string& dump_path,
+    bool open_benchmark
+);
+
+// Pointer interface: decompresses into out[0, capacity) and returns the bytes
+// written (0 for a malformed stream). Throws std::runtime_error if capacity
+// is smaller than the decoded frame.
+size_t decompress_internal(
+    const void* input_data, 
+    size_t size,
+    const MansParams& params, 
+    void* out,
+    size_t capacity,
+    DecompressContext& ctx,
+    bool save_adm, 
+    const std::string& dump_path,
+    bool open_benchmark
+);
+
+// Random access: decodes elements [first, first + count) of a frame into
+// out[0, capacity) and returns the bytes written (0 for a malformed frame).
+// Only the ANS blocks holding those elements (for an ADM frame: its header
+// and the prefix entries, centers, codes and bit signals of the ADM groups
+// the range touches) are decoded, so the cost follows count, not the frame.
+// Throws std::runtime_error if the range lies outside the frame or capacity
+// is smaller than count elements.
+size_t decompress_range_internal(
+    const void* input_data,
+    size_t size,
+    size_t first,
+    size_t count,
+    const MansParams& params,
+    void* out,
+    size_t capacity,
+    DecompressContext& ctx
+);
+
+// Batch interface: compresses num independent slices in one go, spreading
+// the PANS blocks of all slices over one parallel region. Slice i is read
+// from inputs[i] (lengths[i] elements) and written to outs[i] (capacities[i]
+// bytes, see max_compressed_size); out_sizes[i] receives its size. Each
+// output is byte-identical to compressing that slice on its own. Throws
+// std::runtime_error if any output buffer is too small.
+void compress_batch_internal(
+    size_t num,
+    const void* const* inputs,
+    const size_t* lengths,
+    const MansParams& params,
+    void* const* outs,
+    const size_t* capacities,
+    size_t* out_sizes,
+    CompressContext& ctx
+);
+
+// Batch interface: decompresses num frames; out_sizes[i] is the decoded size
+// in bytes, 0 for a malformed frame. Throws std::runtime_error if any output
+// buffer is too small.
+void decompress_batch_internal(
+    size_t num,
+    const void* const* inputs,
+    const size_t* sizes,
+    const MansParams& params,
+    void* const* outs,
+    const size_t* capacities,
+    size_t* out_sizes,
+    DecompressContext& ctx
+);
+
 }
 }
\ No newline at end of file
@@ -0,0 +1,148 @@
+#ifndef CPU_ANS_INCLUDE_ANS_CPUANSCHECKSUM_H
+#define CPU_ANS_INCLUDE_ANS_CPUANSCHECKSUM_H
+
+#pragma once
+
+#include "CpuANSUtils.h"
+#include "../cpu_isa.h"
+
+// ---------------- Block checksums ----------------
+//
+// A stream with getUseChecksum set carries the CRC32C (Castagnoli, as in
+// iSCSI and ext4) of the uncompressed bytes of every block, and the header
+// checksum is the CRC32C of those block checksums. The encoder takes the
+// checksum of a block right after coding it and the decoder right after
+// decoding it, while the block is still in L1, so a corrupt block is found
+// by index without another pass over the data.
+
+namespace cpu_ans {
+
+constexpr uint32_t kANSCrc32cPoly = 0x82f63b78;  // reflected 0x1edc6f41
+
+// Slicing-by-8 tables of the portable CRC32C
+struct ANSCrc32cTable {
+  uint32_t t[8][256];
+  constexpr ANSCrc32cTable() : t() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (kANSCrc32cPoly & (0u - (c & 1)));
+      t[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+      for (int s = 1; s < 8; ++s) t[s][i] = (t[s - 1][i] >> 8) ^ t[0][t[s - 1][i] & 0xff];
+    }
+  }
+};
+
+inline constexpr ANSCrc32cTable kANSCrc32c{};
+
+// CRC32C of n bytes at p
+inline uint32_t ansCrc32cScalar(const uint8_t* p, size_t n) {
+  const auto& t = kANSCrc32c.t;
+  uint32_t crc = ~0u;
+  for (; n >= 8; n -= 8, p += 8) {
+    const uint64_t v = loadUnaligned<uint64_t>(p) ^ crc;
+    crc = t[7][v & 0xff] ^ t[6][(v >> 8) & 0xff] ^ t[5][(v >> 16) & 0xff] ^
+          t[4][(v >> 24) & 0xff] ^ t[3][(v >> 32) & 0xff] ^ t[2][(v >> 40) & 0xff] ^
+          t[1][(v >> 48) & 0xff] ^ t[0][v >> 56];
+  }
+  for (; n > 0; --n) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+  return ~crc;
+}
+
+// Multiplies a CRC by x^(8 * Bytes) mod P, i.e. appends Bytes zero bytes to
+// what it covers: the 32 x 32 GF(2) operator of that, squared up from the
+// one of a single zero bit, applied a byte of the CRC at a time
+template <size_t Bytes>
+struct ANSCrc32cShift {
+  uint32_t t[4][256];
+
+  static constexpr uint32_t times(const uint32_t* op, uint32_t v) {
+    uint32_t sum = 0;
+    for (int i = 0; v != 0; ++i, v >>= 1) {
+      if (v & 1) sum ^= op[i];
+    }
+    return sum;
+  }
+  constexpr ANSCrc32cShift() : t() {
+    static_assert(Bytes > 0 && (Bytes & (Bytes - 1)) == 0, "power of two");
+    uint32_t op[32] = {kANSCrc32cPoly}, sq[32] = {};
+    for (int i = 1; i < 32; ++i) op[i] = 1u << (i - 1);
+    for (size_t bits = 1; bits < 8 * Bytes; bits *= 2) {
+      for (int i = 0; i < 32; ++i) sq[i] = times(op, op[i]);
+      for (int i = 0; i < 32; ++i) op[i] = sq[i];
+    }
+    for (uint32_t v = 0; v < 256; ++v) {
+      for (int k = 0; k < 4; ++k) t[k][v] = times(op, v << (8 * k));
+    }
+  }
+  uint32_t operator()(uint32_t crc) const {
+    return t[0][crc & 0xff] ^ t[1][(crc >> 8) & 0xff] ^ t[2][(crc >> 16) & 0xff] ^ t[3][crc >> 24];
+  }
+};
+
+// Lane lengths of ansCrc32cSse42
+constexpr size_t kANSCrc32cLong = 8192;
+constexpr size_t kANSCrc32cShort = 256;
+inline constexpr ANSCrc32cShift<kANSCrc32cLong> kANSCrc32cShiftLong{};
+inline constexpr ANSCrc32cShift<kANSCrc32cShort> kANSCrc32cShiftShort{};
+
+// Sums the input in rounds of three lanes of Lane bytes at once while at
+// least one is left; the first two lane sums are shifted over the lanes
+// behind them
+template <size_t Lane>
+__attribute__((target(MANS_TARGET_SSE42), always_inline))
+inline void ansCrc32cLanesSse42(uint64_t& crc0, const uint8_t*& p, size_t& n,
+                                const ANSCrc32cShift<Lane>& shift) {
+  for (; n >= 3 * Lane; n -= 3 * Lane, p += 3 * Lane) {
+    uint64_t crc1 = 0, crc2 = 0;
+    for (size_t k = 0; k < Lane; k += 8) {
+      crc0 = _mm_crc32_u64(crc0, loadUnaligned<uint64_t>(p + k));
+      crc1 = _mm_crc32_u64(crc1, loadUnaligned<uint64_t>(p + Lane + k));
+      crc2 = _mm_crc32_u64(crc2, loadUnaligned<uint64_t>(p + 2 * Lane + k));
+    }
+    crc0 = shift((uint32_t)crc0) ^ (uint32_t)crc1;
+    crc0 = shift((uint32_t)crc0) ^ (uint32_t)crc2;
+  }
+}
+
+// The same with the SSE4.2 crc32 instruction. One crc32 has a latency of 3
+// cycles and a throughput of 1, so three lanes are summed side by side.
+__attribute__((target(MANS_TARGET_SSE42)))
+inline uint32_t ansCrc32cSse42(const uint8_t* p, size_t n) {
+  uint64_t crc0 = ~0u;
+  ansCrc32cLanesSse42(crc0, p, n, kANSCrc32cShiftLong);
+  ansCrc32cLanesSse42(crc0, p, n, kANSCrc32cShiftShort);
+  for (; n >= 8; n -= 8, p += 8) crc0 = _mm_crc32_u64(crc0, loadUnaligned<uint64_t>(p));
+  uint32_t c = (uint32_t)crc0;
+  for (; n > 0; --n) c = _mm_crc32_u8(c, *p++);
+  return ~c;
+}
+
+using ANSChecksumFn = uint32_t (*)(const uint8_t*, size_t);
+
+// CRC32C for the instruction set in use
+inline ANSChecksumFn selectChecksum() {
+  return mans::active_isa() >= mans::Isa::Sse42 ? &ansCrc32cSse42 : &ansCrc32cScalar;
+}
+
+// true if outBlock, block i of the stream at headerIn as decoded, does not
+// match the checksum stored for it
+inline bool ansBlockChecksumBad(ANSChecksumFn checksum, ANSCoalescedHeader* headerIn,
+                                uint32_t numBlocks, uint32_t i, const uint8_t* outBlock) {
+  const size_t bytes =
+      getBlockUncompressedWords(headerIn->loadBlockWords(numBlocks, i).x) * sizeof(ANSDecodedT);
+  return checksum(outBlock, bytes) !=
+         loadUnaligned<uint32_t>(headerIn->getBlockChecksums(numBlocks) + (size_t)i * sizeof(uint32_t));
+}
+
+// Header checksum of a stream with these block checksums (numBlocks
+// little-endian words)
+inline uint32_t ansStreamChecksum(ANSChecksumFn checksum, const uint8_t* blockChecksums,
+                                  uint32_t numBlocks) {
+  return checksum(blockChecksums, (size_t)numBlocks * sizeof(uint32_t));
+}
+
+} // namespace cpu_ans
+
+#endif
@@ -0,0 +1,287 @@
+#ifndef CPU_ANS_INCLUDE_ANS_CPUANSCOMPACT_H
+#define CPU_ANS_INCLUDE_ANS_CPUANSCOMPACT_H
+
+#pragma once
+
+#include "CpuANSUtils.h"
+
+// ---------------- Compact streams (v3) ----------------
+//
+// On a few KiB of input the fixed parts of a stream (512 bytes of
+// probabilities, 8 bytes of block words and the padding of every block) are a
+// large share of it. A v3 stream keeps the header and packs the rest, in this
+// order:
+//   tables  the dictionary ID (4 bytes), or per table a bitmap of the
+//           symbols present (kNumSymbols / 8 bytes) and their probabilities
+//   index   one byte per block, with more than one table
+//   states  per block the first two words of its warp state (getBlockMode),
+//           then the rest of them for an ANS block, the symbol (1 byte) for
+//           a constant one and nothing for a stored one
+//   words   compressed words of every block, zigzag difference to the block
+//           before
+//   sums    the block checksums as they are, with getUseChecksum
+//   data    block data, back to back without padding
+// Probabilities and words are LEB128 varints. The final states are spread
+// about evenly over their bit lengths, so a varint would make them longer.
+// The encoder writes v3 for inputs of up to
+// kANSCompactMaxBytes whenever it is smaller. Decoders expand such a stream
+// into the v1 layout (ansExpandStream) and decode that; the copy of the block
+// data that costs is why larger streams stay v1.
+
+namespace cpu_ans {
+
+constexpr size_t kANSCompactMaxBytes = size_t(64) << 10;
+// State words getBlockMode reads
+constexpr size_t kANSCompactModeBytes = 2 * sizeof(ANSStateT);
+constexpr uint32_t kANSCompactMaxBlocks = kANSCompactMaxBytes / kMinBlockSize;
+// Largest packed part ansCompactStream builds: one table, every block ANS
+// coded with a checksum and every varint at its longest
+constexpr size_t kANSCompactMaxSize =
+    kNumSymbols / 8 + 2 * kNumSymbols +
+    kANSCompactMaxBlocks * (sizeof(ANSWarpState) + 3 + sizeof(uint32_t));
+
+inline uint8_t* ansPutVarint(uint8_t* p, uint32_t v) {
+  while (v >= 0x80) {
+    *p++ = static_cast<uint8_t>(v) | 0x80;
+    v >>= 7;
+  }
+  *p++ = static_cast<uint8_t>(v);
+  return p;
+}
+
+// false if the varint runs past end or does not fit 32 bits
+inline bool ansGetVarint(const uint8_t*& p, const uint8_t* end, uint32_t& v) {
+  v = 0;
+  for (int shift = 0; shift < 35; shift += 7) {
+    if (p == end) return false;
+    uint8_t b = *p++;
+    if (shift == 28 && b > 0x0f) return false;
+    v |= static_cast<uint32_t>(b & 0x7f) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+inline uint32_t ansZigzag(int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+inline int32_t ansUnzigzag(uint32_t v) { return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1); }
+
+// Rewrites the v1 stream of size bytes at stream as v3 if that is smaller
+// and returns its size then, size otherwise. Streams of more than
+// kANSCompactMaxBytes input or more than one table are left as they are.
+inline size_t ansCompactStream(uint8_t* stream, size_t size) {
+  ANSCoalescedHeader header;
+  std::memcpy(&header, stream, sizeof(header));
+  const uint32_t numBlocks = header.getNumBlocks();
+  if (header.getVersion() != kANSVersion || header.getNumTables() != 1 ||
+      header.getTotalUncompressedWords() * sizeof(ANSDecodedT) > kANSCompactMaxBytes ||
+      numBlocks > kANSCompactMaxBlocks) {
+    return size;
+  }
+  // address math only, every access goes through loadUnaligned
+  auto headerIn = (ANSCoalescedHeader*)stream;
+
+  uint8_t packed[kANSCompactMaxSize];
+  uint8_t* p = packed;
+  if (header.getUseDictionary()) {
+    storeUnaligned(p, headerIn->getDictionaryId());
+    p += sizeof(uint32_t);
+  } else {
+    uint16_t probs[kNumSymbols];
+    std::memcpy(probs, headerIn->getSymbolProbs(), sizeof(probs));
+    uint8_t* bitmap = p;
+    std::memset(bitmap, 0, kNumSymbols / 8);
+    p += kNumSymbols / 8;
+    for (uint32_t i = 0; i < kNumSymbols; ++i) {
+      if (probs[i] == 0) continue;
+      bitmap[i / 8] |= 1 << (i % 8);
+      p = ansPutVarint(p, probs[i]);
+    }
+  }
+
+  for (uint32_t i = 0; i < numBlocks; ++i) {
+    const uint8_t* states = (const uint8_t*)(headerIn->getWarpStates() + i);
+    const ANSStateT mode = getBlockMode(states);
+    size_t bytes = kANSCompactModeBytes;
+    if (mode >= kANSMinState) {
+      bytes = sizeof(ANSWarpState);
+    }
+    std::memcpy(p, states, bytes);
+    p += bytes;
+    if (mode == kANSBlockConstant) {
+      *p++ = states[kANSBlockSymbolWord * sizeof(ANSStateT)];
+    }
+  }
+
+  uint32_t words[kANSCompactMaxBlocks];
+  uint64_t start[kANSCompactMaxBlocks];
+  uint64_t totalWords = 0;
+  int32_t prev = 0;
+  for (uint32_t i = 0; i < numBlocks; ++i) {
+    ANSBlockWords64 w = headerIn->loadBlockWords(numBlocks, i);
+    words[i] = getBlockCompressedWords(w.x);
+    start[i] = w.start;
+    totalWords += words[i];
+    p = ansPutVarint(p, ansZigzag((int32_t)words[i] - prev));
+    prev = (int32_t)words[i];
+  }
+  if (header.getUseChecksum()) {
+    std::memcpy(p, headerIn->getBlockChecksums(numBlocks), (size_t)numBlocks * sizeof(uint32_t));
+    p += (size_t)numBlocks * sizeof(uint32_t);
+  }
+
+  const size_t packedSize = p - packed;
+  const size_t compactSize = sizeof(ANSCoalescedHeader) + packedSize + totalWords * sizeof(ANSEncodedT);
+  const uint8_t* dataIn = (const uint8_t*)headerIn->getBlockDataStart(numBlocks);
+  uint8_t* dataOut = stream + sizeof(ANSCoalescedHeader) + packedSize;
+  // with the packed part no longer than the one it replaces every block moves
+  // towards the front, so in block order none overwrites one still to be
+  // moved
+  if (compactSize >= size || dataOut > dataIn) {
+    return size;
+  }
+  for (uint32_t i = 0; i < numBlocks; ++i) {
+    std::memmove(dataOut, dataIn + start[i] * sizeof(ANSEncodedT), words[i] * sizeof(ANSEncodedT));
+    dataOut += words[i] * sizeof(ANSEncodedT);
+  }
+  std::memcpy(stream + sizeof(ANSCoalescedHeader), packed, packedSize);
+
+  header.setMagicAndVersion(kANSVersionCompact);
+  header.setTotalCompressedWords(totalWords);
+  header.setCompactSize(packedSize);
+  std::memcpy(stream, &header, sizeof(header));
+  return compactSize;
+}
+
+// Bytes ansExpandStream may write for the v3 stream with this header; 0 if
+// its block count does not match its block size and input words
+inline size_t ansExpandedSizeBound(ANSCoalescedHeader& header) {
+  const uint32_t numBlocks = header.getNumBlocks();
+  if (!isSupportedBlockSize(header.getBlockSize()) ||
+      numBlocks != divUp(header.getTotalUncompressedWords(), (uint64_t)header.getBlockSize())) {
+    return 0;
+  }
+  return ANSCoalescedHeader::getCompressedOverhead(
+             numBlocks, kANSVersion, header.getNumTables(), header.getUseDictionary(),
+             header.getUseChecksum()) +
+         header.getTotalCompressedWords() * sizeof(ANSEncodedT) +
+         (size_t)numBlocks * kBlockAlignment;
+}
+
+// Writes the v1 form of the v3 stream at in, whose size the caller has
+// checked against its header, to out (ansExpandedSizeBound bytes) and
+// returns its size; 0 if the stream is malformed.
+inline size_t ansExpandStream(const uint8_t* in, uint8_t* out) {
+  ANSCoalescedHeader header;
+  std::memcpy(&header, in, sizeof(header));
+  const uint32_t numBlocks = header.getNumBlocks();
+  const uint32_t numTables = header.getNumTables();
+  const uint32_t blockSize = header.getBlockSize();
+  const uint64_t totalSymbols = header.getTotalUncompressedWords();
+  const uint64_t totalWords = header.getTotalCompressedWords();
+  const int probBits = header.getProbBits();
+  if (!isSupportedBlockSize(blockSize) || numBlocks != divUp(totalSymbols, (uint64_t)blockSize) ||
+      probBits < kANSMinProbBits || probBits > kANSMaxProbBits) {
+    return 0;
+  }
+  const uint8_t* p = in + sizeof(ANSCoalescedHeader);
+  const uint8_t* end = p + header.getCompactSize();
+  const uint8_t* dataIn = end;
+
+  ANSCoalescedHeader expanded = header;
+  expanded.setMagicAndVersion(kANSVersion);
+  expanded.setTotalCompressedWords(0);
+  std::memcpy(out, &expanded, sizeof(expanded));
+  // address math only, every access goes through storeUnaligned / memcpy
+  auto headerOut = (ANSCoalescedHeader*)out;
+
+  if (header.getUseDictionary()) {
+    if (end - p < (ptrdiff_t)sizeof(uint32_t)) return 0;
+    uint32_t ref[kANSDictionaryRefSize / sizeof(uint32_t)] = {loadUnaligned<uint32_t>(p)};
+    p += sizeof(uint32_t);
+    std::memcpy(headerOut->getSymbolProbs(), ref, sizeof(ref));
+  } else {
+    for (uint32_t t = 0; t < numTables; ++t) {
+      if (end - p < (ptrdiff_t)(kNumSymbols / 8)) return 0;
+      const uint8_t* bitmap = p;
+      p += kNumSymbols / 8;
+      uint16_t probs[kNumSymbols];
+      uint32_t sum = 0;
+      for (uint32_t i = 0; i < kNumSymbols; ++i) {
+        uint32_t prob = 0;
+        if ((bitmap[i / 8] >> (i % 8)) & 1) {
+          if (!ansGetVarint(p, end, prob) || prob == 0 || prob > (1u << probBits)) return 0;
+        }
+        probs[i] = prob;
+        sum += prob;
+      }
+      if (sum != 1u << probBits) return 0;
+      std::memcpy(headerOut->getSymbolProbs() + (size_t)t * kNumSymbols, probs, sizeof(probs));
+    }
+  }
+
+  if (numTables > 1) {
+    if (end - p < (ptrdiff_t)numBlocks) return 0;
+    uint8_t* index = headerOut->getTableIndex();
+    std::memcpy(index, p, numBlocks);
+    std::memset(index + numBlocks, 0,
+                ANSCoalescedHeader::getTableIndexSize(numBlocks, numTables) - numBlocks);
+    p += numBlocks;
+  }
+
+  for (uint32_t i = 0; i < numBlocks; ++i) {
+    ANSWarpState states = {};
+    if (end - p < (ptrdiff_t)kANSCompactModeBytes) return 0;
+    const ANSStateT mode = getBlockMode(p);
+    if (mode >= kANSMinState) {
+      if (end - p < (ptrdiff_t)sizeof(states)) return 0;
+      std::memcpy(&states, p, sizeof(states));
+      p += sizeof(states);
+    } else if (mode == kANSBlockConstant) {
+      if (end - p < (ptrdiff_t)kANSCompactModeBytes + 1) return 0;
+      states.warpState[0] = mode;
+      states.warpState[kANSBlockSymbolWord] = p[kANSCompactModeBytes];
+      p += kANSCompactModeBytes + 1;
+    } else if (mode == kANSBlockStored) {
+      p += kANSCompactModeBytes;
+    } else {
+      return 0;
+    }
+    std::memcpy(headerOut->getWarpStates() + i, &states, sizeof(states));
+  }
+
+  uint8_t* dataOut = (uint8_t*)headerOut->getBlockDataStart(numBlocks);
+  uint64_t wordsIn = 0, start = 0;
+  int32_t prev = 0;
+  for (uint32_t i = 0; i < numBlocks; ++i) {
+    uint32_t zigzag;
+    if (!ansGetVarint(p, end, zigzag)) return 0;
+    const int64_t words = (int64_t)prev + ansUnzigzag(zigzag);
+    if (words < 0 || words > 0xffff || wordsIn + words > totalWords) return 0;
+    const uint64_t first = (uint64_t)i * blockSize;
+    const uint32_t symbols = (uint32_t)std::min<uint64_t>(blockSize, totalSymbols - first);
+    headerOut->storeBlockWords(numBlocks, i, packBlockWords(symbols, (uint32_t)words), start);
+
+    const size_t bytes = words * sizeof(ANSEncodedT);
+    const size_t paddedBytes = roundUp(bytes, (size_t)kBlockAlignment);
+    uint8_t* blockOut = dataOut + start * sizeof(ANSEncodedT);
+    std::memcpy(blockOut, dataIn + wordsIn * sizeof(ANSEncodedT), bytes);
+    std::memset(blockOut + bytes, 0, paddedBytes - bytes);
+    wordsIn += words;
+    start += paddedBytes / sizeof(ANSEncodedT);
+    prev = (int32_t)words;
+  }
+  const size_t checksumBytes = header.getUseChecksum() ? (size_t)numBlocks * sizeof(uint32_t) : 0;
+  if (end - p != (ptrdiff_t)checksumBytes || wordsIn != totalWords) return 0;
+  uint8_t* blockWordsEnd = headerOut->getBlockWords(numBlocks) +
+      (size_t)numBlocks * ANSCoalescedHeader::getBlockWordsEntrySize(kANSVersion);
+  std::memset(blockWordsEnd, 0, dataOut - blockWordsEnd);
+  std::memcpy(headerOut->getBlockChecksums(numBlocks), p, checksumBytes);
+
+  expanded.setTotalCompressedWords(start);
+  std::memcpy(out, &expanded, sizeof(expanded));
+  return expanded.getTotalCompressedSize();
+}
+
+} // namespace cpu_ans
+
+#endif
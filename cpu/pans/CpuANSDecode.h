@@ -5,6 +5,11 @@
 #pragma once
 
 #include "CpuANSUtils.h"
+#include "CpuANSChecksum.h"
+#include "CpuANSDecodeSimd.h"
+#include "CpuANSWide.h"
+#include "../cpu_isa.h"
+#include "../executor.h"
 
 namespace cpu_ans {
 
@@ -14,325 +19,589 @@ struct SymbolInfo {
   uint32_t z;//cdf
 };
 
-inline uint32_t packDecodeLookup(uint32_t sym, uint32_t pdf, uint32_t cdf) {
-  // [31:20] cdf
-  // [19:8] pdf
-  // [7:0] symbol
-  return (cdf << 20) | (pdf << 8) | sym;
+// Expands the probabilities opdf (summing to at most tableSize) into the
+// packed decode table lookup, one entry per slot. The entries of a symbol
+// differ only in cdf, so they are written a row of kRow at a time (vector
+// stores even in the baseline build), and a row running past the symbol is
+// overwritten by the symbols after it; only rows that would leave the table
+// are cut short.
+inline void ansBuildDecodeTable(const uint16_t* opdf, uint32_t tableSize, uint32_t* lookup) {
+  constexpr uint32_t kRow = 16;
+  uint32_t begin = 0;
+  for (uint32_t s = 0; s < kNumSymbols; ++s) {
+    const uint32_t pdf = opdf[s];
+    if (pdf == 0) continue;
+    const uint32_t entry = packDecodeLookup(s, pdf, 0);
+    uint32_t k = 0;
+    for (; k < pdf && begin + k + kRow <= tableSize; k += kRow) {
+      for (uint32_t j = 0; j < kRow; ++j) lookup[begin + k + j] = entry + ((k + j) << 20);
+    }
+    for (; k < pdf; ++k) lookup[begin + k] = entry + (k << 20);
+    begin += pdf;
+  }
 }
 
-inline void unpackDecodeLookup(uint32_t v, uint32_t& sym, uint32_t& pdf, uint32_t& cdf) {
-  // [31:20] cdf
-  // [19:8] pdf
-  // [7:0] symbol
-  sym = v & 0xffU;
-  v >>= 8;
-  pdf = v & 0xfffU;
-  v >>= 12;
-  cdf = v;
+// Same for table t of the stream at in (any alignment)
+inline void ansBuildDecodeTable(const void* in, uint32_t t, uint32_t tableSize, uint32_t* lookup) {
+  uint16_t opdf[kNumSymbols];
+  std::memcpy(opdf, ((const uint8_t*)in + sizeof(ANSCoalescedHeader) + (size_t)t * sizeof(opdf)),
+              sizeof(opdf));
+  ansBuildDecodeTable(opdf, tableSize, lookup);
 }
 
+// Decodes block i of the stream at headerIn (any alignment) into out,
+// which points at the start of the whole decoded stream.
 template <int ProbBits,
-    int kDefaultBlockSize>
-void ansDecodeKernel_opti(
-    uint32_t* symbol,
-    uint32_t* pdf,
-    uint32_t* cdf,
-    void* in,
+    int BlockSize>
+inline void ansDecodeBlock(
+    const uint32_t* __restrict__ lookup,
+    ANSCoalescedHeader* headerIn,
+    uint32_t numBlocks,
+    uint32_t i,
     void* out
     ) {
-  int num_threads = 16;
-  auto headerIn = (ANSCoalescedHeader*)in;
-  auto opdf = headerIn->getSymbolProbs();
-  // __builtin_prefetch(opdf, 0, 3);
-  std::vector<uint32_t> ocdf(kNumSymbols);
-  std::exclusive_scan(opdf, opdf + kNumSymbols, ocdf.begin(), 0);
-  std::vector<SymbolInfo> symbol_info(1 << ProbBits);
-  // uint32_t* symbol = (uint32_t*)std::aligned_alloc(kBlockAlignment, sizeof(uint32_t) * (1 << ProbBits));
-  // uint32_t* pdf = (uint32_t*)std::aligned_alloc(kBlockAlignment, sizeof(uint32_t) * (1 << ProbBits));
-  // uint32_t* cdf = (uint32_t*)std::aligned_alloc(kBlockAlignment, sizeof(uint32_t) * (1 << ProbBits));
-  // uint32_t* table_dev = (uint32_t*)std::aligned_alloc(kBlockAlignment, sizeof(uint32_t) * (1 << ProbBits) * 3);
-  #pragma unroll 
-  // #pragma omp parallel for 
-  for(uint32_t i = 0; i < kNumSymbols; i ++){
-    auto smempdf = opdf[i];
-    auto begin = ocdf[i];
-    auto end = begin + smempdf;
-    for(int j = begin, k = 0; j < end; j ++, k ++){
-        symbol[j] = i;
-        pdf[j] = smempdf;
-        cdf[j] = (uint32_t)k;
-        // symbol_info[j] = {i, smempdf, (uint32_t)k};
-    }
+  constexpr ANSStateT StateMask = (ANSStateT(1) << ProbBits) - ANSStateT(1);
+  auto blockDataInStart = headerIn->getBlockDataStart(numBlocks);
+  ANSStateT state[kWarpSize];
+  std::memcpy(state, headerIn->getWarpStates() + i, sizeof(state));
+  auto blockWords = headerIn->loadBlockWords(numBlocks, i);
+  uint32_t uncompressedWords = getBlockUncompressedWords(blockWords.x);
+  uint32_t compressedWords = getBlockCompressedWords(blockWords.x);
+  ANSEncodedT* blockDataIn =
+      blockDataInStart + blockWords.start;
+  __builtin_prefetch(blockDataIn, 0, 0);
+  // Every step loads the word below the current position and keeps it only
+  // if the lane reads; that word is always inside the stream, while the one
+  // at the position is past its end for a last block without padding. A
+  // corrupt block may read more words than it has (ansClampWordPosition).
+  uint8_t* outBlock_ = (uint8_t*)out + (size_t)i * BlockSize;
+  if(uncompressedWords == BlockSize){
+      // #pragma unroll
+      // #pragma omp simd
+      for(int k = BlockSize - kWarpSize; k >= 0; k -= kWarpSize){
+        // uint32_t outsym[kWarpSize];
+          // for(int j = kWarpSize - 1; j >= 0; j --){ 
+          //   auto s_bar = state[j] & StateMask;
+          //   state[j] = pdf[s_bar] * (state[j] >> ProbBits) + ANSStateT(cdf[s_bar]);
+          //   uint32_t read = state[j] < kANSMinState;
+          //   compressedWords -= read;
+          //   auto v = blockDataIn[compressedWords];
+          //   state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          //   outBlock_[k + j] = symbol[s_bar];
+          // }
+        
+        uint64_t outsym;
+        uint32_t e;
+        uint32_t read;
+        uint16_t v;
+        SymbolInfo info;
+        int tempk = k >> 3;
+        uint8_t tempoutsym[8];
+        // __builtin_prefetch(blockDataIn + compressedWords, 0, 0);
+        for(int j = kWarpSize - 8, l = 3; j >= 0; j -= 8, l --){
+          int temp = j + 7;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[7] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j] = symbol[s_bar];
+          tempoutsym[7] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[6] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j1] = symbol[s_bar];
+          tempoutsym[6] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[5] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j2] = symbol[s_bar];
+          tempoutsym[5] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[4] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j3] = symbol[s_bar];
+          tempoutsym[4] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[3] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j4] = symbol[s_bar];
+          tempoutsym[3] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[2] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j5] = symbol[s_bar];
+          tempoutsym[2] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[1] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j6] = symbol[s_bar];
+          tempoutsym[1] = lookupSymbol(e);
+
+          temp --;
+          e = lookup[state[temp] & StateMask];
+          // info = symbol_info[s_bar];
+          // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
+          // read = state[temp] < kANSMinState;
+          // compressedWords -= read;
+          // v = blockDataIn[compressedWords];
+          // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // tempoutsym[0] = info.x;
+          state[temp] = lookupPdf(e) * (state[temp] >> ProbBits) + ANSStateT(lookupCdf(e));
+          read = state[temp] < kANSMinState;
+          v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+          compressedWords -= read;
+          state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+          // outsym = (outsym << 8) | symbol[s_bar];
+          // outBlock_[k + j7] = symbol[s_bar];
+          tempoutsym[0] = lookupSymbol(e);
+
+          storeUnaligned(outBlock_ + ((tempk + l) << 3), loadUnaligned<uint64_t>(tempoutsym));
+        }
+        ansClampWordPosition(compressedWords);
+      }
+  } 
+  else {
+      uint32_t remainder = uncompressedWords & 31;
+      int uncompressedOffset = uncompressedWords - remainder;
+      if(remainder > 0){
+          for(int j = remainder - 1; j >= 0; j --){
+              // bool valid = j < remainder;
+              auto e = lookup[state[j] & StateMask];
+              // if(valid){
+              state[j] = lookupPdf(e) * (state[j] >> ProbBits) + ANSStateT(lookupCdf(e));
+              // }
+              bool read = 
+              // valid && 
+              (state[j] < kANSMinState);
+              auto v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+              compressedWords -= read;
+              state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+              // if(valid){
+              outBlock_[uncompressedOffset + j] = lookupSymbol(e);
+              // }
+            //   if(valid){
+            //       state[j] = pdf[s_bar] * (state[j] >> ProbBits) + ANSStateT(cdf[s_bar]);
+            //   }
+            //   bool read = valid && (state[j] < kANSMinState);
+            // compressedWords -= read;
+            // auto v = blockDataIn[compressedWords];
+            // state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+            //   if(valid){
+            //       outBlock_[uncompressedOffset + j] = symbol[s_bar];
+            //   }
+          }
+          ansClampWordPosition(compressedWords);
+      }
+      while(uncompressedOffset > 0){
+          uncompressedOffset -= kWarpSize;
+          for(int j = kWarpSize - 1; j >= 0; j --){
+              auto e = lookup[state[j] & StateMask];
+              state[j] = lookupPdf(e) * (state[j] >> ProbBits) + ANSStateT(lookupCdf(e));
+              bool read = state[j] < kANSMinState;
+              auto v = loadUnaligned<ANSEncodedT>(blockDataIn + int(compressedWords) - 1);
+              compressedWords -= read;
+              state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
+              outBlock_[uncompressedOffset + j] = lookupSymbol(e);
+          }
+          ansClampWordPosition(compressedWords);
+      }
+  }
+}
+
+// Every kernel reads the packed decode table of the block (packDecodeLookup)
+using ANSDecodeBlockFn = void (*)(const uint32_t*, ANSCoalescedHeader*, uint32_t, uint32_t, void*);
+
+// Writes block i of the stream at headerIn to outBlock if it is a stored or
+// constant one (kANSBlockStored, kANSBlockConstant); false for an ANS block.
+// A stored block with fewer words than symbols has the rest zeroed.
+inline bool ansDecodeRawBlock(
+    ANSCoalescedHeader* headerIn, uint32_t numBlocks, uint32_t i, uint8_t* outBlock) {
+  const uint8_t* states = (const uint8_t*)(headerIn->getWarpStates() + i);
+  const ANSStateT mode = getBlockMode(states);
+  if (mode >= kANSMinState) return false;
+  const ANSBlockWords64 blockWords = headerIn->loadBlockWords(numBlocks, i);
+  const size_t bytes = getBlockUncompressedWords(blockWords.x) * sizeof(ANSDecodedT);
+  if (mode == kANSBlockConstant) {
+    std::memset(outBlock,
+                (uint8_t)loadUnaligned<ANSStateT>(states + kANSBlockSymbolWord * sizeof(ANSStateT)),
+                bytes);
+    return true;
+  }
+  const size_t stored = std::min(
+      bytes, (size_t)getBlockCompressedWords(blockWords.x) * sizeof(ANSEncodedT));
+  std::memcpy(outBlock, headerIn->getBlockDataStart(numBlocks) + blockWords.start, stored);
+  std::memset(outBlock + stored, 0, bytes - stored);
+  return true;
+}
+
+// ansDecodeBlockWide for the instruction set in use: the AVX-512 kernel, or
+// the baseline build, which the vectorized clones do not beat
+template <int ProbBits, int BlockSize>
+ANSDecodeBlockFn selectDecodeBlockWide() {
+  if (mans::active_isa() == mans::Isa::Avx512) {
+    return [](const uint32_t* t, ANSCoalescedHeader* h, uint32_t n, uint32_t i, void* out) {
+      ansDecodeBlockWideAvx512<ProbBits, BlockSize>(t, h, n, i, out);
+    };
   }
-  auto header = *headerIn;
+  return [](const uint32_t* t, ANSCoalescedHeader* h, uint32_t n, uint32_t i, void* out) {
+    ansDecodeBlockWide<ProbBits, BlockSize>(t, h, n, i, out);
+  };
+}
+
+// ansDecodeBlock variant for the instruction set in use (mans::active_isa());
+// all of them write the same output. wide picks the kernel of the wide coder.
+template <int ProbBits, int BlockSize>
+ANSDecodeBlockFn selectDecodeBlock(bool wide = false) {
+  if (wide) return selectDecodeBlockWide<ProbBits, BlockSize>();
+  using Scalar = mans::IsaClones<&ansDecodeBlock<ProbBits, BlockSize>>;
+  switch (mans::active_isa()) {
+    case mans::Isa::Avx512:
+      return [](const uint32_t* t, ANSCoalescedHeader* h, uint32_t n, uint32_t i, void* out) {
+        ansDecodeBlockAvx512<ProbBits, BlockSize>(t, h, n, i, out);
+      };
+    case mans::Isa::Avx2:
+      return [](const uint32_t* t, ANSCoalescedHeader* h, uint32_t n, uint32_t i, void* out) {
+        ansDecodeBlockAvx2<ProbBits, BlockSize>(t, h, n, i, out);
+      };
+    case mans::Isa::Sse42:
+      return [](const uint32_t* t, ANSCoalescedHeader* h, uint32_t n, uint32_t i, void* out) {
+        Scalar::sse42(t, h, n, i, out);
+      };
+    case mans::Isa::Scalar:
+      break;
+  }
+  return [](const uint32_t* t, ANSCoalescedHeader* h, uint32_t n, uint32_t i, void* out) {
+    ansDecodeBlock<ProbBits, BlockSize>(t, h, n, i, out);
+  };
+}
+
+// Where block i goes: out + i * BlockSize, or with out null (verifying only)
+// the thread's block buffer local. Returns the base pointer to hand the
+// decode kernels, which add i * BlockSize themselves.
+template <int BlockSize>
+inline uint8_t* ansBlockOutBase(void* out, uint8_t* local, uint32_t i, uint8_t*& outBlock) {
+  if (out != nullptr) {
+    outBlock = (uint8_t*)out + (size_t)i * BlockSize;
+    return (uint8_t*)out;
+  }
+  outBlock = local;
+  return (uint8_t*)((uintptr_t)local - (uintptr_t)i * BlockSize);
+}
+
+// lookup holds 1 << ProbBits entries per table of the stream; a stream with
+// more than one table has every one built up front and picks one per block
+// from its table index. With prebuilt (the table of the dictionary a stream
+// refers to) nothing is built.
+// With blockBad (numBlocks entries, stream with block checksums) every block
+// is checked right after it is decoded and blockBad[i] set to 1 if it does
+// not match, 0 if it does; out may then be null to only check.
+template <int ProbBits,
+    int BlockSize>
+void ansDecodeKernel_opti(
+    uint32_t* lookup,
+    const void* in,
+    void* out,
+    const mans::Parallel& par,
+    const uint32_t* prebuilt = nullptr,
+    uint8_t* blockBad = nullptr
+    ) {
+  // The stream may start at any byte offset, so everything read from it goes
+  // through loadUnaligned / memcpy; headerIn is only used for address math.
+  auto headerIn = (ANSCoalescedHeader*)in;
+  constexpr uint32_t kTableSize = 1u << ProbBits;
+  ANSCoalescedHeader header;
+  std::memcpy(&header, in, sizeof(header));
+  const ANSDecodeBlockFn decodeBlock = selectDecodeBlock<ProbBits, BlockSize>(header.getWideCoder());
   auto numBlocks = header.getNumBlocks();
-  auto totalUncompressedWords = header.getTotalUncompressedWords();
-  constexpr ANSStateT StateMask = (ANSStateT(1) << ProbBits) - ANSStateT(1);
+  const uint32_t numTables = header.getNumTables();
+  auto buildTable = [&](uint32_t t) {
+    ansBuildDecodeTable(in, t, kTableSize, lookup + t * kTableSize);
+  };
+  const uint32_t* tables = lookup;
+  if (prebuilt != nullptr) {
+    tables = prebuilt;
+  } else if (numTables == 1) {
+    buildTable(0);
+  } else {
+    par.for_range(numTables, [&](size_t first, size_t last) {
+      for (size_t t = first; t < last; ++t) buildTable((uint32_t)t);
+    });
+  }
+  const uint8_t* tableIndex = headerIn->getTableIndex();
   auto blockWordspre = headerIn->getBlockWords(numBlocks);
   auto blockDataInStart = headerIn->getBlockDataStart(numBlocks);
 
   // __builtin_prefetch(headerIn->getWarpStates()[0].warpState, 0, 0);
 
-  #pragma omp parallel proc_bind(spread) num_threads(num_threads)
-  {
+  const ANSChecksumFn blockChecksum = selectChecksum();
+
+  // blocks differ in cost (raw, ANS, skewed or flat), so workers claim
+  // chunks of consecutive blocks as they come free
+  par.for_chunks(numBlocks, [&](size_t first, size_t last) {
     __builtin_prefetch(headerIn->getWarpStates(), 0, 0);
     __builtin_prefetch(blockWordspre, 0, 0);
     __builtin_prefetch(blockDataInStart, 0, 0);
-    // __builtin_prefetch(symbol, 0, 0);
-    // __builtin_prefetch(pdf, 0, 0);
-    // __builtin_prefetch(cdf, 0, 0);
-    int thread_id = omp_get_thread_num();
-    // #pragma omp for schedule(dynamic, 8)
-    // #pragma omp for 
-    for(int i = thread_id; i < numBlocks; i += num_threads){
-    // for(int i = 0; i < numBlocks; i ++){
-      ANSStateT state[kWarpSize];
-      auto State = headerIn->getWarpStates()[i].warpState;
-      #pragma  unroll 16
-      for(int j = 0; j < kWarpSize; j ++){
-          state[j] = State[j];
+    alignas(kBlockAlignment) uint8_t local[BlockSize];  // untouched unless out is null
+    for(uint32_t i = (uint32_t)first; i < last; i ++){
+      uint8_t* outBlock;
+      uint8_t* base = ansBlockOutBase<BlockSize>(out, local, i, outBlock);
+      if (!ansDecodeRawBlock(headerIn, numBlocks, i, outBlock)) {
+        const uint32_t t = numTables > 1 ? tableIndex[i] * kTableSize : 0;
+        decodeBlock(tables + t, headerIn, numBlocks, i, base);
       }
-      auto blockWords = blockWordspre[i];
-      uint32_t uncompressedWords = (blockWords.x >> 16);
-      uint32_t compressedWords = (blockWords.x & 0xffff);
-      uint32_t blockCompressedWordStart = blockWords.y;
-      ANSEncodedT* blockDataIn =
-          blockDataInStart + blockCompressedWordStart;
-      __builtin_prefetch(blockDataIn, 0, 0);
-      uint8_t* outBlock_ = (uint8_t*)out + (i << 12);
-      if(uncompressedWords == kDefaultBlockSize){
-          // #pragma unroll
-          // #pragma omp simd
-          for(int k = kDefaultBlockSize - kWarpSize; k >= 0; k -= kWarpSize){
-            // uint32_t outsym[kWarpSize];
-              // for(int j = kWarpSize - 1; j >= 0; j --){ 
-              //   auto s_bar = state[j] & StateMask;
-              //   state[j] = pdf[s_bar] * (state[j] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              //   uint32_t read = state[j] < kANSMinState;
-              //   compressedWords -= read;
-              //   auto v = blockDataIn[compressedWords];
-              //   state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              //   outBlock_[k + j] = symbol[s_bar];
-              // }
-            
-            uint64_t outsym;
-            uint32_t s_bar;
-            uint32_t read;
-            uint16_t v;
-            SymbolInfo info;
-            int tempk = k >> 3;
-            uint8_t tempoutsym[8];
-            // __builtin_prefetch(blockDataIn + compressedWords, 0, 0);
-            for(int j = kWarpSize - 8, l = 3; j >= 0; j -= 8, l --){
-              int temp = j + 7;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[7] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j] = symbol[s_bar];
-              tempoutsym[7] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[6] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j1] = symbol[s_bar];
-              tempoutsym[6] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[5] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j2] = symbol[s_bar];
-              tempoutsym[5] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[4] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j3] = symbol[s_bar];
-              tempoutsym[4] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[3] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j4] = symbol[s_bar];
-              tempoutsym[3] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[2] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j5] = symbol[s_bar];
-              tempoutsym[2] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[1] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j6] = symbol[s_bar];
-              tempoutsym[1] = symbol[s_bar];
-
-              temp --;
-              s_bar = state[temp] & StateMask;
-              // info = symbol_info[s_bar];
-              // state[temp] = info.y * (state[temp] >> ProbBits) + ANSStateT(info.z);
-              // read = state[temp] < kANSMinState;
-              // compressedWords -= read;
-              // v = blockDataIn[compressedWords];
-              // state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // tempoutsym[0] = info.x;
-              state[temp] = pdf[s_bar] * (state[temp] >> ProbBits) + ANSStateT(cdf[s_bar]);
-              read = state[temp] < kANSMinState;
-              compressedWords -= read;
-              v = blockDataIn[compressedWords];
-              state[temp] = ((state[temp] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-              // outsym = (outsym << 8) | symbol[s_bar];
-              // outBlock_[k + j7] = symbol[s_bar];
-              tempoutsym[0] = symbol[s_bar];
-
-              ((uint64_t*)outBlock_)[tempk + l] = ((uint64_t*)tempoutsym)[0];
-            }
-          }
-      } 
-      else {
-          uint32_t remainder = uncompressedWords & 31;
-          int uncompressedOffset = uncompressedWords - remainder;
-          if(remainder > 0){
-              for(int j = remainder - 1; j >= 0; j --){
-                  // bool valid = j < remainder;
-                  auto s_bar = state[j] & StateMask;
-                  // if(valid){
-                  state[j] = pdf[s_bar] * (state[j] >> ProbBits) + ANSStateT(cdf[s_bar]);
-                  // }
-                  bool read = 
-                  // valid && 
-                  (state[j] < kANSMinState);
-                  compressedWords -= read;
-                  auto v = blockDataIn[compressedWords];
-                  state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-                  // if(valid){
-                  outBlock_[uncompressedOffset + j] = symbol[s_bar];
-                  // }
-                //   if(valid){
-                //       state[j] = pdf[s_bar] * (state[j] >> ProbBits) + ANSStateT(cdf[s_bar]);
-                //   }
-                //   bool read = valid && (state[j] < kANSMinState);
-                // compressedWords -= read;
-                // auto v = blockDataIn[compressedWords];
-                // state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-                //   if(valid){
-                //       outBlock_[uncompressedOffset + j] = symbol[s_bar];
-                //   }
-              }
-          }
-          while(uncompressedOffset > 0){
-              uncompressedOffset -= kWarpSize;
-              for(int j = kWarpSize - 1; j >= 0; j --){
-                  auto s_bar = state[j] & StateMask;
-                  state[j] = pdf[s_bar] * (state[j] >> ProbBits) + ANSStateT(cdf[s_bar]);
-                  bool read = state[j] < kANSMinState;
-                  compressedWords -= read;
-                  auto v = blockDataIn[compressedWords];
-                  state[j] = ((state[j] << (kANSEncodedBits * read)) + ANSStateT(v) * read);
-                  outBlock_[uncompressedOffset + j] = symbol[s_bar];
-              }
-          }
+      if (blockBad != nullptr) {
+        blockBad[i] = ansBlockChecksumBad(blockChecksum, headerIn, numBlocks, i, outBlock);
+      }
+    }
+  });
+}
+
+// Batched decode of numSlices independent streams in two parallel stages:
+// tables are built per slice, then every block of every slice is decoded
+// through one flattened block index. sliceBlockStart is the exclusive prefix
+// of the per-slice block counts (numSlices + 1 entries), sliceTableStart the
+// one of their table counts; tables holds 1 << ProbBits entries per table.
+// Slices with an entry in slicePrebuilt (may be null) use that table and have
+// none of their own.
+// Slices with an entry in sliceBlockBad (may be null) have their blocks
+// checked as in ansDecodeKernel_opti, and those with a null out[s] are only
+// checked.
+template <int ProbBits,
+    int BlockSize>
+void ansDecodeSlices(
+    uint32_t numSlices,
+    const uint8_t* const* in,
+    uint8_t* const* out,
+    const uint32_t* sliceBlockStart,
+    const uint32_t* sliceTableStart,
+    const uint32_t* const* slicePrebuilt,
+    uint32_t* tables,
+    const mans::Parallel& par,
+    uint8_t* const* sliceBlockBad = nullptr
+    ) {
+  constexpr uint32_t kTableSize = 1u << ProbBits;
+  uint32_t totalBlocks = sliceBlockStart[numSlices];
+  // slices may mix coders: pick per slice
+  const ANSDecodeBlockFn decodeBlocks[2] = {selectDecodeBlock<ProbBits, BlockSize>(false),
+                                            selectDecodeBlock<ProbBits, BlockSize>(true)};
+
+  par.for_range(numSlices, [&](size_t first, size_t last) {
+    for(size_t s = first; s < last; s ++){
+      if(sliceBlockStart[s + 1] == sliceBlockStart[s]) continue;
+      for(uint32_t t = sliceTableStart[s]; t < sliceTableStart[s + 1]; t ++){
+        ansBuildDecodeTable(in[s], t - sliceTableStart[s], kTableSize,
+                            tables + (size_t)t * kTableSize);
+      }
+    }
+  });
+
+  const ANSChecksumFn blockChecksum = selectChecksum();
+
+  par.for_chunks(totalBlocks, [&](size_t first, size_t last) {
+    alignas(kBlockAlignment) uint8_t local[BlockSize];  // blocks of slices only checked
+    uint32_t s = std::upper_bound(sliceBlockStart, sliceBlockStart + numSlices + 1,
+                                  (uint32_t)first) - sliceBlockStart - 1;
+    for(uint32_t b = (uint32_t)first; b < last; b ++){
+      while(b >= sliceBlockStart[s + 1]) s ++;
+      const uint32_t i = b - sliceBlockStart[s];
+      auto headerIn = (ANSCoalescedHeader*)in[s];
+      const uint32_t numBlocks = sliceBlockStart[s + 1] - sliceBlockStart[s];
+      uint8_t* outBlock;
+      uint8_t* base = ansBlockOutBase<BlockSize>(out[s], local, i, outBlock);
+      if (!ansDecodeRawBlock(headerIn, numBlocks, i, outBlock)) {
+        const ANSDecodeBlockFn decodeBlock = decodeBlocks[headerIn->getWideCoder()];
+        if(slicePrebuilt != nullptr && slicePrebuilt[s] != nullptr){
+          decodeBlock(slicePrebuilt[s], headerIn, numBlocks, i, base);
+        } else {
+          uint32_t t = sliceTableStart[s];
+          if(sliceTableStart[s + 1] - t > 1) t += headerIn->getTableIndex()[i];
+          decodeBlock(tables + (size_t)t * kTableSize, headerIn, numBlocks, i, base);
+        }
+      }
+      if (sliceBlockBad != nullptr && sliceBlockBad[s] != nullptr) {
+        sliceBlockBad[s][i] = ansBlockChecksumBad(blockChecksum, headerIn, numBlocks, i, outBlock);
+      }
+    }
+  });
+}
+
+// Random access: bytes [offset, offset + size) of the decoded stream at in
+// into out. Only the blocks overlapping them are decoded, straight into out
+// where a block lies inside the range and through the thread's block buffer
+// where it sticks out of it. Only the tables those blocks use are built,
+// into lookup as in ansDecodeKernel_opti; prebuilt as there, and blockBad
+// gets one entry per block overlapping the range.
+template <int ProbBits,
+    int BlockSize>
+void ansDecodeBlockRange(
+    uint32_t* lookup,
+    const void* in,
+    uint64_t offset,
+    size_t size,
+    uint8_t* out,
+    const mans::Parallel& par,
+    const uint32_t* prebuilt = nullptr,
+    uint8_t* blockBad = nullptr
+    ) {
+  auto headerIn = (ANSCoalescedHeader*)in;
+  constexpr uint32_t kTableSize = 1u << ProbBits;
+  ANSCoalescedHeader header;
+  std::memcpy(&header, in, sizeof(header));
+  const ANSDecodeBlockFn decodeBlock = selectDecodeBlock<ProbBits, BlockSize>(header.getWideCoder());
+  const uint32_t numBlocks = header.getNumBlocks();
+  const uint32_t numTables = header.getNumTables();
+  const uint64_t total = header.getTotalUncompressedWords() * sizeof(ANSDecodedT);
+  const uint64_t end = offset + size;
+  const uint32_t first = (uint32_t)(offset / BlockSize);
+  const uint32_t last = (uint32_t)divUp(end, (uint64_t)BlockSize);
+  const uint8_t* tableIndex = headerIn->getTableIndex();
+  const uint32_t* tables = lookup;
+  if (prebuilt != nullptr) {
+    tables = prebuilt;
+  } else if (numTables == 1) {
+    ansBuildDecodeTable(in, 0, kTableSize, lookup);
+  } else {
+    bool built[kANSMaxTables] = {};
+    for (uint32_t i = first; i < last; i ++) {
+      const uint32_t t = tableIndex[i];
+      if (!built[t]) {
+        ansBuildDecodeTable(in, t, kTableSize, lookup + t * kTableSize);
+        built[t] = true;
       }
     }
   }
+  const ANSChecksumFn blockChecksum = selectChecksum();
+
+  par.for_chunks(last - first, [&](size_t begin, size_t stop) {
+    alignas(kBlockAlignment) uint8_t local[BlockSize];  // blocks sticking out of the range
+    for (uint32_t i = first + (uint32_t)begin; i < first + stop; i ++) {
+      const uint64_t blockStart = (uint64_t)i * BlockSize;
+      const uint64_t blockEnd = std::min(blockStart + BlockSize, total);
+      const bool inside = blockStart >= offset && blockEnd <= end;
+      uint8_t* outBlock = inside ? out + (blockStart - offset) : local;
+      // the kernels add i * BlockSize to the base they get
+      uint8_t* base = (uint8_t*)((uintptr_t)outBlock - (uintptr_t)blockStart);
+      if (!ansDecodeRawBlock(headerIn, numBlocks, i, outBlock)) {
+        const uint32_t t = numTables > 1 ? tableIndex[i] * kTableSize : 0;
+        decodeBlock(tables + t, headerIn, numBlocks, i, base);
+      }
+      if (blockBad != nullptr) {
+        blockBad[i - first] = ansBlockChecksumBad(blockChecksum, headerIn, numBlocks, i, outBlock);
+      }
+      if (!inside) {
+        const uint64_t from = std::max(blockStart, offset);
+        std::memcpy(out + (from - offset), local + (from - blockStart),
+                    std::min(blockEnd, end) - from);
+      }
+    }
+  });
 }
 
+// precision and blockSize are the ones in the stream header (validated by
+// the caller)
 void ansDecode(
-    uint32_t* symbol,
-    uint32_t* pdf,
-    uint32_t* cdf,
+    uint32_t* lookup,
     int precision,
-    uint8_t* in,
-    uint8_t* out
+    uint32_t blockSize,
+    const uint8_t* in,
+    uint8_t* out,
+    const mans::Parallel& par,
+    const uint32_t* prebuilt = nullptr,
+    uint8_t* blockBad = nullptr
     ) {
   
   {
 #define RUN_DECODE(BITS)                                           \
-  do { ansDecodeKernel_opti<BITS, kDefaultBlockSize>(symbol, pdf, cdf, in, out);} while (false)   \
+  do { dispatchBlockSize(blockSize, [&](auto bs) { \
+    ansDecodeKernel_opti<BITS, decltype(bs)::value>(lookup, in, out, par, prebuilt, blockBad); }); } while (false)
     
     switch (precision) {
       case 9:
@@ -344,6 +613,9 @@ void ansDecode(
       case 11:
         RUN_DECODE(11);
         break;
+      case 12:
+        RUN_DECODE(12);
+        break;
       default:
         std::cout << "unhandled pdf precision " << precision << std::endl;
     }
@@ -351,6 +623,77 @@ void ansDecode(
 #undef RUN_DECODE
   }
 }
+void ansDecodeRange(
+    uint32_t* lookup,
+    int precision,
+    uint32_t blockSize,
+    const uint8_t* in,
+    uint64_t offset,
+    size_t size,
+    uint8_t* out,
+    const mans::Parallel& par,
+    const uint32_t* prebuilt = nullptr,
+    uint8_t* blockBad = nullptr
+    ) {
+#define RUN_DECODE(BITS)                                           \
+  do { dispatchBlockSize(blockSize, [&](auto bs) { \
+    ansDecodeBlockRange<BITS, decltype(bs)::value>(lookup, in, offset, size, out, par, prebuilt, blockBad); }); } while (false)
+
+  switch (precision) {
+    case 9:
+      RUN_DECODE(9);
+      break;
+    case 10:
+      RUN_DECODE(10);
+      break;
+    case 11:
+      RUN_DECODE(11);
+      break;
+    case 12:
+      RUN_DECODE(12);
+      break;
+    default:
+      std::cout << "unhandled pdf precision " << precision << std::endl;
+  }
+
+#undef RUN_DECODE
+}
+void ansDecodeBatch(
+    int precision,
+    uint32_t blockSize,
+    uint32_t numSlices,
+    const uint8_t* const* in,
+    uint8_t* const* out,
+    const uint32_t* sliceBlockStart,
+    const uint32_t* sliceTableStart,
+    const uint32_t* const* slicePrebuilt,
+    uint32_t* tables,
+    const mans::Parallel& par,
+    uint8_t* const* sliceBlockBad = nullptr
+    ) {
+#define RUN_DECODE(BITS)                                           \
+  do { dispatchBlockSize(blockSize, [&](auto bs) { \
+    ansDecodeSlices<BITS, decltype(bs)::value>(numSlices, in, out, sliceBlockStart, sliceTableStart, slicePrebuilt, tables, par, sliceBlockBad); }); } while (false)
+
+  switch (precision) {
+    case 9:
+      RUN_DECODE(9);
+      break;
+    case 10:
+      RUN_DECODE(10);
+      break;
+    case 11:
+      RUN_DECODE(11);
+      break;
+    case 12:
+      RUN_DECODE(12);
+      break;
+    default:
+      std::cout << "unhandled pdf precision " << precision << std::endl;
+  }
+
+#undef RUN_DECODE
+}
 } // namespace 
 
 #endif
@@ -0,0 +1,239 @@
+/**
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef CPU_ANS_INCLUDE_ANS_CPUANSDECODESIMD_H
+#define CPU_ANS_INCLUDE_ANS_CPUANSDECODESIMD_H
+
+#pragma once
+
+#include "CpuANSUtils.h"
+#include "../cpu_isa.h"
+
+// Vector versions of ansDecodeBlock. The 32 states of a block are held in two
+// 16-lane (AVX-512) or four 8-lane (AVX2) registers and a whole row of 32
+// symbols is decoded per iteration, with a single gather per vector into the
+// packed lookup table (packDecodeLookup: cdf [31:20], pdf - 1 [19:8], sym [7:0]).
+//
+// The scalar decoder walks lanes 31..0 and every lane that drops below
+// kANSMinState takes the next word going down the stream. For one vector that
+// means the set lanes of the read mask, in ascending order, take the n words
+// just below the current position in ascending order, which is exactly what
+// a compress-store undone (vpexpandd, or a permute from a per-mask table)
+// produces. The upper vectors are renormalized first.
+
+namespace cpu_ans {
+
+// ---------------- AVX-512 (F + BW + VL), 16 lanes ----------------
+
+template <int ProbBits>
+__attribute__((target(MANS_TARGET_AVX512), always_inline))
+inline __m512i ansDecodeStepAvx512(
+    __m512i& state,
+    __mmask16& read,
+    __mmask16 active,
+    const int* __restrict__ lookup) {
+  const __m512i slot = _mm512_and_si512(state, _mm512_set1_epi32((1 << ProbBits) - 1));
+  const __m512i e = _mm512_i32gather_epi32(slot, lookup, 4);
+  const __m512i pdf = _mm512_add_epi32(
+      _mm512_and_si512(_mm512_srli_epi32(e, 8), _mm512_set1_epi32(0xfff)), _mm512_set1_epi32(1));
+  const __m512i cdf = _mm512_srli_epi32(e, 20);
+  const __m512i s = _mm512_add_epi32(
+      _mm512_mullo_epi32(pdf, _mm512_srli_epi32(state, ProbBits)), cdf);
+  state = _mm512_mask_mov_epi32(state, active, s);
+  read = _mm512_mask_cmplt_epu32_mask(active, state, _mm512_set1_epi32(kANSMinState));
+  return e;
+}
+
+// Shifts the next words below compressedWords into the lanes set in read
+__attribute__((target(MANS_TARGET_AVX512), always_inline))
+inline void ansDecodeRenormAvx512(
+    __m512i& state,
+    __mmask16 read,
+    const ANSEncodedT* __restrict__ blockDataIn,
+    uint32_t& compressedWords) {
+  const uint32_t n = _mm_popcnt_u32(read);
+  compressedWords -= n;
+  const __m256i words = _mm256_maskz_loadu_epi16(
+      (__mmask16)((1u << n) - 1), blockDataIn + (int32_t)compressedWords);
+  const __m512i w = _mm512_maskz_expand_epi32(read, _mm512_cvtepu16_epi32(words));
+  state = _mm512_mask_add_epi32(
+      state, read, _mm512_slli_epi32(state, kANSEncodedBits), w);
+}
+
+template <int ProbBits, int BlockSize>
+__attribute__((target(MANS_TARGET_AVX512)))
+void ansDecodeBlockAvx512(
+    const uint32_t* __restrict__ lookup,
+    ANSCoalescedHeader* headerIn,
+    uint32_t numBlocks,
+    uint32_t i,
+    void* out) {
+  const int* tab = (const int*)lookup;
+  auto blockWords = headerIn->loadBlockWords(numBlocks, i);
+  uint32_t uncompressedWords = getBlockUncompressedWords(blockWords.x);
+  uint32_t compressedWords = getBlockCompressedWords(blockWords.x);
+  const ANSEncodedT* blockDataIn =
+      headerIn->getBlockDataStart(numBlocks) + blockWords.start;
+  uint8_t* outBlock = (uint8_t*)out + (size_t)i * BlockSize;
+
+  const uint32_t* warpState = (const uint32_t*)(headerIn->getWarpStates() + i);
+  __m512i state0 = _mm512_loadu_si512(warpState);
+  __m512i state1 = _mm512_loadu_si512(warpState + 16);
+  __mmask16 read0, read1;
+
+  uint32_t rows = uncompressedWords / kWarpSize;
+  uint32_t tail = uncompressedWords % kWarpSize;
+  // a partial last row was encoded last, so it is decoded first
+  if (tail) {
+    __mmask16 active0 = tail >= 16 ? 0xFFFF : (__mmask16)((1u << tail) - 1);
+    __mmask16 active1 = tail > 16 ? (__mmask16)((1u << (tail - 16)) - 1) : 0;
+    __m512i e0 = ansDecodeStepAvx512<ProbBits>(state0, read0, active0, tab);
+    __m512i e1 = ansDecodeStepAvx512<ProbBits>(state1, read1, active1, tab);
+    ansDecodeRenormAvx512(state1, read1, blockDataIn, compressedWords);
+    ansDecodeRenormAvx512(state0, read0, blockDataIn, compressedWords);
+    ansClampWordPosition(compressedWords);
+    uint8_t* row = outBlock + rows * kWarpSize;
+    _mm_mask_storeu_epi8(row, active0, _mm512_cvtepi32_epi8(e0));
+    _mm_mask_storeu_epi8(row + 16, active1, _mm512_cvtepi32_epi8(e1));
+  }
+
+  for (int r = (int)rows - 1; r >= 0; --r) {
+    __m512i e0 = ansDecodeStepAvx512<ProbBits>(state0, read0, 0xFFFF, tab);
+    __m512i e1 = ansDecodeStepAvx512<ProbBits>(state1, read1, 0xFFFF, tab);
+    ansDecodeRenormAvx512(state1, read1, blockDataIn, compressedWords);
+    ansDecodeRenormAvx512(state0, read0, blockDataIn, compressedWords);
+    ansClampWordPosition(compressedWords);
+    uint8_t* row = outBlock + r * kWarpSize;
+    _mm_storeu_si128((__m128i*)row, _mm512_cvtepi32_epi8(e0));
+    _mm_storeu_si128((__m128i*)(row + 16), _mm512_cvtepi32_epi8(e1));
+  }
+}
+
+// ---------------- AVX2, 8 lanes ----------------
+
+// vpermd controls for the AVX2 renormalization: with the 8 words below the
+// stream position loaded into lanes 0..7, the k-th set lane of mask m takes
+// word 8 - popcount(m) + k
+struct ANSExpand8Table {
+  alignas(32) uint32_t index[256][8];
+  constexpr ANSExpand8Table() : index() {
+    for (int m = 0; m < 256; ++m) {
+      int n = 0;
+      for (int lane = 0; lane < 8; ++lane) n += (m >> lane) & 1;
+      int k = 0;
+      for (int lane = 0; lane < 8; ++lane) {
+        index[m][lane] = (m & (1 << lane)) ? uint32_t(8 - n + k++) : 0;
+      }
+    }
+  }
+};
+
+inline constexpr ANSExpand8Table kANSExpand8{};
+
+template <int ProbBits>
+__attribute__((target(MANS_TARGET_AVX2), always_inline))
+inline __m256i ansDecodeStepAvx2(
+    __m256i& state,
+    __m256i& read,
+    __m256i active,
+    const int* __restrict__ lookup) {
+  const __m256i slot = _mm256_and_si256(state, _mm256_set1_epi32((1 << ProbBits) - 1));
+  const __m256i e = _mm256_i32gather_epi32(lookup, slot, 4);
+  const __m256i pdf = _mm256_add_epi32(
+      _mm256_and_si256(_mm256_srli_epi32(e, 8), _mm256_set1_epi32(0xfff)), _mm256_set1_epi32(1));
+  const __m256i cdf = _mm256_srli_epi32(e, 20);
+  const __m256i s = _mm256_add_epi32(
+      _mm256_mullo_epi32(pdf, _mm256_srli_epi32(state, ProbBits)), cdf);
+  state = _mm256_blendv_epi8(state, s, active);
+  // states stay below 2^31, so the signed compare is enough
+  read = _mm256_and_si256(active, _mm256_cmpgt_epi32(_mm256_set1_epi32(kANSMinState), state));
+  return _mm256_and_si256(e, _mm256_set1_epi32(0xff));
+}
+
+// The 8 words ending at compressedWords are always loaded: everything in
+// front of the block data (earlier blocks, the block words and the header)
+// belongs to the same stream, so the read stays inside it.
+__attribute__((target(MANS_TARGET_AVX2), always_inline))
+inline void ansDecodeRenormAvx2(
+    __m256i& state,
+    __m256i read,
+    const ANSEncodedT* __restrict__ blockDataIn,
+    uint32_t& compressedWords) {
+  const uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(read));
+  const __m256i words = _mm256_cvtepu16_epi32(
+      _mm_loadu_si128((const __m128i*)(blockDataIn + int(compressedWords) - 8)));
+  compressedWords -= _mm_popcnt_u32(mask);
+  const __m256i w = _mm256_permutevar8x32_epi32(
+      words, _mm256_load_si256((const __m256i*)kANSExpand8.index[mask]));
+  state = _mm256_blendv_epi8(
+      state, _mm256_add_epi32(_mm256_slli_epi32(state, kANSEncodedBits), w), read);
+}
+
+// Packs the symbols of four 8-lane vectors (values 0..255) into 32 bytes in
+// lane order
+__attribute__((target(MANS_TARGET_AVX2), always_inline))
+inline __m256i ansPackSymbolsAvx2(const __m256i* sym) {
+  const __m256i p01 = _mm256_packus_epi32(sym[0], sym[1]);
+  const __m256i p23 = _mm256_packus_epi32(sym[2], sym[3]);
+  return _mm256_permutevar8x32_epi32(
+      _mm256_packus_epi16(p01, p23), _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+template <int ProbBits, int BlockSize>
+__attribute__((target(MANS_TARGET_AVX2)))
+void ansDecodeBlockAvx2(
+    const uint32_t* __restrict__ lookup,
+    ANSCoalescedHeader* headerIn,
+    uint32_t numBlocks,
+    uint32_t i,
+    void* out) {
+  const int* tab = (const int*)lookup;
+  auto blockWords = headerIn->loadBlockWords(numBlocks, i);
+  uint32_t uncompressedWords = getBlockUncompressedWords(blockWords.x);
+  uint32_t compressedWords = getBlockCompressedWords(blockWords.x);
+  const ANSEncodedT* blockDataIn =
+      headerIn->getBlockDataStart(numBlocks) + blockWords.start;
+  uint8_t* outBlock = (uint8_t*)out + (size_t)i * BlockSize;
+
+  const uint32_t* warpState = (const uint32_t*)(headerIn->getWarpStates() + i);
+  __m256i state[4], read[4], sym[4];
+  for (int v = 0; v < 4; ++v) {
+    state[v] = _mm256_loadu_si256((const __m256i*)(warpState + 8 * v));
+  }
+  const __m256i all = _mm256_set1_epi32(-1);
+
+  uint32_t rows = uncompressedWords / kWarpSize;
+  uint32_t tail = uncompressedWords % kWarpSize;
+  if (tail) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (int v = 0; v < 4; ++v) {
+      __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(tail) - 8 * v), lane);
+      sym[v] = ansDecodeStepAvx2<ProbBits>(state[v], read[v], active, tab);
+    }
+    for (int v = 3; v >= 0; --v) {
+      ansDecodeRenormAvx2(state[v], read[v], blockDataIn, compressedWords);
+    }
+    ansClampWordPosition(compressedWords);
+    alignas(32) uint8_t row[kWarpSize];
+    _mm256_store_si256((__m256i*)row, ansPackSymbolsAvx2(sym));
+    std::memcpy(outBlock + rows * kWarpSize, row, tail);
+  }
+
+  for (int r = (int)rows - 1; r >= 0; --r) {
+    for (int v = 0; v < 4; ++v) {
+      sym[v] = ansDecodeStepAvx2<ProbBits>(state[v], read[v], all, tab);
+    }
+    for (int v = 3; v >= 0; --v) {
+      ansDecodeRenormAvx2(state[v], read[v], blockDataIn, compressedWords);
+    }
+    ansClampWordPosition(compressedWords);
+    _mm256_storeu_si256((__m256i*)(outBlock + r * kWarpSize), ansPackSymbolsAvx2(sym));
+  }
+}
+
+} // namespace cpu_ans
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef CPU_ANS_INCLUDE_ANS_CPUANSDICTIONARY_H
+#define CPU_ANS_INCLUDE_ANS_CPUANSDICTIONARY_H
+
+#pragma once
+
+#include "CpuANSEncode.h"
+#include "CpuANSDecode.h"
+
+// ---------------- Dictionaries ----------------
+//
+// A dictionary is a normalized table trained on sample inputs. Streams coded
+// with it carry its ID (kANSDictionaryRefSize bytes) instead of 512 bytes of
+// probabilities, and neither side computes weights or builds tables for
+// them: the encode table and the decode tables are built once, when the
+// dictionary is loaded.
+
+namespace cpu_ans {
+
+constexpr uint32_t kANSDictionaryMagic = 0x4349444d;  // "MDIC"
+
+// Serialized dictionary, as written by ansTrainDictionary
+struct ANSDictionaryFile {
+  uint32_t magic;
+  uint32_t id;
+  uint32_t probBits;
+  uint32_t reserved;
+  uint16_t probs[kNumSymbols];
+};
+
+struct ANSDictionary {
+  uint16_t probs[kNumSymbols];
+  ANSEncodeDictionary encode;
+  std::vector<uint32_t> lookup;  // packed decode table
+};
+
+// ID of a table when the trainer is not given one: FNV-1a of the precision
+// and the probabilities, never 0
+inline uint32_t ansDictionaryHash(uint32_t probBits, const uint16_t* probs) {
+  uint32_t h = 2166136261u;
+  auto mix = [&](uint8_t byte) { h = (h ^ byte) * 16777619u; };
+  for (int k = 0; k < 4; ++k) mix((uint8_t)(probBits >> (8 * k)));
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    mix((uint8_t)probs[i]);
+    mix((uint8_t)(probs[i] >> 8));
+  }
+  return h != 0 ? h : 1;
+}
+
+// Normalizes the summed symbol counts of the training samples into file, at
+// precision (or the one kANSAutoProbBits picks for them), under id (0: from
+// the table). Symbols no sample has get no share; inputs containing one are
+// coded with a table of their own. false if there are no counts or the
+// precision is not supported.
+inline bool ansTrainDictionary(
+    const uint64_t* counts, int precision, uint32_t id, ANSDictionaryFile& file) {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < kNumSymbols; ++i) total += counts[i];
+  if (total == 0) return false;
+  if (precision == kANSAutoProbBits) {
+    precision = ansChooseProbBits(total, counts);
+  }
+  if (precision < kANSMinProbBits || precision > kANSMaxProbBits) return false;
+
+  uint4 table[kNumSymbols];
+  file = {};
+  file.magic = kANSDictionaryMagic;
+  file.probBits = precision;
+  ansCalcWeights(precision, total, counts, file.probs, table);
+  file.id = id != 0 ? id : ansDictionaryHash(file.probBits, file.probs);
+  return true;
+}
+
+// Checks a serialized dictionary and builds its tables into dict
+inline bool ansLoadDictionary(const void* data, size_t size, ANSDictionary& dict) {
+  if (size < sizeof(ANSDictionaryFile)) return false;
+  ANSDictionaryFile file;
+  std::memcpy(&file, data, sizeof(file));
+  if (file.magic != kANSDictionaryMagic || file.id == 0 ||
+      (int)file.probBits < kANSMinProbBits || (int)file.probBits > kANSMaxProbBits) {
+    return false;
+  }
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i < kNumSymbols; ++i) sum += file.probs[i];
+  if (sum != 1u << file.probBits) return false;
+
+  ANSEncodeDictionary& encode = dict.encode;
+  encode.id = file.id;
+  encode.probBits = file.probBits;
+  std::memcpy(dict.probs, file.probs, sizeof(dict.probs));
+  ansBuildEncodeTable(dict.probs, encode.table);
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    encode.bits[i] = dict.probs[i] != 0
+        ? encode.probBits - std::log2((float)dict.probs[i]) : -1.0f;
+  }
+  const size_t slots = size_t(1) << encode.probBits;
+  dict.lookup.resize(slots);
+  ansBuildDecodeTable(dict.probs, (uint32_t)slots, dict.lookup.data());
+  return true;
+}
+
+} // namespace cpu_ans
+
+#endif
@@ -10,449 +10,478 @@
 #pragma once
 
 #include "CpuANSUtils.h"
+#include "CpuANSCompact.h"
+#include "CpuANSEncodeSimd.h"
+#include "CpuANSWide.h"
+#include "CpuANSChecksum.h"
+#include "../cpu_isa.h"
+#include "../executor.h"
 
 namespace cpu_ans {
 
-constexpr uint32_t kAlign = 32;
-constexpr int kPrefetchAhead = 2;
+// ---------------- Histogram ----------------
+//
+// One engine for every input size. Each worker counts a contiguous range into
+// kANSHistogramTables interleaved 32-bit tables, byte j of a load going to
+// table j % kANSHistogramTables: a run of equal bytes then increments four
+// different counters in turn instead of waiting on the store of the previous
+// increment. The tables are folded into 64-bit per-worker counts, which the
+// calling thread adds up.
 
-uint32_t getAlignmentRoundUp(uint32_t alignment, const void* ptr) {
-    uintptr_t addr = reinterpret_cast<uintptr_t>(ptr);
-    uint32_t mod = addr % alignment;
-    return mod == 0 ? 0 : alignment - mod;
-}
-
-
-__attribute__((target("avx2")))
-void processBlock(const __restrict uint8_t* in, uint32_t size, uint32_t* __restrict localHist) {
-    uint32_t roundUp = std::min(size, static_cast<uint32_t>(getAlignmentRoundUp(kAlign, in)));
-    for (uint32_t i = 0; i < roundUp; ++i) {
-        ++localHist[in[i]]; 
-    }
+constexpr int kANSHistogramTables = 4;
 
-    const uint8_t* alignedIn = in + roundUp;
-    uint32_t remaining = size - roundUp;
-    uint32_t numChunks = remaining / kAlign;
+// A table sees a quarter of every chunk, so its counters stay below 2^32
+constexpr size_t kANSHistogramChunk = size_t(1) << 32;
 
-    const __m256i* avxIn = reinterpret_cast<const __m256i*>(alignedIn);
-    for (uint32_t i = 0; i < numChunks; ++i) {
-        const __m256i vec = _mm256_load_si256(avxIn + i);
-        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(avxIn + i);
-        
-        _mm_prefetch(reinterpret_cast<const char*>(avxIn + i + 1), _MM_HINT_T0);
-        
-      
-        uint32_t v0 = bytes[0], v1 = bytes[1], v2 = bytes[2], v3 = bytes[3];
-        uint32_t v4 = bytes[4], v5 = bytes[5], v6 = bytes[6], v7 = bytes[7];
-        ++localHist[v0]; ++localHist[v1]; ++localHist[v2]; ++localHist[v3];
-        ++localHist[v4]; ++localHist[v5]; ++localHist[v6]; ++localHist[v7];
-
-        uint32_t v8 = bytes[8], v9 = bytes[9], v10 = bytes[10], v11 = bytes[11];
-        uint32_t v12 = bytes[12], v13 = bytes[13], v14 = bytes[14], v15 = bytes[15];
-        ++localHist[v8]; ++localHist[v9]; ++localHist[v10]; ++localHist[v11];
-        ++localHist[v12]; ++localHist[v13]; ++localHist[v14]; ++localHist[v15];
-
-        uint32_t v16 = bytes[16], v17 = bytes[17], v18 = bytes[18], v19 = bytes[19];
-        uint32_t v20 = bytes[20], v21 = bytes[21], v22 = bytes[22], v23 = bytes[23];
-        ++localHist[v16]; ++localHist[v17]; ++localHist[v18]; ++localHist[v19];
-        ++localHist[v20]; ++localHist[v21]; ++localHist[v22]; ++localHist[v23];
-
-        uint32_t v24 = bytes[24], v25 = bytes[25], v26 = bytes[26], v27 = bytes[27];
-        uint32_t v28 = bytes[28], v29 = bytes[29], v30 = bytes[30], v31 = bytes[31];
-        ++localHist[v24]; ++localHist[v25]; ++localHist[v26]; ++localHist[v27];
-        ++localHist[v28]; ++localHist[v29]; ++localHist[v30]; ++localHist[v31];
-    }
+// Smallest range worth handing to another worker (below it the wake-up and the
+// merge cost more than the counting)
+constexpr size_t kANSHistogramBytesPerWorker = size_t(256) << 10;
 
-    const uint8_t* tail = alignedIn + numChunks * kAlign;
-    uint32_t remainingTail = remaining % kAlign;
-    
-    if (remainingTail >= 8) {
-        const uint8_t* chunk = tail;
-        ++localHist[chunk[0]]; ++localHist[chunk[1]]; 
-        ++localHist[chunk[2]]; ++localHist[chunk[3]];
-        ++localHist[chunk[4]]; ++localHist[chunk[5]];
-        ++localHist[chunk[6]]; ++localHist[chunk[7]];
-        tail += 8;
-        remainingTail -= 8;
-    }
-    switch (remainingTail) {
-        case 7: ++localHist[tail[6]];
-        case 6: ++localHist[tail[5]];
-        case 5: ++localHist[tail[4]];
-        case 4: ++localHist[tail[3]];
-        case 3: ++localHist[tail[2]];
-        case 2: ++localHist[tail[1]];
-        case 1: ++localHist[tail[0]];
-        default: break;
-    }
-}
-
-void ansHistogram_v0(
+// in[0, size) into counts[kANSHistogramTables * kNumSymbols], which is added to
+inline void ansHistogramCount(
     const uint8_t* __restrict in,
-    uint32_t size,
-    uint32_t* __restrict out,
-    bool multithread = true) {
-      std::memset(out, 0, kNumSymbols * sizeof(uint32_t));
-      // for(int i = 0; i < size; i ++){
-      //   out[in[i]]++;
-      // }
-    
-
-    if (size < 100000 || !multithread) {
-        alignas(64) uint32_t localHist[kNumSymbols] = {0};
-        processBlock(in, size, localHist);
-        
-        for (int i = 0; i < kNumSymbols; i += 8) {
-            _mm256_store_si256(
-                reinterpret_cast<__m256i*>(out + i),
-                _mm256_add_epi32(
-                    _mm256_load_si256(reinterpret_cast<const __m256i*>(out + i)),
-                    _mm256_load_si256(reinterpret_cast<const __m256i*>(localHist + i))
-                )
-            );
-        }
-        return;
-    }
-
-    const unsigned numThreads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    alignas(64) std::vector<uint32_t> histograms(numThreads * kNumSymbols, 0);
-
-    const uint32_t blockSize = (size + numThreads * 4 - 1) / (numThreads * 4);
-    std::atomic<uint32_t> currentBlock(0);
-
-    for (unsigned t = 0; t < numThreads; ++t) {
-        threads.emplace_back([&, t]() {
-            cpu_set_t cpuset;
-            CPU_ZERO(&cpuset);
-            CPU_SET(t % numThreads, &cpuset);
-            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-
-            uint32_t* localHist = &histograms[t * kNumSymbols];
-            while (true) {
-                const uint32_t blockIdx = currentBlock.fetch_add(1);
-                const uint32_t start = blockIdx * blockSize;
-                if (start >= size) break;
-                const uint32_t end = std::min(start + blockSize, size);
-                processBlock(in + start, end - start, localHist);
-            }
-        });
-    }
-
-    for (auto& thread : threads) {
-        thread.join();
-    }
-    
-    for (unsigned t = 0; t < numThreads; ++t) {
-        const uint32_t* src = &histograms[t * kNumSymbols];
-        #pragma omp simd aligned(src, out:64)
-        for (int i = 0; i < kNumSymbols; ++i) {
-            out[i] += src[i];
-        }
-    }
+    size_t size,
+    uint32_t* __restrict counts) {
+  uint32_t* __restrict c0 = counts;
+  uint32_t* __restrict c1 = counts + kNumSymbols;
+  uint32_t* __restrict c2 = counts + 2 * kNumSymbols;
+  uint32_t* __restrict c3 = counts + 3 * kNumSymbols;
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint64_t a, b;
+    std::memcpy(&a, in + i, sizeof(a));
+    std::memcpy(&b, in + i + 8, sizeof(b));
+    ++c0[a & 0xff]; ++c1[(a >> 8) & 0xff]; ++c2[(a >> 16) & 0xff]; ++c3[(a >> 24) & 0xff];
+    ++c0[(a >> 32) & 0xff]; ++c1[(a >> 40) & 0xff]; ++c2[(a >> 48) & 0xff]; ++c3[a >> 56];
+    ++c0[b & 0xff]; ++c1[(b >> 8) & 0xff]; ++c2[(b >> 16) & 0xff]; ++c3[(b >> 24) & 0xff];
+    ++c0[(b >> 32) & 0xff]; ++c1[(b >> 40) & 0xff]; ++c2[(b >> 48) & 0xff]; ++c3[b >> 56];
+  }
+  for (; i < size; ++i) {
+    ++c0[in[i]];
+  }
 }
 
-void processBlock_v1(const uint8_t* in, uint32_t size, uint32_t* localHist) {
-    if (size > kAlign) {
-        __builtin_prefetch(in + kAlign, 0, 0);
-    }
-    uint32_t roundUp = std::min(size, static_cast<uint32_t>(getAlignmentRoundUp(kAlign, in)));
-    for (uint32_t i = 0; i < roundUp; ++i) {
-        ++localHist[in[i]];
-    }
-
-    const uint8_t* alignedIn = in + roundUp;
-    uint32_t remaining = size - roundUp;
-    uint32_t numChunks = remaining / kAlign;
-
-    for (uint32_t i = 0; i < numChunks; ++i) {
-        const uint8_t* chunk = alignedIn + i * kAlign;
-        if (i + 1 < numChunks) {
-            __builtin_prefetch(chunk + kAlign, 0, 0);
-        }
-        ++localHist[chunk[0]]; ++localHist[chunk[1]]; ++localHist[chunk[2]]; ++localHist[chunk[3]];
-        ++localHist[chunk[4]]; ++localHist[chunk[5]]; ++localHist[chunk[6]]; ++localHist[chunk[7]];
-        ++localHist[chunk[8]]; ++localHist[chunk[9]]; ++localHist[chunk[10]]; ++localHist[chunk[11]];
-        ++localHist[chunk[12]]; ++localHist[chunk[13]]; ++localHist[chunk[14]]; ++localHist[chunk[15]];
-        ++localHist[chunk[16]]; ++localHist[chunk[17]]; ++localHist[chunk[18]]; ++localHist[chunk[19]];
-        ++localHist[chunk[20]]; ++localHist[chunk[21]]; ++localHist[chunk[22]]; ++localHist[chunk[23]];
-        ++localHist[chunk[24]]; ++localHist[chunk[25]]; ++localHist[chunk[26]]; ++localHist[chunk[27]];
-        ++localHist[chunk[28]]; ++localHist[chunk[29]]; ++localHist[chunk[30]]; ++localHist[chunk[31]];
-    }
+// out[s] += the kANSHistogramTables counts of s
+inline void ansHistogramFold(
+    const uint32_t* __restrict counts,
+    uint64_t* __restrict out) {
+  #pragma omp simd
+  for (int s = 0; s < kNumSymbols; ++s) {
+    out[s] += (uint64_t)counts[s] + counts[kNumSymbols + s] +
+        counts[2 * kNumSymbols + s] + counts[3 * kNumSymbols + s];
+  }
+}
 
-    const uint8_t* tail = alignedIn + numChunks * kAlign;
-    uint32_t remainingTail = remaining % kAlign;
-    
-    if (remainingTail >= 8) {
-        ++localHist[tail[0]]; ++localHist[tail[1]];
-        ++localHist[tail[2]]; ++localHist[tail[3]];
-        ++localHist[tail[4]]; ++localHist[tail[5]];
-        ++localHist[tail[6]]; ++localHist[tail[7]];
-        tail += 8;
-        remainingTail -= 8;
+// out[s] = the sum of partial[w * kNumSymbols + s] over numPartial workers
+inline void ansHistogramReduce(
+    const uint64_t* __restrict partial,
+    int numPartial,
+    uint64_t* __restrict out) {
+  #pragma omp simd
+  for (int s = 0; s < kNumSymbols; ++s) {
+    out[s] = partial[s];
+  }
+  for (int w = 1; w < numPartial; ++w) {
+    const uint64_t* __restrict src = partial + (size_t)w * kNumSymbols;
+    #pragma omp simd
+    for (int s = 0; s < kNumSymbols; ++s) {
+      out[s] += src[s];
     }
+  }
+}
 
-    switch (remainingTail) {
-        case 7: ++localHist[tail[6]];
-        case 6: ++localHist[tail[5]];
-        case 5: ++localHist[tail[4]];
-        case 4: ++localHist[tail[3]];
-        case 3: ++localHist[tail[2]];
-        case 2: ++localHist[tail[1]];
-        case 1: ++localHist[tail[0]];
-        default: break;
-    }
+// Counts of in[0, size) into out (kNumSymbols entries, overwritten) on one
+// thread
+inline void ansHistogramSerial(const uint8_t* in, size_t size, uint64_t* out) {
+  const auto count = mans::IsaClones<&ansHistogramCount>::select();
+  const auto fold = mans::IsaClones<&ansHistogramFold>::select();
+  alignas(64) uint32_t counts[kANSHistogramTables * kNumSymbols];
+  std::fill(out, out + kNumSymbols, 0);
+  for (size_t done = 0; done < size;) {
+    const size_t chunk = std::min(size - done, kANSHistogramChunk);
+    std::memset(counts, 0, sizeof(counts));
+    count(in + done, chunk, counts);
+    fold(counts, out);
+    done += chunk;
+  }
 }
 
-void ansHistogram_v1(
+// Symbol counts of in[0, size) into out (kNumSymbols entries, overwritten),
+// on at most one worker per kANSHistogramBytesPerWorker bytes
+inline void ansHistogram(
     const uint8_t* in,
-    uint32_t size,
-    uint32_t* out,
-    bool multithread = true) {
-    std::memset(out, 0, kNumSymbols * sizeof(uint32_t));
-
-    if (size < 45 * 100000 || !multithread) {
-        alignas(64) uint32_t localHist[kNumSymbols] = {0};
-        processBlock_v1(in, size, localHist);
-        for (int i = 0; i < kNumSymbols; ++i) {
-            out[i] += localHist[i];
-        }
-        return;
-    }
-
-    const unsigned numThreads = std::thread::hardware_concurrency();
-    std::vector<std::thread> threads;
-    alignas(64) std::vector<uint32_t> histograms(numThreads * kNumSymbols, 0);
-
-    const uint32_t blockSize = (size + numThreads * 4 - 1) / (numThreads * 4);
-    std::atomic<uint32_t> currentBlock(0);
-
-    for (unsigned t = 0; t < numThreads; ++t) {
-        threads.emplace_back([&, t]() {
-            cpu_set_t cpuset;
-            CPU_ZERO(&cpuset);
-            CPU_SET(t % numThreads, &cpuset);
-            pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
-
-            uint32_t* localHist = &histograms[t * kNumSymbols];
-            while (true) {
-                uint32_t blockIdx = currentBlock.fetch_add(1);
-                uint32_t start = blockIdx * blockSize;
-                if (start >= size) break;
-                uint32_t end = std::min(start + blockSize, size);
-                processBlock_v1(in + start, end - start, localHist);
-            }
-        });
-    }
-
-    for (auto& thread : threads) {
-        thread.join();
-    }
-    
-    for (unsigned t = 0; t < numThreads; ++t) {
-        const uint32_t* src = &histograms[t * kNumSymbols];
-        for (int i = 0; i < kNumSymbols; ++i) {
-            out[i] += src[i];
-        }
-    }
-}
+    size_t size,
+    uint64_t* out,
+    const mans::Parallel& par) {
+  const size_t maxWorkers = std::max<size_t>(1, size / kANSHistogramBytesPerWorker);
+  const int numWorkers = (int)std::min<size_t>(par.size(), maxWorkers);
+  if (numWorkers == 1) {
+    ansHistogramSerial(in, size, out);
+    return;
+  }
 
-void ansHistogram_v2(
-    const uint8_t* __restrict in,
-    uint32_t size,
-    uint32_t* __restrict out,
-    bool multithread = true) {
-
-    std::memset(out, 0, kNumSymbols * sizeof(uint32_t));
-    #pragma openmp for
-    for(int i = 0; i < size; i ++)
-        out[in[i]] ++;
+  // ranges start on a cache line
+  const size_t range = ((size + numWorkers - 1) / numWorkers + 63) & ~size_t(63);
+  std::vector<uint64_t> partial((size_t)numWorkers * kNumSymbols);
+  par.workers([&](int worker, int) {
+    const size_t begin = std::min(size, (size_t)worker * range);
+    const size_t end = std::min(size, begin + range);
+    ansHistogramSerial(in + begin, end - begin, &partial[(size_t)worker * kNumSymbols]);
+  }, numWorkers);
+  mans::IsaClones<&ansHistogramReduce>::select()(partial.data(), numWorkers, out);
 }
 
-void ansHistogram_v3(
-    const uint8_t* __restrict in,
-    uint32_t size,
-    uint32_t* __restrict out,
-    bool multithread = true) {
-
-    // std::memset(out, 0, kNumSymbols * sizeof(uint32_t));
-    uint32_t temp[256];
-    #pragma unroll(2)
-    #pragma openmp for reduction
-    for(int i = 0; i < size; i ++)
-        temp[in[i]] ++;
-    memcpy(out, temp, 256*4);
+// Encode lookup of every symbol for the quantized probabilities probs: pdf,
+// cdf, and the magic multiplier and shift that divide by the pdf
+inline void ansBuildEncodeTable(const uint16_t* probs, uint4* table) {
+  uint32_t cdf = 0;
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    uint32_t p = probs[i];
+    // ceil(log2(pdf)); clz(0) is undefined, and only lzcnt happens to give 32
+    uint32_t shift = p > 1 ? 32 - __builtin_clz(p - 1) : 0;
+    // absent symbols are never looked up
+    uint64_t magic = p != 0 ? ((1ULL << 32) * ((1ULL << shift) - p)) / p + 1 : 0;
+    table[i] = {p, cdf, static_cast<uint32_t>(magic), shift};
+    cdf += p;
+  }
 }
 
-template <int one_bits, int kStateCheckMul>
-void ansCalcWeights(
+// Quantizes counts to probabilities summing to 1 << probBits, into probsOut
+// and the encode lookup table. Every symbol gets its floor share, at least 1
+// if it occurs. A shortfall then goes to the lowest symbols, one each; an
+// excess (from the raised rare symbols) is taken back one at a time from the
+// smallest probabilities above 1, lower symbols first on a tie, all of them
+// again while it lasts. O(kNumSymbols), no sorting: this runs once per table
+// and per precision tried, which on small inputs is a good part of the call.
+inline void ansCalcWeights(
     int probBits,
-    uint32_t totalNum,
-    const uint32_t* counts,
+    uint64_t totalNum,
+    const uint64_t* counts,
     uint16_t* __restrict probsOut,
     uint4* table) {
     if (totalNum == 0) return;
     const uint32_t kProbWeight = 1 << probBits;
     int currentSum = 0;
-    // printf("totalNum: %d\n", totalNum);
-    std::vector<uint32_t> qProb(kNumSymbols);
-    std::vector<uint32_t> sortedPairs(kNumSymbols);
+    uint32_t qProb[kNumSymbols];
     for (int i = 0; i < kNumSymbols; ++i) {
         qProb[i] = static_cast<uint32_t>(kProbWeight * ((float)counts[i] / (float)(totalNum)));
         qProb[i] = (counts[i] > 0 && qProb[i] == 0) ? 1U : qProb[i];
-        sortedPairs[i] = (qProb[i] << 16) | i;
         currentSum += qProb[i];
     }
-    // printf("currentSum: %d\n", currentSum);
-
-    // for(int i = 0; i < kNumSymbols; ++i)
-    // printf("i: %d, counts: %d\n", i, counts[i]);
-
-    // #pragma omp single
-    // {
-    //     __gnu_parallel::sort(
-    //         sortedPairs.begin(), 
-    //         sortedPairs.end(),
-    //         [](uint32_t a, uint32_t b) { return a > b; },
-    //         __gnu_parallel::balanced_quicksort_tag()
-    //     );
-    // }
-    std::sort(
-      sortedPairs.begin(),
-      sortedPairs.end(),
-      [](uint32_t a, uint32_t b) { return a > b; }
-    );
-
-    uint32_t tidSymbol[kNumSymbols];
-    for (int i = 0; i < kNumSymbols; ++i) {
-        tidSymbol[i] = sortedPairs[i] & 0xFFFFU;
-        qProb[i] = sortedPairs[i] >> 16;
-    }
-    
-    // for(int i = 0; i < kNumSymbols; ++i)
-    // printf("i: %d, tidSymbol: %d, qProb: %d\n", i, tidSymbol[i], qProb[i]);
-
-    // #pragma omp parallel num_threads(32)
-    // {
-    //     int localSum = 0;
-    //     #pragma omp for schedule(static)
-    //     for (int i = 0; i < kNumSymbols; ++i) {
-    //         localSum += qProb[i];
-    //     }
-    //     #pragma omp atomic
-    //     currentSum += localSum;
-    // }
 
+    // the floor shares lose less than one per symbol, so diff < kNumSymbols
     int diff = static_cast<int>(kProbWeight) - currentSum;
-
     if (diff > 0) {
-      // printf("diff: %d\n", diff);
-      int iterToApply = std::min(diff, static_cast<int>(kNumSymbols));
-      for(int i = diff; i > 0; i -= iterToApply){
-        #pragma omp parallel for num_threads(32) schedule(static)
-        for(int j = 0; j < kNumSymbols; ++j){
-            qProb[j] += (tidSymbol[j] < iterToApply);       
+        for (int i = 0; i < diff; ++i) {
+            qProb[i] += 1;
         }
-      }
     }
-    else{
-      // printf("fucking\n");
-      diff = -diff;
-      while(diff > 0){
-        int qNumGt1s = 0;
-        for(int j = 0; j < kNumSymbols; ++j){
-          qNumGt1s += (int)(qProb[j] > 1);
+    diff = -diff;
+    while (diff > 0) {
+        int numGt1 = 0;
+        for (int i = 0; i < kNumSymbols; ++i) {
+            numGt1 += (int)(qProb[i] > 1);
+        }
+        if (diff >= numGt1) {
+            for (int i = 0; i < kNumSymbols; ++i) {
+                qProb[i] -= (qProb[i] > 1);
+            }
+            diff -= numGt1;
+            continue;
         }
-        int iterToApply = diff < qNumGt1s ? diff : qNumGt1s;
-        int startIndex = qNumGt1s - iterToApply;
-        #pragma omp parallel for num_threads(32) schedule(static)
-        for(int j = startIndex; j < qNumGt1s; ++j){
-          qProb[j] --;
+        // the diff smallest of the (qProb, symbol) pairs above 1: two stable
+        // counting passes over qProb < 2^13 (7 + 6 bits), from symbol order
+        constexpr int kLowBits = 7;
+        uint16_t order[kNumSymbols], byLow[kNumSymbols];
+        uint16_t start[1 << kLowBits];
+        auto countingPass = [&](const uint16_t* from, uint16_t* to, int n, int shift, int buckets) {
+            std::fill(start, start + buckets, 0);
+            for (int k = 0; k < n; ++k) ++start[(qProb[from[k]] >> shift) & (buckets - 1)];
+            for (int b = 0, sum = 0; b < buckets; ++b) {
+                int c = start[b];
+                start[b] = sum;
+                sum += c;
+            }
+            for (int k = 0; k < n; ++k) to[start[(qProb[from[k]] >> shift) & (buckets - 1)]++] = from[k];
+        };
+        int n = 0;
+        for (int i = 0; i < kNumSymbols; ++i) {
+            if (qProb[i] > 1) order[n++] = i;
+        }
+        countingPass(order, byLow, n, 0, 1 << kLowBits);
+        countingPass(byLow, order, n, kLowBits, 1 << (13 - kLowBits));
+        for (int k = 0; k < diff; ++k) {
+            qProb[order[k]] -= 1;
         }
-        // for(int j = 0; j < kNumSymbols; ++j){
-        //   if(j >= startIndex && j < qNumGt1s){
-        //     qProb[j] -= 1;
-        //   }
-        // }
-        diff -= iterToApply;
-      }  
+        diff = 0;
     }
-    uint32_t symPdf[kNumSymbols];
-    #pragma omp for simd schedule(static)
-    for(int i = 0; i < kNumSymbols; i ++){
-      symPdf[tidSymbol[i]] = qProb[i];
+    for (int i = 0; i < kNumSymbols; ++i) {
+        probsOut[i] = qProb[i];
     }
-    // for(int i = 0; i < kNumSymbols; ++i)
-    // printf("i: %d, symPdf: %d\n", i, symPdf[i]);
-    std::vector<uint16_t> cdf(kNumSymbols, 0);
-    uint32_t pp = symPdf[0];
-    probsOut[0] = pp;
-    uint32_t shift0 = 32 - __builtin_clz(pp - 1);
-    uint64_t magic0 = ((1ULL << 32) * ((1ULL << shift0) - pp)) / pp + 1;
-    table[0] = {pp, 0, static_cast<uint32_t>(magic0), shift0
-    // , uint16_t(one_bits - pp)
-    };
-    for (int i = 1; i < kNumSymbols; ++i) {
-        uint32_t p = symPdf[i];
-        probsOut[i] = p;
-        // if(p == 0)
-        // printf("?\n");
-        uint32_t shift = 32 - __builtin_clz(p - 1);
-        
-        uint64_t magic = 0;
-        if(p!= 0)
-        magic = ((1ULL << 32) * ((1ULL << shift) - p)) / p + 1;
-        cdf[i] = cdf[i-1] + symPdf[i-1];
-        // table[i] = {p, cdf[i], static_cast<uint32_t>(magic), shift};
-        table[i] = {p, cdf[i], static_cast<uint32_t>(magic), shift};
-        // printf("i: %d, p: %d, cdf: %d, magic: %d, shift: %d\n", i, p, cdf[i], magic, shift);
-        //, uint16_t(one_bits - p)
-        // };
+    ansBuildEncodeTable(probsOut, table);
+}
+
+// Precision for an input of totalNum symbols with these counts, for the
+// encoders' kANSAutoProbBits. A finer table only loses less to the rounding
+// of the rare symbols, while the decoder rebuilds 1 << probBits slots for
+// every stream and looks them up at random, so:
+//  - the input must be at least kANSAutoBytesPerSlot bytes per table slot
+//    for a precision to be considered at all, and
+//  - of those, the smallest whose estimated coded size is within
+//    kANSAutoSlack of the best one is taken.
+constexpr uint32_t kANSAutoBytesPerSlot = 8;
+constexpr double kANSAutoSlack = 0.005;
+
+// Coded bits of the counts with the probabilities probs of probBits
+inline double ansTableBits(int probBits, const uint64_t* counts, const uint16_t* probs) {
+  double bits = 0;
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    if (counts[i] != 0) bits += counts[i] * (probBits - std::log2(probs[i]));
+  }
+  return bits;
+}
+
+// Coded bits of the counts with the table ansCalcWeights builds for probBits
+inline double ansEstimateBits(int probBits, uint64_t totalNum, const uint64_t* counts) {
+  uint16_t probs[kNumSymbols];
+  uint4 table[kNumSymbols];
+  ansCalcWeights(probBits, totalNum, counts, probs, table);
+  return ansTableBits(probBits, counts, probs);
+}
+
+// Whether the totalNum symbols with these counts are not expected to come out
+// of the coder any shorter with probs. The blocks of such a table are stored
+// (kANSBlockStored) without trying the coder on them first.
+inline bool ansTableStores(
+    int probBits, uint64_t totalNum, const uint64_t* counts, const uint16_t* probs) {
+  return ansTableBits(probBits, counts, probs) >= 8.0 * sizeof(ANSDecodedT) * totalNum;
+}
+
+inline int ansChooseProbBits(uint64_t totalNum, const uint64_t* counts) {
+  int maxBits = kANSMinProbBits;
+  while (maxBits < kANSMaxProbBits &&
+         totalNum >= (uint64_t)kANSAutoBytesPerSlot << (maxBits + 1)) {
+    ++maxBits;
+  }
+  if (maxBits == kANSMinProbBits) return kANSMinProbBits;
+
+  double bits[kANSMaxProbBits + 1];
+  double best = 0;
+  for (int p = kANSMinProbBits; p <= maxBits; ++p) {
+    bits[p] = ansEstimateBits(p, totalNum, counts);
+    best = p == kANSMinProbBits ? bits[p] : std::min(best, bits[p]);
+  }
+  for (int p = kANSMinProbBits; p < maxBits; ++p) {
+    if (bits[p] <= best * (1 + kANSAutoSlack)) return p;
+  }
+  return maxBits;
+}
+
+// ---------------- Segment tables ----------------
+//
+// Data whose distribution drifts along the input codes better with more
+// than one table. The input is cut into segments of whole blocks, each
+// segment is counted on its own, and the segments are then grouped greedily
+// in input order: a segment joins the recently used table whose counts it
+// merges with at the smallest entropy increase, or starts a table of its own
+// when every merge costs more than storing another table would. Segments
+// that come back to an earlier distribution thus share its table.
+
+// Smallest segment: below it a table costs more than it can save
+constexpr size_t kANSMinSegmentBytes = size_t(64) << 10;
+// Segments of one input; larger inputs get longer segments
+constexpr uint32_t kANSMaxSegments = 1024;
+// Recently used tables a segment is compared against
+constexpr uint32_t kANSSegmentSearch = 8;
+// Bits a further table adds to the stream
+constexpr double kANSTableBits = 8.0 * sizeof(uint16_t) * kNumSymbols;
+
+// Blocks per segment of an input of numBlocks blocks, for segments of at least
+// segmentBytes bytes; 0 (no segments) if segmentBytes is
+inline uint32_t ansSegmentBlocks(uint32_t numBlocks, uint32_t blockSize, size_t segmentBytes) {
+  if (segmentBytes == 0) return 0;
+  return std::max<uint32_t>(
+      divUp(std::max(segmentBytes, kANSMinSegmentBytes), (size_t)blockSize),
+      divUp(numBlocks, kANSMaxSegments));
+}
+
+// Most tables an input of numBlocks blocks can be given
+inline uint32_t ansMaxTables(uint32_t numBlocks, uint32_t segmentBlocks) {
+  return segmentBlocks == 0 ? 1 : std::min(kANSMaxTables, divUp(numBlocks, segmentBlocks));
+}
+
+// sum of c log2 c over the counts
+inline double ansSumXLogX(const uint64_t* counts) {
+  double sum = 0;
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    if (counts[i] > 1) sum += counts[i] * std::log2((double)counts[i]);
+  }
+  return sum;
+}
+
+// Groups the segments of in (segmentBlocks blocks each, the last one may be
+// shorter) into at most maxTables tables. Returns the number of tables; their
+// counts go to tableCounts (kNumSymbols per table) and the table of every
+// block to blockTable.
+inline uint32_t ansPlanSegments(
+    const uint8_t* in,
+    size_t inSize,
+    uint32_t blockSize,
+    uint32_t segmentBlocks,
+    uint32_t maxTables,
+    uint64_t* tableCounts,
+    uint8_t* blockTable,
+    const mans::Parallel& par) {
+  const uint32_t numBlocks = divUp(inSize, (size_t)blockSize);
+  const uint32_t numSegments = divUp(numBlocks, segmentBlocks);
+  const size_t segmentBytes = (size_t)segmentBlocks * blockSize;
+  std::vector<uint64_t> segmentCounts((size_t)numSegments * kNumSymbols);
+  par.for_range(numSegments, [&](size_t first, size_t last) {
+    for (size_t g = first; g < last; ++g) {
+      const size_t begin = g * segmentBytes;
+      ansHistogramSerial(in + begin, std::min(inSize - begin, segmentBytes),
+                         &segmentCounts[g * kNumSymbols]);
+    }
+  });
+
+  // per table: symbols and sum of c log2 c; cost = n log2 n - sum
+  std::vector<double> tableSymbols(maxTables), tableSum(maxTables);
+  uint32_t recent[kANSSegmentSearch];
+  uint32_t numRecent = 0, numTables = 0;
+  auto cost = [](double n, double sum) { return n > 1 ? n * std::log2(n) - sum : 0.0; };
+  for (uint32_t g = 0; g < numSegments; ++g) {
+    const uint64_t* h = &segmentCounts[(size_t)g * kNumSymbols];
+    const double symbols = (double)std::min(inSize - g * segmentBytes, segmentBytes);
+    const double sum = ansSumXLogX(h);
+
+    uint32_t best = 0, bestRank = 0;
+    double bestDelta = 0, bestSum = 0;
+    for (uint32_t r = 0; r < numRecent; ++r) {
+      const uint32_t t = recent[r];
+      const uint64_t* c = tableCounts + (size_t)t * kNumSymbols;
+      double merged = tableSum[t];
+      for (uint32_t i = 0; i < kNumSymbols; ++i) {
+        if (h[i] == 0) continue;
+        const double m = (double)(c[i] + h[i]);
+        merged += m * std::log2(m) - (c[i] > 1 ? c[i] * std::log2((double)c[i]) : 0.0);
+      }
+      const double delta = cost(tableSymbols[t] + symbols, merged) -
+          cost(tableSymbols[t], tableSum[t]) - cost(symbols, sum);
+      if (r == 0 || delta < bestDelta) {
+        best = t;
+        bestRank = r;
+        bestDelta = delta;
+        bestSum = merged;
+      }
     }
+
+    if (numRecent == 0 || (bestDelta > kANSTableBits && numTables < maxTables)) {
+      best = numTables++;
+      std::memcpy(tableCounts + (size_t)best * kNumSymbols, h, sizeof(uint64_t) * kNumSymbols);
+      tableSymbols[best] = symbols;
+      tableSum[best] = sum;
+      bestRank = std::min(numRecent, kANSSegmentSearch - 1);
+      numRecent = std::min(numRecent + 1, kANSSegmentSearch);
+    } else {
+      uint64_t* c = tableCounts + (size_t)best * kNumSymbols;
+      for (uint32_t i = 0; i < kNumSymbols; ++i) c[i] += h[i];
+      tableSymbols[best] += symbols;
+      tableSum[best] = bestSum;
+    }
+    // most recent first
+    std::memmove(recent + 1, recent, sizeof(uint32_t) * bestRank);
+    recent[0] = best;
+
+    const uint32_t b = g * segmentBlocks;
+    std::memset(blockTable + b, (int)best, std::min(numBlocks - b, segmentBlocks));
+  }
+  return numTables;
 }
 
-template <int one_bits, int BlockSize, int kStateCheckMul>
-void ansEncodeBatch_v0(
-    uint8_t* __restrict__ in,
-    int inSize,
-    uint32_t __restrict__ maxNumCompressedBlocks,
-    uint32_t __restrict__ uncoalescedBlockStride,
-    uint8_t* __restrict__ compressedBlocks_dev,
-    uint32_t* __restrict__ compressedWords_dev,
-    uint32_t* __restrict__ compressedWords_host_prefix,
-    const uint4* __restrict__ table) {
-    // constexpr ANSStateT kStateCheckMul = kANSStateBits - ProbBits;
-
-    int num_threads = 32;
-    #pragma omp parallel proc_bind(spread) num_threads(num_threads) 
-    // #pragma omp parallel proc_bind(close) num_threads(omp_get_max_threads())
-    {
-    int thread_id = omp_get_thread_num();
-    // #pragma omp for schedule(static, 8)
-    // #pragma omp for schedule(dynamic, 8)
-    // for(int l = 0; l < maxNumCompressedBlocks; ++l){
-    for(int l = thread_id; l < maxNumCompressedBlocks; l += num_threads){
-    uint32_t start = l << 12;
-    auto blockSize =  std::min(start + BlockSize, (uint32_t)inSize) - start;
-
-    auto inBlock = in + start;
-    if (l + kPrefetchAhead < maxNumCompressedBlocks) {
-        uint32_t prefetch_l = l + kPrefetchAhead;
-        uint32_t prefetch_start = prefetch_l << 12;
-        __builtin_prefetch(in + prefetch_start, 0, 0);
-        __builtin_prefetch(compressedBlocks_dev + prefetch_l * uncoalescedBlockStride, 1, 0);
+// Tables of one input for the segment plan of ansPlanSegments: all of them at
+// one precision (precision, or the one kANSAutoProbBits picks for the whole
+// input), with ansTableStores of each in tableStored. Returns that
+// precision, 0 if it is not supported.
+inline int ansSegmentTables(
+    int precision,
+    size_t inSize,
+    uint32_t numTables,
+    const uint64_t* tableCounts,
+    uint16_t* probsOut,
+    uint4* tables,
+    uint8_t* tableStored,
+    const mans::Parallel& par) {
+  if (precision == kANSAutoProbBits) {
+    uint64_t counts[kNumSymbols] = {};
+    for (uint32_t t = 0; t < numTables; ++t) {
+      for (uint32_t i = 0; i < kNumSymbols; ++i) counts[i] += tableCounts[(size_t)t * kNumSymbols + i];
     }
+    precision = ansChooseProbBits(inSize, counts);
+  }
+  if (precision < kANSMinProbBits || precision > kANSMaxProbBits) {
+    std::cout<< "unhandled pdf precision " << precision << std::endl;
+    return 0;
+  }
+  par.for_range(numTables, [&](size_t first, size_t last) {
+    for (size_t t = first; t < last; ++t) {
+      const uint64_t* counts = tableCounts + t * kNumSymbols;
+      uint64_t symbols = 0;
+      for (uint32_t i = 0; i < kNumSymbols; ++i) symbols += counts[i];
+      ansCalcWeights(precision, symbols, counts, probsOut + t * kNumSymbols,
+                     tables + t * kNumSymbols);
+      tableStored[t] = ansTableStores(precision, symbols, counts, probsOut + t * kNumSymbols);
+    }
+  });
+  return precision;
+}
 
-    auto outBlock = (ANSWarpState*)(compressedBlocks_dev
-        + l * uncoalescedBlockStride);
+// ---------------- Dictionaries ----------------
+
+// What the encoders need of a dictionary (CpuANSDictionary.h): its table and
+// precision, and the coded bits of every symbol, negative for one it lacks
+struct ANSEncodeDictionary {
+  uint32_t id = 0;
+  int probBits = 0;
+  uint4 table[kNumSymbols];
+  float bits[kNumSymbols];
+};
+
+// Whether an input of totalNum symbols with these counts is better coded
+// with dict than with a table of its own: every symbol must be in dict, and
+// its estimated size must not exceed the entropy of the input plus the
+// probabilities a stream of its own would store
+inline bool ansPreferDictionary(
+    const ANSEncodeDictionary& dict, uint64_t totalNum, const uint64_t* counts) {
+  double dictBits = 0;
+  double ownBits = 8.0 * (sizeof(uint16_t) * kNumSymbols - kANSDictionaryRefSize);
+  const double logTotal = std::log2((double)totalNum);
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    if (counts[i] == 0) continue;
+    if (dict.bits[i] < 0) return false;
+    dictBits += counts[i] * (double)dict.bits[i];
+    ownBits += counts[i] * (logTotal - std::log2((double)counts[i]));
+  }
+  return dictBits <= ownBits;
+}
+
+// Encodes one block of up to BlockSize symbols into an uncoalesced block
+// (ANSWarpState followed by the words) and returns the number of words.
+template <int one_bits, int BlockSize, int kStateCheckMul>
+inline uint32_t ansEncodeBlock(
+    const uint8_t* __restrict__ inBlock,
+    uint32_t blockSize,
+    uint8_t* __restrict__ outBlockRaw,
+    const uint4* __restrict__ table) {
+    auto outBlock = (ANSWarpState*)outBlockRaw;
     ANSEncodedT* outWords = (ANSEncodedT*)(outBlock + 1);
     uint64_t state[kWarpSize];// = {kANSStartState};
     // thread_local uint32_t state[kWarpSize];  // 每个线程独立副本
     std::fill(std::begin(state), std::end(state), kANSStartState);
     // std::fill(state, state + kWarpSize, kANSStartState);
     uint32_t outOffset = 0;
-    // constexpr 
-    int limit = roundDown(blockSize, 256);
+    // every block but the last of a stream is full: give those a
+    // compile-time trip count
+    int limit = blockSize == BlockSize ? roundDown(BlockSize, 256) : roundDown(blockSize, 256);
     //roundDown(blockSize, 256);
     // constexpr 
     int cyclenum0 = limit >> 8;
@@ -542,405 +571,580 @@ void ansEncodeBatch_v0(
     // outBlock->warpState[i] = state[i];
     outblockwarpstate[i] = state[i];
   }
-  compressedWords_dev[l] = outOffset;
-  compressedWords_host_prefix[l] = roundUp(outOffset, kBlockAlignment / sizeof(ANSEncodedT));
-  }
-  }
+  return outOffset;
 }
 
+using ANSEncodeBlockFn = uint32_t (*)(const uint8_t*, uint32_t, uint8_t*, const uint4*);
+
+// ansEncodeBlock variant for the instruction set in use (mans::active_isa()).
+// All of them write the same words and final states.
 template <int one_bits, int BlockSize, int kStateCheckMul>
-void ansEncodeBatch_v1(
-    uint8_t* in,
-    int inSize,
-    uint32_t maxNumCompressedBlocks,
-    uint32_t uncoalescedBlockStride,
-    uint8_t* compressedBlocks_dev,
-    uint32_t* compressedWords_dev,
-    uint32_t* compressedWords_host_prefix,
-    const uint4* table) {
-    #pragma omp parallel proc_bind(close) num_threads(omp_get_max_threads())
-    {
-        #pragma omp for schedule(dynamic, 8)
-        for(int l = 0; l < maxNumCompressedBlocks; ++l) {
-            uint32_t start = l * BlockSize;
-            auto blockSize = std::min(start + BlockSize, (uint32_t)inSize) - start;
-
-            auto inBlock = in + start;
-            auto outBlock = (ANSWarpState*)(compressedBlocks_dev + l * uncoalescedBlockStride);
-            ANSEncodedT* outWords = (ANSEncodedT*)(outBlock + 1);
-            
-            uint64_t* __restrict__ state = new uint64_t[kWarpSize];
-            std::fill_n(state, kWarpSize, kANSStartState);
-
-            uint32_t outOffset = 0;
-            uint32_t limit = roundDown(blockSize, 256);
-            int cyclenum0 = limit >> 8;
-
-            for (int i = 0; i < cyclenum0; ++i) {
-                int idx0 = i << 8;
-                #pragma unroll(8)
-                for (int j = 0; j < 8; ++j) {
-                    int idx1 = idx0 + (j << 5);
-                    #pragma unroll(16)
-                    for(int k = 0; k < kWarpSize; ++k) {
-                        auto lookup = table[inBlock[k + idx1]];
-                        uint32_t pdf = lookup.x;
-                        uint32_t write_mask = (state[k] >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = (state[k] & kANSEncodedMask);
-                        outOffset += write_mask;
-                        state[k] >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((state[k] * lookup.z >> 32) + state[k]) >> lookup.w;
-                        state[k] += div * (one_bits - pdf) + (uint64_t)lookup.y;
-                    }
-                }
-            }
+ANSEncodeBlockFn selectEncodeBlock() {
+  using Scalar = mans::IsaClones<&ansEncodeBlock<one_bits, BlockSize, kStateCheckMul>>;
+  switch (mans::active_isa()) {
+    case mans::Isa::Avx512:
+      return &ansEncodeBlockAvx512<one_bits, BlockSize, kStateCheckMul>;
+    case mans::Isa::Avx2:
+      return &ansEncodeBlockAvx2<one_bits, BlockSize, kStateCheckMul>;
+    case mans::Isa::Sse42:
+      return &Scalar::sse42;
+    case mans::Isa::Scalar:
+      break;
+  }
+  return &ansEncodeBlock<one_bits, BlockSize, kStateCheckMul>;
+}
 
-            if (blockSize - limit) {
-                uint32_t limit1 = roundDown(blockSize, kWarpSize);
-                int cyclenum1 = (limit1 - limit) / kWarpSize;
-                for(int i = 0; i < cyclenum1; ++i) {
-                    int idx = limit + (i << 5);
-                    #pragma unroll(16)
-                    for(int k = 0; k < kWarpSize; ++k) {
-                        auto lookup = table[inBlock[k + idx]];
-                        uint64_t pdf = lookup.x;
-                        uint64_t tempstate = state[k];
-                        bool write_mask = (tempstate >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = ((uint32_t)tempstate & kANSEncodedMask);
-                        outOffset += write_mask;
-                        tempstate >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((tempstate * lookup.z >> 32) + tempstate) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + tempstate;
-                    }
-                }
-                if (blockSize - limit1) {
-                    int num = blockSize - limit1;
-                    #pragma unroll(16)
-                    for(int k = 0; k < num; ++k) {
-                        auto lookup = table[inBlock[k + limit1]];
-                        uint64_t pdf = lookup.x;
-                        uint64_t tempstate = state[k];
-                        bool write_mask = (tempstate >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = ((uint32_t)tempstate & kANSEncodedMask);
-                        outOffset += write_mask;
-                        tempstate >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((tempstate * lookup.z >> 32) + tempstate) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + tempstate;
-                    }
-                }
-            }
+// Same for a precision and block size known only at run time; nullptr if
+// either is not supported. Renormalization keeps the state below 2^31, so
+// kStateCheckMul is kANSStateBits - probBits.
+template <int BlockSize>
+ANSEncodeBlockFn selectEncodeBlock(int probBits) {
+  switch (probBits) {
+    case 9:
+      return selectEncodeBlock<512, BlockSize, 22>();
+    case 10:
+      return selectEncodeBlock<1024, BlockSize, 21>();
+    case 11:
+      return selectEncodeBlock<2048, BlockSize, 20>();
+    case 12:
+      return selectEncodeBlock<4096, BlockSize, 19>();
+  }
+  return nullptr;
+}
 
-            #pragma omp simd
-            for(int i = 0; i < kWarpSize; ++i) {
-                outBlock->warpState[i] = state[i];
-            }
+// The wide coder's ansEncodeBlockWide. Its 64-bit lanes gain nothing from
+// the vectorized clones (they run slower than the baseline build), so every
+// instruction set takes this one.
+template <int BlockSize>
+ANSEncodeBlockFn selectEncodeBlockWide(int probBits) {
+  switch (probBits) {
+    case 9:
+      return &ansEncodeBlockWide<9, BlockSize>;
+    case 10:
+      return &ansEncodeBlockWide<10, BlockSize>;
+    case 11:
+      return &ansEncodeBlockWide<11, BlockSize>;
+    case 12:
+      return &ansEncodeBlockWide<12, BlockSize>;
+  }
+  return nullptr;
+}
 
-            compressedWords_dev[l] = outOffset;
-            compressedWords_host_prefix[l] = roundUp(outOffset, kBlockAlignment / sizeof(ANSEncodedT));
-            delete[] state;
-        }
-    }
+inline ANSEncodeBlockFn selectEncodeBlock(int probBits, uint32_t blockSize, bool wide = false) {
+  ANSEncodeBlockFn fn = nullptr;
+  dispatchBlockSize(blockSize, [&](auto bs) {
+    fn = wide ? selectEncodeBlockWide<decltype(bs)::value>(probBits)
+              : selectEncodeBlock<decltype(bs)::value>(probBits);
+  });
+  return fn;
 }
 
-template <int one_bits, int BlockSize, int kStateCheckMul>
-void ansEncodeBatch_v3(
-    uint8_t* __restrict__ in,
-    int inSize,
-    uint32_t __restrict__ maxNumCompressedBlocks,
-    uint32_t __restrict__ uncoalescedBlockStride,
-    uint8_t* __restrict__ compressedBlocks_dev,
-    uint32_t* __restrict__ compressedWords_dev,
-    uint32_t* __restrict__ compressedWords_host_prefix,
-    const uint4* __restrict__ table) {
-    #pragma omp parallel proc_bind(close) num_threads(omp_get_max_threads())
-    {
-        #pragma omp for schedule(dynamic, 8)
-        for(int l = 0; l < maxNumCompressedBlocks; ++l) {
-            uint32_t start = l * BlockSize;
-            auto blockSize = std::min(start + BlockSize, (uint32_t)inSize) - start;
-
-            auto inBlock = in + start;
-            auto outBlock = (ANSWarpState*)(compressedBlocks_dev + l * uncoalescedBlockStride);
-            ANSEncodedT* outWords = (ANSEncodedT*)(outBlock + 1);
-            
-            uint64_t* __restrict__ state = new uint64_t[kWarpSize];
-            std::fill_n(state, kWarpSize, kANSStartState);
-
-            uint32_t outOffset = 0;
-            uint32_t limit = roundDown(blockSize, 256);
-            int cyclenum0 = limit >> 8;
-
-            for (int i = 0; i < cyclenum0; ++i) {
-                int idx0 = i << 8;
-                for (int j = 0; j < 8; ++j) {
-                    int idx1 = idx0 + (j << 5);
-                    #pragma unroll(16)
-                    for(int k = 0; k < kWarpSize; ++k) {
-                        auto lookup = table[inBlock[k + idx1]];
-                        uint32_t pdf = lookup.x;
-                        uint32_t write_mask = (state[k] >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = (state[k] & kANSEncodedMask);
-                        outOffset += write_mask;
-                        state[k] >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((state[k] * lookup.z >> 32) + state[k]) >> lookup.w;
-                        state[k] += div * (one_bits - pdf) + (uint64_t)lookup.y;
-                    }
-                }
-            }
+// Writes the blockSize symbols at inBlock into an uncoalesced block as a
+// constant block if they are all the same, as a stored one otherwise, and
+// returns the number of words
+inline uint32_t ansEncodeRawBlock(const uint8_t* inBlock, uint32_t blockSize, uint8_t* outBlock) {
+  ANSWarpState states{};
+  const size_t bytes = blockSize * sizeof(ANSDecodedT);
+  if (std::memcmp(inBlock, inBlock + 1, bytes - 1) == 0) {
+    states.warpState[0] = kANSBlockConstant;
+    states.warpState[kANSBlockSymbolWord] = inBlock[0];
+    std::memcpy(outBlock, &states, sizeof(states));
+    return 0;
+  }
+  states.warpState[0] = kANSBlockStored;
+  std::memcpy(outBlock, &states, sizeof(states));
+  const uint32_t words = divUp(bytes, sizeof(ANSEncodedT));
+  std::memcpy(outBlock + sizeof(states), inBlock, bytes);
+  std::memset(outBlock + sizeof(states) + bytes, 0, words * sizeof(ANSEncodedT) - bytes);
+  return words;
+}
 
-            if (blockSize - limit) {
-                uint32_t limit1 = roundDown(blockSize, kWarpSize);
-                int cyclenum1 = (limit1 - limit) / kWarpSize;
-                for(int i = 0; i < cyclenum1; ++i) {
-                    int idx = limit + (i << 5);
-                    #pragma unroll(16)
-                    for(int k = 0; k < kWarpSize; ++k) {
-                        auto lookup = table[inBlock[k + idx]];
-                        uint64_t pdf = lookup.x;
-                        uint64_t tempstate = state[k];
-                        bool write_mask = (tempstate >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = ((uint32_t)tempstate & kANSEncodedMask);
-                        outOffset += write_mask;
-                        tempstate >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((tempstate * lookup.z >> 32) + tempstate) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + tempstate;
-                    }
-                }
-                if (blockSize - limit1) {
-                    int num = blockSize - limit1;
-                    #pragma unroll(16)
-                    for(int k = 0; k < num; ++k) {
-                        auto lookup = table[inBlock[k + limit1]];
-                        uint64_t pdf = lookup.x;
-                        uint64_t tempstate = state[k];
-                        bool write_mask = (tempstate >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = ((uint32_t)tempstate & kANSEncodedMask);
-                        outOffset += write_mask;
-                        tempstate >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((tempstate * lookup.z >> 32) + tempstate) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + tempstate;
-                    }
-                }
-            }
+// Codes a block with encodeBlock, unless it is constant, its table stores
+// (ansTableStores) or the coder did not make it shorter: ansEncodeRawBlock
+// then. The first symbol that differs from the one before ends the constant
+// check, so on most blocks it reads a few bytes.
+inline uint32_t ansEncodeBlockOrRaw(
+    ANSEncodeBlockFn encodeBlock,
+    bool stored,
+    const uint8_t* inBlock,
+    uint32_t blockSize,
+    uint8_t* outBlock,
+    const uint4* table) {
+  const uint32_t storedWords = divUp(blockSize * sizeof(ANSDecodedT), sizeof(ANSEncodedT));
+  if (!stored && (blockSize == 1 || std::memcmp(inBlock, inBlock + 1, blockSize - 1) != 0)) {
+    const uint32_t words = encodeBlock(inBlock, blockSize, outBlock, table);
+    if (words < storedWords) return words;
+  }
+  return ansEncodeRawBlock(inBlock, blockSize, outBlock);
+}
 
-            #pragma omp simd
-            for(int i = 0; i < kWarpSize; ++i) {
-                outBlock->warpState[i] = state[i];
-            }
+// Input bytes of the encoder window each worker takes per round
+constexpr uint32_t kEncodeWindowBytes = 256 * 1024;
+
+// Chunks each worker claims of a round of the coalescing encoder, on average
+constexpr uint32_t kEncodeChunksPerWorker = 4;
+
+// Window of the coalescing encoder for totalBlocks blocks on up to maxWorkers
+// workers: perWorker consecutive blocks for each of the workers it is split
+// over. Returns its size in blocks; the staging area holds two windows.
+inline uint32_t getEncodeWindow(
+    uint32_t totalBlocks, uint32_t blockSize, int maxWorkers,
+    uint32_t& perWorker, int& workers) {
+  if (totalBlocks == 0) {
+    perWorker = 0;
+    workers = 1;
+    return 0;
+  }
+  maxWorkers = std::max(1, maxWorkers);
+  perWorker = std::max(1u, kEncodeWindowBytes / blockSize);
+  perWorker = std::min<uint32_t>(perWorker, divUp(totalBlocks, (uint32_t)maxWorkers));
+  workers = (int)std::min<uint32_t>(maxWorkers, divUp(totalBlocks, perWorker));
+  return perWorker * workers;
+}
 
-            compressedWords_dev[l] = outOffset;
-            compressedWords_host_prefix[l] = roundUp(outOffset, kBlockAlignment / sizeof(ANSEncodedT));
-            delete[] state;
-        }
-    }
+// Version of the stream of one input; the block data offsets (v1: 32 bits)
+// are bounded by the largest the blocks can encode to
+inline uint32_t ansStreamVersion(
+    int precision, uint32_t blockSize, size_t inSize, uint32_t numBlocks) {
+  uint64_t maxWords = (uint64_t)numBlocks *
+      (getMaxBlockSizeCoalesced(blockSize, precision) / sizeof(ANSEncodedT));
+  return ANSCoalescedHeader::getRequiredVersion(inSize / sizeof(ANSDecodedT), maxWords);
 }
 
-template <int one_bits, int BlockSize, int kStateCheckMul>
-void ansEncodeBatch_v4(
-    uint8_t* __restrict__ in,
-    int inSize,
-    uint32_t __restrict__ maxNumCompressedBlocks,
-    uint32_t __restrict__ uncoalescedBlockStride,
-    uint8_t* __restrict__ compressedBlocks_dev,
-    uint32_t* __restrict__ compressedWords_dev,
-    uint32_t* __restrict__ compressedWords_host_prefix,
-    const uint4* __restrict__ table) {
-    int num_threads = std::thread::hardware_concurrency();
-    #pragma omp parallel proc_bind(close) num_threads(num_threads)
-    {
-        #pragma omp for schedule(static, 8)
-        for(int l = 0; l < maxNumCompressedBlocks; ++l) {
-            uint32_t start = l << 12;
-            auto blockSize = std::min(start + BlockSize, (uint32_t)inSize) - start;
-            auto inBlock = in + start;
-
-            if (l + kPrefetchAhead < maxNumCompressedBlocks) {
-                uint32_t prefetch_l = l + kPrefetchAhead;
-                uint32_t prefetch_start = prefetch_l << 12;
-                __builtin_prefetch(in + prefetch_start, 0, 0);
-                __builtin_prefetch(compressedBlocks_dev + prefetch_l * uncoalescedBlockStride, 1, 0);
-            }
+// Writes everything of a stream but the warp states, block words, block
+// checksums and block data: the header (total compressed words still 0, the
+// wide coder flagged if wide, block checksums if checksum), the probs of its
+// numTables tables (or the reference to dictionary, when not 0), the table
+// index (tableIndex, numBlocks entries, when there is more than one table)
+// and the padding in front of the block data. false (nothing written) if not
+// even that fits in outCapacity.
+inline bool ansBeginStream(
+    int precision,
+    uint32_t blockSize,
+    bool wide,
+    bool checksum,
+    size_t inSize,
+    uint32_t numBlocks,
+    const uint16_t* probs,
+    uint32_t numTables,
+    const uint8_t* tableIndex,
+    uint32_t dictionary,
+    uint8_t* out,
+    size_t outCapacity) {
+  ANSCoalescedHeader header{};
+  header.setMagicAndVersion(ansStreamVersion(precision, blockSize, inSize, numBlocks));
+  header.setProbBits(precision);
+  header.setBlockSize(blockSize);
+  header.setWideCoder(wide);
+  header.setUseChecksum(checksum);
+  header.setNumTables(numTables);
+  header.setUseDictionary(dictionary != 0);
+  header.setNumBlocks(numBlocks);
+  header.setTotalUncompressedWords(inSize);
+  header.setTotalCompressedWords(0);
+  if (header.getCompressedOverhead() > outCapacity) {
+    return false;
+  }
 
-            auto outBlock = (ANSWarpState*)(compressedBlocks_dev + l * uncoalescedBlockStride);
-            ANSEncodedT* outWords = (ANSEncodedT*)(outBlock + 1);
-            uint64_t state[kWarpSize];
-            std::fill(std::begin(state), std::end(state), kANSStartState);
-
-            uint32_t outOffset = 0;
-            constexpr int limit = 4096;
-            constexpr int cyclenum0 = limit >> 8;
-
-            for (int i = 0; i < cyclenum0; ++i) {
-                int idx0 = i << 8;
-                const uint8_t* vecStart = inBlock + idx0;
-                __builtin_prefetch(vecStart + 256, 0, 0);
-
-                for (int j = 0; j < 8; ++j) {
-                    int idx1 = idx0 + (j << 5);
-                    __builtin_prefetch(inBlock + idx1, 0, 0);
-
-                    #pragma unroll(16)
-                    for(int k = 0; k < kWarpSize; ++k) {
-                        auto lookup = table[inBlock[k + idx1]];
-                        uint32_t pdf = lookup.x;
-                        uint32_t write_mask = (state[k] >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = (state[k] & kANSEncodedMask);
-                        outOffset += write_mask;
-                        state[k] >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((state[k] * lookup.z >> 32) + state[k]) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + state[k];
-                    }
-                }
-            }
+  // address math only, every access below is a memcpy
+  auto headerOut = (ANSCoalescedHeader*)out;
+  std::memcpy(out, &header, sizeof(header));
+  if (dictionary != 0) {
+    uint32_t ref[kANSDictionaryRefSize / sizeof(uint32_t)] = {dictionary};
+    std::memcpy(headerOut->getSymbolProbs(), ref, sizeof(ref));
+  } else {
+    std::memcpy(headerOut->getSymbolProbs(), probs, sizeof(uint16_t) * kNumSymbols * numTables);
+  }
+  if (numTables > 1) {
+    uint8_t* index = headerOut->getTableIndex();
+    std::memcpy(index, tableIndex, numBlocks);
+    std::memset(index + numBlocks, 0,
+                ANSCoalescedHeader::getTableIndexSize(numBlocks, numTables) - numBlocks);
+  }
 
-            if (blockSize > limit) {
-                uint32_t limit1 = roundDown(blockSize, kWarpSize);
-                int cyclenum1 = (limit1 - limit) / kWarpSize;
-
-                for(int i = 0; i < cyclenum1; ++i) {
-                    int idx = limit + (i << 5);
-                    for(int k = 0; k < kWarpSize; ++k) {
-                        auto lookup = table[inBlock[k + idx]];
-                        uint64_t pdf = lookup.x;
-                        uint64_t tempstate = state[k];
-                        bool write_mask = (tempstate >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = ((uint32_t)tempstate & kANSEncodedMask);
-                        outOffset += write_mask;
-                        tempstate >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((tempstate * lookup.z >> 32) + tempstate) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + tempstate;
-                    }
-                }
-
-                if (blockSize > limit1) {
-                    int num = blockSize - limit1;
-                    for(int k = 0; k < num; ++k) {
-                        auto lookup = table[inBlock[k + limit1]];
-                        uint64_t pdf = lookup.x;
-                        uint64_t tempstate = state[k];
-                        bool write_mask = (tempstate >= (pdf << kStateCheckMul));
-                        outWords[outOffset] = ((uint32_t)tempstate & kANSEncodedMask);
-                        outOffset += write_mask;
-                        tempstate >>= kANSEncodedBits * write_mask;
-                        uint64_t div = ((tempstate * lookup.z >> 32) + tempstate) >> lookup.w;
-                        state[k] = div * (one_bits - pdf) + (uint64_t)lookup.y + tempstate;
-                    }
-                }
-            }
+  auto blockWordsEnd = headerOut->getBlockWords(numBlocks) +
+      (size_t)numBlocks * ANSCoalescedHeader::getBlockWordsEntrySize(header.getVersion());
+  auto blockDataOut = (uint8_t*)headerOut->getBlockDataStart(numBlocks);
+  std::memset(blockWordsEnd, 0, blockDataOut - blockWordsEnd);
+  return true;
+}
 
-            auto outblockwarpstate = outBlock->warpState;
-            #pragma omp simd
-            for(int i = 0; i < kWarpSize; ++i) {
-                outblockwarpstate[i] = state[i];
-            }
+// Moves block i of an uncoalesced slot to its place in the stream at out:
+// warp states, block words and the data at word offset start, zero-padded to
+// kBlockAlignment so the stream does not depend on what the slot held before
+inline void ansStoreBlock(
+    uint8_t* out,
+    uint32_t numBlocks,
+    uint32_t i,
+    uint32_t uncompressedWords,
+    const uint8_t* uncoalescedBlock,
+    uint32_t compressedWords,
+    uint64_t start) {
+  auto headerOut = (ANSCoalescedHeader*)out;
+  std::memcpy(headerOut->getWarpStates() + i, uncoalescedBlock, sizeof(ANSWarpState));
+  headerOut->storeBlockWords(numBlocks, i,
+                             packBlockWords(uncompressedWords, compressedWords), start);
+
+  uint8_t* writePtr = (uint8_t*)(headerOut->getBlockDataStart(numBlocks) + start);
+  size_t bytes = compressedWords * sizeof(ANSEncodedT);
+  size_t paddedBytes = roundUp(bytes, kBlockAlignment);
+  std::memcpy(writePtr, uncoalescedBlock + sizeof(ANSWarpState), bytes);
+  std::memset(writePtr + bytes, 0, paddedBytes - bytes);
+}
 
-            compressedWords_dev[l] = outOffset;
-            compressedWords_host_prefix[l] = roundUp(outOffset, kBlockAlignment / sizeof(ANSEncodedT));
-        }
+// Tables of the slices of ansEncodeCoalesced. Slice s owns count(s)
+// consecutive tables from first(s) on, and block b (flattened index) is coded
+// with table of(b) of its slice. A slice with a dictionary(s) has a single
+// table, that dictionary's, and its stream refers to the dictionary instead
+// of storing the probs. The blocks of a table that stored(t) are stored
+// without trying the coder. Left empty: one table per slice, table s, no
+// dictionaries, nothing stored up front.
+struct ANSSliceTables {
+  const uint32_t* sliceTableStart = nullptr;  // numSlices entries
+  const uint32_t* sliceNumTables = nullptr;   // numSlices entries
+  const uint8_t* blockTable = nullptr;        // one entry per block
+  const uint32_t* sliceDictionary = nullptr;  // numSlices entries, 0: none
+  const uint8_t* tableStored = nullptr;       // one entry per table, ansTableStores
+
+  uint32_t first(uint32_t s) const { return sliceTableStart ? sliceTableStart[s] : s; }
+  uint32_t count(uint32_t s) const { return sliceNumTables ? sliceNumTables[s] : 1; }
+  uint32_t of(uint32_t b) const { return blockTable ? blockTable[b] : 0; }
+  uint32_t dictionary(uint32_t s) const { return sliceDictionary ? sliceDictionary[s] : 0; }
+  bool stored(uint32_t t) const { return tableStored && tableStored[t]; }
+};
+
+// Encodes the blocks of numSlices inputs straight into their coalesced
+// streams, without staging the whole input. Blocks go round by round through
+// two halves of a window (getEncodeWindow) of uncoalesced slots: while the
+// workers encode a round into one half, claiming chunks of it as they come
+// free, each also moves the chunks it encoded in the round before, still in
+// its cache, out of the other half.
+// Their offsets are summed by the calling thread in between.
+// sliceBlockStart is the exclusive prefix of the per-slice block counts
+// (numSlices + 1 entries); tables and probs hold kNumSymbols entries per
+// table (sliceTables) and sliceProbBits the precision per slice. With wide
+// the blocks are coded with the wide coder, whose tables ansWidenEncodeTable
+// has rewritten; with checksum every block gets its CRC32C, taken right after
+// coding it. windowBlocks holds 2 * window slots
+// of uncoalescedBlockStride bytes, windowWords / windowStart 2 * window
+// entries and sliceWords numSlices. outSize[s] is the stream size (compact,
+// see ansCompactStream, when that is smaller), 0 for an
+// input with no blocks or if outCapacity[s] was too small (a part of the
+// stream may have been written then).
+void ansEncodeCoalesced(
+    uint32_t blockSize,
+    bool wide,
+    bool checksum,
+    uint32_t numSlices,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    const uint32_t* sliceBlockStart,
+    const uint4* tables,
+    const uint16_t* probs,
+    const uint32_t* sliceProbBits,
+    uint32_t uncoalescedBlockStride,
+    uint8_t* windowBlocks,
+    uint32_t* windowWords,
+    uint64_t* windowStart,
+    uint64_t* sliceWords,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    const mans::Parallel& par,
+    const ANSSliceTables& sliceTables = ANSSliceTables()) {
+  constexpr uint64_t kFailed = UINT64_MAX;
+  const uint32_t totalBlocks = sliceBlockStart[numSlices];
+  ANSEncodeBlockFn encodeBlock[kANSMaxProbBits + 1] = {};
+  for (int p = kANSMinProbBits; p <= kANSMaxProbBits; ++p) {
+    encodeBlock[p] = selectEncodeBlock(p, blockSize, wide);
+  }
+  const ANSChecksumFn blockChecksum = selectChecksum();
+  auto numBlocksOf = [&](uint32_t s) { return sliceBlockStart[s + 1] - sliceBlockStart[s]; };
+
+  // the block stores address the streams through their headers
+  par.for_range(numSlices, [&](size_t first, size_t last) {
+    for (size_t s = first; s < last; ++s) {
+      bool ok = numBlocksOf(s) > 0 &&
+          ansBeginStream(sliceProbBits[s], blockSize, wide, checksum, inSize[s], numBlocksOf(s),
+                         probs + (size_t)sliceTables.first(s) * kNumSymbols,
+                         sliceTables.count(s),
+                         sliceTables.blockTable ? sliceTables.blockTable + sliceBlockStart[s] : nullptr,
+                         sliceTables.dictionary(s), out[s], outCapacity[s]);
+      sliceWords[s] = ok ? 0 : kFailed;
+    }
+  });
+
+  uint32_t perWorker;
+  int workers;
+  const uint32_t window = getEncodeWindow(totalBlocks, blockSize, par.size(), perWorker, workers);
+  auto sliceOf = [&](uint32_t b) {
+    return (uint32_t)(std::upper_bound(sliceBlockStart, sliceBlockStart + numSlices + 1, b) -
+                      sliceBlockStart - 1);
+  };
+
+  // moves blocks [b, end) of the round starting at roundFirst out of half
+  auto storeBlocks = [&](uint32_t b, uint32_t end, uint32_t roundFirst, uint32_t half) {
+    for (uint32_t s = b < end ? sliceOf(b) : 0; b < end; ++b) {
+      while (b >= sliceBlockStart[s + 1]) ++s;
+      if (sliceWords[s] == kFailed) continue;
+      const uint32_t k = half * window + (b - roundFirst);
+      const uint32_t i = b - sliceBlockStart[s];
+      const size_t start = (size_t)i * blockSize;
+      ansStoreBlock(out[s], numBlocksOf(s), i,
+                    (uint32_t)(std::min(start + blockSize, inSize[s]) - start),
+                    windowBlocks + (size_t)k * uncoalescedBlockStride,
+                    windowWords[k], windowStart[k]);
+    }
+  };
+  // encodes blocks [b, end) of the round starting at roundFirst into half
+  auto encodeBlocks = [&](uint32_t b, uint32_t end, uint32_t roundFirst, uint32_t half) {
+    for (uint32_t s = b < end ? sliceOf(b) : 0; b < end; ++b) {
+      while (b >= sliceBlockStart[s + 1]) ++s;
+      if (sliceWords[s] == kFailed) continue;
+      const uint32_t k = half * window + (b - roundFirst);
+      const uint32_t i = b - sliceBlockStart[s];
+      const size_t start = (size_t)i * blockSize;
+      const uint32_t bytes = (uint32_t)(std::min(start + blockSize, inSize[s]) - start);
+      const uint32_t t = sliceTables.first(s) + sliceTables.of(b);
+      windowWords[k] = ansEncodeBlockOrRaw(
+          encodeBlock[sliceProbBits[s]], sliceTables.stored(t), in[s] + start, bytes,
+          windowBlocks + (size_t)k * uncoalescedBlockStride, tables + (size_t)t * kNumSymbols);
+      if (checksum) {
+        storeUnaligned(((ANSCoalescedHeader*)out[s])->getBlockChecksums(numBlocksOf(s)) +
+                           (size_t)i * sizeof(uint32_t),
+                       blockChecksum(in[s] + start, bytes));
+      }
     }
+  };
+
+  // A round is claimed in chunks of grain blocks, kEncodeChunksPerWorker per
+  // worker on average, by whichever worker is free; chunkWorker records who
+  // encoded each chunk of either half, as that worker stores it next round.
+  const uint32_t grain = std::max(1u, perWorker / kEncodeChunksPerWorker);
+  const uint32_t windowChunks = std::max(1u, divUp(window, grain));
+  std::vector<int> chunkWorker(2 * (size_t)windowChunks, -1);
+
+  // [prevFirst, prevLast) sit in half prevHalf with their offsets summed
+  uint32_t prevFirst = 0, prevLast = 0, prevHalf = 1;
+  for (uint64_t first = 0, half = 0; prevLast < totalBlocks || prevFirst < prevLast;
+       first += window, half ^= 1) {
+    const uint32_t curFirst = (uint32_t)std::min<uint64_t>(first, totalBlocks);
+    const uint32_t curLast = (uint32_t)std::min<uint64_t>(first + window, totalBlocks);
+
+    std::atomic<uint32_t> next{0};
+    par.workers([&](int w, int) {
+      const uint32_t prevChunks = divUp(prevLast - prevFirst, grain);
+      for (uint32_t c = 0; c < prevChunks; ++c) {
+        if (chunkWorker[prevHalf * windowChunks + c] != w) continue;
+        const uint32_t b = prevFirst + c * grain;
+        storeBlocks(b, std::min(prevLast, b + grain), prevFirst, prevHalf);
+      }
+      const uint32_t curChunks = divUp(curLast - curFirst, grain);
+      for (uint32_t c; (c = next.fetch_add(1, std::memory_order_relaxed)) < curChunks;) {
+        chunkWorker[half * windowChunks + c] = w;
+        const uint32_t b = curFirst + c * grain;
+        encodeBlocks(b, std::min(curLast, b + grain), curFirst, (uint32_t)half);
+      }
+    }, workers);
+
+    // offsets of the round just encoded, in block order per slice
+    for (uint32_t b = curFirst, s = b < curLast ? sliceOf(b) : 0; b < curLast; ++b) {
+      while (b >= sliceBlockStart[s + 1]) ++s;
+      if (sliceWords[s] == kFailed) continue;
+      const uint32_t k = (uint32_t)half * window + (b - curFirst);
+      windowStart[k] = sliceWords[s];
+      sliceWords[s] += roundUp(windowWords[k], kBlockAlignment / sizeof(ANSEncodedT));
+      size_t overhead = ANSCoalescedHeader::getCompressedOverhead(
+          numBlocksOf(s), ansStreamVersion(sliceProbBits[s], blockSize, inSize[s], numBlocksOf(s)),
+          sliceTables.count(s), sliceTables.dictionary(s) != 0, checksum);
+      if (overhead + sliceWords[s] * sizeof(ANSEncodedT) > outCapacity[s]) {
+        sliceWords[s] = kFailed;
+      }
+    }
+    prevFirst = curFirst;
+    prevLast = curLast;
+    prevHalf = (uint32_t)half;
+  }
+
+  // small streams are rewritten compact (v3) in place
+  par.for_range(numSlices, [&](size_t first, size_t last) {
+    for (size_t s = first; s < last; ++s) {
+      outSize[s] = 0;
+      if (sliceWords[s] == kFailed) continue;
+      ANSCoalescedHeader header;
+      std::memcpy(&header, out[s], sizeof(header));
+      header.setTotalCompressedWords(sliceWords[s]);
+      if (checksum) {
+        header.setChecksum(ansStreamChecksum(
+            blockChecksum, ((ANSCoalescedHeader*)out[s])->getBlockChecksums(numBlocksOf(s)),
+            numBlocksOf(s)));
+      }
+      std::memcpy(out[s], &header, sizeof(header));
+      outSize[s] = ansCompactStream(out[s], header.getTotalCompressedSize());
+    }
+  });
 }
 
-void ansEncode(
+// Histogram and tables of one input. precision is
+// kANSMinProbBits..kANSMaxProbBits or kANSAutoProbBits; returns the precision
+// the tables were built with (what the stream has to record), 0 if it is not
+// supported. counts are the symbol counts of in when the caller has them
+// already, otherwise they are computed into tempHistogram. stored gets
+// ansTableStores of the table.
+int ansEncodeTables(
     uint4* table,
-    uint32_t* tempHistogram,
+    uint64_t* tempHistogram,
     int precision,
-    uint8_t* in,
-    uint32_t inSize,
-    uint8_t* out,
-    uint32_t* outSize,
-    ANSCoalescedHeader* headerOut,
-    uint32_t& maxNumCompressedBlocks,
-    uint32_t& uncoalescedBlockStride,
-    uint8_t* compressedBlocks_host,
-    uint32_t* compressedWords_host,
-    uint32_t* compressedWords_host_prefix,
-    uint32_t* compressedWordsPrefix_host) {
-  ANSCoalescedHeader header;
-  // ANSCoalescedHeader* headerOut = (ANSCoalescedHeader*)out;
-  header.setProbBits(precision);
+    const uint8_t* in,
+    size_t inSize,
+    uint16_t* probsOut,
+    uint8_t& stored,
+    const mans::Parallel& par,
+    const uint64_t* counts = nullptr) {
+  if (counts == nullptr) {
+    ansHistogram(in, inSize, tempHistogram, par);
+    counts = tempHistogram;
+  }
+  if (precision == kANSAutoProbBits) {
+    precision = ansChooseProbBits(inSize, counts);
+  }
+  if (precision < kANSMinProbBits || precision > kANSMaxProbBits) {
+    std::cout<< "unhandled pdf precision " << precision << std::endl;
+    return 0;
+  }
+  ansCalcWeights(precision, inSize, counts, probsOut, table);
+  stored = ansTableStores(precision, inSize, counts, probsOut);
+  return precision;
+}
 
-  uint32_t maxUncompressedWords = inSize / sizeof(ANSDecodedT);
-  maxNumCompressedBlocks =
-      (maxUncompressedWords + kDefaultBlockSize - 1) / kDefaultBlockSize;//一个batch的数据以kDefaultBlockSize作为基准划分数据，形成多个数据块
+// Batched encode of numSlices independent inputs: per-slice histograms and
+// tables, then the blocks of all slices through ansEncodeCoalesced. tables,
+// histograms and probs hold kNumSymbols entries per slice; inputs with no
+// blocks are skipped. precision applies to every slice, with
+// kANSAutoProbBits each one gets its own, written to sliceProbBits.
+// sliceCounts, if not null, holds the symbol counts of the slices that come
+// with them (null entries are counted here).
+// With segmentBytes set, every slice is split into segments of about that
+// many bytes with tables of their own (ansPlanSegments): slice s then gets
+// up to ansMaxTables tables from sliceTableStart[s] on, which tables,
+// histograms and probs must have room for, its table count goes to
+// sliceNumTables and the table of every block to blockTable (one entry per
+// block). Those three are not used without segmentBytes.
+// With a dictionary, every slice that is not split and that
+// ansPreferDictionary finds better off with it is coded with its table (and
+// precision, whatever precision says); sliceDictionary[s] gets its ID then,
+// 0 otherwise. sliceDictionary is not used without dictionary.
+// tableStored gets ansTableStores of every table, one entry per table as for
+// histograms. With wide the streams use the wide coder, with checksum they
+// carry block checksums.
+// uncoalescedBlockStride must fit a block at the largest precision used.
+void ansEncodeBatch(
+    int precision,
+    uint32_t blockSize,
+    bool wide,
+    bool checksum,
+    size_t segmentBytes,
+    uint32_t numSlices,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    const uint64_t* const* sliceCounts,
+    const uint32_t* sliceBlockStart,
+    const uint32_t* sliceTableStart,
+    uint4* tables,
+    uint64_t* histograms,
+    uint16_t* probs,
+    uint32_t* sliceProbBits,
+    uint32_t* sliceNumTables,
+    uint8_t* blockTable,
+    const ANSEncodeDictionary* dictionary,
+    uint32_t* sliceDictionary,
+    uint8_t* tableStored,
+    uint32_t uncoalescedBlockStride,
+    uint8_t* windowBlocks,
+    uint32_t* windowWords,
+    uint64_t* windowStart,
+    uint64_t* sliceWords,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    const mans::Parallel& par) {
+  if ((precision != kANSAutoProbBits &&
+       (precision < kANSMinProbBits || precision > kANSMaxProbBits)) ||
+      !isSupportedBlockSize(blockSize)) {
+    std::cout<< "unhandled pdf precision " << precision << " or block size "
+             << blockSize << std::endl;
+    std::fill(outSize, outSize + numSlices, 0);
+    return;
+  }
 
-  header.setNumBlocks(maxNumCompressedBlocks);
-  // printf("maxNumCompressedBlocks:%d\n",maxNumCompressedBlocks);
-  header.setTotalUncompressedWords(inSize);
-  // printf("uncompressedWords:%d\n",uncompressedWords);
-
-//   auto start = std::chrono::high_resolution_clock::now();
-  if(inSize > 2621440 * 2){
-  ansHistogram_v1(
-      in,
-      inSize,
-      tempHistogram);
-  }
-  else{
-  ansHistogram_v2(
-      in,
-      inSize,
-      tempHistogram);
-  }
-//   auto end = std::chrono::high_resolution_clock::now();
-//   double histgram_time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1e3;
-//   printf("little histgram_time: %f\n", histgram_time);
-  
-//   start = std::chrono::high_resolution_clock::now();
-#define RUN_ENCODE(ONEBITS, kStateCheckMul)                                       \
-  do {    \
-    ansCalcWeights<ONEBITS, kStateCheckMul>(\
-      precision,\
-      inSize,\
-      tempHistogram,\
-      headerOut->getSymbolProbs(),\
-      table);                                                \
-    ansEncodeBatch_v0<ONEBITS, kDefaultBlockSize, kStateCheckMul>(\
-            in,\
-            inSize,                                        \
-            maxNumCompressedBlocks,                            \
-            uncoalescedBlockStride,                            \
-            compressedBlocks_host,                       \
-            compressedWords_host,  \
-            compressedWords_host_prefix,                      \
-            table);                                 \
-  } while (false)
-
-    switch (precision) {
-      case 9:
-        RUN_ENCODE(512, 22);
-        break;
-      case 10:
-        RUN_ENCODE(1024, 21);
-        break;
-      case 11:
-        RUN_ENCODE(2048, 20);
-        break;
-      default:
-        std::cout<< "unhandled pdf precision " << precision << std::endl;
+  ANSSliceTables sliceTables;
+  if (segmentBytes != 0) {
+    sliceTables = {sliceTableStart, sliceNumTables, blockTable};
+  }
+  if (dictionary != nullptr) {
+    sliceTables.sliceDictionary = sliceDictionary;
+  }
+  sliceTables.tableStored = tableStored;
+
+  par.for_range(numSlices, [&](size_t first, size_t last) {
+    for (size_t s = first; s < last; ++s) {
+      const uint32_t numBlocks = sliceBlockStart[s + 1] - sliceBlockStart[s];
+      if (numBlocks == 0) continue;
+      const uint32_t t = sliceTables.first(s);
+      if (dictionary != nullptr) sliceDictionary[s] = 0;
+      const uint32_t segmentBlocks = ansSegmentBlocks(numBlocks, blockSize, segmentBytes);
+      if (ansMaxTables(numBlocks, segmentBlocks) > 1) {
+        uint8_t* index = blockTable + sliceBlockStart[s];
+        sliceNumTables[s] = ansPlanSegments(
+            in[s], inSize[s], blockSize, segmentBlocks, ansMaxTables(numBlocks, segmentBlocks),
+            histograms + (size_t)t * kNumSymbols, index, par.serial());
+        sliceProbBits[s] = ansSegmentTables(
+            precision, inSize[s], sliceNumTables[s], histograms + (size_t)t * kNumSymbols,
+            probs + (size_t)t * kNumSymbols, tables + (size_t)t * kNumSymbols,
+            tableStored + t, par.serial());
+        continue;
+      }
+      if (segmentBytes != 0) {
+        sliceNumTables[s] = 1;
+        std::memset(blockTable + sliceBlockStart[s], 0, numBlocks);
+      }
+      const uint64_t* histogram = sliceCounts ? sliceCounts[s] : nullptr;
+      if (histogram == nullptr) {
+        uint64_t* counts = histograms + (size_t)t * kNumSymbols;
+        ansHistogram(in[s], inSize[s], counts, par.serial());
+        histogram = counts;
+      }
+      if (dictionary != nullptr && ansPreferDictionary(*dictionary, inSize[s], histogram)) {
+        sliceDictionary[s] = dictionary->id;
+        sliceProbBits[s] = dictionary->probBits;
+        tableStored[t] = 0;
+        std::memcpy(tables + (size_t)t * kNumSymbols, dictionary->table, sizeof(dictionary->table));
+        continue;
+      }
+      sliceProbBits[s] = precision != kANSAutoProbBits
+          ? precision : ansChooseProbBits(inSize[s], histogram);
+      ansCalcWeights(
+          sliceProbBits[s], inSize[s], histogram,
+          probs + (size_t)t * kNumSymbols, tables + (size_t)t * kNumSymbols);
+      tableStored[t] = ansTableStores(
+          sliceProbBits[s], inSize[s], histogram, probs + (size_t)t * kNumSymbols);
     }
-
-#undef RUN_ENCODE
-
-//   end = std::chrono::high_resolution_clock::now();
-//   double other = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1e3;
-//   printf("other: %f\n", other);
-
-  uint32_t totalCompressedWords = 0;
-  // std::exclusive_scan(compressedWords_host, compressedWords_host + maxNumCompressedBlocks, compressedWordsPrefix_host, 0);
-  if(maxNumCompressedBlocks > 0){
-    std::exclusive_scan(compressedWords_host_prefix, compressedWords_host_prefix + maxNumCompressedBlocks, compressedWordsPrefix_host, 0);
-    totalCompressedWords =
-        compressedWordsPrefix_host[maxNumCompressedBlocks - 1] +
-            roundUp(
-            compressedWords_host[maxNumCompressedBlocks - 1],
-            kBlockAlignment / sizeof(ANSEncodedT));
+  });
+  if (wide) {
+    par.for_range(numSlices, [&](size_t first, size_t last) {
+      for (size_t s = first; s < last; ++s) {
+        if (sliceBlockStart[s + 1] == sliceBlockStart[s]) continue;
+        for (uint32_t t = 0; t < sliceTables.count(s); ++t) {
+          ansWidenEncodeTable(tables + (size_t)(sliceTables.first(s) + t) * kNumSymbols);
+        }
+      }
+    });
   }
-  header.setTotalCompressedWords(totalCompressedWords);
-  // printf("totalCompressedWords:%d\n",totalCompressedWords);
 
-  *outSize = header.getTotalCompressedSize();
-  *headerOut = header;
-  
+  ansEncodeCoalesced(
+      blockSize, wide, checksum, numSlices, in, inSize, sliceBlockStart, tables, probs, sliceProbBits,
+      uncoalescedBlockStride, windowBlocks, windowWords, windowStart, sliceWords,
+      out, outCapacity, outSize, par, sliceTables);
 }
 } // namespace 
 
@@ -0,0 +1,236 @@
+/**
+ * Copyright (c) Meta Platforms, Inc. and affiliates.
+ *
+ * This source code is licensed under the MIT license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+#ifndef CPU_ANS_INCLUDE_ANS_CPUANSENCODESIMD_H
+#define CPU_ANS_INCLUDE_ANS_CPUANSENCODESIMD_H
+
+#pragma once
+
+#include "CpuANSUtils.h"
+#include "../cpu_isa.h"
+
+// Vector versions of ansEncodeBlock: the 32 interleaved states of a block live
+// in two 16-lane (AVX-512) or four 8-lane (AVX2) registers and one row of 32
+// symbols is encoded per iteration. Lanes are processed in order 0..31, so the
+// renormalization words come out in exactly the order of the scalar encoder.
+//
+// Every state stays below 2^31 (kANSStateBits), which lets the whole update
+// run in 32-bit lanes: only the magic-number division needs the high half of
+// a 32 x 32 bit product, taken from vpmuludq on the even and odd lanes.
+//
+// Words are stored a full vector at a time; up to kEncodeStoreSlack bytes
+// past the last word may be written (getMaxBlockSizeUnCoalesced covers it).
+
+namespace cpu_ans {
+
+// ---------------- AVX-512 (F + BW + VL), 16 lanes ----------------
+
+template <int one_bits, int kStateCheckMul>
+__attribute__((target(MANS_TARGET_AVX512), always_inline))
+inline void ansEncodeStepAvx512(
+    __m512i& state,
+    __m512i sym,
+    __mmask16 active,
+    const int* __restrict__ table,
+    ANSEncodedT* __restrict__ outWords,
+    uint32_t& outOffset) {
+  const __m512i idx = _mm512_slli_epi32(sym, 2);
+  const __m512i zero = _mm512_setzero_si512();
+  const __m512i pdf = _mm512_mask_i32gather_epi32(zero, active, idx, table, 4);
+  const __m512i cdf = _mm512_mask_i32gather_epi32(
+      zero, active, _mm512_add_epi32(idx, _mm512_set1_epi32(1)), table, 4);
+  const __m512i magic = _mm512_mask_i32gather_epi32(
+      zero, active, _mm512_add_epi32(idx, _mm512_set1_epi32(2)), table, 4);
+  const __m512i shift = _mm512_mask_i32gather_epi32(
+      zero, active, _mm512_add_epi32(idx, _mm512_set1_epi32(3)), table, 4);
+
+  // renormalize: lanes at or above pdf << kStateCheckMul emit their low word
+  const __mmask16 write = _mm512_mask_cmpge_epu32_mask(
+      active, state, _mm512_slli_epi32(pdf, kStateCheckMul));
+  const __m512i words = _mm512_maskz_compress_epi32(write, state);
+  _mm256_storeu_si256((__m256i*)(outWords + outOffset), _mm512_cvtepi32_epi16(words));
+  outOffset += _mm_popcnt_u32(write);
+  __m512i s = _mm512_mask_srli_epi32(state, write, state, kANSEncodedBits);
+
+  // div = (mulhi(s, magic) + s) >> shift
+  const __m512i even = _mm512_srli_epi64(_mm512_mul_epu32(s, magic), 32);
+  const __m512i odd = _mm512_mul_epu32(_mm512_srli_epi64(s, 32), _mm512_srli_epi64(magic, 32));
+  const __m512i hi = _mm512_mask_blend_epi32(0xAAAA, even, odd);
+  const __m512i div = _mm512_srlv_epi32(_mm512_add_epi32(hi, s), shift);
+
+  // s += div * (one_bits - pdf) + cdf
+  s = _mm512_add_epi32(
+      _mm512_add_epi32(
+          _mm512_mullo_epi32(div, _mm512_sub_epi32(_mm512_set1_epi32(one_bits), pdf)), cdf),
+      s);
+  state = _mm512_mask_mov_epi32(state, active, s);
+}
+
+template <int one_bits, int BlockSize, int kStateCheckMul>
+__attribute__((target(MANS_TARGET_AVX512)))
+uint32_t ansEncodeBlockAvx512(
+    const uint8_t* __restrict__ inBlock,
+    uint32_t blockSize,
+    uint8_t* __restrict__ outBlockRaw,
+    const uint4* __restrict__ table) {
+  auto outBlock = (ANSWarpState*)outBlockRaw;
+  ANSEncodedT* outWords = (ANSEncodedT*)(outBlock + 1);
+  const int* tab = (const int*)table;
+  uint32_t outOffset = 0;
+
+  __m512i state0 = _mm512_set1_epi32(kANSStartState);
+  __m512i state1 = _mm512_set1_epi32(kANSStartState);
+
+  uint32_t rows = blockSize / kWarpSize;
+  for (uint32_t r = 0; r < rows; ++r) {
+    const uint8_t* row = inBlock + r * kWarpSize;
+    __builtin_prefetch(row + 256, 0, 0);
+    __m512i sym0 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)row));
+    __m512i sym1 = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(row + 16)));
+    ansEncodeStepAvx512<one_bits, kStateCheckMul>(state0, sym0, 0xFFFF, tab, outWords, outOffset);
+    ansEncodeStepAvx512<one_bits, kStateCheckMul>(state1, sym1, 0xFFFF, tab, outWords, outOffset);
+  }
+
+  // partial last row: only lanes [0, tail) take a symbol
+  uint32_t tail = blockSize - rows * kWarpSize;
+  if (tail) {
+    const uint8_t* row = inBlock + rows * kWarpSize;
+    __mmask16 active0 = tail >= 16 ? 0xFFFF : (__mmask16)((1u << tail) - 1);
+    __mmask16 active1 = tail > 16 ? (__mmask16)((1u << (tail - 16)) - 1) : 0;
+    __m512i sym0 = _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(active0, row));
+    ansEncodeStepAvx512<one_bits, kStateCheckMul>(state0, sym0, active0, tab, outWords, outOffset);
+    if (active1) {
+      __m512i sym1 = _mm512_cvtepu8_epi32(_mm_maskz_loadu_epi8(active1, row + 16));
+      ansEncodeStepAvx512<one_bits, kStateCheckMul>(state1, sym1, active1, tab, outWords, outOffset);
+    }
+  }
+
+  _mm512_storeu_si512(outBlock->warpState, state0);
+  _mm512_storeu_si512(outBlock->warpState + 16, state1);
+  return outOffset;
+}
+
+// ---------------- AVX2, 8 lanes ----------------
+
+// pshufb controls that move the words selected by an 8-bit mask to the front
+struct ANSCompress8Table {
+  alignas(16) uint8_t shuffle[256][16];
+  constexpr ANSCompress8Table() : shuffle() {
+    for (int m = 0; m < 256; ++m) {
+      int n = 0;
+      for (int lane = 0; lane < 8; ++lane) {
+        if (m & (1 << lane)) {
+          shuffle[m][2 * n] = uint8_t(2 * lane);
+          shuffle[m][2 * n + 1] = uint8_t(2 * lane + 1);
+          ++n;
+        }
+      }
+      for (; n < 8; ++n) {
+        shuffle[m][2 * n] = 0x80;
+        shuffle[m][2 * n + 1] = 0x80;
+      }
+    }
+  }
+};
+
+inline constexpr ANSCompress8Table kANSCompress8{};
+
+template <int one_bits, int kStateCheckMul>
+__attribute__((target(MANS_TARGET_AVX2), always_inline))
+inline void ansEncodeStepAvx2(
+    __m256i& state,
+    __m256i sym,
+    __m256i active,
+    const int* __restrict__ table,
+    ANSEncodedT* __restrict__ outWords,
+    uint32_t& outOffset) {
+  const __m256i idx = _mm256_slli_epi32(sym, 2);
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i pdf = _mm256_mask_i32gather_epi32(zero, table, idx, active, 4);
+  const __m256i cdf = _mm256_mask_i32gather_epi32(
+      zero, table, _mm256_add_epi32(idx, _mm256_set1_epi32(1)), active, 4);
+  const __m256i magic = _mm256_mask_i32gather_epi32(
+      zero, table, _mm256_add_epi32(idx, _mm256_set1_epi32(2)), active, 4);
+  const __m256i shift = _mm256_mask_i32gather_epi32(
+      zero, table, _mm256_add_epi32(idx, _mm256_set1_epi32(3)), active, 4);
+
+  // unsigned state >= pdf << kStateCheckMul
+  const __m256i threshold = _mm256_slli_epi32(pdf, kStateCheckMul);
+  const __m256i write = _mm256_and_si256(
+      active, _mm256_cmpeq_epi32(_mm256_max_epu32(state, threshold), state));
+  const uint32_t mask = _mm256_movemask_ps(_mm256_castsi256_ps(write));
+
+  // low words of the 8 lanes into one 128-bit vector, then compacted
+  const __m256i low16 = _mm256_setr_epi8(
+      0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1,
+      0, 1, 4, 5, 8, 9, 12, 13, -1, -1, -1, -1, -1, -1, -1, -1);
+  __m256i packed = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(state, low16), 0x08);
+  __m128i words = _mm_shuffle_epi8(
+      _mm256_castsi256_si128(packed),
+      _mm_load_si128((const __m128i*)kANSCompress8.shuffle[mask]));
+  _mm_storeu_si128((__m128i*)(outWords + outOffset), words);
+  outOffset += _mm_popcnt_u32(mask);
+  __m256i s = _mm256_blendv_epi8(state, _mm256_srli_epi32(state, kANSEncodedBits), write);
+
+  const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(s, magic), 32);
+  const __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(s, 32), _mm256_srli_epi64(magic, 32));
+  const __m256i hi = _mm256_blend_epi32(even, odd, 0xAA);
+  const __m256i div = _mm256_srlv_epi32(_mm256_add_epi32(hi, s), shift);
+
+  s = _mm256_add_epi32(
+      _mm256_add_epi32(
+          _mm256_mullo_epi32(div, _mm256_sub_epi32(_mm256_set1_epi32(one_bits), pdf)), cdf),
+      s);
+  state = _mm256_blendv_epi8(state, s, active);
+}
+
+template <int one_bits, int BlockSize, int kStateCheckMul>
+__attribute__((target(MANS_TARGET_AVX2)))
+uint32_t ansEncodeBlockAvx2(
+    const uint8_t* __restrict__ inBlock,
+    uint32_t blockSize,
+    uint8_t* __restrict__ outBlockRaw,
+    const uint4* __restrict__ table) {
+  auto outBlock = (ANSWarpState*)outBlockRaw;
+  ANSEncodedT* outWords = (ANSEncodedT*)(outBlock + 1);
+  const int* tab = (const int*)table;
+  uint32_t outOffset = 0;
+
+  __m256i state[4];
+  for (int v = 0; v < 4; ++v) state[v] = _mm256_set1_epi32(kANSStartState);
+  const __m256i all = _mm256_set1_epi32(-1);
+
+  uint32_t rows = blockSize / kWarpSize;
+  for (uint32_t r = 0; r < rows; ++r) {
+    const uint8_t* row = inBlock + r * kWarpSize;
+    __builtin_prefetch(row + 256, 0, 0);
+    for (int v = 0; v < 4; ++v) {
+      __m256i sym = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(row + 8 * v)));
+      ansEncodeStepAvx2<one_bits, kStateCheckMul>(state[v], sym, all, tab, outWords, outOffset);
+    }
+  }
+
+  uint32_t tail = blockSize - rows * kWarpSize;
+  if (tail) {
+    alignas(32) uint8_t row[kWarpSize] = {0};
+    std::memcpy(row, inBlock + rows * kWarpSize, tail);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    for (uint32_t v = 0; v * 8 < tail; ++v) {
+      __m256i active = _mm256_cmpgt_epi32(_mm256_set1_epi32(int(tail - 8 * v)), lane);
+      __m256i sym = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(row + 8 * v)));
+      ansEncodeStepAvx2<one_bits, kStateCheckMul>(state[v], sym, active, tab, outWords, outOffset);
+    }
+  }
+
+  for (int v = 0; v < 4; ++v) {
+    _mm256_storeu_si256((__m256i*)(outBlock->warpState + 8 * v), state[v]);
+  }
+  return outOffset;
+}
+
+} // namespace cpu_ans
+
+#endif
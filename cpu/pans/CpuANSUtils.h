@@ -11,12 +11,11 @@
 #include <memory>
 #include <sstream>
 #include <string>
-#include <numeric> 
+#include <numeric>
+#include <type_traits>
 #include <immintrin.h>
 #include <thread>
 #include <parallel/algorithm>
-#include <avx512fintrin.h>
-#include <omp.h>
 #include <cstdlib>
 #include <stdexcept>
 #include <chrono>
@@ -58,39 +57,127 @@ inline auto roundUp(U a, V b) -> decltype(a + b) {
   return divUp(a, b) * b;
 }
 
+// Plain loads and stores for data that need not be naturally aligned
+template <typename T>
+inline T loadUnaligned(const void* p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+template <typename T>
+inline void storeUnaligned(void* p, T v) {
+  std::memcpy(p, &v, sizeof(T));
+}
+
 constexpr int kWarpSize = 32;
 constexpr uint32_t kNumSymbols = 1 << (sizeof(ANSDecodedT) * 8);
 constexpr uint32_t kMaxBEPSThreads = 512;
 constexpr uint32_t kDefaultBlockSize = 4096;
+// Block sizes (symbols per block) a stream may use, powers of two; the one
+// used is stored in the stream header (getBlockSize)
+constexpr uint32_t kMinBlockSize = 1024;
+constexpr uint32_t kMaxBlockSize = 65536;
 constexpr int kANSDefaultProbBits = 10;
+// Table precisions the coders are instantiated for; the one used is stored in
+// the stream header (getProbBits)
+constexpr int kANSMinProbBits = 9;
+constexpr int kANSMaxProbBits = 12;
+// Precision argument of the encoders asking for one picked per input
+// (ansChooseProbBits)
+constexpr int kANSAutoProbBits = 0;
 constexpr int kANSRequiredAlignment = 4;
 constexpr int kANSStateBits = (sizeof(ANSStateT) * 8) - 1;
 constexpr int kANSEncodedBits = sizeof(ANSEncodedT) * 8;
 constexpr ANSStateT kANSStartState = ANSStateT(1) << (kANSStateBits - kANSEncodedBits);
 constexpr ANSStateT kANSMinState = ANSStateT(1) << (kANSStateBits - kANSEncodedBits);
 constexpr ANSStateT kANSEncodedMask = (ANSStateT(1) << kANSEncodedBits) - ANSStateT(1);
+// Wide coder (getWideCoder, CpuANSWide.h): 16 lanes of 64-bit states in the
+// 128 state bytes of a block, kept in [kANSWideMinState, 2^63) and
+// renormalized by 32-bit words
+using ANSWideStateT = uint64_t;
+using ANSWideEncodedT = uint32_t;
+constexpr int kANSWideLanes = sizeof(ANSWarpState) / sizeof(ANSWideStateT);
+constexpr int kANSWideStateBits = (sizeof(ANSWideStateT) * 8) - 1;
+constexpr int kANSWideEncodedBits = sizeof(ANSWideEncodedT) * 8;
+constexpr ANSWideStateT kANSWideMinState =
+    ANSWideStateT(1) << (kANSWideStateBits - kANSWideEncodedBits);
 constexpr uint32_t kANSMagic = 0xd00d;
+// v1: 32-bit sizes and block offsets, the layout the GPU coders share.
+// v2: the same layout with 64-bit sizes (upper halves in the header words v1
+// leaves unused) and 64-bit block offsets (ANSBlockWords64), for streams past
+// 4 Gi words. Encoders write v1 whenever the stream fits it.
+// v3: v1 sizes with everything between the header and the block data packed
+// (CpuANSCompact.h); getCompactSize() bytes of it, in the header word v2 uses
+// for the upper half of the compressed words. Only small streams use it.
 constexpr uint32_t kANSVersion = 0x0001;
+constexpr uint32_t kANSVersion2 = 0x0002;
+constexpr uint32_t kANSVersionCompact = 0x0003;
 constexpr uint32_t kBlockAlignment = 16;
+// Probability tables one stream may carry (getNumTables); with more than one,
+// every block names the table it was coded with (getTableIndex)
+constexpr uint32_t kANSMaxTables = 256;
+// A stream coded with a dictionary (getUseDictionary) holds this reference
+// to it in place of the probabilities: the dictionary ID, then zeros
+constexpr uint32_t kANSDictionaryRefSize = 16;
+
+// Block words entry of a v2 stream; x is laid out as in v1 (packBlockWords)
+struct ANSBlockWords64 {
+    uint32_t x;
+    uint32_t unused;
+    uint64_t start;     // first word of the block data, from getBlockDataStart
+};
 
 struct ANSCoalescedHeader {
-    static inline uint32_t getCompressedOverhead(uint32_t numBlocks) {
-        int kAlignment = kBlockAlignment / sizeof(uint2);
-        if (kAlignment == 0) kAlignment = 1;
+    static inline size_t getBlockWordsEntrySize(uint32_t version) {
+        return version == kANSVersion2 ? sizeof(ANSBlockWords64) : sizeof(uint2);
+    }
+
+    // block words of numBlocks blocks, padded to kBlockAlignment
+    static inline size_t getBlockWordsSize(uint32_t numBlocks, uint32_t version) {
+        return roundUp((size_t)numBlocks * getBlockWordsEntrySize(version), (size_t)kBlockAlignment);
+    }
+
+    // one table index byte per block, padded to kBlockAlignment; absent
+    // from single-table streams
+    static inline size_t getTableIndexSize(uint32_t numBlocks, uint32_t numTables) {
+        return numTables > 1 ? roundUp((size_t)numBlocks, (size_t)kBlockAlignment) : 0;
+    }
+
+    // block checksums (CpuANSChecksum.h) of numBlocks blocks, padded to
+    // kBlockAlignment; only in streams with getUseChecksum
+    static inline size_t getChecksumsSize(uint32_t numBlocks, bool checksum) {
+        return checksum ? roundUp((size_t)numBlocks * sizeof(uint32_t), (size_t)kBlockAlignment) : 0;
+    }
 
+    // probabilities of numTables tables, or the dictionary reference
+    static inline size_t getTablesSize(uint32_t numTables, bool dictionary) {
+        return dictionary ? kANSDictionaryRefSize
+                          : sizeof(uint16_t) * kNumSymbols * (size_t)numTables;
+    }
+
+    static inline size_t getCompressedOverhead(
+        uint32_t numBlocks, uint32_t version = kANSVersion, uint32_t numTables = 1,
+        bool dictionary = false, bool checksum = false) {
         return sizeof(ANSCoalescedHeader) +
-               sizeof(uint16_t) * kNumSymbols +
-               sizeof(ANSWarpState) * numBlocks +
-               sizeof(uint2) * roundUp(numBlocks, kAlignment);
+               getTablesSize(numTables, dictionary) +
+               getTableIndexSize(numBlocks, numTables) +
+               sizeof(ANSWarpState) * (size_t)numBlocks +
+               getBlockWordsSize(numBlocks, version) +
+               getChecksumsSize(numBlocks, checksum);
     }
     
-    inline uint32_t getTotalCompressedSize() {
+    inline size_t getTotalCompressedSize() {
         return getCompressedOverhead() +
                getTotalCompressedWords() * sizeof(ANSEncodedT);
     }
 
-    inline uint32_t getCompressedOverhead() {
-        return getCompressedOverhead(getNumBlocks());
+    inline size_t getCompressedOverhead() {
+        if (getVersion() == kANSVersionCompact) {
+            return sizeof(ANSCoalescedHeader) + getCompactSize();
+        }
+        return getCompressedOverhead(getNumBlocks(), getVersion(), getNumTables(),
+                                     getUseDictionary(), getUseChecksum());
     }
 
     inline float getCompressionRatio() {
@@ -101,20 +188,66 @@ struct ANSCoalescedHeader {
     inline uint32_t getNumBlocks() { return numBlocks; }
     inline void setNumBlocks(uint32_t nb) { numBlocks = nb; }
 
-    inline void setMagicAndVersion() {
-        magicAndVersion = (kANSMagic << 16) | kANSVersion;
+    inline void setMagicAndVersion(uint32_t version = kANSVersion) {
+        magicAndVersion = (kANSMagic << 16) | version;
     }
 
     inline void checkMagicAndVersion() {
-        assert((magicAndVersion >> 16) == kANSMagic);
-        assert((magicAndVersion & 0xffffU) == kANSVersion);
+        assert(isSupportedVersion());
     }
 
-    inline uint32_t getTotalUncompressedWords() { return totalUncompressedWords; }
-    inline void setTotalUncompressedWords(uint32_t words) { totalUncompressedWords = words; }
+    // Streams of earlier CPU encoders left the whole word 0; they are v1
+    inline uint32_t getVersion() {
+        uint32_t mv = loadUnaligned<uint32_t>(&magicAndVersion);
+        return mv == 0 ? kANSVersion : (mv & 0xffffU);
+    }
 
-    inline uint32_t getTotalCompressedWords() { return totalCompressedWords; }
-    inline void setTotalCompressedWords(uint32_t words) { totalCompressedWords = words; }
+    inline bool isSupportedVersion() {
+        uint32_t mv = loadUnaligned<uint32_t>(&magicAndVersion);
+        return mv == 0 ||
+            ((mv >> 16) == kANSMagic &&
+             ((mv & 0xffffU) == kANSVersion || (mv & 0xffffU) == kANSVersion2 ||
+              (mv & 0xffffU) == kANSVersionCompact));
+    }
+
+    // Version needed for these totals
+    static inline uint32_t getRequiredVersion(uint64_t uncompressedWords, uint64_t compressedWords) {
+        return uncompressedWords > UINT32_MAX || compressedWords > UINT32_MAX
+            ? kANSVersion2 : kANSVersion;
+    }
+
+    // The upper halves are only read from v2 headers: in v1 the words are unused
+    inline uint64_t getTotalUncompressedWords() {
+        return getVersion() == kANSVersion2
+            ? ((uint64_t)totalUncompressedWordsHi << 32) | totalUncompressedWords
+            : totalUncompressedWords;
+    }
+    inline void setTotalUncompressedWords(uint64_t words) {
+        assert(getVersion() == kANSVersion2 || words <= UINT32_MAX);
+        totalUncompressedWords = (uint32_t)words;
+        totalUncompressedWordsHi = (uint32_t)(words >> 32);
+    }
+
+    inline uint64_t getTotalCompressedWords() {
+        return getVersion() == kANSVersion2
+            ? ((uint64_t)totalCompressedWordsHi << 32) | totalCompressedWords
+            : totalCompressedWords;
+    }
+    inline void setTotalCompressedWords(uint64_t words) {
+        assert(getVersion() == kANSVersion2 || words <= UINT32_MAX);
+        totalCompressedWords = (uint32_t)words;
+        totalCompressedWordsHi = (uint32_t)(words >> 32);
+    }
+
+    // Bytes of packed tables, states and block words of a v3 stream; set
+    // after the totals, which clear it
+    inline uint32_t getCompactSize() {
+        return getVersion() == kANSVersionCompact ? totalCompressedWordsHi : 0;
+    }
+    inline void setCompactSize(uint32_t bytes) {
+        assert(getVersion() == kANSVersionCompact);
+        totalCompressedWordsHi = bytes;
+    }
 
     inline uint32_t getProbBits() { return options & 0xf; }
     inline void setProbBits(uint32_t bits) {
@@ -122,7 +255,44 @@ struct ANSCoalescedHeader {
         options = (options & 0xfffffff0U) | bits;
     }
 
-    inline bool getUseChecksum() { return options & 0x10; }
+    // log2 of the block size in [12:8]; 0 stands for kDefaultBlockSize, so
+    // streams written before the field existed still read as 4 KiB blocks
+    inline uint32_t getBlockSize() {
+        uint32_t log2 = (options >> 8) & 0x1f;
+        return log2 == 0 ? kDefaultBlockSize : 1u << log2;
+    }
+    inline void setBlockSize(uint32_t blockSize) {
+        assert(blockSize != 0 && (blockSize & (blockSize - 1)) == 0);
+        uint32_t log2 = blockSize == kDefaultBlockSize ? 0 : __builtin_ctz(blockSize);
+        options = (options & 0xffffe0ffU) | (log2 << 8);
+    }
+
+    // Probability tables in the stream, count - 1 in [23:16]: streams written
+    // before the field existed read as the single-table layout they have
+    inline uint32_t getNumTables() {
+        return ((loadUnaligned<uint32_t>(&options) >> 16) & 0xff) + 1;
+    }
+    inline void setNumTables(uint32_t n) {
+        assert(n >= 1 && n <= kANSMaxTables);
+        options = (options & 0xff00ffffU) | ((n - 1) << 16);
+    }
+
+    // Bit 5: the single table is a dictionary's, named by getDictionaryId
+    inline bool getUseDictionary() { return (loadUnaligned<uint32_t>(&options) >> 5) & 1; }
+    inline void setUseDictionary(bool ud) {
+        options = (options & 0xffffffdfU) | (static_cast<uint32_t>(ud) << 5);
+    }
+
+    // Bit 6: coded with the wide coder (CpuANSWide.h), which only the CPU
+    // decoders read
+    inline bool getWideCoder() { return (loadUnaligned<uint32_t>(&options) >> 6) & 1; }
+    inline void setWideCoder(bool wide) {
+        options = (options & 0xffffffbfU) | (static_cast<uint32_t>(wide) << 6);
+    }
+
+    // Bit 4: block checksums follow the block words (getBlockChecksums) and
+    // getChecksum is the CRC32C of them; read by the CPU decoders only
+    inline bool getUseChecksum() { return (loadUnaligned<uint32_t>(&options) >> 4) & 1; }
     inline void setUseChecksum(bool uc) {
         options = (options & 0xffffffef) | (static_cast<uint32_t>(uc) << 4);
     }
@@ -130,18 +300,60 @@ struct ANSCoalescedHeader {
     inline uint32_t getChecksum() { return checksum; }
     inline void setChecksum(uint32_t c) { checksum = c; }
 
+    // kNumSymbols probabilities per table, table t at getSymbolProbs() + t * kNumSymbols
     inline uint16_t* getSymbolProbs() { return reinterpret_cast<uint16_t*>(this + 1); }
 
-    inline ANSWarpState* getWarpStates() { return reinterpret_cast<ANSWarpState*>(getSymbolProbs() + kNumSymbols); }
+    // Dictionary a getUseDictionary() stream was coded with; like the
+    // accessors below, only valid on the stream itself, not on a copy of the
+    // header
+    inline uint32_t getDictionaryId() { return loadUnaligned<uint32_t>(getSymbolProbs()); }
+
+    // Table of every block, when getNumTables() > 1
+    inline uint8_t* getTableIndex() {
+        return reinterpret_cast<uint8_t*>(this + 1) +
+            getTablesSize(getNumTables(), getUseDictionary());
+    }
+
+    inline ANSWarpState* getWarpStates() {
+        return reinterpret_cast<ANSWarpState*>(
+            getTableIndex() +
+            getTableIndexSize(loadUnaligned<uint32_t>(&numBlocks), getNumTables()));
+    }
  
-    inline uint2* getBlockWords(uint32_t numBlocks) {
-        return reinterpret_cast<uint2*>(getWarpStates() + numBlocks);
+    // Entries are uint2 {x, start} in v1 and ANSBlockWords64 in v2; go
+    // through loadBlockWords / storeBlockWords
+    inline uint8_t* getBlockWords(uint32_t numBlocks) {
+        return reinterpret_cast<uint8_t*>(getWarpStates() + numBlocks);
+    }
+
+    inline ANSBlockWords64 loadBlockWords(uint32_t numBlocks, uint32_t i) {
+        if (getVersion() == kANSVersion2) {
+            return loadUnaligned<ANSBlockWords64>(getBlockWords(numBlocks) + (size_t)i * sizeof(ANSBlockWords64));
+        }
+        uint2 w = loadUnaligned<uint2>(getBlockWords(numBlocks) + (size_t)i * sizeof(uint2));
+        return {w.x, 0, w.y};
+    }
+
+    inline void storeBlockWords(uint32_t numBlocks, uint32_t i, uint32_t x, uint64_t start) {
+        if (getVersion() == kANSVersion2) {
+            storeUnaligned(getBlockWords(numBlocks) + (size_t)i * sizeof(ANSBlockWords64),
+                           ANSBlockWords64{x, 0, start});
+        } else {
+            assert(start <= UINT32_MAX);
+            storeUnaligned(getBlockWords(numBlocks) + (size_t)i * sizeof(uint2),
+                           uint2{x, (uint32_t)start});
+        }
+    }
+
+    // CRC32C of the uncompressed bytes of every block, numBlocks
+    // little-endian words, when getUseChecksum
+    inline uint8_t* getBlockChecksums(uint32_t numBlocks) {
+        return getBlockWords(numBlocks) + getBlockWordsSize(numBlocks, getVersion());
     }
 
     inline ANSEncodedT* getBlockDataStart(uint32_t numBlocks) {
-        constexpr int kAlignment = kBlockAlignment / sizeof(uint2) == 0
-        ? 1 : kBlockAlignment / sizeof(uint2);
-        return reinterpret_cast<ANSEncodedT*>(getBlockWords(numBlocks) + roundUp(numBlocks, kAlignment));
+        return reinterpret_cast<ANSEncodedT*>(
+            getBlockChecksums(numBlocks) + getChecksumsSize(numBlocks, getUseChecksum()));
     }
 
     uint32_t magicAndVersion;
@@ -150,30 +362,138 @@ struct ANSCoalescedHeader {
     uint32_t totalCompressedWords;
     uint32_t options;
     uint32_t checksum;
-    uint32_t unused0;
-    uint32_t unused1;
+    uint32_t totalUncompressedWordsHi;  // v2 only
+    uint32_t totalCompressedWordsHi;    // v2 only; v3: getCompactSize()
 };
 
+inline bool isSupportedBlockSize(uint32_t blockSize) {
+  return blockSize >= kMinBlockSize && blockSize <= kMaxBlockSize &&
+      (blockSize & (blockSize - 1)) == 0;
+}
+
+// Calls fn(std::integral_constant<uint32_t, BlockSize>()) for a supported
+// block size, so every size gets its own instantiation of the kernels fn
+// runs; returns false for any other size.
+template <typename Fn>
+inline bool dispatchBlockSize(uint32_t blockSize, Fn&& fn) {
+  switch (blockSize) {
+    case 1024: fn(std::integral_constant<uint32_t, 1024>()); return true;
+    case 2048: fn(std::integral_constant<uint32_t, 2048>()); return true;
+    case 4096: fn(std::integral_constant<uint32_t, 4096>()); return true;
+    case 8192: fn(std::integral_constant<uint32_t, 8192>()); return true;
+    case 16384: fn(std::integral_constant<uint32_t, 16384>()); return true;
+    case 32768: fn(std::integral_constant<uint32_t, 32768>()); return true;
+    case 65536: fn(std::integral_constant<uint32_t, 65536>()); return true;
+  }
+  return false;
+}
+
+// blockWords[i].x: uncompressed words of the block in [31:16], compressed
+// words in [15:0]. A full 64 KiB block has 65536 uncompressed words, which
+// wraps to 0 in the upper half; blocks are never empty, so 0 reads back as
+// 65536. The compressed count always fits: at most 12 bits per symbol and
+// one word per lane, 49184 words for a 64 KiB block.
+inline uint32_t packBlockWords(uint32_t uncompressedWords, uint32_t compressedWords) {
+  return (uncompressedWords << 16) | compressedWords;
+}
+
+inline uint32_t getBlockUncompressedWords(uint32_t x) {
+  return (((x >> 16) - 1) & 0xffffU) + 1;
+}
+
+inline uint32_t getBlockCompressedWords(uint32_t x) {
+  return x & 0xffffU;
+}
+
+// Blocks the coder does not pay off for. The final states of an ANS block
+// are all at least kANSMinState (a wide lane, words 0 and 1, at least
+// kANSWideMinState), so word 0 of the states below kANSMinState with word 1
+// zero marks one of these: a stored block holds its symbols as they are
+// (rounded up to whole words), a constant one no words and its symbol in
+// word kANSBlockSymbolWord. Their other words are 0.
+constexpr ANSStateT kANSBlockStored = 0;
+constexpr ANSStateT kANSBlockConstant = 1;
+constexpr int kANSBlockSymbolWord = 2;
+
+// kANSBlockStored or kANSBlockConstant for such a block, given its states;
+// kANSMinState for an ANS block
+inline ANSStateT getBlockMode(const void* states) {
+  const ANSStateT mode = loadUnaligned<ANSStateT>(states);
+  return mode < kANSMinState &&
+      loadUnaligned<ANSStateT>((const uint8_t*)states + sizeof(ANSStateT)) == 0
+      ? mode : kANSMinState;
+}
+
+// A corrupt block can run out of words before its last symbol. The decode
+// kernels read at a signed word position, which one row takes at most one
+// row of words (64 bytes) below the block start, still inside the header and
+// states in front of the block data, and reset it with this after every row;
+// the block checksum, if there is one, tells.
+inline void ansClampWordPosition(uint32_t& words) {
+  if (__builtin_expect((int32_t)words < 0, 0)) words = 0;
+}
+
+// pdf is stored minus one: a symbol owning the whole of a 12-bit table has
+// pdf 4096, one more than the field holds
+inline uint32_t packDecodeLookup(uint32_t sym, uint32_t pdf, uint32_t cdf) {
+  // [31:20] cdf
+  // [19:8] pdf - 1
+  // [7:0] symbol
+  return (cdf << 20) | ((pdf - 1) << 8) | sym;
+}
+
+inline void unpackDecodeLookup(uint32_t v, uint32_t& sym, uint32_t& pdf, uint32_t& cdf) {
+  // [31:20] cdf
+  // [19:8] pdf - 1
+  // [7:0] symbol
+  sym = v & 0xffU;
+  v >>= 8;
+  pdf = (v & 0xfffU) + 1;
+  v >>= 12;
+  cdf = v;
+}
+
+// Fields of a packed entry, for the scalar kernels
+inline uint32_t lookupSymbol(uint32_t v) { return v & 0xffU; }
+inline uint32_t lookupPdf(uint32_t v) { return ((v >> 8) & 0xfffU) + 1; }
+inline uint32_t lookupCdf(uint32_t v) { return v >> 20; }
+
+// A symbol costs at most probBits bits (pdf >= 1), and every lane can end
+// up to one word above its share when the block is flushed
 inline uint32_t
-getRawCompBlockMaxSize(uint32_t uncompressedBlockBytes) {
+getRawCompBlockMaxSize(uint32_t uncompressedBlockBytes, int probBits = kANSMaxProbBits) {
   return roundUp(
-      uncompressedBlockBytes + (uncompressedBlockBytes / 4), kBlockAlignment);
+      divUp(uncompressedBlockBytes * (uint32_t)probBits, 8u) +
+          kWarpSize * (uint32_t)sizeof(ANSEncodedT),
+      kBlockAlignment);
 }
 
-inline uint32_t getMaxBlockSizeCoalesced(uint32_t uncompressedBlockBytes) {
-  return getRawCompBlockMaxSize(uncompressedBlockBytes);
+// A block the coder would not make shorter is stored instead
+inline uint32_t getMaxBlockSizeCoalesced(
+    uint32_t uncompressedBlockBytes, int probBits = kANSMaxProbBits) {
+  return std::min(getRawCompBlockMaxSize(uncompressedBlockBytes, probBits),
+                  roundUp(uncompressedBlockBytes, kBlockAlignment));
 }
 
-inline uint32_t getMaxCompressedSize(uint32_t uncompressedBytes) {
-  uint32_t blocks = divUp(uncompressedBytes, kDefaultBlockSize);
-  size_t rawSize = ANSCoalescedHeader::getCompressedOverhead(kDefaultBlockSize);
-  rawSize += (size_t)getMaxBlockSizeCoalesced(kDefaultBlockSize) * blocks;
+inline size_t getMaxCompressedSize(size_t uncompressedBytes) {
+  uint32_t blocks = divUp(uncompressedBytes, (size_t)kDefaultBlockSize);
+  size_t dataSize = (size_t)getMaxBlockSizeCoalesced(kDefaultBlockSize) * blocks;
+  size_t rawSize = ANSCoalescedHeader::getCompressedOverhead(
+      blocks, ANSCoalescedHeader::getRequiredVersion(
+                  uncompressedBytes / sizeof(ANSDecodedT), dataSize / sizeof(ANSEncodedT)));
+  rawSize += dataSize;
   rawSize = roundUp(rawSize, sizeof(uint4));
   return rawSize;
 }
 
-inline uint32_t getMaxBlockSizeUnCoalesced(uint32_t uncompressedBlockBytes) {
-  return sizeof(ANSWarpState) + getRawCompBlockMaxSize(uncompressedBlockBytes);
+// The vector encoders store whole registers of words, so the uncoalesced
+// blocks of the encoder scratch carry this many spare bytes at their end
+constexpr uint32_t kEncodeStoreSlack = 32;
+
+inline uint32_t getMaxBlockSizeUnCoalesced(
+    uint32_t uncompressedBlockBytes, int probBits = kANSMaxProbBits) {
+  return sizeof(ANSWarpState) + getRawCompBlockMaxSize(uncompressedBlockBytes, probBits) +
+      kEncodeStoreSlack;
 }
 
 }
\ No newline at end of file
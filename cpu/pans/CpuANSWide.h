@@ -0,0 +1,237 @@
+#ifndef CPU_ANS_INCLUDE_ANS_CPUANSWIDE_H
+#define CPU_ANS_INCLUDE_ANS_CPUANSWIDE_H
+
+#pragma once
+
+#include "CpuANSUtils.h"
+#include "../cpu_isa.h"
+
+// ---------------- Wide coder ----------------
+//
+// The portable coder is shaped after the GPU: 32 lanes of 32-bit states that
+// renormalize by 16-bit words, about every other symbol. A stream with
+// getWideCoder set keeps its layout, but the 128 state bytes of every ANS
+// block hold kANSWideLanes 64-bit states, renormalized by 32-bit words: half
+// as often, and in plain 64-bit registers. Block words still count
+// ANSEncodedT, two per wide word, so padding, offsets, stored blocks and the
+// compact layout are shared with the portable coder. Only CPU decoders read
+// it.
+
+namespace cpu_ans {
+
+static_assert(kANSWideLanes * sizeof(ANSWideStateT) == sizeof(ANSWarpState),
+              "wide states must fill the state bytes of a block");
+
+// Rewrites an encode table of ansBuildEncodeTable for ansEncodeBlockWide:
+// {pdf | shift << 16, cdf, magic[31:0], magic[63:32]}, with the multiplier
+// of the same division for 64-bit states
+inline void ansWidenEncodeTable(uint4* table) {
+  for (uint32_t i = 0; i < kNumSymbols; ++i) {
+    const uint32_t p = table[i].x;
+    const uint32_t shift = table[i].w;
+    // absent symbols are never looked up
+    const uint64_t magic = p != 0
+        ? (uint64_t)(((unsigned __int128)((1ULL << shift) - p) << 64) / p) + 1 : 0;
+    table[i] = {p | (shift << 16), table[i].y, (uint32_t)magic, (uint32_t)(magic >> 32)};
+  }
+}
+
+// ansEncodeBlock for the wide coder: symbol k goes to lane k % kANSWideLanes.
+// Returns the words written, in ANSEncodedT.
+template <int ProbBits, int BlockSize>
+inline uint32_t ansEncodeBlockWide(
+    const uint8_t* __restrict__ inBlock,
+    uint32_t blockSize,
+    uint8_t* __restrict__ outBlock,
+    const uint4* __restrict__ table) {
+  // a state at or above pdf << kCheckShift would leave [kANSWideMinState, 2^63)
+  constexpr int kCheckShift = kANSWideStateBits - ProbBits;
+  ANSWideStateT state[kANSWideLanes];
+  std::fill(state, state + kANSWideLanes, kANSWideMinState);
+  uint8_t* outWords = outBlock + sizeof(ANSWarpState);
+  uint32_t outOffset = 0;
+
+  auto encode = [&](int lane, uint8_t sym) {
+    const uint4 e = table[sym];
+    const uint64_t pdf = e.x & 0xffffU;
+    uint64_t x = state[lane];
+    const uint32_t write = x >= (pdf << kCheckShift);
+    storeUnaligned(outWords + (size_t)outOffset * sizeof(ANSWideEncodedT), (ANSWideEncodedT)x);
+    outOffset += write;
+    x >>= kANSWideEncodedBits * write;
+    const uint64_t magic = ((uint64_t)e.w << 32) | e.z;
+    const uint64_t q = ((uint64_t)(((unsigned __int128)x * magic) >> 64) + x) >> (e.x >> 16);
+    state[lane] = x + q * ((1U << ProbBits) - pdf) + e.y;
+  };
+
+  // every block but the last of a stream is full: give those a compile-time
+  // trip count
+  if (blockSize == BlockSize) {
+    for (uint32_t k = 0; k < BlockSize; k += kANSWideLanes) {
+      for (int lane = 0; lane < kANSWideLanes; ++lane) {
+        encode(lane, inBlock[k + lane]);
+      }
+    }
+  } else {
+    uint32_t k = 0;
+    for (; k + kANSWideLanes <= blockSize; k += kANSWideLanes) {
+      for (int lane = 0; lane < kANSWideLanes; ++lane) {
+        encode(lane, inBlock[k + lane]);
+      }
+    }
+    for (int lane = 0; k + lane < blockSize; ++lane) {
+      encode(lane, inBlock[k + lane]);
+    }
+  }
+  std::memcpy(outBlock, state, sizeof(state));
+  return outOffset * (sizeof(ANSWideEncodedT) / sizeof(ANSEncodedT));
+}
+
+// ansDecodeBlock for the wide coder, on the same packed decode table
+template <int ProbBits, int BlockSize>
+inline void ansDecodeBlockWide(
+    const uint32_t* __restrict__ lookup,
+    ANSCoalescedHeader* headerIn,
+    uint32_t numBlocks,
+    uint32_t i,
+    void* out) {
+  constexpr ANSWideStateT kStateMask = (ANSWideStateT(1) << ProbBits) - 1;
+  ANSWideStateT state[kANSWideLanes];
+  std::memcpy(state, headerIn->getWarpStates() + i, sizeof(state));
+  const ANSBlockWords64 blockWords = headerIn->loadBlockWords(numBlocks, i);
+  const uint32_t uncompressedWords = getBlockUncompressedWords(blockWords.x);
+  uint32_t words = getBlockCompressedWords(blockWords.x) / (sizeof(ANSWideEncodedT) / sizeof(ANSEncodedT));
+  const uint8_t* blockDataIn = (const uint8_t*)(headerIn->getBlockDataStart(numBlocks) + blockWords.start);
+  uint8_t* outBlock = (uint8_t*)out + (size_t)i * BlockSize;
+
+  // As in ansDecodeBlock, the word below the current position is loaded on
+  // every step and kept only if the lane reads
+  auto decode = [&](int lane) -> uint8_t {
+    ANSWideStateT x = state[lane];
+    const uint32_t e = lookup[x & kStateMask];
+    x = (ANSWideStateT)lookupPdf(e) * (x >> ProbBits) + lookupCdf(e);
+    const uint32_t read = x < kANSWideMinState;
+    const ANSWideStateT v = loadUnaligned<ANSWideEncodedT>(
+        blockDataIn + ((ptrdiff_t)(int32_t)words - 1) * (ptrdiff_t)sizeof(ANSWideEncodedT));
+    words -= read;
+    state[lane] = (x << (kANSWideEncodedBits * read)) | (v * read);
+    return lookupSymbol(e);
+  };
+
+  if (uncompressedWords == BlockSize) {
+    for (int k = BlockSize - kANSWideLanes; k >= 0; k -= kANSWideLanes) {
+      uint8_t symbols[kANSWideLanes];
+      for (int lane = kANSWideLanes - 1; lane >= 0; --lane) {
+        symbols[lane] = decode(lane);
+      }
+      ansClampWordPosition(words);
+      std::memcpy(outBlock + k, symbols, sizeof(symbols));
+    }
+    return;
+  }
+  const uint32_t remainder = uncompressedWords % kANSWideLanes;
+  int offset = uncompressedWords - remainder;
+  for (int lane = (int)remainder - 1; lane >= 0; --lane) {
+    outBlock[offset + lane] = decode(lane);
+  }
+  ansClampWordPosition(words);
+  while (offset > 0) {
+    offset -= kANSWideLanes;
+    for (int lane = kANSWideLanes - 1; lane >= 0; --lane) {
+      outBlock[offset + lane] = decode(lane);
+    }
+    ansClampWordPosition(words);
+  }
+}
+
+// ansDecodeBlockWide with AVX-512: the 16 states are two vectors of eight
+// 64-bit lanes, decoded a row at a time through the packed lookup table, and
+// renormalized as in ansDecodeBlockAvx512, upper vector first. AVX-512 F has
+// no 64-bit multiply, so pdf * (x >> ProbBits) is put together from the two
+// 32-bit halves of the state.
+template <int ProbBits>
+__attribute__((target(MANS_TARGET_AVX512), always_inline))
+inline __m256i ansDecodeStepWideAvx512(
+    __m512i& state,
+    __mmask8& read,
+    __mmask8 active,
+    const int* __restrict__ lookup) {
+  const __m512i slot = _mm512_and_si512(state, _mm512_set1_epi64((1 << ProbBits) - 1));
+  const __m256i e = _mm512_i64gather_epi32(slot, lookup, 4);
+  const __m512i pdf = _mm512_cvtepu32_epi64(_mm256_add_epi32(
+      _mm256_and_si256(_mm256_srli_epi32(e, 8), _mm256_set1_epi32(0xfff)), _mm256_set1_epi32(1)));
+  const __m512i cdf = _mm512_cvtepu32_epi64(_mm256_srli_epi32(e, 20));
+  const __m512i x = _mm512_srli_epi64(state, ProbBits);
+  const __m512i s = _mm512_add_epi64(
+      _mm512_add_epi64(_mm512_mul_epu32(x, pdf),
+                       _mm512_slli_epi64(_mm512_mul_epu32(_mm512_srli_epi64(x, 32), pdf), 32)),
+      cdf);
+  state = _mm512_mask_mov_epi64(state, active, s);
+  read = _mm512_mask_cmplt_epu64_mask(active, state, _mm512_set1_epi64(kANSWideMinState));
+  return e;
+}
+
+__attribute__((target(MANS_TARGET_AVX512), always_inline))
+inline void ansDecodeRenormWideAvx512(
+    __m512i& state,
+    __mmask8 read,
+    const ANSWideEncodedT* __restrict__ blockDataIn,
+    uint32_t& words) {
+  const uint32_t n = _mm_popcnt_u32(read);
+  words -= n;
+  const __m256i w = _mm256_maskz_loadu_epi32((__mmask8)((1u << n) - 1), blockDataIn + (int32_t)words);
+  state = _mm512_mask_or_epi64(
+      state, read, _mm512_slli_epi64(state, kANSWideEncodedBits),
+      _mm512_maskz_expand_epi64(read, _mm512_cvtepu32_epi64(w)));
+}
+
+template <int ProbBits, int BlockSize>
+__attribute__((target(MANS_TARGET_AVX512)))
+void ansDecodeBlockWideAvx512(
+    const uint32_t* __restrict__ lookup,
+    ANSCoalescedHeader* headerIn,
+    uint32_t numBlocks,
+    uint32_t i,
+    void* out) {
+  const int* tab = (const int*)lookup;
+  const ANSBlockWords64 blockWords = headerIn->loadBlockWords(numBlocks, i);
+  const uint32_t uncompressedWords = getBlockUncompressedWords(blockWords.x);
+  uint32_t words = getBlockCompressedWords(blockWords.x) / (sizeof(ANSWideEncodedT) / sizeof(ANSEncodedT));
+  const ANSWideEncodedT* blockDataIn =
+      (const ANSWideEncodedT*)(headerIn->getBlockDataStart(numBlocks) + blockWords.start);
+  uint8_t* outBlock = (uint8_t*)out + (size_t)i * BlockSize;
+
+  const uint64_t* states = (const uint64_t*)(headerIn->getWarpStates() + i);
+  __m512i state0 = _mm512_loadu_si512(states);
+  __m512i state1 = _mm512_loadu_si512(states + 8);
+  __mmask8 read0, read1;
+
+  const uint32_t rows = uncompressedWords / kANSWideLanes;
+  const uint32_t tail = uncompressedWords % kANSWideLanes;
+  if (tail) {
+    const __mmask8 active0 = tail >= 8 ? 0xFF : (__mmask8)((1u << tail) - 1);
+    const __mmask8 active1 = tail > 8 ? (__mmask8)((1u << (tail - 8)) - 1) : 0;
+    const __m256i e0 = ansDecodeStepWideAvx512<ProbBits>(state0, read0, active0, tab);
+    const __m256i e1 = ansDecodeStepWideAvx512<ProbBits>(state1, read1, active1, tab);
+    ansDecodeRenormWideAvx512(state1, read1, blockDataIn, words);
+    ansDecodeRenormWideAvx512(state0, read0, blockDataIn, words);
+    ansClampWordPosition(words);
+    uint8_t* row = outBlock + rows * kANSWideLanes;
+    _mm_mask_storeu_epi8(row, active0, _mm256_cvtepi32_epi8(e0));
+    _mm_mask_storeu_epi8(row + 8, active1, _mm256_cvtepi32_epi8(e1));
+  }
+
+  for (int r = (int)rows - 1; r >= 0; --r) {
+    const __m256i e0 = ansDecodeStepWideAvx512<ProbBits>(state0, read0, 0xFF, tab);
+    const __m256i e1 = ansDecodeStepWideAvx512<ProbBits>(state1, read1, 0xFF, tab);
+    ansDecodeRenormWideAvx512(state1, read1, blockDataIn, words);
+    ansDecodeRenormWideAvx512(state0, read0, blockDataIn, words);
+    ansClampWordPosition(words);
+    _mm_storeu_si128((__m128i*)(outBlock + r * kANSWideLanes),
+                     _mm_unpacklo_epi64(_mm256_cvtepi32_epi8(e0), _mm256_cvtepi32_epi8(e1)));
+  }
+}
+
+} // namespace cpu_ans
+
+#endif
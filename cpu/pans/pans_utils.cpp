@@ -2,6 +2,7 @@
 #include "pans_utils.h"
 #include "CpuANSEncode.h"
 #include "CpuANSDecode.h"
+#include "CpuANSDictionary.h"
 
 #include <iostream>
 #include <vector>
@@ -9,168 +10,305 @@
 #include <iomanip>
 #include <cstring>
 #include <cstdlib>
-
-#define PANS_PRECISION 10   // define compression precision 
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 
 using namespace cpu_ans;
 
+static_assert(kPansAutoPrecision == kANSAutoProbBits, "auto precision differs from the coder's");
+static_assert(kPansDefaultPrecision == kANSDefaultProbBits, "default precision differs from the coder's");
+static_assert(kPansDefaultBlockSize == kDefaultBlockSize, "default block size differs from the coder's");
+static_assert(kPansMinSegmentSize == kANSMinSegmentBytes, "minimum segment size differs from the coder's");
+static_assert(kPansDictionarySize == sizeof(ANSDictionaryFile), "dictionary size differs from the coder's");
+static_assert(kPansCompactMaxSize == kANSCompactMaxBytes, "compact stream limit differs from the coder's");
+
+// Dictionaries loaded in this process by ID. Entries are never removed, so
+// the pointers handed out stay valid while streams are coded with them.
+static std::mutex dictionaryMutex;
+static std::unordered_map<uint32_t, std::unique_ptr<ANSDictionary>> dictionaries;
+
+static const ANSDictionary* find_dictionary(uint32_t id) {
+    std::lock_guard<std::mutex> lock(dictionaryMutex);
+    auto it = dictionaries.find(id);
+    return it != dictionaries.end() ? it->second.get() : nullptr;
+}
+
+uint32_t pans_train_dictionary(
+    const uint64_t* counts,
+    int precision,
+    uint32_t id,
+    uint8_t* out
+) {
+    ANSDictionaryFile file;
+    if (!ansTrainDictionary(counts, precision, id, file)) {
+        std::cerr << "Error: no samples or unsupported precision " << precision << "." << std::endl;
+        return 0;
+    }
+    std::memcpy(out, &file, sizeof(file));
+    return file.id;
+}
+
+uint32_t pans_load_dictionary(const uint8_t* data, size_t size) {
+    auto dict = std::make_unique<ANSDictionary>();
+    if (!ansLoadDictionary(data, size, *dict)) {
+        std::cerr << "Error: malformed dictionary." << std::endl;
+        return 0;
+    }
+    const uint32_t id = dict->encode.id;
+    std::lock_guard<std::mutex> lock(dictionaryMutex);
+    auto it = dictionaries.find(id);
+    if (it == dictionaries.end()) {
+        dictionaries.emplace(id, std::move(dict));
+    } else if (it->second->encode.probBits != dict->encode.probBits ||
+               std::memcmp(it->second->probs, dict->probs, sizeof(dict->probs)) != 0) {
+        std::cerr << "Error: another dictionary is loaded with ID " << id << "." << std::endl;
+        return 0;
+    }
+    return id;
+}
+
+// dictionary argument of the encoders -> its tables; false for an unknown ID
+static bool encode_dictionary(uint32_t id, const ANSEncodeDictionary*& dict) {
+    dict = nullptr;
+    if (id == kPansNoDictionary) {
+        return true;
+    }
+    if (const ANSDictionary* found = find_dictionary(id)) {
+        dict = &found->encode;
+        return true;
+    }
+    std::cerr << "Error: dictionary " << id << " is not loaded." << std::endl;
+    return false;
+}
+
 // tool function：raw_data or adm_compressed_data -> pans_compressed_data
 void pans_compress(
     std::vector<uint8_t>& inputData,
     std::vector<uint8_t>& compressedData,
-    uint32_t& batchSize,
-    uint32_t& compressedSize,
+    size_t& batchSize,
+    size_t& compressedSize,
     double &duration
 ) {
-    const std::streamsize fileSize =
-        static_cast<std::streamsize>(inputData.size());
-    if (fileSize <= 0) {
+    PansEncodeScratch scratch;
+    pans_compress(inputData, compressedData, batchSize, compressedSize, duration, scratch);
+}
+
+static size_t max_compressed_size(size_t inSize, uint32_t blockSize) {
+    size_t numBlocks = divUp(inSize, (size_t)blockSize);
+    size_t dataSize = numBlocks * getMaxBlockSizeCoalesced(blockSize, kANSMaxProbBits);
+    uint32_t version = ANSCoalescedHeader::getRequiredVersion(
+        inSize / sizeof(ANSDecodedT), dataSize / sizeof(ANSEncodedT));
+    // segments are never shorter than kANSMinSegmentBytes
+    uint32_t numTables = std::min<size_t>(kANSMaxTables, divUp(inSize, kANSMinSegmentBytes));
+    return ANSCoalescedHeader::getCompressedOverhead(numBlocks, version, std::max(1u, numTables),
+                                                     false, true) +
+           dataSize;
+}
+
+size_t pans_max_compressed_size(size_t inSize) {
+    size_t bound = 0;
+    for (uint32_t blockSize = kMinBlockSize; blockSize <= kMaxBlockSize; blockSize *= 2) {
+        bound = std::max(bound, max_compressed_size(inSize, blockSize));
+    }
+    return bound;
+}
+
+// precision argument of the encoders -> largest table they may build
+static bool valid_precision(int precision) {
+    return precision == kANSAutoProbBits ||
+           (precision >= kANSMinProbBits && precision <= kANSMaxProbBits);
+}
+
+static int max_precision(int precision) {
+    return precision == kANSAutoProbBits ? kANSMaxProbBits : precision;
+}
+
+static bool valid_coder(uint32_t coder) {
+    return coder == kPansCoderPortable || coder == kPansCoderWide;
+}
+
+// Bit of a (precision, block size) decode kernel in a 32-bit set
+static uint32_t kernel_index(int precision, uint32_t blockSize) {
+    constexpr int kNumBlockSizes = __builtin_ctz(kMaxBlockSize) - __builtin_ctz(kMinBlockSize) + 1;
+    static_assert((kANSMaxProbBits - kANSMinProbBits + 1) * kNumBlockSizes <= 32,
+                  "decode kernels do not fit the pass mask");
+    return (precision - kANSMinProbBits) * kNumBlockSizes +
+           (__builtin_ctz(blockSize) - __builtin_ctz(kMinBlockSize));
+}
+
+void pans_compress(
+    const std::vector<uint8_t>& inputData,
+    std::vector<uint8_t>& compressedData,
+    size_t& batchSize,
+    size_t& compressedSize,
+    double &duration,
+    PansEncodeScratch& scratch
+) {
+    compressedData.resize(pans_max_compressed_size(inputData.size()));
+    size_t written = pans_compress(inputData.data(), inputData.size(),
+                                   compressedData.data(), compressedData.size(),
+                                   duration, scratch);
+    compressedData.resize(written);
+    batchSize = written > 0 ? inputData.size() : 0;
+    compressedSize = written;
+}
+
+size_t pans_compress(
+    const uint8_t* in,
+    size_t inSize,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par,
+    int precision,
+    uint32_t blockSize,
+    size_t segmentBytes,
+    uint32_t dictionary,
+    uint32_t coder,
+    bool checksum
+) {
+    return pans_compress(in, inSize, nullptr, out, outCapacity, duration, scratch, par,
+                         precision, blockSize, segmentBytes, dictionary, coder, checksum);
+}
+
+size_t pans_compress(
+    const uint8_t* in,
+    size_t inSize,
+    const uint64_t* histogram,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par,
+    int precision,
+    uint32_t blockSize,
+    size_t segmentBytes,
+    uint32_t dictionary,
+    uint32_t coder,
+    bool checksum
+) {
+    if (inSize == 0) {
         std::cerr << "Error: inputData is empty." << std::endl;
-        batchSize = 0;
-        compressedSize = 0;
-        compressedData.clear();
-        return;
+        return 0;
+    }
+    if (!valid_precision(precision)) {
+        std::cerr << "Error: unsupported precision " << precision << "." << std::endl;
+        return 0;
+    }
+    if (!isSupportedBlockSize(blockSize)) {
+        std::cerr << "Error: unsupported block size " << blockSize << "." << std::endl;
+        return 0;
+    }
+    if (!valid_coder(coder)) {
+        std::cerr << "Error: unknown coder " << coder << "." << std::endl;
+        return 0;
     }
+    if (divUp(inSize / sizeof(ANSDecodedT), (size_t)blockSize) > UINT32_MAX) {
+        std::cerr << "Error: inputData has more than 2^32 blocks." << std::endl;
+        return 0;
+    }
+    const ANSEncodeDictionary* dict;
+    if (!encode_dictionary(dictionary, dict)) {
+        return 0;
+    }
+
+    const uint32_t numBlocks = divUp(inSize / sizeof(ANSDecodedT), (size_t)blockSize);
+    const uint32_t segmentBlocks = ansSegmentBlocks(numBlocks, blockSize, segmentBytes);
+    const uint32_t maxTables = ansMaxTables(numBlocks, segmentBlocks);
 
-    uint8_t* inPtrs = inputData.data();
-    batchSize = static_cast<uint32_t>(fileSize);
-    const int precision = PANS_PRECISION;
-
-    uint32_t* outCompressedSize = (uint32_t*)malloc(sizeof(uint32_t));
-    uint8_t* encPtrs = (uint8_t*)malloc(getMaxCompressedSize(fileSize));
-    ANSCoalescedHeader* headerOut = (ANSCoalescedHeader*)encPtrs;
-    uint32_t maxNumCompressedBlocks;
-
-    uint32_t maxUncompressedWords = fileSize / sizeof(ANSDecodedT);
-    maxNumCompressedBlocks =
-        (maxUncompressedWords + kDefaultBlockSize - 1) / kDefaultBlockSize;
-    
-    uint4* table = (uint4*)malloc(sizeof(uint4) * kNumSymbols);
-    uint32_t* tempHistogram = (uint32_t*)malloc(sizeof(uint32_t) * kNumSymbols);
-    uint32_t uncoalescedBlockStride = getMaxBlockSizeUnCoalesced(kDefaultBlockSize);
-    uint8_t* compressedBlocks_host = (uint8_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint8_t) * maxNumCompressedBlocks * uncoalescedBlockStride);
-    uint32_t* compressedWords_host = (uint32_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint32_t) * maxNumCompressedBlocks);
-    uint32_t* compressedWords_host_prefix = (uint32_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint32_t) * maxNumCompressedBlocks);
-    uint32_t* compressedWordsPrefix_host = (uint32_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint32_t) * maxNumCompressedBlocks);
-    
-    auto start = std::chrono::high_resolution_clock::now();  
-    ansEncode(
+    uint4* table = (uint4*)scratch.table.reserve((size_t)4 * kNumSymbols * maxTables);
+    uint64_t* tempHistogram = scratch.histogram.reserve((size_t)kNumSymbols * maxTables);
+    uint16_t* probs = scratch.probs.reserve((size_t)kNumSymbols * maxTables);
+    uint8_t* blockTable = maxTables > 1 ? scratch.blockTable.reserve(numBlocks) : nullptr;
+    uint8_t* tableStored = scratch.tableStored.reserve(maxTables);
+    uint32_t uncoalescedBlockStride = getMaxBlockSizeUnCoalesced(
+        blockSize, dict ? std::max(dict->probBits, max_precision(precision)) : max_precision(precision));
+    uint32_t perWorker;
+    int workers;
+    const uint32_t window = getEncodeWindow(numBlocks, blockSize, par.size(), perWorker, workers);
+    uint8_t* windowBlocks = scratch.blocks.reserve((size_t)2 * window * uncoalescedBlockStride);
+    uint32_t* windowWords = scratch.words.reserve((size_t)2 * window);
+    uint64_t* windowStart = scratch.wordsStart.reserve((size_t)2 * window);
+    uint64_t* sliceWords = scratch.sliceWords.reserve(1);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    uint32_t numTables = 1;
+    uint32_t probBits;
+    uint32_t useDictionary = kPansNoDictionary;
+    if (maxTables > 1) {
+        numTables = ansPlanSegments(
+            in, inSize, blockSize, segmentBlocks, maxTables, tempHistogram, blockTable, par);
+        probBits = ansSegmentTables(
+            precision, inSize, numTables, tempHistogram, probs, table, tableStored, par);
+    } else if (dict != nullptr) {
+        // the histogram only decides whether the dictionary fits this input
+        if (histogram == nullptr) {
+            ansHistogram(in, inSize, tempHistogram, par);
+            histogram = tempHistogram;
+        }
+        if (ansPreferDictionary(*dict, inSize, histogram)) {
+            useDictionary = dict->id;
+            probBits = dict->probBits;
+            std::memcpy(table, dict->table, sizeof(dict->table));
+            tableStored[0] = 0;
+        } else {
+            probBits = ansEncodeTables(
+                table, tempHistogram, precision, in, inSize, probs, tableStored[0], par, histogram);
+        }
+    } else {
+        probBits = ansEncodeTables(
+            table, tempHistogram, precision, in, inSize, probs, tableStored[0], par, histogram);
+    }
+    if (probBits == 0) {
+        return 0;
+    }
+    const uint32_t sliceTableStart = 0;
+    ANSSliceTables sliceTables;
+    if (numTables > 1) {
+        sliceTables = {&sliceTableStart, &numTables, blockTable};
+    }
+    sliceTables.sliceDictionary = &useDictionary;
+    sliceTables.tableStored = tableStored;
+
+    // header, tables and blocks straight into out
+    const uint32_t sliceBlockStart[2] = {0, numBlocks};
+    size_t outCompressedSize = 0;
+    if (coder == kPansCoderWide) {
+        for (uint32_t t = 0; t < numTables; ++t) {
+            ansWidenEncodeTable(table + (size_t)t * kNumSymbols);
+        }
+    }
+    ansEncodeCoalesced(
+        blockSize,
+        coder == kPansCoderWide,
+        checksum,
+        1,
+        &in,
+        &inSize,
+        sliceBlockStart,
         table,
-        tempHistogram,
-        precision,
-        inPtrs,
-        batchSize,
-        encPtrs,
-        outCompressedSize,
-        headerOut,
-        maxNumCompressedBlocks,
+        probs,
+        &probBits,
         uncoalescedBlockStride,
-        compressedBlocks_host,
-        compressedWords_host,
-        compressedWords_host_prefix,
-        compressedWordsPrefix_host);
+        windowBlocks,
+        windowWords,
+        windowStart,
+        sliceWords,
+        &out,
+        &outCapacity,
+        &outCompressedSize,
+        par,
+        sliceTables);
     auto end = std::chrono::high_resolution_clock::now();
     duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1e3;
-    
-    auto blockWordsOut = headerOut->getBlockWords(maxNumCompressedBlocks);
-    auto BlockDataStart = headerOut->getBlockDataStart(maxNumCompressedBlocks);
-    
-    int i = 0;
-    for(; i < static_cast<int>(maxNumCompressedBlocks) - 1; i ++){
-        auto uncoalescedBlock = compressedBlocks_host + i * uncoalescedBlockStride;
-        for(int j = 0; j < kWarpSize; ++j){
-            auto warpStateOut = (ANSWarpState*)uncoalescedBlock;
-            headerOut->getWarpStates()[i].warpState[j] = (warpStateOut->warpState[j]);
-        }
-        blockWordsOut[i] = uint2{
-            (kDefaultBlockSize << 16) | compressedWords_host[i], 
-            compressedWordsPrefix_host[i]};
-    }
-
-    // Process last block
-    auto uncoalescedBlock = compressedBlocks_host + i * uncoalescedBlockStride;
-    for(int j = 0; j < kWarpSize; ++j){
-        auto warpStateOut = (ANSWarpState*)uncoalescedBlock;
-        headerOut->getWarpStates()[i].warpState[j] = (warpStateOut->warpState[j]);
-    }
-    
-    uint32_t lastBlockWords = static_cast<uint32_t>(fileSize) % kDefaultBlockSize;
-    lastBlockWords = lastBlockWords == 0 ? kDefaultBlockSize : lastBlockWords;
-
-    blockWordsOut[i] =
-        uint2{(lastBlockWords << 16) |
-                  compressedWords_host[i],
-              compressedWordsPrefix_host[i]};
-
-    // Aggregate the header and all block data into compressedData
-    const uint32_t headerSize =
-        headerOut->getCompressedOverhead(
-            maxNumCompressedBlocks);
-    uint32_t outsize = *outCompressedSize;
-    compressedSize = outsize;
-
-    compressedData.resize(outsize);
-
-    // First copy the header part
-    std::memcpy(compressedData.data(),
-                encPtrs,
-                headerSize);
-
-    // Append block data sequentially after the header
-    uint8_t* writePtr =
-        compressedData.data() + headerSize;
-
-    i = 0;
-    for (; i < static_cast<int>(maxNumCompressedBlocks) - 1;
-         i++) {
-        auto uncoalescedBlock2 =
-            compressedBlocks_host +
-            i * uncoalescedBlockStride;
-        uint32_t numWords = compressedWords_host[i];
-        uint32_t limitEnd = divUp(numWords, kBlockAlignment / sizeof(ANSEncodedT));
-
-        auto inT = (const uint4*)(uncoalescedBlock2 +
-                                  sizeof(ANSWarpState));
-        size_t bytes = (size_t)limitEnd << 4;
-        std::memcpy(writePtr,
-                    reinterpret_cast<const char*>(inT),
-                    bytes);
-        writePtr += bytes;
-    }
-
-    // Write last block data
-    {
-        uint32_t numWords = compressedWords_host[i];
-        uint32_t limitEnd =
-            divUp(numWords,
-                  kBlockAlignment /
-                      sizeof(ANSEncodedT));
-        auto inT = (const uint4*)(uncoalescedBlock +
-                                  sizeof(ANSWarpState));
-        size_t bytes = (size_t)limitEnd << 4;
-        std::memcpy(writePtr,
-                    reinterpret_cast<const char*>(inT),
-                    bytes);
-        writePtr += bytes;
-    }
-
-    // Clean up
-    free(outCompressedSize);
-    free(encPtrs);
-    free(table);
-    free(tempHistogram);
-    free(compressedBlocks_host);
-    free(compressedWords_host);
-    free(compressedWords_host_prefix);
-    free(compressedWordsPrefix_host);
+
+    if (outCompressedSize == 0) {
+        std::cerr << "Error: output buffer too small (" << outCapacity
+                  << " bytes)." << std::endl;
+    }
+    return outCompressedSize;
 }
 
 // benchmark: call pans_compress multiple times to measure time
@@ -178,8 +316,8 @@ void pans_compress_and_benchmark(
     std::vector<uint8_t>& inputData,
     std::vector<uint8_t>& compressedData
 ) {
-    uint32_t batchSize = 0;
-    uint32_t compressedSize = 0;
+    size_t batchSize = 0;
+    size_t compressedSize = 0;
 
     const std::streamsize fileSize =
         static_cast<std::streamsize>(inputData.size());
@@ -191,7 +329,7 @@ void pans_compress_and_benchmark(
     // Warmup & Benchmark loop
     for(int i = 0; i < 11; i ++){
         std::vector<uint8_t> tmp;
-        uint32_t bs = 0, cs = 0;
+        size_t bs = 0, cs = 0;
         pans_compress(inputData, tmp, bs, cs,dur);
         if (i > 0 && comp_time > dur) comp_time = dur;  // discard the 0th run as warmup
         if (i == 10) {
@@ -218,85 +356,748 @@ void pans_compress_and_benchmark(
 void pans_decompress(
     std::vector<uint8_t>& compressedData,
     std::vector<uint8_t>& decompressedData,
-    uint32_t& batchSize,
-    uint32_t& compressedSize,
+    size_t& batchSize,
+    size_t& compressedSize,
     double &duration
 ) {
-    if (compressedData.size() < 32) {
-        std::cerr << "Error: compressedData too small."
-                  << std::endl;
+    PansDecodeScratch scratch;
+    pans_decompress(compressedData, decompressedData, batchSize, compressedSize, duration, scratch);
+}
+
+size_t pans_decompressed_size(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        return 0;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getTotalUncompressedWords() * sizeof(ANSDecodedT);
+}
+
+int pans_precision(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        return 0;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getProbBits();
+}
+
+uint32_t pans_block_size(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        return 0;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getBlockSize();
+}
+
+uint32_t pans_num_tables(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        return 0;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getNumTables();
+}
+
+uint32_t pans_coder(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        return kPansCoderPortable;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getWideCoder() ? kPansCoderWide : kPansCoderPortable;
+}
+
+bool pans_has_checksums(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        return false;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getUseChecksum();
+}
+
+uint32_t pans_dictionary_id(const uint8_t* in, size_t inSize) {
+    if (inSize < sizeof(ANSCoalescedHeader) + kANSDictionaryRefSize) {
+        return kPansNoDictionary;
+    }
+    ANSCoalescedHeader Header;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return Header.getUseDictionary() ? ((ANSCoalescedHeader*)in)->getDictionaryId()
+                                     : kPansNoDictionary;
+}
+
+// Decode table of the dictionary a stream refers to, null if it stores its
+// own; false if that dictionary is not loaded or does not match the header.
+// The stream is known to hold its overhead.
+static bool decode_dictionary(const uint8_t* in, ANSCoalescedHeader& Header,
+                              const uint32_t*& tables) {
+    tables = nullptr;
+    if (!Header.getUseDictionary()) {
+        return true;
+    }
+    const ANSDictionary* dict = find_dictionary(((ANSCoalescedHeader*)in)->getDictionaryId());
+    if (dict == nullptr || dict->encode.probBits != (int)Header.getProbBits() ||
+        Header.getNumTables() != 1) {
+        return false;
+    }
+    tables = dict->lookup.data();
+    return true;
+}
+
+// Every block of a multi-table stream (or of blocks [first, last) of it)
+// must name one of its tables; the stream is known to hold its overhead
+static bool valid_table_index(const uint8_t* in, ANSCoalescedHeader& Header,
+                              uint32_t first = 0, uint32_t last = UINT32_MAX) {
+    const uint32_t numTables = Header.getNumTables();
+    if (numTables == 1) {
+        return true;
+    }
+    const uint8_t* index = ((ANSCoalescedHeader*)in)->getTableIndex();
+    last = std::min(last, Header.getNumBlocks());
+    uint8_t maxTable = 0;
+    for (uint32_t i = first; i < last; ++i) {
+        maxTable = std::max(maxTable, index[i]);
+    }
+    return maxTable < numTables;
+}
+
+// No table of the stream may cover more than the 1 << ProbBits entries
+// its decode table has; the stream is known to hold its overhead
+static bool valid_tables(const uint8_t* in, ANSCoalescedHeader& Header) {
+    if (Header.getUseDictionary()) {
+        return true;
+    }
+    const uint8_t* tables = in + sizeof(ANSCoalescedHeader);
+    for (uint32_t t = 0; t < Header.getNumTables(); ++t) {
+        uint32_t sum = 0;
+        for (uint32_t s = 0; s < kNumSymbols; ++s) {
+            sum += loadUnaligned<uint16_t>(tables + ((size_t)t * kNumSymbols + s) * sizeof(uint16_t));
+        }
+        if (sum > (1u << Header.getProbBits())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every block (or blocks [first, last)) must decode to its share of the
+// symbols from words inside the stream; the stream is known to hold its
+// overhead
+static bool valid_block_words(const uint8_t* in, ANSCoalescedHeader& Header,
+                              uint32_t first = 0, uint32_t last = UINT32_MAX) {
+    const uint32_t numBlocks = Header.getNumBlocks();
+    const uint32_t blockSize = Header.getBlockSize();
+    const uint64_t totalSymbols = Header.getTotalUncompressedWords();
+    const uint64_t totalWords = Header.getTotalCompressedWords();
+    auto headerIn = (ANSCoalescedHeader*)in;
+    last = std::min(last, numBlocks);
+    for (uint32_t i = first; i < last; ++i) {
+        const ANSBlockWords64 w = headerIn->loadBlockWords(numBlocks, i);
+        const uint64_t symbols = std::min<uint64_t>(blockSize, totalSymbols - (uint64_t)i * blockSize);
+        if (getBlockUncompressedWords(w.x) != symbols ||
+            w.start + getBlockCompressedWords(w.x) > totalWords) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The header checksum of a stream with block checksums must be the one of
+// them, so a corrupt checksum section is not taken for corrupt blocks; the
+// stream is known to hold its overhead
+static bool valid_checksums(const uint8_t* in, ANSCoalescedHeader& Header) {
+    if (!Header.getUseChecksum()) {
+        return true;
+    }
+    const uint32_t numBlocks = Header.getNumBlocks();
+    return ansStreamChecksum(selectChecksum(), ((ANSCoalescedHeader*)in)->getBlockChecksums(numBlocks),
+                             numBlocks) == Header.getChecksum();
+}
+
+// Indices of the blocks flagged in blockBad (numBlocks entries)
+static void collect_bad_blocks(const uint8_t* blockBad, uint32_t numBlocks,
+                               std::vector<uint32_t>& badBlocks) {
+    badBlocks.clear();
+    for (uint32_t i = 0; i < numBlocks; ++i) {
+        if (blockBad[i]) badBlocks.push_back(i);
+    }
+}
+
+static void report_bad_blocks(const std::vector<uint32_t>& badBlocks, const char* stream) {
+    std::cerr << "Error: " << badBlocks.size() << " block(s) of " << stream
+              << " do not match their checksums, the first is block " << badBlocks[0] << "."
+              << std::endl;
+}
+
+void pans_histogram(
+    const uint8_t* in,
+    size_t inSize,
+    uint64_t* counts,
+    const mans::Parallel& par) {
+    ansHistogram(in, inSize, counts, par);
+}
+
+void pans_decompress(
+    const std::vector<uint8_t>& compressedData,
+    std::vector<uint8_t>& decompressedData,
+    size_t& batchSize,
+    size_t& compressedSize,
+    double &duration,
+    PansDecodeScratch& scratch
+) {
+    decompressedData.resize(
+        pans_decompressed_size(compressedData.data(), compressedData.size()));
+    size_t written = pans_decompress(compressedData.data(), compressedData.size(),
+                                     decompressedData.data(), decompressedData.size(),
+                                     duration, scratch);
+    if (written == 0) {
         decompressedData.clear();
         batchSize = 0;
         compressedSize = 0;
         return;
     }
+    batchSize = written;
+    compressedSize = compressedData.size();
+}
 
-    // Read the header data directly from compressedData
-    std::vector<uint8_t> fileCompressedHead(32);
-    std::memcpy(fileCompressedHead.data(),
-                compressedData.data(),
-                32);
-    auto Header =
-        (ANSCoalescedHeader*)fileCompressedHead.data();
-    int totalCompressedSize =
-        Header->getTotalCompressedSize();
-    int bs =
-        Header->getTotalUncompressedWords();
-
-    if ((int)compressedData.size() < totalCompressedSize) {
+// Reads the header of the stream at in (any byte offset) into Header and
+// checks that the stream holds what it claims and that the coder supports
+// its precision and block size
+static bool read_stream_header(const uint8_t* in, size_t inSize, ANSCoalescedHeader& Header) {
+    if (inSize < sizeof(ANSCoalescedHeader)) {
+        std::cerr << "Error: compressedData too small."
+                  << std::endl;
+        return false;
+    }
+    std::memcpy(&Header,
+                in,
+                sizeof(ANSCoalescedHeader));
+    if (!Header.isSupportedVersion()) {
+        std::cerr << "Error: unknown stream magic or version." << std::endl;
+        return false;
+    }
+    if (inSize < Header.getTotalCompressedSize()) {
         std::cerr
             << "Error: compressedData size less than header "
                "reported totalCompressedSize."
             << std::endl;
-        decompressedData.clear();
-        batchSize = 0;
-        compressedSize = 0;
-        return;
+        return false;
     }
+    const int precision = Header.getProbBits();
+    if (precision < kANSMinProbBits || precision > kANSMaxProbBits) {
+        std::cerr << "Error: unsupported precision " << precision
+                  << " in the stream header." << std::endl;
+        return false;
+    }
+    const size_t bs = Header.getTotalUncompressedWords() * sizeof(ANSDecodedT);
+    const uint32_t blockSize = Header.getBlockSize();
+    if (!isSupportedBlockSize(blockSize) ||
+        Header.getNumBlocks() != divUp(bs, (size_t)blockSize)) {
+        std::cerr << "Error: unsupported block size " << blockSize
+                  << " in the stream header." << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    compressedSize = static_cast<uint32_t>(compressedData.size());
-    batchSize = static_cast<uint32_t>(bs);
-
-    uint8_t* compressedPtr =
-        compressedData.data();
+// A compact (v3) stream is expanded into scratch and in, inSize and Header
+// are pointed at that; other streams are left as they are
+static bool expand_compact(const uint8_t*& in, size_t& inSize, ANSCoalescedHeader& Header,
+                           PansDecodeScratch& scratch) {
+    if (Header.getVersion() != kANSVersionCompact) {
+        return true;
+    }
+    uint8_t* expanded = scratch.expanded.reserve(ansExpandedSizeBound(Header));
+    inSize = ansExpandStream(in, expanded);
+    if (inSize == 0) {
+        std::cerr << "Error: malformed compact stream." << std::endl;
+        return false;
+    }
+    in = expanded;
+    std::memcpy(&Header, in, sizeof(ANSCoalescedHeader));
+    return true;
+}
 
-    const int precision = PANS_PRECISION;
+// pans_decompress, and with out null pans_verify: decodes the stream into out
+// or only checks its blocks, and returns its uncompressed size, 0 if it is
+// malformed. A stream with block checksums gets the ones that do not match
+// in badBlocks; checksum says whether it has them.
+static size_t decode_stream(
+    const uint8_t* in,
+    size_t inSize,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par,
+    std::vector<uint32_t>& badBlocks,
+    bool& checksum
+) {
+    badBlocks.clear();
+    checksum = false;
+    ANSCoalescedHeader Header;
+    if (!read_stream_header(in, inSize, Header)) {
+        return 0;
+    }
+    size_t bs =
+        Header.getTotalUncompressedWords() * sizeof(ANSDecodedT);
+    if (out != nullptr && outCapacity < bs) {
+        std::cerr << "Error: output buffer too small (" << outCapacity
+                  << " < " << bs << " bytes)." << std::endl;
+        return 0;
+    }
+    const int precision = Header.getProbBits();
+    const uint32_t blockSize = Header.getBlockSize();
 
-    uint8_t* decPtrs =
-        (uint8_t*)malloc(sizeof(uint8_t) *
-                         (size_t)batchSize);
-    uint32_t* symbol = (uint32_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint32_t) * (1u << precision));
-    uint32_t* pdf = (uint32_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint32_t) * (1u << precision));
-    uint32_t* cdf = (uint32_t*)std::aligned_alloc(
-        kBlockAlignment,
-        sizeof(uint32_t) * (1u << precision));
-    
     auto start = std::chrono::high_resolution_clock::now();
+    if (!expand_compact(in, inSize, Header, scratch)) {
+        return 0;
+    }
+    if (!valid_table_index(in, Header)) {
+        std::cerr << "Error: table index out of range in the stream." << std::endl;
+        return 0;
+    }
+    if (!valid_tables(in, Header) || !valid_block_words(in, Header)) {
+        std::cerr << "Error: table or block sizes out of range in the stream." << std::endl;
+        return 0;
+    }
+    const uint32_t* dictionary;
+    if (!decode_dictionary(in, Header, dictionary)) {
+        std::cerr << "Error: the stream refers to dictionary "
+                  << ((ANSCoalescedHeader*)in)->getDictionaryId()
+                  << ", which is not loaded or does not match." << std::endl;
+        return 0;
+    }
+    if (!valid_checksums(in, Header)) {
+        std::cerr << "Error: the block checksums do not match the header checksum." << std::endl;
+        return 0;
+    }
+    checksum = Header.getUseChecksum();
+    if (out == nullptr && !checksum) {
+        return bs;
+    }
+    uint8_t* blockBad = checksum ? scratch.blockBad.reserve(Header.getNumBlocks()) : nullptr;
+
+    // a stream with a dictionary has no tables of its own to build
+    const size_t numTables = dictionary ? 0 : Header.getNumTables();
+    uint32_t* lookup = scratch.lookup.reserve(numTables << precision);
+
     ansDecode(
-        symbol,
-        pdf,
-        cdf,
+        lookup,
         precision,
-        compressedPtr,
-        decPtrs);
+        blockSize,
+        in,
+        out,
+        par,
+        dictionary,
+        blockBad);
+    if (checksum) {
+        collect_bad_blocks(blockBad, Header.getNumBlocks(), badBlocks);
+    }
     auto end = std::chrono::high_resolution_clock::now();  
     duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() / 1e3;
 
+    return bs;
+}
 
+size_t pans_decompress(
+    const uint8_t* in,
+    size_t inSize,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par
+) {
+    std::vector<uint32_t> badBlocks;
+    bool checksum;
+    size_t bs = decode_stream(in, inSize, out, outCapacity, duration, scratch, par, badBlocks, checksum);
+    if (!badBlocks.empty()) {
+        report_bad_blocks(badBlocks, "the stream");
+        return 0;
+    }
+    return bs;
+}
 
-    decompressedData.resize((size_t)batchSize);
-    std::memcpy(decompressedData.data(),
-                decPtrs,
-                (size_t)batchSize * sizeof(uint8_t));
+bool pans_decompress_range(
+    const uint8_t* in,
+    size_t inSize,
+    uint64_t offset,
+    size_t size,
+    uint8_t* out,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par
+) {
+    ANSCoalescedHeader Header;
+    if (!read_stream_header(in, inSize, Header)) {
+        return false;
+    }
+    const uint64_t bs = Header.getTotalUncompressedWords() * sizeof(ANSDecodedT);
+    if (offset > bs || size > bs - offset) {
+        std::cerr << "Error: range [" << offset << ", " << offset + size
+                  << ") outside the " << bs << " bytes of the stream." << std::endl;
+        return false;
+    }
+    if (size == 0) {
+        return true;
+    }
+    if (!expand_compact(in, inSize, Header, scratch)) {
+        return false;
+    }
+    const int precision = Header.getProbBits();
+    const uint32_t blockSize = Header.getBlockSize();
+    const uint32_t first = (uint32_t)(offset / blockSize);
+    const uint32_t last = (uint32_t)divUp(offset + size, (uint64_t)blockSize);
+    if (!valid_table_index(in, Header, first, last)) {
+        std::cerr << "Error: table index out of range in the stream." << std::endl;
+        return false;
+    }
+    if (!valid_tables(in, Header) || !valid_block_words(in, Header, first, last)) {
+        std::cerr << "Error: table or block sizes out of range in the stream." << std::endl;
+        return false;
+    }
+    const uint32_t* dictionary;
+    if (!decode_dictionary(in, Header, dictionary)) {
+        std::cerr << "Error: the stream refers to dictionary "
+                  << ((ANSCoalescedHeader*)in)->getDictionaryId()
+                  << ", which is not loaded or does not match." << std::endl;
+        return false;
+    }
+    // the header checksum covers every block checksum, so only the blocks
+    // decoded are checked, each against its own
+    const bool checksum = Header.getUseChecksum();
+    uint8_t* blockBad = checksum ? scratch.blockBad.reserve(last - first) : nullptr;
 
-    free(decPtrs);
-    free(symbol);
-    free(pdf);
-    free(cdf);
+    const size_t numTables = dictionary ? 0 : Header.getNumTables();
+    uint32_t* lookup = scratch.lookup.reserve(numTables << precision);
+    ansDecodeRange(lookup, precision, blockSize, in, offset, size, out, par, dictionary, blockBad);
+    if (checksum) {
+        std::vector<uint32_t> badBlocks;
+        collect_bad_blocks(blockBad, last - first, badBlocks);
+        if (!badBlocks.empty()) {
+            for (uint32_t& b : badBlocks) b += first;
+            report_bad_blocks(badBlocks, "the stream");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool pans_verify(
+    const uint8_t* in,
+    size_t inSize,
+    std::vector<uint32_t>& badBlocks,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par
+) {
+    double duration;
+    bool checksum;
+    size_t bs = decode_stream(in, inSize, nullptr, 0, duration, scratch, par, badBlocks, checksum);
+    if (bs != 0 && !checksum) {
+        std::cerr << "Error: the stream has no block checksums." << std::endl;
+    }
+    return checksum;
+}
+
+void pans_compress_batch(
+    uint32_t numInBatch,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par,
+    int precision,
+    uint32_t blockSize,
+    size_t segmentBytes,
+    uint32_t dictionary,
+    uint32_t coder,
+    bool checksum
+) {
+    pans_compress_batch(numInBatch, in, inSize, nullptr, out, outCapacity, outSize, scratch,
+                        par, precision, blockSize, segmentBytes, dictionary, coder, checksum);
+}
+
+void pans_compress_batch(
+    uint32_t numInBatch,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    const uint64_t* const* inHistograms,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par,
+    int precision,
+    uint32_t blockSize,
+    size_t segmentBytes,
+    uint32_t dictionary,
+    uint32_t coder,
+    bool checksum
+) {
+    if (numInBatch == 0) {
+        return;
+    }
+    if (!valid_precision(precision)) {
+        std::cerr << "Error: unsupported precision " << precision << "." << std::endl;
+        std::fill(outSize, outSize + numInBatch, 0);
+        return;
+    }
+    if (!isSupportedBlockSize(blockSize)) {
+        std::cerr << "Error: unsupported block size " << blockSize << "." << std::endl;
+        std::fill(outSize, outSize + numInBatch, 0);
+        return;
+    }
+    if (!valid_coder(coder)) {
+        std::cerr << "Error: unknown coder " << coder << "." << std::endl;
+        std::fill(outSize, outSize + numInBatch, 0);
+        return;
+    }
+    const ANSEncodeDictionary* dict;
+    if (!encode_dictionary(dictionary, dict)) {
+        std::fill(outSize, outSize + numInBatch, 0);
+        return;
+    }
+
+    // flattened block index: inputs own consecutive block ranges
+    uint32_t* sliceBlockStart = scratch.sliceBlocks.reserve(numInBatch + 1);
+    sliceBlockStart[0] = 0;
+    for (uint32_t i = 0; i < numInBatch; ++i) {
+        size_t end = sliceBlockStart[i] + divUp(inSize[i], (size_t)blockSize);
+        if (end > UINT32_MAX) {
+            std::cerr << "Error: batch needs more than 2^32 blocks." << std::endl;
+            std::fill(outSize, outSize + numInBatch, 0);
+            return;
+        }
+        sliceBlockStart[i + 1] = static_cast<uint32_t>(end);
+    }
+    uint32_t totalBlocks = sliceBlockStart[numInBatch];
+
+    // with segments, every input gets room for as many tables as it may use
+    size_t numTables = numInBatch;
+    uint32_t* sliceTableStart = nullptr;
+    uint32_t* sliceNumTables = nullptr;
+    uint8_t* blockTable = nullptr;
+    if (segmentBytes != kPansNoSegments) {
+        sliceTableStart = scratch.sliceTables.reserve(numInBatch + 1);
+        sliceNumTables = scratch.tableCount.reserve(numInBatch);
+        blockTable = scratch.blockTable.reserve(totalBlocks);
+        sliceTableStart[0] = 0;
+        for (uint32_t i = 0; i < numInBatch; ++i) {
+            uint32_t numBlocks = sliceBlockStart[i + 1] - sliceBlockStart[i];
+            sliceTableStart[i + 1] = sliceTableStart[i] +
+                ansMaxTables(numBlocks, ansSegmentBlocks(numBlocks, blockSize, segmentBytes));
+        }
+        numTables = sliceTableStart[numInBatch];
+    }
+
+    uint4* tables = (uint4*)scratch.table.reserve((size_t)4 * kNumSymbols * numTables);
+    uint64_t* histograms = scratch.histogram.reserve((size_t)kNumSymbols * numTables);
+    uint16_t* probs = scratch.probs.reserve((size_t)kNumSymbols * numTables);
+    uint32_t* sliceBits = scratch.sliceBits.reserve(numInBatch);
+    uint32_t* sliceDictionary = dict ? scratch.sliceDictionary.reserve(numInBatch) : nullptr;
+    uint8_t* tableStored = scratch.tableStored.reserve(numTables);
+    uint32_t uncoalescedBlockStride = getMaxBlockSizeUnCoalesced(
+        blockSize, dict ? std::max(dict->probBits, max_precision(precision)) : max_precision(precision));
+    uint32_t perWorker;
+    int workers;
+    const uint32_t window = getEncodeWindow(totalBlocks, blockSize, par.size(), perWorker, workers);
+    uint8_t* windowBlocks = scratch.blocks.reserve((size_t)2 * window * uncoalescedBlockStride);
+    uint32_t* windowWords = scratch.words.reserve((size_t)2 * window);
+    uint64_t* windowStart = scratch.wordsStart.reserve((size_t)2 * window);
+    uint64_t* sliceWords = scratch.sliceWords.reserve(numInBatch);
+
+    ansEncodeBatch(
+        precision,
+        blockSize,
+        coder == kPansCoderWide,
+        checksum,
+        segmentBytes,
+        numInBatch,
+        in,
+        inSize,
+        inHistograms,
+        sliceBlockStart,
+        sliceTableStart,
+        tables,
+        histograms,
+        probs,
+        sliceBits,
+        sliceNumTables,
+        blockTable,
+        dict,
+        sliceDictionary,
+        tableStored,
+        uncoalescedBlockStride,
+        windowBlocks,
+        windowWords,
+        windowStart,
+        sliceWords,
+        out,
+        outCapacity,
+        outSize,
+        par);
+}
+
+void pans_decompress_batch(
+    uint32_t numInBatch,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par
+) {
+    if (numInBatch == 0) {
+        return;
+    }
+    // compact streams are expanded first, into one buffer
+    const uint8_t** streams = scratch.streams.reserve(numInBatch);
+    size_t* streamBytes = scratch.streamBytes.reserve(numInBatch);
+    size_t* expandedAt = scratch.expandedAt.reserve(numInBatch);
+    size_t expandedBytes = 0;
+    for (uint32_t i = 0; i < numInBatch; ++i) {
+        streams[i] = in[i];
+        streamBytes[i] = inSize[i];
+        expandedAt[i] = SIZE_MAX;
+        if (inSize[i] < sizeof(ANSCoalescedHeader)) continue;
+        ANSCoalescedHeader Header;
+        std::memcpy(&Header, in[i], sizeof(ANSCoalescedHeader));
+        if (!Header.isSupportedVersion() || Header.getVersion() != kANSVersionCompact) continue;
+        size_t bound = ansExpandedSizeBound(Header);
+        if (bound == 0 || Header.getTotalCompressedSize() > inSize[i] ||
+            Header.getTotalUncompressedWords() * sizeof(ANSDecodedT) > outCapacity[i]) {
+            streamBytes[i] = 0;
+            continue;
+        }
+        expandedAt[i] = expandedBytes;
+        expandedBytes += bound;
+    }
+    if (expandedBytes > 0) {
+        uint8_t* expanded = scratch.expanded.reserve(expandedBytes);
+        par.for_range(numInBatch, [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                if (expandedAt[i] == SIZE_MAX) continue;
+                streams[i] = expanded + expandedAt[i];
+                streamBytes[i] = ansExpandStream(in[i], expanded + expandedAt[i]);
+            }
+        });
+    }
+
+    // streams that fail validation get an empty block range
+    uint32_t* sliceBlockStart = scratch.sliceBlocks.reserve(numInBatch + 1);
+    uint32_t* sliceTableStart = scratch.sliceTables.reserve(numInBatch + 1);
+    const uint32_t** slicePrebuilt = scratch.dictionaries.reserve(numInBatch);
+    uint8_t** sliceBlockBad = scratch.sliceBlockBad.reserve(numInBatch);
+    bool anyChecksum = false;
+    sliceBlockStart[0] = 0;
+    sliceTableStart[0] = 0;
+    int maxPrecision = 0;
+    uint32_t kernelsSeen = 0;
+    for (uint32_t i = 0; i < numInBatch; ++i) {
+        uint32_t numBlocks = 0;
+        uint32_t numTables = 0;
+        outSize[i] = 0;
+        slicePrebuilt[i] = nullptr;
+        sliceBlockBad[i] = nullptr;
+        if (streamBytes[i] >= sizeof(ANSCoalescedHeader)) {
+            ANSCoalescedHeader Header;
+            std::memcpy(&Header, streams[i], sizeof(ANSCoalescedHeader));
+            size_t bs = Header.getTotalUncompressedWords() * sizeof(ANSDecodedT);
+            int precision = Header.getProbBits();
+            uint32_t blockSize = Header.getBlockSize();
+            if (Header.isSupportedVersion() &&
+                Header.getTotalCompressedSize() <= streamBytes[i] && bs <= outCapacity[i] &&
+                precision >= kANSMinProbBits && precision <= kANSMaxProbBits &&
+                isSupportedBlockSize(blockSize) &&
+                Header.getNumBlocks() == divUp(bs, (size_t)blockSize) &&
+                (size_t)sliceBlockStart[i] + Header.getNumBlocks() <= UINT32_MAX &&
+                valid_table_index(streams[i], Header) &&
+                valid_tables(streams[i], Header) &&
+                valid_block_words(streams[i], Header) &&
+                decode_dictionary(streams[i], Header, slicePrebuilt[i]) &&
+                valid_checksums(streams[i], Header)) {
+                numBlocks = Header.getNumBlocks();
+                numTables = slicePrebuilt[i] ? 0 : Header.getNumTables();
+                anyChecksum |= Header.getUseChecksum() && numBlocks > 0;
+                outSize[i] = bs;
+                if (numBlocks > 0) {
+                    maxPrecision = std::max(maxPrecision, precision);
+                    kernelsSeen |= 1u << kernel_index(precision, blockSize);
+                }
+            }
+        }
+        if (outSize[i] == 0 && inSize[i] != 0) {
+            std::cerr << "Error: batch stream " << i
+                      << " is malformed or its output buffer is too small." << std::endl;
+        }
+        sliceBlockStart[i + 1] = sliceBlockStart[i] + numBlocks;
+        sliceTableStart[i + 1] = sliceTableStart[i] + numTables;
+    }
+    if (kernelsSeen == 0) {
+        return;
+    }
+    // the flags of the blocks of each stream with checksums, in block order
+    uint8_t* blockBad =
+        anyChecksum ? scratch.blockBad.reserve(sliceBlockStart[numInBatch]) : nullptr;
+    for (uint32_t i = 0; anyChecksum && i < numInBatch; ++i) {
+        if (outSize[i] != 0 && pans_has_checksums(streams[i], streamBytes[i])) {
+            sliceBlockBad[i] = blockBad + sliceBlockStart[i];
+        }
+    }
+
+    const size_t totalTables = sliceTableStart[numInBatch];
+    uint32_t* tables = scratch.lookup.reserve(((size_t)1 << maxPrecision) * totalTables);
+
+    // The kernels are built per precision and block size: one pass per
+    // combination present, with the streams of the others given empty block
+    // ranges
+    for (int precision = kANSMinProbBits; precision <= kANSMaxProbBits; ++precision) {
+        for (uint32_t blockSize = kMinBlockSize; blockSize <= kMaxBlockSize; blockSize *= 2) {
+            const uint32_t kernel = 1u << kernel_index(precision, blockSize);
+            if (!(kernelsSeen & kernel)) continue;
+            const uint32_t* passBlockStart = sliceBlockStart;
+            if (kernelsSeen != kernel) {
+                uint32_t* kernelBlockStart = scratch.kernelBlocks.reserve(numInBatch + 1);
+                kernelBlockStart[0] = 0;
+                for (uint32_t i = 0; i < numInBatch; ++i) {
+                    uint32_t numBlocks = sliceBlockStart[i + 1] - sliceBlockStart[i];
+                    if (pans_precision(streams[i], streamBytes[i]) != precision ||
+                        pans_block_size(streams[i], streamBytes[i]) != blockSize) {
+                        numBlocks = 0;
+                    }
+                    kernelBlockStart[i + 1] = kernelBlockStart[i] + numBlocks;
+                }
+                passBlockStart = kernelBlockStart;
+            }
+            ansDecodeBatch(
+                precision,
+                blockSize,
+                numInBatch,
+                streams,
+                out,
+                passBlockStart,
+                sliceTableStart,
+                slicePrebuilt,
+                tables,
+                par,
+                sliceBlockBad);
+        }
+    }
+
+    std::vector<uint32_t> badBlocks;
+    for (uint32_t i = 0; anyChecksum && i < numInBatch; ++i) {
+        if (sliceBlockBad[i] == nullptr) continue;
+        collect_bad_blocks(sliceBlockBad[i], sliceBlockStart[i + 1] - sliceBlockStart[i], badBlocks);
+        if (!badBlocks.empty()) {
+            outSize[i] = 0;
+            report_bad_blocks(badBlocks, ("batch stream " + std::to_string(i)).c_str());
+        }
+    }
 }
 
 // benchmark: call pans_decompress multiple times to measure time
@@ -304,8 +1105,8 @@ void pans_decompress_and_benchmark(
     std::vector<uint8_t>& compressedData,
     std::vector<uint8_t>& decompressedData
 ) {
-    uint32_t batchSize = 0;
-    uint32_t compressedSize = 0;
+    size_t batchSize = 0;
+    size_t compressedSize = 0;
 
 
 
@@ -315,7 +1116,7 @@ void pans_decompress_and_benchmark(
     // Warmup & Benchmark loop
     for(int i = 0; i < 11; i ++){
         std::vector<uint8_t> tmp;
-        uint32_t bs = 0, cs = 0;
+        size_t bs = 0, cs = 0;
         pans_decompress(compressedData, tmp, bs, cs,dur);
         
         if (i > 0 && decomp_time > dur) decomp_time = dur; 
@@ -2,34 +2,337 @@
 #ifndef PANS_UTILS_H
 #define PANS_UTILS_H
 
+#include <cstddef>
 #include <cstdint>
 #include <vector>
 
+#include "../scratch_buffer.h"
+#include "../executor.h"
+
+// Table precision argument of the encoders: 9..12 bits, or
+// kPansAutoPrecision to pick it per input from the histogram and the size.
+// Decoders read it from the stream header.
+constexpr int kPansDefaultPrecision = 10;
+constexpr int kPansAutoPrecision = 0;
+
+// Symbols per ANS block, a power of two from 1 KiB to 64 KiB; also read back
+// from the stream header. Larger blocks carry less per-block overhead,
+// smaller ones spread better over threads.
+constexpr uint32_t kPansDefaultBlockSize = 4096;
+
+// Segment argument of the encoders: 0 codes the whole input with one table;
+// otherwise the input is cut into segments of at least this many bytes (and
+// at least kPansMinSegmentSize), and segments with different symbol
+// distributions get tables of their own, up to 256 per stream. Decoders
+// handle both.
+constexpr size_t kPansNoSegments = 0;
+constexpr size_t kPansMinSegmentSize = size_t(64) << 10;
+
+// Dictionary argument of the encoders: kPansNoDictionary, or the ID of a
+// dictionary registered with pans_load_dictionary. Inputs it suits are coded
+// with its table and their streams refer to it instead of storing one; they
+// only decode where the same dictionary is loaded. A serialized dictionary
+// (pans_train_dictionary) is kPansDictionarySize bytes.
+constexpr uint32_t kPansNoDictionary = 0;
+constexpr size_t kPansDictionarySize = 528;
+
+// Coder argument of the encoders: kPansCoderPortable writes the streams the
+// GPU decoders share (32-bit states, 16-bit words, 32 lanes per block);
+// kPansCoderWide 64-bit states and 32-bit words in 16 lanes, which
+// renormalize half as often and decode faster on a CPU, but only there.
+// Decoders read it from the stream header.
+constexpr uint32_t kPansCoderPortable = 0;
+constexpr uint32_t kPansCoderWide = 1;
+
+// Checksum argument of the encoders: with true the stream carries the CRC32C
+// of every block, 4 bytes per block. pans_decompress then checks every block
+// as it decodes it and fails naming the first one that does not match, and
+// pans_verify checks a stream without writing it out.
+
+// Streams of inputs up to kPansCompactMaxSize bytes are written in a compact
+// layout (varint tables, states and block sizes, no padding) when that is
+// smaller. The decoders expand them before decoding.
+constexpr size_t kPansCompactMaxSize = size_t(64) << 10;
+
+// Scratch reused across pans_compress calls. Every buffer only grows, so once
+// it has seen the largest input a caller feeds it, compression stops hitting
+// the allocator.
+// The batch entry points size the per-input tables for every input at once.
+struct PansEncodeScratch {
+    ScratchBuffer<uint32_t> table;         // kNumSymbols x uint4 encode lookup, per table
+    ScratchBuffer<uint64_t> histogram;     // kNumSymbols counts, per table
+    ScratchBuffer<uint16_t> probs;         // kNumSymbols quantized probabilities, per table
+    ScratchBuffer<uint8_t>  blocks;        // encoder window: uncoalesced blocks of two rounds
+    ScratchBuffer<uint32_t> words;         // compressed words per window block
+    ScratchBuffer<uint64_t> wordsStart;    // stream word offset per window block
+    ScratchBuffer<uint64_t> sliceWords;    // compressed words so far, per input
+    ScratchBuffer<uint32_t> sliceBlocks;   // batch only: first block of each input
+    ScratchBuffer<uint32_t> sliceBits;     // batch only: table precision of each input
+    ScratchBuffer<uint8_t>  blockTable;    // segments only: table of each block
+    ScratchBuffer<uint32_t> sliceTables;   // segments only: first table of each input
+    ScratchBuffer<uint32_t> tableCount;    // segments only: tables of each input
+    ScratchBuffer<uint32_t> sliceDictionary; // dictionary only: dictionary ID of each input, 0: none
+    ScratchBuffer<uint8_t>  tableStored;   // 1: the blocks of that table are stored, per table
+};
+
+// Scratch reused across pans_decompress calls.
+struct PansDecodeScratch {
+    ScratchBuffer<uint32_t> lookup;        // 1 << precision packed decode entries per table
+    ScratchBuffer<uint32_t> sliceTables;   // batch only: first table of each input
+    ScratchBuffer<uint32_t> kernelBlocks;  // batch only: sliceBlocks of the inputs of one kernel
+    ScratchBuffer<uint32_t> sliceBlocks;   // batch only: first block of each input
+    ScratchBuffer<const uint32_t*> dictionaries; // batch only: dictionary decode table of each input, null: none
+    ScratchBuffer<uint8_t>  expanded;      // compact streams expanded to the full layout
+    ScratchBuffer<const uint8_t*> streams; // batch only: each input, or its expanded form
+    ScratchBuffer<size_t>   streamBytes;   // batch only: size of streams[i], 0: malformed
+    ScratchBuffer<size_t>   expandedAt;    // batch only: offset of streams[i] in expanded
+    ScratchBuffer<uint8_t>  blockBad;      // checksums only: 1 per block that does not match
+    ScratchBuffer<uint8_t*> sliceBlockBad; // batch only: blockBad of each input, null: no checksums
+};
+
 // tool function：raw_data or adm_compressed_data -> pans_compressed_data
 void pans_compress(
     std::vector<uint8_t>& inputData,
     std::vector<uint8_t>& compressedData,
-    uint32_t& batchSize,
-    uint32_t& compressedSize,
+    size_t& batchSize,
+    size_t& compressedSize,
     double &duration
 );
 
+// same as above, but all temporaries live in (and are reused from) scratch
+void pans_compress(
+    const std::vector<uint8_t>& inputData,
+    std::vector<uint8_t>& compressedData,
+    size_t& batchSize,
+    size_t& compressedSize,
+    double &duration,
+    PansEncodeScratch& scratch
+);
+
 // tool function：pans_compressed_data -> raw_data or adm_compressed_data
 void pans_decompress(
     std::vector<uint8_t>& compressedData,
     std::vector<uint8_t>& decompressedData,
-    uint32_t& batchSize,
-    uint32_t& compressedSize,
+    size_t& batchSize,
+    size_t& compressedSize,
     double &duration
 );
 
-// benchmark: internally calls pans_compress, precision uses the macro PANS_PRECISION
+// same as above, but all temporaries live in (and are reused from) scratch
+void pans_decompress(
+    const std::vector<uint8_t>& compressedData,
+    std::vector<uint8_t>& decompressedData,
+    size_t& batchSize,
+    size_t& compressedSize,
+    double &duration,
+    PansDecodeScratch& scratch
+);
+
+// Upper bound on the pans_compress output size for inSize input bytes, at any
+// precision, block size and segment size
+size_t pans_max_compressed_size(size_t inSize);
+
+// Decoded size recorded in the header of a pans stream, 0 if in is too short
+size_t pans_decompressed_size(const uint8_t* in, size_t inSize);
+
+// Table precision recorded in the header of a pans stream, 0 if in is too short
+int pans_precision(const uint8_t* in, size_t inSize);
+
+// Block size recorded in the header of a pans stream, 0 if in is too short
+uint32_t pans_block_size(const uint8_t* in, size_t inSize);
+
+// Probability tables in a pans stream (1 unless it was encoded with
+// segments), 0 if in is too short
+uint32_t pans_num_tables(const uint8_t* in, size_t inSize);
+
+// Coder of a pans stream (kPansCoderPortable or kPansCoderWide),
+// kPansCoderPortable if in is too short
+uint32_t pans_coder(const uint8_t* in, size_t inSize);
+
+// Dictionary a pans stream refers to, kPansNoDictionary if it stores its own
+// tables or in is too short
+uint32_t pans_dictionary_id(const uint8_t* in, size_t inSize);
+
+// true if the stream carries block checksums (the checksum argument of the
+// encoders)
+bool pans_has_checksums(const uint8_t* in, size_t inSize);
+
+// Normalizes the summed symbol counts of sample inputs (counts, 256 entries)
+// into a serialized dictionary of kPansDictionarySize bytes at out, at
+// precision (kPansAutoPrecision: picked from the counts). id 0 derives the ID
+// from the table. Returns the ID, 0 if there are no counts or the precision
+// is not supported.
+uint32_t pans_train_dictionary(
+    const uint64_t* counts,
+    int precision,
+    uint32_t id,
+    uint8_t* out
+);
+
+// Registers the serialized dictionary at data for the encoders and decoders
+// of this process and returns its ID, 0 if it is malformed or another
+// dictionary is registered under the same ID. Loading one twice is harmless;
+// dictionaries stay registered until the process exits.
+uint32_t pans_load_dictionary(const uint8_t* data, size_t size);
+
+// Symbol counts of in[0, inSize) into counts (256 entries), the histogram the
+// encoder builds its tables from
+void pans_histogram(
+    const uint8_t* in,
+    size_t inSize,
+    uint64_t* counts,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// Pointer interface: encodes in[0, inSize) into out and returns the number of
+// bytes written, or 0 on error (including outCapacity being too small;
+// pans_max_compressed_size(inSize) is always enough). out may be unaligned.
+// All pointer functions run their parallel stages on par; the vector ones
+// above use the default pool and precision.
+size_t pans_compress(
+    const uint8_t* in,
+    size_t inSize,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel(),
+    int precision = kPansDefaultPrecision,
+    uint32_t blockSize = kPansDefaultBlockSize,
+    size_t segmentBytes = kPansNoSegments,
+    uint32_t dictionary = kPansNoDictionary,
+    uint32_t coder = kPansCoderPortable,
+    bool checksum = false
+);
+
+// Same as above for a caller that already has the symbol counts of
+// in[0, inSize) (histogram, 256 entries, e.g. from adm_emit), which saves the
+// encoder its histogram pass. The stream is the same as without them.
+// With segments the encoder counts every segment on its own and does not use
+// them.
+size_t pans_compress(
+    const uint8_t* in,
+    size_t inSize,
+    const uint64_t* histogram,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel(),
+    int precision = kPansDefaultPrecision,
+    uint32_t blockSize = kPansDefaultBlockSize,
+    size_t segmentBytes = kPansNoSegments,
+    uint32_t dictionary = kPansNoDictionary,
+    uint32_t coder = kPansCoderPortable,
+    bool checksum = false
+);
+
+// Pointer interface: decodes the stream at in (any alignment) straight into
+// out and returns the number of bytes written, or 0 on error, which includes
+// a block that does not match its checksum (out then holds the decoded data).
+size_t pans_decompress(
+    const uint8_t* in,
+    size_t inSize,
+    uint8_t* out,
+    size_t outCapacity,
+    double &duration,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// Random access: writes bytes [offset, offset + size) of the decoded stream
+// to out, decoding only the blocks that overlap them and checking only those
+// blocks and the tables they use, so the cost follows size rather than the
+// stream. Blocks of a stream with block checksums are checked against them.
+// false if the stream is malformed, the range lies outside it or a block
+// does not match its checksum.
+bool pans_decompress_range(
+    const uint8_t* in,
+    size_t inSize,
+    uint64_t offset,
+    size_t size,
+    uint8_t* out,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// Decodes every block of a stream with block checksums to check it, without
+// writing the output anywhere. badBlocks gets the indices of the blocks that
+// do not match, in order; block i starts at byte i * pans_block_size.
+// false if the stream is malformed or has no checksums.
+bool pans_verify(
+    const uint8_t* in,
+    size_t inSize,
+    std::vector<uint32_t>& badBlocks,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// Batched pointer interface: encodes numInBatch independent inputs together,
+// spreading the blocks of all of them over the threads.
+// Each output is the same stream pans_compress would produce for that input
+// at the same precision, block size, segment size and coder. outSize[i] is 0 for an empty input or when
+// outCapacity[i] is too small.
+void pans_compress_batch(
+    uint32_t numInBatch,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel(),
+    int precision = kPansDefaultPrecision,
+    uint32_t blockSize = kPansDefaultBlockSize,
+    size_t segmentBytes = kPansNoSegments,
+    uint32_t dictionary = kPansNoDictionary,
+    uint32_t coder = kPansCoderPortable,
+    bool checksum = false
+);
+
+// Same as above with the symbol counts of the inputs that have them at hand
+// (inHistograms[i], 256 entries); inputs with a null entry are counted as usual.
+void pans_compress_batch(
+    uint32_t numInBatch,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    const uint64_t* const* inHistograms,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    PansEncodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel(),
+    int precision = kPansDefaultPrecision,
+    uint32_t blockSize = kPansDefaultBlockSize,
+    size_t segmentBytes = kPansNoSegments,
+    uint32_t dictionary = kPansNoDictionary,
+    uint32_t coder = kPansCoderPortable,
+    bool checksum = false
+);
+
+// Batched pointer interface: decodes numInBatch streams together, spreading
+// the blocks of all of them over the threads; the streams may use different
+// precisions and block sizes. outSize[i] is the decoded size, 0 for a malformed stream or when
+// outCapacity[i] is too small (that output is then left untouched), and 0 as
+// well when a block does not match its checksum.
+void pans_decompress_batch(
+    uint32_t numInBatch,
+    const uint8_t* const* in,
+    const size_t* inSize,
+    uint8_t* const* out,
+    const size_t* outCapacity,
+    size_t* outSize,
+    PansDecodeScratch& scratch,
+    const mans::Parallel& par = mans::Parallel()
+);
+
+// benchmark: internally calls pans_compress at the default precision
 void pans_compress_and_benchmark(
     std::vector<uint8_t>& inputData,
     std::vector<uint8_t>& compressedData
 );
 
-// benchmark: internally calls pans_decompress, precision uses the macro PANS_PRECISION
+// benchmark: internally calls pans_decompress
 void pans_decompress_and_benchmark(
     std::vector<uint8_t>& compressedData,
     std::vector<uint8_t>& decompressedData
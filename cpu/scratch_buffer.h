@@ -0,0 +1,65 @@
+#ifndef SCRATCH_BUFFER_H
+#define SCRATCH_BUFFER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Aligned scratch storage that only ever grows. reserve() keeps the existing
+// allocation when it is already large enough, so a buffer reused across calls
+// stops touching the allocator (and faulting in fresh pages) once warmed up.
+// Contents are not preserved across a growing reserve().
+template <typename T, std::size_t Alignment = 64>
+class ScratchBuffer {
+public:
+    ScratchBuffer() = default;
+    ScratchBuffer(const ScratchBuffer&) = delete;
+    ScratchBuffer& operator=(const ScratchBuffer&) = delete;
+    ScratchBuffer(ScratchBuffer&& other) noexcept
+        : ptr_(other.ptr_), capacity_(other.capacity_) {
+        other.ptr_ = nullptr;
+        other.capacity_ = 0;
+    }
+    ScratchBuffer& operator=(ScratchBuffer&& other) noexcept {
+        if (this != &other) {
+            std::free(ptr_);
+            ptr_ = other.ptr_;
+            capacity_ = other.capacity_;
+            other.ptr_ = nullptr;
+            other.capacity_ = 0;
+        }
+        return *this;
+    }
+    ~ScratchBuffer() { std::free(ptr_); }
+
+    T* reserve(std::size_t count) {
+        if (count > capacity_) {
+            std::size_t bytes = count * sizeof(T);
+            bytes = (bytes + Alignment - 1) / Alignment * Alignment;
+            void* p = std::aligned_alloc(Alignment, bytes);
+            if (p == nullptr) {
+                throw std::bad_alloc();
+            }
+            std::free(ptr_);
+            ptr_ = static_cast<T*>(p);
+            capacity_ = count;
+        }
+        return ptr_;
+    }
+
+    T* data() { return ptr_; }
+    const T* data() const { return ptr_; }
+    std::size_t capacity() const { return capacity_; }
+
+    void release() {
+        std::free(ptr_);
+        ptr_ = nullptr;
+        capacity_ = 0;
+    }
+
+private:
+    T* ptr_ = nullptr;
+    std::size_t capacity_ = 0;
+};
+
+#endif // SCRATCH_BUFFER_H
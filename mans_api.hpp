@@ -45,4 +45,299 @@ inline void decompress(
     throw std::runtime_error("mans::decompress: unknown/unsupported backend");
 }
 
+// top module: Compress, reusing the scratch buffers held by ctx.
+// Prefer this overload when compressing many slices back to back.
+inline void compress(
+    const void* input_data, 
+    size_t length, 
+    const MansParams& params, 
+    std::vector<uint8_t>& out,
+    cpu::CompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        mans::cpu::compress_internal(input_data, length, params, out, ctx, false, "", false);
+        return;
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::compress: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::compress: unknown/unsupported backend");
+}
+
+// top module: Decompress, reusing the scratch buffers held by ctx
+inline void decompress(
+    const std::vector<uint8_t>& input_data, 
+    const MansParams& params, 
+    std::vector<uint8_t>& out,
+    cpu::DecompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        mans::cpu::decompress_internal(input_data, params, out, ctx, false, "", false);
+        return;
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::decompress: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::decompress: unknown/unsupported backend");
+}
+
+// Upper bound on the compressed size of length elements of dtype. Size the
+// output of the buffer overloads below with it.
+inline size_t max_compressed_size(size_t length, uint32_t dtype) {
+    return mans::cpu::max_compressed_size(length, dtype);
+}
+
+// ANS table precision (Precision::Min..Max) of a compressed frame; tells
+// what Precision::Auto picked. 0 for a frame of an empty input.
+inline uint32_t stream_precision(const void* input_data, size_t size) {
+    return mans::cpu::stream_precision(input_data, size);
+}
+
+// ANS block size (BlockSize::Min..Max) of a compressed frame, 0 for a frame of
+// an empty input
+inline uint32_t stream_block_size(const void* input_data, size_t size) {
+    return mans::cpu::stream_block_size(input_data, size);
+}
+
+// ANS probability tables of a compressed frame: 1, or up to 256 when it was
+// compressed with MansParams::segment_size. 0 for a frame of an empty input.
+inline uint32_t stream_num_tables(const void* input_data, size_t size) {
+    return mans::cpu::stream_num_tables(input_data, size);
+}
+
+// Dictionary a compressed frame refers to (MansParams::dictionary), 0 if it
+// carries its own ANS table or is the frame of an empty input
+inline uint32_t stream_dictionary(const void* input_data, size_t size) {
+    return mans::cpu::stream_dictionary(input_data, size);
+}
+
+// ANS coder a compressed frame was written with (MansParams::coder);
+// Coder::Wide frames only decode on the CPU backend
+inline uint32_t stream_coder(const void* input_data, size_t size) {
+    return mans::cpu::stream_coder(input_data, size);
+}
+
+// Checks a frame compressed with MansParams::checksum = Checksum::On, in
+// parallel and without decompressing it into memory. bad_blocks gets the
+// indices of the ANS blocks that are corrupt (block i holds bytes
+// i * stream_block_size onwards of the ANS input: the ADM stream of an ADM
+// frame, the raw data otherwise). false if the frame is malformed or has no
+// checksums.
+inline bool verify(
+    const void* input_data,
+    size_t size,
+    const MansParams& params,
+    std::vector<uint32_t>& bad_blocks,
+    cpu::DecompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        return mans::cpu::verify_internal(input_data, size, params, bad_blocks, ctx);
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::verify: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::verify: unknown/unsupported backend");
+}
+
+inline bool verify(
+    const void* input_data,
+    size_t size,
+    const MansParams& params,
+    std::vector<uint32_t>& bad_blocks
+) {
+    cpu::DecompressContext ctx;
+    return verify(input_data, size, params, bad_blocks, ctx);
+}
+
+// Trains a dictionary on num representative slices, laid out as for
+// compress_batch. Frames of small slices compressed with its ID in
+// MansParams::dictionary refer to it instead of carrying a table; id 0
+// derives one from the table. Save the result and hand it to
+// load_dictionary wherever those frames are compressed or decompressed.
+inline std::vector<uint8_t> train_dictionary(
+    size_t num,
+    const void* const* inputs,
+    const size_t* lengths,
+    const MansParams& params,
+    uint32_t id = 0
+) {
+    return mans::cpu::train_dictionary(num, inputs, lengths, params, id);
+}
+
+// Makes a dictionary from train_dictionary available to this process and
+// returns its ID
+inline uint32_t load_dictionary(const void* data, size_t size) {
+    return mans::cpu::load_dictionary(data, size);
+}
+
+// top module: Compress into a caller-owned buffer, returns the bytes written.
+// Nothing is copied besides what the codecs themselves produce; throws if
+// capacity is smaller than the compressed frame.
+inline size_t compress(
+    const void* input_data, 
+    size_t length, 
+    const MansParams& params, 
+    void* out,
+    size_t capacity,
+    cpu::CompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        return mans::cpu::compress_internal(input_data, length, params, out, capacity, ctx, false, "", false);
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::compress: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::compress: unknown/unsupported backend");
+}
+
+inline size_t compress(
+    const void* input_data, 
+    size_t length, 
+    const MansParams& params, 
+    void* out,
+    size_t capacity
+) {
+    cpu::CompressContext ctx;
+    return compress(input_data, length, params, out, capacity, ctx);
+}
+
+// top module: Decompress size bytes at input_data into a caller-owned buffer,
+// returns the bytes written. Throws if capacity is smaller than the frame.
+inline size_t decompress(
+    const void* input_data, 
+    size_t size,
+    const MansParams& params, 
+    void* out,
+    size_t capacity,
+    cpu::DecompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        return mans::cpu::decompress_internal(input_data, size, params, out, capacity, ctx, false, "", false);
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::decompress: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::decompress: unknown/unsupported backend");
+}
+
+inline size_t decompress(
+    const void* input_data, 
+    size_t size,
+    const MansParams& params, 
+    void* out,
+    size_t capacity
+) {
+    cpu::DecompressContext ctx;
+    return decompress(input_data, size, params, out, capacity, ctx);
+}
+
+// top module: Decompress only elements [first, first + count) of the frame
+// at input_data into a caller-owned buffer (at least count elements of
+// params.dtype), returns the bytes written. Only the ANS blocks and ADM
+// groups that hold those elements are decoded, so the cost follows count
+// rather than the frame. Throws if the range lies outside the frame or
+// capacity is too small.
+inline size_t decompress_range(
+    const void* input_data,
+    size_t size,
+    size_t first,
+    size_t count,
+    const MansParams& params,
+    void* out,
+    size_t capacity,
+    cpu::DecompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        return mans::cpu::decompress_range_internal(input_data, size, first, count, params, out, capacity, ctx);
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::decompress_range: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::decompress_range: unknown/unsupported backend");
+}
+
+inline size_t decompress_range(
+    const void* input_data,
+    size_t size,
+    size_t first,
+    size_t count,
+    const MansParams& params,
+    void* out,
+    size_t capacity
+) {
+    cpu::DecompressContext ctx;
+    return decompress_range(input_data, size, first, count, params, out, capacity, ctx);
+}
+
+// top module: Compress num slices in one call. inputs[i] holds lengths[i]
+// elements; the frame of slice i goes to outs[i] (capacities[i] bytes) and
+// its size to out_sizes[i]. Frames are identical to per-slice compress().
+inline void compress_batch(
+    size_t num,
+    const void* const* inputs,
+    const size_t* lengths,
+    const MansParams& params,
+    void* const* outs,
+    const size_t* capacities,
+    size_t* out_sizes,
+    cpu::CompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        mans::cpu::compress_batch_internal(num, inputs, lengths, params, outs, capacities, out_sizes, ctx);
+        return;
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::compress_batch: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::compress_batch: unknown/unsupported backend");
+}
+
+inline void compress_batch(
+    size_t num,
+    const void* const* inputs,
+    const size_t* lengths,
+    const MansParams& params,
+    void* const* outs,
+    const size_t* capacities,
+    size_t* out_sizes
+) {
+    cpu::CompressContext ctx;
+    compress_batch(num, inputs, lengths, params, outs, capacities, out_sizes, ctx);
+}
+
+// top module: Decompress num frames in one call; out_sizes[i] receives the
+// decoded size in bytes of frame i.
+inline void decompress_batch(
+    size_t num,
+    const void* const* inputs,
+    const size_t* sizes,
+    const MansParams& params,
+    void* const* outs,
+    const size_t* capacities,
+    size_t* out_sizes,
+    cpu::DecompressContext& ctx
+) {
+    if (params.backend == Backend::CPU) {
+        mans::cpu::decompress_batch_internal(num, inputs, sizes, params, outs, capacities, out_sizes, ctx);
+        return;
+    }
+    if (params.backend == Backend::NVIDIA) {
+        throw std::runtime_error("mans::decompress_batch: NVIDIA backend is not implemented");
+    }
+    throw std::runtime_error("mans::decompress_batch: unknown/unsupported backend");
+}
+
+inline void decompress_batch(
+    size_t num,
+    const void* const* inputs,
+    const size_t* sizes,
+    const MansParams& params,
+    void* const* outs,
+    const size_t* capacities,
+    size_t* out_sizes
+) {
+    cpu::DecompressContext ctx;
+    decompress_batch(num, inputs, sizes, params, outs, capacities, out_sizes, ctx);
+}
+
 } // namespace mans
\ No newline at end of file
@@ -3,11 +3,21 @@
 
 namespace mans {
 
+class Executor; // cpu/executor.h
 
 struct MansParams {
     uint32_t backend;       // 0: CPU, 1: GPU
     uint32_t dtype;         // 0: U16, 1: U32
     uint32_t adm_threshold; // block max diff > adm_threshold -> skip adm mode
+    uint32_t num_threads;   // CPU: thread budget of one call, 0 -> whole executor
+    Executor* executor;     // CPU: where parallel stages run, nullptr -> shared default pool
+    uint32_t precision;     // ANS table bits 9..12, see Precision; decoders read it from the stream
+    uint32_t block_size;    // ANS symbols per block, see BlockSize; decoders read it from the stream
+    uint32_t segment_size;  // ANS bytes per table segment, see SegmentSize; decoders read the tables from the stream
+    uint32_t dictionary;    // ID of a loaded dictionary (load_dictionary) for small inputs, 0: none; decoders need it loaded as well
+    uint32_t low_latency;   // CPU: run a call on the calling thread alone, see LowLatency
+    uint32_t coder;         // ANS stream format, see Coder; decoders read it from the stream
+    uint32_t checksum;      // CRC32C of every ANS block in the stream, see Checksum; decoders read it from the stream
 };
 
 
@@ -21,6 +31,41 @@ namespace DataType {
     constexpr uint32_t U32 = 1;
 }
 
+namespace Precision {
+    constexpr uint32_t Default = 0; // 10 bits
+    constexpr uint32_t Auto = 1;    // per input, from its histogram entropy and size
+    constexpr uint32_t Min = 9;     // fewer bits: smaller decode tables, faster on small inputs
+    constexpr uint32_t Max = 12;    // more bits: better ratio on skewed distributions
+}
+
+namespace BlockSize {
+    constexpr uint32_t Default = 0;     // 4096
+    constexpr uint32_t Min = 1024;      // powers of two only; smaller: more blocks to spread over threads
+    constexpr uint32_t Max = 65536;     // larger: less per-block overhead (states, block words, padding)
+}
+
+namespace SegmentSize {
+    constexpr uint32_t Off = 0;         // one table for the whole input
+    constexpr uint32_t Min = 65536;     // smallest accepted; shorter segments rarely pay for their table
+}
+
+namespace LowLatency {
+    constexpr uint32_t Auto = 0;        // on for calls of at most AutoBytes
+    constexpr uint32_t Off = 1;         // always spread over the thread budget
+    constexpr uint32_t On = 2;          // always on the calling thread
+    constexpr uint32_t AutoBytes = 32768; // raw bytes of the call (of the whole batch for the batch calls)
+}
+
+namespace Coder {
+    constexpr uint32_t Portable = 0;    // 32-bit states, 16-bit words: the format the GPU decoders share
+    constexpr uint32_t Wide = 1;        // 64-bit states, 32-bit words: faster on CPUs, CPU decoders only
+}
+
+namespace Checksum {
+    constexpr uint32_t Off = 0;
+    constexpr uint32_t On = 1;          // 4 bytes per block; corrupt blocks fail decompress and show in verify
+}
+
 // === 2. 文件头定义 ===
 struct MansHeader {
     std::uint8_t codec;  // 1 = ADM, 2 = ANS
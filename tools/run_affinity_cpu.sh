@@ -0,0 +1,51 @@
+#!/bin/bash
+# Runs cpu_mans_bench in affinity mode under taskset with 1, 2, 4, ... of the
+# CPUs this shell may use and checks that MANS follows the mask: the default
+# pool must size itself to the allowed CPUs, and compress / decompress
+# throughput must grow with them instead of collapsing.
+#
+# usage: bash run_affinity_cpu.sh [file.u2] [iters]
+#   MIN_EFFICIENCY  required throughput per allowed core, relative to one
+#                   core (default 0.5; use 0 to only check for collapse)
+#   MANS_PIN_THREADS=0 runs the same sweep without pinning
+
+BENCH=${BENCH:-../build/bin/cpu/cpu_mans_bench}
+FILE=${1:-../testdata/u2/exafel/exafel_59200x388_1024kB.u2}
+ITERS=${2:-50}
+MIN_EFFICIENCY=${MIN_EFFICIENCY:-0.5}
+
+if [ ! -x "$BENCH" ]; then
+    echo "cpu_mans_bench not found at $BENCH (set BENCH=...)"
+    exit 1
+fi
+
+CPUS=($(taskset -pc $$ | sed 's/.*: //' | tr ',' '\n' | while IFS=- read a b; do seq $a ${b:-$a}; done))
+echo "allowed CPUs: ${#CPUS[@]}"
+
+base_cmp=""
+base_dec=""
+fail=0
+n=1
+while [ $n -le ${#CPUS[@]} ]; do
+    mask=$(IFS=,; echo "${CPUS[*]:0:$n}")
+    out=$(taskset -c "$mask" "$BENCH" affinity u2 "$ITERS" "$FILE") || { echo "$out"; exit 1; }
+    usable=$(echo "$out" | sed -n 's/.*usable_cpus=\([0-9]*\).*/\1/p')
+    read cmp dec <<< "$(echo "$out" | tail -n 1 | awk '{print $3, $4}')"
+    [ -z "$base_cmp" ] && base_cmp=$cmp && base_dec=$dec
+    verdict=$(awk -v n=$n -v c=$cmp -v d=$dec -v bc=$base_cmp -v bd=$base_dec -v e=$MIN_EFFICIENCY '
+        BEGIN {
+            sc = c / bc; sd = d / bd; need = (n * e > 1) ? n * e : 1
+            ok = (sc >= 0.9 * need && sd >= 0.9 * need) ? "ok" : "FAIL"
+            printf "%s %.2f %.2f", ok, sc, sd
+        }')
+    read status scale_cmp scale_dec <<< "$verdict"
+    if [ "$usable" != "$n" ]; then
+        status="FAIL(usable_cpus=$usable)"
+    fi
+    printf "cpus=%-3d cmp=%8.1f MB/s (x%s)  dec=%8.1f MB/s (x%s)  %s\n" \
+        $n $cmp $scale_cmp $dec $scale_dec "$status"
+    [ "$status" != "ok" ] && fail=1
+    n=$((n * 2))
+done
+
+exit $fail